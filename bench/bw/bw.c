@@ -0,0 +1,141 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <numa.h>
+#include "measure.h"
+
+// Reports the bandwidth of every (cpu node, memory node) pair for each
+// kernel. Without -k all kernels run, and the mix kernel sweeps 75/50/25
+// percent reads unless -r picks a single ratio.
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-k kernel] [-r read_ratio] [-t nthreads] [-s MB] [-n samples] [-i isa] [cpu_node mem_node]...\n", prog);
+    fprintf(stderr, "  kernel: read, write, write_nt, copy, mix\n");
+    fprintf(stderr, "  isa: avx512, avx2, sse (default: widest supported)\n");
+}
+
+static int parse_kernel(const char* name)
+{
+    int k;
+
+    for (k = 0; k < BW_KERNEL_COUNT; k++) {
+        if (strcmp(name, bw_kernel_name(k)) == 0) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void run(int cpu_node, int mem_node, bw_params_t* params)
+{
+    bw_result_t result;
+
+    if (measure_bw(cpu_node, mem_node, params, &result) != 0) {
+        printf("%-8s %3d %8d %8d %8s %8s %12s\n", bw_kernel_name(params->kernel),
+               params->kernel == BW_KERNEL_MIX ? params->read_ratio : 100,
+               cpu_node, mem_node, "-", "-", "failed");
+        return;
+    }
+    printf("%-8s %3d %8d %8d %8s %8d %12.0f %12.0f %10.0f\n", bw_kernel_name(params->kernel),
+           params->kernel == BW_KERNEL_MIX ? params->read_ratio : 100,
+           cpu_node, mem_node, result.isa, result.nthreads,
+           result.best, result.mean, result.stddev);
+}
+
+int main(int argc, char* argv[])
+{
+    static const int default_ratios[] = {75, 50, 25};
+    bw_params_t params;
+    int kernel = -1, ratio = -1;
+    int nthreads = 0, samples = 0;
+    size_t bytes = 0;
+    const char* isa = NULL;
+    int opt, k, r, c, m;
+
+    while ((opt = getopt(argc, argv, "k:r:t:s:n:i:h")) != -1) {
+        switch (opt) {
+            case 'k':
+                if ((kernel = parse_kernel(optarg)) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r':
+                ratio = atoi(optarg);
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 's':
+                bytes = (size_t) atol(optarg) * 1024 * 1024;
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                break;
+            case 'i':
+                isa = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if ((argc - optind) % 2 != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (numa_available() < 0) {
+        fprintf(stderr, "NUMA is not available\n");
+        return 1;
+    }
+
+    printf("%-8s %3s %8s %8s %8s %8s %12s %12s %10s\n",
+           "kernel", "rd%", "cpu_node", "mem_node", "isa", "threads", "best(MB/s)", "mean(MB/s)", "stddev");
+
+    for (k = 0; k < BW_KERNEL_COUNT; k++) {
+        int nratios = 1;
+        if (kernel >= 0 && k != kernel) continue;
+        if (k == BW_KERNEL_MIX && ratio < 0) {
+            nratios = sizeof(default_ratios) / sizeof(default_ratios[0]);
+        }
+        for (r = 0; r < nratios; r++) {
+            bw_params_init(&params, k);
+            params.nthreads = nthreads;
+            params.bytes = bytes;
+            params.isa = isa;
+            if (samples > 0) params.samples = samples;
+            if (k == BW_KERNEL_MIX) {
+                params.read_ratio = ratio < 0 ? default_ratios[r] : ratio;
+            }
+            if (optind < argc) {
+                int a;
+                for (a = optind; a < argc; a += 2) {
+                    run(atoi(argv[a]), atoi(argv[a+1]), &params);
+                }
+            } else {
+                for (c = 0; c <= numa_max_node(); c++) {
+                    for (m = 0; m <= numa_max_node(); m++) {
+                        run(c, m, &params);
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <numa.h>
+#include <numaif.h>
+#include "monotonic_timer.h"
+#include "pmalloc.h"
+
+// Aggregate bandwidth of a buffer interleaved between DRAM and NVM with
+// pmalloc_interleave(), for a list of DRAM:NVM weights. Threads stream over
+// their slice of the buffer, reading or writing it. Run it under the
+// emulator with bandwidth emulation on to see the throttled NVM share.
+
+#define PAGE_SIZE 4096
+#define PLACEMENT_SAMPLES 4096
+
+typedef struct {
+    char* buf;
+    size_t len;
+    int passes;
+    int write;
+    uint64_t sum;
+} bench_args_t;
+
+static void* worker(void* arg)
+{
+    bench_args_t* args = arg;
+    uint64_t* p;
+    uint64_t* end = (uint64_t*) (args->buf + args->len);
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < args->passes; i++) {
+        if (args->write) {
+            memset(args->buf, i, args->len);
+        } else {
+            for (p = (uint64_t*) args->buf; p < end; p += 8) {
+                sum += p[0] + p[1] + p[2] + p[3] + p[4] + p[5] + p[6] + p[7];
+            }
+        }
+    }
+    args->sum = sum;
+    return NULL;
+}
+
+// fraction of the sampled pages of buf the kernel placed on dram_node
+static double dram_share(char* buf, size_t len, int dram_node)
+{
+    void* pages[PLACEMENT_SAMPLES];
+    int status[PLACEMENT_SAMPLES];
+    size_t npages = len / PAGE_SIZE;
+    size_t stride = npages > PLACEMENT_SAMPLES ? npages / PLACEMENT_SAMPLES : 1;
+    int n = 0, on_dram = 0, i;
+
+    for (i = 0; i < PLACEMENT_SAMPLES && (size_t) i * stride < npages; i++) {
+        pages[n++] = buf + (size_t) i * stride * PAGE_SIZE;
+    }
+    if (move_pages(0, n, pages, NULL, status, 0) != 0) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        on_dram += status[i] == dram_node;
+    }
+    return (double) on_dram / n;
+}
+
+static double run(int nthreads, size_t len, int passes, int write, int dram_weight, int nvm_weight, double* share)
+{
+    pthread_t* threads = calloc(nthreads, sizeof(*threads));
+    bench_args_t* args = calloc(nthreads, sizeof(*args));
+    size_t slice = len / nthreads / PAGE_SIZE * PAGE_SIZE;
+    double start, end;
+    char* buf;
+    int t;
+
+    if ((buf = pmalloc_interleave(len, dram_weight, nvm_weight)) == NULL) {
+        free(threads);
+        free(args);
+        return -1;
+    }
+    // fault the pages in, the bound policy decides where each one goes
+    memset(buf, 1, len);
+    *share = dram_share(buf, len, numa_node_of_cpu(sched_getcpu()));
+
+    start = monotonic_time_us();
+    for (t = 0; t < nthreads; t++) {
+        args[t].buf = buf + t * slice;
+        args[t].len = slice;
+        args[t].passes = passes;
+        args[t].write = write;
+        pthread_create(&threads[t], NULL, worker, &args[t]);
+    }
+    for (t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    end = monotonic_time_us();
+
+    pfree(buf);
+    free(threads);
+    free(args);
+    return (double) slice * nthreads * passes / (end - start); // bytes per us, i.e. MB/s
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-t nthreads] [-s MB] [-p passes] [-w] [dram_weight:nvm_weight]...\n", prog);
+    fprintf(stderr, "  -w: stream writes instead of reads\n");
+    fprintf(stderr, "  default weights: 1:0 3:1 2:1 1:1 1:2 1:3 0:1\n");
+}
+
+int main(int argc, char* argv[])
+{
+    static const char* default_weights[] = {"1:0", "3:1", "2:1", "1:1", "1:2", "1:3", "0:1"};
+    const char** weights = default_weights;
+    int nweights = sizeof(default_weights) / sizeof(default_weights[0]);
+    int nthreads = 1, passes = 10, write = 0;
+    size_t len = 256UL * 1024 * 1024;
+    int opt, i, dram_weight, nvm_weight;
+    double mbps, share;
+
+    while ((opt = getopt(argc, argv, "t:s:p:wh")) != -1) {
+        switch (opt) {
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 's':
+                len = atol(optarg) * 1024UL * 1024;
+                break;
+            case 'p':
+                passes = atoi(optarg);
+                break;
+            case 'w':
+                write = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (nthreads <= 0 || passes <= 0 || len < (size_t) nthreads * PAGE_SIZE) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (optind < argc) {
+        weights = (const char**) &argv[optind];
+        nweights = argc - optind;
+    }
+    if (numa_available() < 0) {
+        fprintf(stderr, "NUMA is not available\n");
+        return 1;
+    }
+
+    printf("%-8s %8s %8s %10s %12s\n", "weights", "threads", "kernel", "dram_pages", "MB/s");
+    for (i = 0; i < nweights; i++) {
+        if (sscanf(weights[i], "%d:%d", &dram_weight, &nvm_weight) != 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        if ((mbps = run(nthreads, len, passes, write, dram_weight, nvm_weight, &share)) < 0) {
+            printf("%-8s %8d %8s %10s %12s\n", weights[i], nthreads, write ? "write" : "read", "-", "failed");
+            continue;
+        }
+        printf("%-8s %8d %8s %9.1f%% %12.0f\n", weights[i], nthreads, write ? "write" : "read",
+               share * 100, mbps);
+    }
+    return 0;
+}
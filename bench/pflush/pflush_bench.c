@@ -0,0 +1,107 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu/cpu.h"
+#include "monotonic_timer.h"
+#include "pflush.h"
+
+// Cost per cache line of persisting objects of several sizes with one
+// pflush() per line against pflush_range(), which issues the write-backs
+// back to back and waits for all of them at a single fence. The benchmark
+// sets up the write latency model itself.
+
+#define MAX_OBJECT_SIZE (64 * 1024)
+
+typedef enum {
+    PATH_PFLUSH = 0,
+    PATH_RANGE
+} flush_path_t;
+
+static const char* path_name[] = {"pflush", "range"};
+
+static double run(flush_path_t path, char* buf, size_t size, long iterations)
+{
+    double start, end;
+    size_t off;
+    long i;
+
+    start = monotonic_time_us();
+    for (i = 0; i < iterations; i++) {
+        // dirty the object so every write-back has work to do
+        memset(buf, i, size);
+        if (path == PATH_PFLUSH) {
+            for (off = 0; off < size; off += CACHE_LINE_SIZE) {
+                pflush((uint64_t*) (buf + off));
+            }
+        } else {
+            pflush_range(buf, size);
+        }
+    }
+    end = monotonic_time_us();
+    return (end - start) * 1000 / iterations / (size / CACHE_LINE_SIZE); // ns per line
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-l write_latency_ns] [-p write_parallelism] [-n iterations]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    static const size_t sizes[] = {64, 256, 1024, 4096, 16384, 65536};
+    int latency = 500, parallelism = 0;
+    long iterations = 10000;
+    char* buf;
+    int opt, s, p;
+
+    while ((opt = getopt(argc, argv, "l:p:n:h")) != -1) {
+        switch (opt) {
+            case 'l':
+                latency = atoi(optarg);
+                break;
+            case 'p':
+                parallelism = atoi(optarg);
+                break;
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (latency < 0 || parallelism < 0 || iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (posix_memalign((void**) &buf, 4096, MAX_OBJECT_SIZE) != 0) {
+        fprintf(stderr, "Cannot allocate the buffer\n");
+        return 1;
+    }
+    init_pflush(cpu_speed_mhz(), latency, parallelism);
+
+    printf("%-8s %10s %10s %12s\n", "path", "size", "latency", "ns/line");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (p = PATH_PFLUSH; p <= PATH_RANGE; p++) {
+            printf("%-8s %10zu %10d %12.1f\n", path_name[p], sizes[s], latency,
+                   run(p, buf, sizes[s], iterations));
+        }
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,196 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <numa.h>
+#include "monotonic_timer.h"
+#include "pmalloc.h"
+
+// Allocation throughput of pmalloc against one numa_alloc_onnode() per
+// object. Every thread keeps a window of live objects and replaces a random
+// one per operation, so each operation is one free and one allocation.
+
+#define WINDOW 1024
+
+typedef enum {
+    ALLOC_PMALLOC = 0,
+    ALLOC_NUMA
+} allocator_t;
+
+static const char* allocator_name[] = {"pmalloc", "numa"};
+
+typedef struct {
+    allocator_t allocator;
+    int node;
+    size_t min_size;
+    size_t max_size;
+    long ops;
+    unsigned int seed;
+} bench_args_t;
+
+typedef struct {
+    void* ptr;
+    size_t size;
+} slot_t;
+
+static void* alloc(bench_args_t* args, size_t size)
+{
+    void* ptr;
+
+    if (args->allocator == ALLOC_PMALLOC) {
+        ptr = pmalloc(size);
+    } else {
+        ptr = numa_alloc_onnode(size, args->node);
+    }
+    if (ptr == NULL) {
+        fprintf(stderr, "%s of %zu bytes failed\n", allocator_name[args->allocator], size);
+        exit(1);
+    }
+    return ptr;
+}
+
+static void release(bench_args_t* args, slot_t* slot)
+{
+    if (args->allocator == ALLOC_PMALLOC) {
+        pfree(slot->ptr);
+    } else {
+        numa_free(slot->ptr, slot->size);
+    }
+}
+
+static void* worker(void* arg)
+{
+    bench_args_t* args = arg;
+    slot_t* slots = calloc(WINDOW, sizeof(*slots));
+    unsigned int seed = args->seed;
+    long i;
+    int s;
+
+    if (slots == NULL) {
+        fprintf(stderr, "Cannot allocate the object window\n");
+        exit(1);
+    }
+    for (i = 0; i < args->ops; i++) {
+        s = rand_r(&seed) % WINDOW;
+        if (slots[s].ptr) {
+            release(args, &slots[s]);
+        }
+        slots[s].size = args->min_size + rand_r(&seed) % (args->max_size - args->min_size + 1);
+        slots[s].ptr = alloc(args, slots[s].size);
+        // touch the object like a real user would
+        *(volatile char*) slots[s].ptr = 0;
+    }
+    for (s = 0; s < WINDOW; s++) {
+        if (slots[s].ptr) {
+            release(args, &slots[s]);
+        }
+    }
+    free(slots);
+    return NULL;
+}
+
+static double run(allocator_t allocator, int nthreads, bench_args_t* proto)
+{
+    pthread_t* threads = calloc(nthreads, sizeof(*threads));
+    bench_args_t* args = calloc(nthreads, sizeof(*args));
+    double start, end;
+    int t;
+
+    if (threads == NULL || args == NULL) {
+        fprintf(stderr, "Cannot allocate %d threads\n", nthreads);
+        exit(1);
+    }
+    start = monotonic_time_us();
+    for (t = 0; t < nthreads; t++) {
+        args[t] = *proto;
+        args[t].allocator = allocator;
+        args[t].seed = t + 1;
+        pthread_create(&threads[t], NULL, worker, &args[t]);
+    }
+    for (t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    end = monotonic_time_us();
+
+    free(threads);
+    free(args);
+    return (double) proto->ops * nthreads / (end - start); // ops per us
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-t nthreads] [-n ops per thread] [-s min_size] [-S max_size] [-m numa node] [-a pmalloc|numa]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_args_t args;
+    int nthreads = 1;
+    int only = -1;
+    int opt, a;
+
+    memset(&args, 0, sizeof(args));
+    args.min_size = 16;
+    args.max_size = 1024;
+    args.ops = 1000000;
+    args.node = -1;
+
+    while ((opt = getopt(argc, argv, "t:n:s:S:m:a:h")) != -1) {
+        switch (opt) {
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 'n':
+                args.ops = atol(optarg);
+                break;
+            case 's':
+                args.min_size = atol(optarg);
+                break;
+            case 'S':
+                args.max_size = atol(optarg);
+                break;
+            case 'm':
+                args.node = atoi(optarg);
+                break;
+            case 'a':
+                only = strcmp(optarg, "numa") == 0 ? ALLOC_NUMA : ALLOC_PMALLOC;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (nthreads <= 0 || args.ops <= 0 || args.min_size == 0 || args.max_size < args.min_size) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (numa_available() < 0) {
+        fprintf(stderr, "NUMA is not available\n");
+        return 1;
+    }
+    if (args.node < 0) {
+        args.node = numa_max_node();
+    }
+
+    printf("%-8s %8s %10s %10s %12s\n", "alloc", "threads", "min_size", "max_size", "Mops/s");
+    for (a = ALLOC_PMALLOC; a <= ALLOC_NUMA; a++) {
+        if (only >= 0 && a != only) continue;
+        printf("%-8s %8d %10zu %10zu %12.3f\n", allocator_name[a], nthreads,
+               args.min_size, args.max_size, run(a, nthreads, &args));
+    }
+    return 0;
+}
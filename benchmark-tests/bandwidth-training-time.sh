@@ -0,0 +1,51 @@
+#################################################################
+#Copyright 2016 Hewlett Packard Enterprise Development LP.  
+#This program is free software; you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation; either version 2 of the License, or (at
+#your option) any later version. This program is distributed in the
+#hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+#the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+#PURPOSE. See the GNU General Public License for more details. You
+#should have received a copy of the GNU General Public License along
+#with this program; if not, write to the Free Software Foundation,
+#Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+#################################################################
+#!/bin/bash
+
+# Measures how long it takes to train the bandwidth model from scratch and
+# how long it takes to refine a cached model for a new target bandwidth.
+
+echo performance | sudo tee /sys/devices/system/cpu/cpu*/cpufreq/scaling_governor
+
+dir_name_res=BW-training-time-test
+
+rm -rf $dir_name_res
+mkdir $dir_name_res
+
+cp  nvmemul-bandwidth.ini  nvmemul.ini
+rm -f /tmp/bandwidth_model
+
+# cold: no cached model, coarse probing plus bisection around the targets
+start=$(date +%s.%N)
+../build/bench/memlat/memlat 1 1 1 1000000 64 8 0 0 > $dir_name_res/cold.txt 2>&1
+end=$(date +%s.%N)
+echo "cold $start $end" > $dir_name_res/wall-time.txt
+
+# warm: cached model, bisection only around the new targets
+start=$(date +%s.%N)
+NVMEMUL_BANDWIDTH_READ=4000 NVMEMUL_BANDWIDTH_WRITE=4000 \
+    ../build/bench/memlat/memlat 1 1 1 1000000 64 8 0 0 > $dir_name_res/warm.txt 2>&1
+end=$(date +%s.%N)
+echo "warm $start $end" >> $dir_name_res/wall-time.txt
+
+echo "#FORMAT: #1_run #2_node #3_model #4_new_points #5_training_sec #6_wall_sec" > $dir_name_res/final-training-time.txt
+for run in cold warm
+do
+    wall=$(awk -v run=$run '($1 == run) {printf "%.1f", $3 - $2}' $dir_name_res/wall-time.txt)
+    grep "Bandwidth model training:" $dir_name_res/$run.txt | \
+    awk -v run=$run -v wall=$wall '{gsub(",", ""); print run, $7, $8, $10, $13, wall; found=1}
+         END {if (!found) print run, "-", "-", 0, 0, wall}' >> $dir_name_res/final-training-time.txt
+done
+
+cat $dir_name_res/final-training-time.txt
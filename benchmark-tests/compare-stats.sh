@@ -0,0 +1,138 @@
+#!/bin/bash
+#################################################################
+#Copyright 2016 Hewlett Packard Enterprise Development LP.
+#This program is free software; you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation; either version 2 of the License, or (at
+#your option) any later version. This program is distributed in the
+#hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+#the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+#PURPOSE. See the GNU General Public License for more details. You
+#should have received a copy of the GNU General Public License along
+#with this program; if not, write to the Free Software Foundation,
+#Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+#################################################################
+
+# Compares the statistics of two runs written with statistics.format = "csv"
+# and flags the regressions of the second one. A file with several runs is
+# summarized over all of them. Exits with 1 when a metric regressed.
+#
+# Metrics:
+#   overhead cycles/epoch    emulator overhead left unamortized per epoch
+#   overhead cycles p99      99th percentile of the overhead per epoch
+#   delay error (%)          distance between the injected delay and the delay
+#                            the model targets, stall_cycles * (read latency -
+#                            NVM hardware latency) / NVM hardware latency
+#   epoch duration p99 (us)  99th percentile of the epoch durations
+#   short epochs (%)         epochs skipped for not reaching the min duration
+#   init time (us)           emulator initialization
+#
+# A metric regresses when it grows by more than the tolerance: percent of its
+# baseline value, or percentage points for the percentages.
+
+if [ $# -lt 2 ]; then
+    echo "compare-stats.sh <baseline.csv> <candidate.csv> [tolerance % (default 10)]"
+    exit 2
+fi
+
+baseline=$1
+candidate=$2
+tolerance=${3:-10}
+
+for f in $baseline $candidate; do
+    if [ ! -r $f ]; then
+        echo "Cannot read $f"
+        exit 2
+    fi
+done
+
+summarize() {
+awk '
+# splits a CSV line into field[], honoring quoted fields
+function parse(line,    n, i, c, quoted, value) {
+    n = 0; value = ""; quoted = 0
+    for (i = 1; i <= length(line); i++) {
+        c = substr(line, i, 1)
+        if (quoted) {
+            if (c == "\"" && substr(line, i + 1, 1) == "\"") { value = value c; i++ }
+            else if (c == "\"") { quoted = 0 }
+            else { value = value c }
+        } else if (c == "\"") { quoted = 1 }
+        else if (c == ",") { field[++n] = value; value = "" }
+        else { value = value c }
+    }
+    field[++n] = value
+    return n
+}
+function get(name) { return field[column[name]] + 0 }
+function max(a, b) { return a > b ? a : b }
+
+NR == 1 || /^timestamp,/ {
+    n = parse($0)
+    for (i = 1; i <= n; i++) column[field[i]] = i
+    next
+}
+{
+    parse($0)
+    epochs += get("epochs")
+    short += get("min_epoch_not_reached")
+    overhead += get("overhead_cycles")
+    overhead_p99 = max(overhead_p99, get("overhead_cycles_p99"))
+    epoch_p99 = max(epoch_p99, get("epoch_duration_us_p99"))
+    hw = get("hw_remote_latency_ns")
+    target = get("read_latency_ns")
+    if (hw > 0 && target > hw) {
+        expected = get("stall_cycles") * (target - hw) / hw
+        delay_error += (get("delay_cycles") > expected) ? get("delay_cycles") - expected : expected - get("delay_cycles")
+        delay_expected += expected
+    }
+    run = get("pid") "-" get("timestamp")
+    if (!(run in runs)) {
+        runs[run] = 1
+        nruns++
+        init_time += get("init_time_us")
+    }
+}
+END {
+    if (NR < 2) exit 1
+    printf "overhead_per_epoch %f\n", epochs ? overhead / epochs : 0
+    printf "overhead_p99 %f\n", overhead_p99
+    printf "delay_error_pct %f\n", delay_expected ? 100 * delay_error / delay_expected : 0
+    printf "epoch_p99_us %f\n", epoch_p99
+    printf "short_epochs_pct %f\n", (epochs + short) ? 100 * short / (epochs + short) : 0
+    printf "init_time_us %f\n", nruns ? init_time / nruns : 0
+}' $1
+}
+
+base_summary=$(summarize $baseline) || { echo "No statistics in $baseline"; exit 2; }
+cand_summary=$(summarize $candidate) || { echo "No statistics in $candidate"; exit 2; }
+
+paste <(echo "$base_summary") <(echo "$cand_summary") | awk -v tol=$tolerance '
+BEGIN {
+    label["overhead_per_epoch"] = "overhead cycles/epoch"
+    label["overhead_p99"] = "overhead cycles p99"
+    label["delay_error_pct"] = "delay error (%)"
+    label["epoch_p99_us"] = "epoch duration p99 (us)"
+    label["short_epochs_pct"] = "short epochs (%)"
+    label["init_time_us"] = "init time (us)"
+    printf "%-26s %14s %14s %10s\n", "#metric", "baseline", "candidate", "change"
+}
+{
+    metric = $1; base = $2; cand = $4
+    if (metric ~ /_pct$/) {
+        change = sprintf("%+.2fpt", cand - base)
+        regressed = cand - base > tol
+    } else {
+        change = base ? sprintf("%+.1f%%", 100 * (cand - base) / base) : "n/a"
+        regressed = base ? 100 * (cand - base) / base > tol : cand > 0
+    }
+    printf "%-26s %14.2f %14.2f %10s%s\n", label[metric], base, cand, change, regressed ? "  REGRESSION" : ""
+    regressions += regressed
+}
+END {
+    if (regressions) {
+        printf "%d regression(s) above %s%% tolerance\n", regressions, tol
+        exit 1
+    }
+    print "No regression"
+}'
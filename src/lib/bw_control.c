@@ -0,0 +1,327 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bw_control.h"
+#include "error.h"
+#include "model.h"
+#include "thread.h"
+#include "topology.h"
+#include "uncore.h"
+
+/**
+ * \file
+ *
+ * Bandwidth throttle controller
+ *
+ * A single activation throttle value cannot match both the read and the
+ * write bandwidth targets since the two traffic classes respond differently
+ * to throttling. In the mix mode, the monitor thread periodically samples
+ * the read and write traffic to the NVM of each virtual node and blends the
+ * register values that hit the read and the write target by the observed
+ * read fraction. To avoid flapping between values on noisy traffic, the
+ * register is reprogrammed only when the smoothed mix moves by more than
+ * the hysteresis band.
+ *
+ * Traffic comes from the memory controller counters when the uncore 
+ * sampler runs, and otherwise from the NVM misses and flushes application
+ * threads account for. Misses are only counted by the latency model, so
+ * without either source the mix mode falls back to the split mode.
+ *
+ * In the split mode we program the read and write throttles separately
+ * instead, once, and leave the activation throttle open.
+ */
+
+#define BW_CONTROL_DEFAULT_PERIOD_MS 10
+#define BW_CONTROL_DEFAULT_HYSTERESIS 10 // percent of read fraction
+#define BW_CONTROL_MIN_BYTES (64*1024) // below this a period says nothing about the mix
+#define BW_CONTROL_SMOOTHING 0.5
+#define THROTTLE_UNTHROTTLED 0x8fff
+
+typedef struct {
+    physical_node_t* node; // the nvram node whose memory controller we throttle
+    uint64_t read_bytes;   // updated atomically by application threads
+    uint64_t write_bytes;
+    uint64_t last_read_bytes;
+    uint64_t last_write_bytes;
+    uint16_t read_val;     // register value that hits the read target
+    uint16_t write_val;    // register value that hits the write target
+    uint16_t next_read_val; // new targets, found for all nodes before any is programmed
+    uint16_t next_write_val;
+    double read_frac;      // smoothed read fraction of the traffic
+    double programmed_frac; // read fraction the register currently reflects, <0 if none
+    uint64_t reprograms;
+} bw_control_node_t;
+
+typedef struct {
+    bw_control_mode_t mode;
+    int period_ms;
+    double hysteresis;
+    bw_control_node_t* nodes; // indexed by virtual node id
+    int num_nodes;
+} bw_control_t;
+
+static bw_control_t bw_control;
+
+void bw_control_account(struct virtual_node_s* virtual_node, uint64_t read_bytes, uint64_t write_bytes)
+{
+    bw_control_node_t* n;
+
+    if (bw_control.mode != BW_CONTROL_MIX || virtual_node == NULL) {
+        return;
+    }
+    n = &bw_control.nodes[virtual_node->node_id];
+    if (read_bytes) {
+        __atomic_fetch_add(&n->read_bytes, read_bytes, __ATOMIC_RELAXED);
+    }
+    if (write_bytes) {
+        __atomic_fetch_add(&n->write_bytes, write_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void bw_control_account_self(uint64_t read_bytes, uint64_t write_bytes)
+{
+    thread_t* thread;
+
+    if (bw_control.mode != BW_CONTROL_MIX) {
+        return;
+    }
+    if ((thread = thread_self()) != NULL) {
+        bw_control_account(thread->virtual_node, read_bytes, write_bytes);
+    }
+}
+
+int bw_control_write_bw_self()
+{
+    thread_t* thread;
+    bw_model_t* model;
+    int write_bw = __atomic_load_n(&bandwidth_model.write_bw, __ATOMIC_RELAXED);
+
+    if (write_bw > 0) {
+        return write_bw;
+    }
+    if ((thread = thread_self()) == NULL || thread->virtual_node->nvram_node == NULL ||
+        (model = thread->virtual_node->nvram_node->write_bw_model) == NULL || model->npoints == 0)
+    {
+        return 0;
+    }
+    return (int) model->bandwidth[model->npoints - 1];
+}
+
+static void control_node(bw_control_node_t* n)
+{
+    uint64_t read_bytes, write_bytes, dr, dw;
+    uncore_sample_t sample;
+    double frac;
+    uint16_t val;
+
+    // memory controller counters see all the traffic, prefer them over
+    // what the application threads account for themselves
+    if (uncore_node_traffic(n->node->node_id, &sample) == E_SUCCESS) {
+        read_bytes = sample.read_bytes;
+        write_bytes = sample.write_bytes;
+    } else {
+        read_bytes = __atomic_load_n(&n->read_bytes, __ATOMIC_RELAXED);
+        write_bytes = __atomic_load_n(&n->write_bytes, __ATOMIC_RELAXED);
+    }
+    dr = read_bytes - n->last_read_bytes;
+    dw = write_bytes - n->last_write_bytes;
+    if (dr + dw < BW_CONTROL_MIN_BYTES) {
+        // idle periods keep the current setting and accumulate traffic
+        return;
+    }
+    n->last_read_bytes = read_bytes;
+    n->last_write_bytes = write_bytes;
+
+    frac = (double) dr / (double) (dr + dw);
+    if (n->programmed_frac < 0) {
+        n->read_frac = frac;
+    } else {
+        n->read_frac = BW_CONTROL_SMOOTHING * frac + (1 - BW_CONTROL_SMOOTHING) * n->read_frac;
+    }
+    if (n->programmed_frac >= 0 && fabs(n->read_frac - n->programmed_frac) < bw_control.hysteresis) {
+        return;
+    }
+
+    val = (uint16_t) floor(n->read_frac * n->read_val + (1 - n->read_frac) * n->write_val + 0.5);
+    n->node->cpu_model->set_throttle_register(n->node->mc_pci_regs, THROTTLE_DDR_ACT, val);
+    n->programmed_frac = n->read_frac;
+    n->reprograms++;
+    DBG_LOG(DEBUG, "Node %d: read fraction %.2f, throttle reg 0x%x\n", n->node->node_id, n->read_frac, val);
+}
+
+static void bw_control_hook(void* arg)
+{
+    int i;
+
+    for (i = 0; i < bw_control.num_nodes; i++) {
+        if (bw_control.nodes[i].node) {
+            control_node(&bw_control.nodes[i]);
+        }
+    }
+}
+
+static int parse_mode(const char* str, bw_control_mode_t* mode)
+{
+    if (strcmp(str, "static") == 0) {
+        *mode = BW_CONTROL_STATIC;
+    } else if (strcmp(str, "mix") == 0) {
+        *mode = BW_CONTROL_MIX;
+    } else if (strcmp(str, "split") == 0) {
+        *mode = BW_CONTROL_SPLIT;
+    } else {
+        return E_INVAL;
+    }
+    return E_SUCCESS;
+}
+
+int init_bw_control(config_t* cfg, virtual_topology_t* topology)
+{
+    char* str;
+    int read_bw = -1;
+    int write_bw = -1;
+    int hysteresis = BW_CONTROL_DEFAULT_HYSTERESIS;
+    int i;
+
+    memset(&bw_control, 0, sizeof(bw_control));
+    if (!bandwidth_model.enabled) {
+        return E_SUCCESS;
+    }
+    if (__cconfig_lookup_string(cfg, "bandwidth.control", &str) == CONFIG_TRUE) {
+        if (parse_mode(str, &bw_control.mode) != E_SUCCESS) {
+            DBG_LOG(WARNING, "Unknown bandwidth.control '%s', using static\n", str);
+            bw_control.mode = BW_CONTROL_STATIC;
+        }
+    }
+    // reads are only seen through the uncore counters or the latency epochs
+    if (bw_control.mode == BW_CONTROL_MIX && !uncore_enabled() && !latency_model.enabled) {
+        DBG_LOG(WARNING, "bandwidth.control mix needs the uncore counters or the latency model to see reads, using split\n");
+        bw_control.mode = BW_CONTROL_SPLIT;
+    }
+    if (bw_control.mode == BW_CONTROL_STATIC) {
+        return E_SUCCESS;
+    }
+
+    if (__cconfig_lookup_int(cfg, "bandwidth.control_period_ms", &bw_control.period_ms) != CONFIG_TRUE ||
+        bw_control.period_ms <= 0)
+    {
+        bw_control.period_ms = BW_CONTROL_DEFAULT_PERIOD_MS;
+    }
+    __cconfig_lookup_int(cfg, "bandwidth.control_hysteresis", &hysteresis);
+    bw_control.hysteresis = hysteresis / 100.0;
+    __cconfig_lookup_int(cfg, "bandwidth.read", &read_bw);
+    __cconfig_lookup_int(cfg, "bandwidth.write", &write_bw);
+
+    bw_control.num_nodes = topology->num_virtual_nodes;
+    if (!(bw_control.nodes = calloc(bw_control.num_nodes, sizeof(*bw_control.nodes)))) {
+        return E_NOMEM;
+    }
+
+    for (i = 0; i < topology->num_virtual_nodes; i++) {
+        bw_control_node_t* n = &bw_control.nodes[i];
+        physical_node_t* node = topology->virtual_nodes[i].nvram_node;
+
+        if (node == NULL || node->mc_pci_regs == NULL) {
+            continue;
+        }
+        if (find_bw_throttle(node, node->read_bw_model, "read", (uint64_t) (int64_t) read_bw, &n->read_val) != E_SUCCESS ||
+            find_bw_throttle(node, node->write_bw_model, "write", (uint64_t) (int64_t) write_bw, &n->write_val) != E_SUCCESS)
+        {
+            continue;
+        }
+        n->node = node;
+        n->programmed_frac = -1;
+
+        if (bw_control.mode == BW_CONTROL_SPLIT) {
+            node->cpu_model->set_throttle_register(node->mc_pci_regs, THROTTLE_DDR_ACT, THROTTLE_UNTHROTTLED);
+            node->cpu_model->set_throttle_register(node->mc_pci_regs, THROTTLE_DDR_READ, n->read_val);
+            node->cpu_model->set_throttle_register(node->mc_pci_regs, THROTTLE_DDR_WRITE, n->write_val);
+            DBG_LOG(INFO, "Node %d: read throttle reg 0x%x, write throttle reg 0x%x\n",
+                    node->node_id, n->read_val, n->write_val);
+        }
+    }
+
+    if (bw_control.mode == BW_CONTROL_MIX) {
+        DBG_LOG(INFO, "Bandwidth controller: period %d ms, hysteresis %d%%\n", bw_control.period_ms, hysteresis);
+        if (register_monitor_hook(bw_control_hook, NULL, bw_control.period_ms * 1000) != E_SUCCESS) {
+            return E_ERROR;
+        }
+        return start_monitor_thread();
+    }
+    return E_SUCCESS;
+}
+
+int bw_control_set_targets(int read_bw, int write_bw)
+{
+    uint16_t read_val, write_val;
+    uint16_t val;
+    int i;
+
+    if (bw_control.mode == BW_CONTROL_STATIC) {
+        return E_NOENT;
+    }
+    // a node without a model leaves every throttle as it is
+    for (i = 0; i < bw_control.num_nodes; i++) {
+        bw_control_node_t* n = &bw_control.nodes[i];
+        if (n->node == NULL) {
+            continue;
+        }
+        if (find_bw_throttle(n->node, n->node->read_bw_model, "read", (uint64_t) (int64_t) read_bw, &n->next_read_val) != E_SUCCESS ||
+            find_bw_throttle(n->node, n->node->write_bw_model, "write", (uint64_t) (int64_t) write_bw, &n->next_write_val) != E_SUCCESS)
+        {
+            return E_INVAL;
+        }
+    }
+    for (i = 0; i < bw_control.num_nodes; i++) {
+        bw_control_node_t* n = &bw_control.nodes[i];
+        if (n->node == NULL) {
+            continue;
+        }
+        read_val = n->next_read_val;
+        write_val = n->next_write_val;
+        n->read_val = read_val;
+        n->write_val = write_val;
+        if (bw_control.mode == BW_CONTROL_SPLIT) {
+            n->node->cpu_model->set_throttle_register(n->node->mc_pci_regs, THROTTLE_DDR_READ, read_val);
+            n->node->cpu_model->set_throttle_register(n->node->mc_pci_regs, THROTTLE_DDR_WRITE, write_val);
+        } else if (n->programmed_frac >= 0) {
+            // blend the new values by the mix seen so far, the hook
+            // follows the traffic from there
+            val = (uint16_t) floor(n->read_frac * read_val + (1 - n->read_frac) * write_val + 0.5);
+            n->node->cpu_model->set_throttle_register(n->node->mc_pci_regs, THROTTLE_DDR_ACT, val);
+            n->programmed_frac = n->read_frac;
+            n->reprograms++;
+        }
+    }
+    return E_SUCCESS;
+}
+
+void finalize_bw_control()
+{
+    int i;
+
+    for (i = 0; i < bw_control.num_nodes; i++) {
+        bw_control_node_t* n = &bw_control.nodes[i];
+        if (n->node == NULL) {
+            continue;
+        }
+        if (bw_control.mode == BW_CONTROL_SPLIT) {
+            n->node->cpu_model->set_throttle_register(n->node->mc_pci_regs, THROTTLE_DDR_READ, THROTTLE_UNTHROTTLED);
+            n->node->cpu_model->set_throttle_register(n->node->mc_pci_regs, THROTTLE_DDR_WRITE, THROTTLE_UNTHROTTLED);
+        } else {
+            DBG_LOG(INFO, "Node %d: throttle reprogrammed %lu times\n", n->node->node_id, n->reprograms);
+        }
+    }
+}
@@ -0,0 +1,56 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __BW_CONTROL_H
+#define __BW_CONTROL_H
+
+#include <stdint.h>
+#include "config.h"
+
+struct virtual_node_s;
+struct virtual_topology_s;
+
+typedef enum {
+    BW_CONTROL_STATIC = 0, // throttle set once at initialization
+    BW_CONTROL_MIX,        // activation throttle follows the observed read/write mix
+    BW_CONTROL_SPLIT       // separate read and write throttles, set once
+} bw_control_mode_t;
+
+int init_bw_control(config_t* cfg, struct virtual_topology_s* topology);
+void finalize_bw_control();
+
+/**
+ * \brief Moves the controller to new bandwidth targets, E_NOENT in the static
+ * mode where the caller programs the throttle itself, E_INVAL with no
+ * throttle changed if a node has no model for a target
+ */
+int bw_control_set_targets(int read_bw, int write_bw);
+
+/**
+ * \brief Account memory traffic to the NVM of a virtual node
+ */
+void bw_control_account(struct virtual_node_s* virtual_node, uint64_t read_bytes, uint64_t write_bytes);
+
+/**
+ * \brief Account memory traffic to the NVM of the calling thread's virtual node
+ */
+void bw_control_account_self(uint64_t read_bytes, uint64_t write_bytes);
+
+/**
+ * \brief Returns the write bandwidth in MB/s of the calling thread's NVM:
+ * the bandwidth.write target, or else the unthrottled bandwidth of the
+ * trained write model, 0 if neither is known
+ */
+int bw_control_write_bw_self();
+
+#endif /* __BW_CONTROL_H */
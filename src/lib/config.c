@@ -272,3 +272,64 @@ __cconfig_init(config_t *cfg, const char *config_file)
     }
     return ret;
 }
+
+
+static void
+for_each_setting(config_setting_t *group, const char *prefix,
+                 void (*fn)(const char *name, const char *value, void *arg), void *arg)
+{
+	config_setting_t *setting;
+	char name[ENVVAR_MAX_LEN];
+	char value[64];
+	const char *str;
+	char *env_value;
+	int i;
+
+	for (i = 0; i < config_setting_length(group); i++) {
+		setting = config_setting_get_elem(group, i);
+		if (!config_setting_name(setting)) {
+			continue;
+		}
+		snprintf(name, sizeof(name), "%s%s%s", prefix, prefix[0] ? "." : "", config_setting_name(setting));
+		str = value;
+		switch (config_setting_type(setting)) {
+			case CONFIG_TYPE_GROUP:
+				for_each_setting(setting, name, fn, arg);
+				continue;
+			case CONFIG_TYPE_INT:
+				snprintf(value, sizeof(value), "%d", config_setting_get_int(setting));
+				break;
+			case CONFIG_TYPE_INT64:
+				snprintf(value, sizeof(value), "%lld", config_setting_get_int64(setting));
+				break;
+			case CONFIG_TYPE_FLOAT:
+				snprintf(value, sizeof(value), "%g", config_setting_get_float(setting));
+				break;
+			case CONFIG_TYPE_BOOL:
+				str = config_setting_get_bool(setting) ? "true" : "false";
+				break;
+			case CONFIG_TYPE_STRING:
+				str = config_setting_get_string(setting);
+				break;
+			default:
+				continue; // arrays and lists are not used by the emulator
+		}
+		if (env_setting_lookup(name, &env_value) == CONFIG_TRUE) {
+			str = env_value;
+		}
+		fn(name, str, arg);
+	}
+}
+
+
+int
+__cconfig_for_each_setting(config_t *cfg, void (*fn)(const char *name, const char *value, void *arg), void *arg)
+{
+	config_setting_t *root = config_root_setting(cfg);
+
+	if (!root) {
+		return CONFIG_FALSE;
+	}
+	for_each_setting(root, "", fn, arg);
+	return CONFIG_TRUE;
+}
@@ -69,6 +69,12 @@ int __cconfig_lookup_valid_int(config_t *cfg, const char *name, int *value, int
 int __cconfig_lookup_valid_string(config_t *cfg, const char *name, char **value, int validity_check, ...);
 int __cconfig_init(config_t *cfg, const char *config_file);
 
+/**
+ * Calls fn with the name ("section.key") and value of every scalar setting
+ * of the configuration file, as the lookup functions would return it.
+ */
+int __cconfig_for_each_setting(config_t *cfg, void (*fn)(const char *name, const char *value, void *arg), void *arg);
+
 #ifdef __cplusplus
 }
 #endif
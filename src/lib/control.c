@@ -0,0 +1,354 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "control.h"
+#include "error.h"
+#include "model.h"
+#include "thread.h"
+
+#define CONTROL_DEFAULT_PERIOD_MS 100
+#define CONTROL_MAX_CLIENTS 8
+
+// a connected client, with the partial line it sent so far kept across
+// hook runs
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[CONTROL_LINE_SIZE];
+} control_client_t;
+
+static struct {
+    int fd;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    uint64_t version;
+    control_client_t clients[CONTROL_MAX_CLIENTS];
+} control = { -1 };
+
+// the settings a set command may change
+typedef struct {
+    int read_latency;
+    int write_latency;
+    int min_epoch_duration_us;
+    int max_epoch_duration_us;
+    int read_bw;
+    int write_bw;
+} control_settings_t;
+
+static void current_settings(control_settings_t* s)
+{
+    memset(s, 0, sizeof(*s));
+    if (latency_model.enabled) {
+        s->read_latency = latency_model.read_latency;
+        s->write_latency = latency_model.write_latency;
+        get_epoch_durations(&s->min_epoch_duration_us, &s->max_epoch_duration_us);
+    }
+    s->read_bw = bandwidth_model.read_bw;
+    s->write_bw = bandwidth_model.write_bw;
+}
+
+static int parse_int(const char* str, int* value)
+{
+    char* end;
+    long v = strtol(str, &end, 0);
+
+    if (*str == '\0' || *end != '\0' || v < -1 || v > 0x7fffffff) {
+        return E_INVAL;
+    }
+    *value = (int) v;
+    return E_SUCCESS;
+}
+
+static void command_get(char* reply, size_t size)
+{
+    control_settings_t s;
+
+    current_settings(&s);
+    snprintf(reply, size, "ok version=%lu latency.read=%d latency.write=%d latency.min_epoch_duration_us=%d "
+             "latency.max_epoch_duration_us=%d bandwidth.read=%d bandwidth.write=%d\n", control.version,
+             s.read_latency, s.write_latency, s.min_epoch_duration_us, s.max_epoch_duration_us, s.read_bw,
+             s.write_bw);
+}
+
+/**
+ * Parses all the settings and checks them against the current ones before
+ * applying any. Only programming the throttles can fail after that, so the
+ * bandwidth is set first and undone on failure: a set takes effect as a
+ * whole or not at all, unless the undo fails too, which bumps the version.
+ */
+static void command_set(char* args, char* reply, size_t size)
+{
+    control_settings_t s, old;
+    int latency = 0, epochs = 0, bandwidth = 0;
+    char *token, *value, *saveptr;
+    int* field;
+
+    current_settings(&s);
+    old = s;
+    for (token = strtok_r(args, " \t", &saveptr); token; token = strtok_r(NULL, " \t", &saveptr)) {
+        if ((value = strchr(token, '=')) == NULL) {
+            snprintf(reply, size, "error expected key=value, got %s\n", token);
+            return;
+        }
+        *value++ = '\0';
+        if (strcmp(token, "latency.read") == 0) {
+            field = &s.read_latency;
+            latency = 1;
+        } else if (strcmp(token, "latency.write") == 0) {
+            field = &s.write_latency;
+            latency = 1;
+        } else if (strcmp(token, "latency.min_epoch_duration_us") == 0) {
+            field = &s.min_epoch_duration_us;
+            epochs = 1;
+        } else if (strcmp(token, "latency.max_epoch_duration_us") == 0) {
+            field = &s.max_epoch_duration_us;
+            epochs = 1;
+        } else if (strcmp(token, "bandwidth.read") == 0) {
+            field = &s.read_bw;
+            bandwidth = 1;
+        } else if (strcmp(token, "bandwidth.write") == 0) {
+            field = &s.write_bw;
+            bandwidth = 1;
+        } else {
+            snprintf(reply, size, "error unknown setting %s\n", token);
+            return;
+        }
+        if (parse_int(value, field) != E_SUCCESS) {
+            snprintf(reply, size, "error invalid value %s for %s\n", value, token);
+            return;
+        }
+    }
+    if (!latency && !epochs && !bandwidth) {
+        snprintf(reply, size, "error nothing to set\n");
+        return;
+    }
+
+    if ((latency || epochs) && !latency_model.enabled) {
+        snprintf(reply, size, "error latency emulation is disabled\n");
+        return;
+    }
+    if (bandwidth && !bandwidth_model.enabled) {
+        snprintf(reply, size, "error bandwidth emulation is disabled\n");
+        return;
+    }
+    if (latency && valid_target_latency(s.read_latency, s.write_latency) != E_SUCCESS) {
+        snprintf(reply, size, "error latencies must exceed the hardware latency of every virtual node\n");
+        return;
+    }
+    if (epochs && valid_epoch_durations(s.min_epoch_duration_us, s.max_epoch_duration_us) != E_SUCCESS) {
+        snprintf(reply, size, "error epoch durations must be in [%d, %d] usec, min below max\n",
+                 MIN_EPOCH_DURATION_US, MAX_EPOCH_DURATION_US);
+        return;
+    }
+    if (bandwidth && valid_bandwidth(s.read_bw, s.write_bw) != E_SUCCESS) {
+        snprintf(reply, size, "error bandwidth must be positive or -1, with a trained bandwidth model\n");
+        return;
+    }
+
+    // the bandwidth is the only setting that can fail to apply, so it goes
+    // first and is put back if it does
+    if (bandwidth && set_bandwidth(s.read_bw, s.write_bw) != E_SUCCESS) {
+        // validated above, only a throttle register write can get here
+        if (set_bandwidth(old.read_bw, old.write_bw) != E_SUCCESS) {
+            // some nodes may run the new throttles, clients must re-read them
+            control.version++;
+            snprintf(reply, size, "error cannot program the bandwidth throttle, bandwidth partially set, version=%lu\n",
+                     control.version);
+            return;
+        }
+        snprintf(reply, size, "error cannot program the bandwidth throttle\n");
+        return;
+    }
+    if (latency) {
+        set_target_latency(s.read_latency, s.write_latency);
+    }
+    if (epochs) {
+        set_epoch_durations(s.min_epoch_duration_us, s.max_epoch_duration_us);
+    }
+    control.version++;
+    snprintf(reply, size, "ok version=%lu\n", control.version);
+}
+
+static void handle_command(char* line, char* reply, size_t size)
+{
+    char* args;
+
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if ((args = strpbrk(line, " \t")) != NULL) {
+        *args++ = '\0';
+    } else {
+        args = line + strlen(line);
+    }
+    if (strcmp(line, "get") == 0) {
+        command_get(reply, size);
+    } else if (strcmp(line, "set") == 0) {
+        command_set(args, reply, size);
+    } else {
+        snprintf(reply, size, "error unknown command %s\n", line);
+    }
+    DBG_LOG(INFO, "Control command %s: %s", line, reply);
+}
+
+static void reply_line(int fd, char* line)
+{
+    char reply[CONTROL_LINE_SIZE];
+    size_t len = strlen(line);
+
+    if (len && line[len - 1] == '\r') {
+        line[len - 1] = '\0';
+    }
+    if (line[0] == '\0') {
+        return;
+    }
+    handle_command(line, reply, sizeof(reply));
+    // a client that does not read its replies loses them
+    send(fd, reply, strlen(reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static void close_client(control_client_t* c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+// answers at most one line of the client and reads only what it already
+// sent, so that no client can hold the monitor thread
+static void serve_client(control_client_t* c)
+{
+    static const char too_long[] = "error line too long\n";
+    struct pollfd pfd;
+    ssize_t n;
+    char* nl;
+
+    if ((nl = memchr(c->buf, '\n', c->len)) == NULL) {
+        pfd.fd = c->fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) <= 0) {
+            return;
+        }
+        if ((n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, MSG_DONTWAIT)) <= 0) {
+            // a last command without a newline
+            if (c->len) {
+                c->buf[c->len] = '\0';
+                reply_line(c->fd, c->buf);
+            }
+            close_client(c);
+            return;
+        }
+        c->len += n;
+        if ((nl = memchr(c->buf, '\n', c->len)) == NULL) {
+            if (c->len == sizeof(c->buf) - 1) {
+                send(c->fd, too_long, sizeof(too_long) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+                close_client(c);
+            }
+            return;
+        }
+    }
+    *nl = '\0';
+    reply_line(c->fd, c->buf);
+    c->len -= nl + 1 - c->buf;
+    memmove(c->buf, nl + 1, c->len);
+}
+
+static void control_hook(void* arg)
+{
+    int listen_fd = __atomic_load_n(&control.fd, __ATOMIC_ACQUIRE);
+    int i;
+
+    if (listen_fd < 0) {
+        return;
+    }
+    // clients beyond the free slots wait in the listen backlog; the client
+    // sockets block but are only used with MSG_DONTWAIT
+    for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control.clients[i].fd < 0 &&
+            (control.clients[i].fd = accept(listen_fd, NULL, NULL)) < 0)
+        {
+            break;
+        }
+    }
+    for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control.clients[i].fd >= 0) {
+            serve_client(&control.clients[i]);
+        }
+    }
+}
+
+int init_control(config_t* cfg)
+{
+    struct sockaddr_un addr;
+    int enabled = 0;
+    int period_ms;
+    char* path;
+    int i;
+
+    __cconfig_lookup_bool(cfg, "control.enable", &enabled);
+    if (!enabled) {
+        return E_SUCCESS;
+    }
+    for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        control.clients[i].fd = -1;
+    }
+    if (__cconfig_lookup_string(cfg, "control.socket", &path) == CONFIG_TRUE) {
+        snprintf(control.path, sizeof(control.path), "%s", path);
+    } else {
+        snprintf(control.path, sizeof(control.path), CONTROL_SOCKET_NAME, getpid());
+    }
+    if (__cconfig_lookup_int(cfg, "control.period_ms", &period_ms) != CONFIG_TRUE || period_ms <= 0) {
+        period_ms = CONTROL_DEFAULT_PERIOD_MS;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", control.path);
+    // a socket left by an earlier process of the same pid
+    unlink(control.path);
+    if ((control.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(control.fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(control.fd, 4) < 0)
+    {
+        DBG_LOG(WARNING, "Cannot listen on control socket %s, runtime control disabled\n", control.path);
+        if (control.fd >= 0) {
+            close(control.fd);
+            control.fd = -1;
+        }
+        return E_SUCCESS;
+    }
+    if (register_monitor_hook(control_hook, NULL, period_ms * 1000) != E_SUCCESS) {
+        finalize_control();
+        return E_SUCCESS;
+    }
+    DBG_LOG(INFO, "Listening for control commands on %s\n", control.path);
+    return start_monitor_thread();
+}
+
+void finalize_control()
+{
+    int fd = __atomic_exchange_n(&control.fd, -1, __ATOMIC_ACQ_REL);
+
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    unlink(control.path);
+}
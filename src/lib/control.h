@@ -0,0 +1,37 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include "config.h"
+#include "control_format.h"
+
+/**
+ * \file
+ *
+ * Runtime control
+ *
+ * The target latencies, the epoch bounds and the bandwidth targets are
+ * read at initialization, which measures the topology and may train the
+ * bandwidth models. To sweep a long running application over several
+ * targets, the control socket changes them in place, see
+ * control_format.h. The monitor thread serves the socket, so changes
+ * apply between two epoch checks and throttles are reprogrammed from the
+ * models trained at initialization.
+ */
+
+int init_control(config_t* cfg);
+void finalize_control();
+
+#endif /* __CONTROL_H */
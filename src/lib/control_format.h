@@ -0,0 +1,40 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __CONTROL_FORMAT_H
+#define __CONTROL_FORMAT_H
+
+/**
+ * \file
+ *
+ * Control socket protocol
+ *
+ * With control.enable the emulator listens on the Unix stream socket
+ * CONTROL_SOCKET_NAME (or control.socket). A client sends one command per
+ * line and gets one line back per command:
+ *
+ *   get                          "ok version=<n> <key>=<value> ..."
+ *   set <key>=<value> ...        "ok version=<n>" or "error <reason>"
+ *
+ * The keys are the configuration names: latency.read, latency.write,
+ * latency.min_epoch_duration_us, latency.max_epoch_duration_us,
+ * bandwidth.read and bandwidth.write. A set applies all its settings or
+ * none of them, and bumps the version. The one exception is a throttle
+ * that can be neither programmed nor put back, reported as an error with
+ * the bumped version. src/tools/quartz-ctl is a client.
+ */
+
+#define CONTROL_SOCKET_NAME "/tmp/quartz.%d.ctl"
+#define CONTROL_LINE_SIZE 1024
+
+#endif /* __CONTROL_FORMAT_H */
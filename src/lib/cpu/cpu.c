@@ -11,6 +11,9 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+// the read_stall_cycles bodies of the processor headers run in the epoch
+// code, from the signal handler, so they log through the debug ring
+#define DBG_ASYNC_MODULE
 #include <stdio.h>
 #include <stdlib.h>
 #include <regex.h>
@@ -62,6 +65,59 @@ void get_family_model(int *family, int *model)
     }
 }
 
+static uint64_t xgetbv0()
+{
+    unsigned int eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+// Unlike the processor model, instruction set support is reliably reported
+// by CPUID. Wide vector registers additionally need the OS to save their
+// state on context switch, which is what XCR0 tells us.
+int cpu_has_feature(cpu_feature_t feature)
+{
+    unsigned int eax, ebx, ecx, edx;
+    uint64_t xcr0 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+
+    if (feature == CPU_FEATURE_SSE4_1)
+    {
+        return (ecx >> 19) & 1;
+    }
+
+    // OSXSAVE
+    if ((ecx >> 27) & 1)
+    {
+        xcr0 = xgetbv0();
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+
+    switch (feature)
+    {
+    case CPU_FEATURE_AVX2:
+        // XMM and YMM state
+        return ((xcr0 & 0x6) == 0x6) && ((ebx >> 5) & 1);
+    case CPU_FEATURE_AVX512F:
+        // XMM, YMM, opmask and ZMM state
+        return ((xcr0 & 0xe6) == 0xe6) && ((ebx >> 16) & 1);
+    case CPU_FEATURE_CLFLUSHOPT:
+        return (ebx >> 23) & 1;
+    case CPU_FEATURE_CLWB:
+        return (ebx >> 24) & 1;
+    default:
+        return 0;
+    }
+}
+
 // caller is responsible for freeing memory allocated by this function
 char *cpuinfo(char *valname)
 {
@@ -123,6 +179,14 @@ char *cpu_model_name()
     return cpuinfo("model name");
 }
 
+const char *cpu_microarch_name(microarch_t microarch)
+{
+    if ((unsigned) microarch > SapphireRapidsXeon) {
+        return microarch_strings[Invalid];
+    }
+    return microarch_strings[microarch];
+}
+
 int match(const char *to_match, const char *regex_text)
 {
     int ret;
@@ -19,6 +19,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "dev.h"
 
 #define MAX_THROTTLE_VALUE 1023
+#define CACHE_LINE_SIZE 64
 
 int set_throttle_register(int node, uint64_t val);
 size_t cpu_llc_size_bytes();
@@ -50,6 +51,15 @@ typedef struct
     microarch_t microarch;
 } microarch_ID_t;
 
+// instruction set extensions we pick code paths on at runtime
+typedef enum {
+    CPU_FEATURE_SSE4_1,
+    CPU_FEATURE_AVX2,
+    CPU_FEATURE_AVX512F,
+    CPU_FEATURE_CLFLUSHOPT,
+    CPU_FEATURE_CLWB
+} cpu_feature_t;
+
 /**
  *  CPU object that encapsulates processor-specific methods for accessing
  *  performance counters and memory controller PCI registers
@@ -61,9 +71,15 @@ typedef struct cpu_model_s {
     struct pmc_events_s* pmc_events; // performance monitoring events supported by the processor
     int (*set_throttle_register)(pci_regs_t *regs, throttle_type_t throttle_type, uint16_t val);
     int (*get_throttle_register)(pci_regs_t *regs, throttle_type_t throttle_type, uint16_t* val);
+    // uncore memory controller counters, NULL if not reachable through PCI
+    int (*setup_imc_counters)(pci_regs_t *regs);
+    int (*read_imc_counters)(pci_regs_t *regs, uint64_t* read_cas, uint64_t* write_cas);
 } cpu_model_t;
 
 cpu_model_t* cpu_model();
 int cpu_speed_mhz();
+char *cpu_model_name(); // caller frees
+const char *cpu_microarch_name(microarch_t microarch);
+int cpu_has_feature(cpu_feature_t feature);
 
 #endif /* __CPU_H */
@@ -80,6 +80,79 @@ int intel_xeon_ex_get_throttle_register(pci_regs_t *regs, throttle_type_t thrott
 }
 
 
+// Memory controller channel PMON registers. On the Xeon E5 family they live 
+// in the same PCI functions as the thermal throttling registers. 
+// Our device only does 16-bit configuration space accesses, so 32-bit 
+// control registers are written in two halves and 48-bit counters are 
+// read in three words.
+#define IMC_PMON_CTR(i)          (0xA0 + (i) * 8)
+#define IMC_PMON_CTL(i)          (0xD8 + (i) * 4)
+#define IMC_PMON_BOX_CTL         0xF4
+#define IMC_PMON_BOX_CTL_RST_CTRS 0x2
+#define IMC_PMON_CTL_EN_HI       0x40 // enable is bit 22, i.e. bit 6 of the high half
+#define IMC_EVENT_CAS_COUNT      0x04
+#define IMC_UMASK_CAS_COUNT_RD   0x03
+#define IMC_UMASK_CAS_COUNT_WR   0x0C
+
+int intel_xeon_ex_setup_imc_counters(pci_regs_t *regs)
+{
+    int i;
+
+    for (i=0; i < regs->channels; ++i) {
+        pci_addr* a = &regs->addr[i];
+        if (set_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_BOX_CTL, IMC_PMON_BOX_CTL_RST_CTRS) != E_SUCCESS) {
+            return E_ERROR;
+        }
+        // counter 0 counts reads, counter 1 counts writes
+        set_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTL(0), (IMC_UMASK_CAS_COUNT_RD << 8) | IMC_EVENT_CAS_COUNT);
+        set_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTL(0) + 2, IMC_PMON_CTL_EN_HI);
+        set_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTL(1), (IMC_UMASK_CAS_COUNT_WR << 8) | IMC_EVENT_CAS_COUNT);
+        set_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTL(1) + 2, IMC_PMON_CTL_EN_HI);
+    }
+    return E_SUCCESS;
+}
+
+static int intel_xeon_ex_read_imc_counter(pci_addr* a, int counter, uint64_t* val)
+{
+    uint16_t lo, mid1, mid2, hi1, hi2;
+    int retries;
+
+    // the counter keeps running while we read it word by word, so retry 
+    // whenever a carry propagated between the reads
+    for (retries = 0; retries < 8; retries++) {
+        if (get_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTR(counter) + 4, &hi1) != E_SUCCESS) {
+            return E_ERROR;
+        }
+        get_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTR(counter) + 2, &mid1);
+        get_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTR(counter), &lo);
+        get_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTR(counter) + 2, &mid2);
+        get_pci(a->bus_id, a->dev_id, a->funct, IMC_PMON_CTR(counter) + 4, &hi2);
+        if (mid1 == mid2 && hi1 == hi2) {
+            *val = ((uint64_t) hi1 << 32) | ((uint64_t) mid1 << 16) | lo;
+            return E_SUCCESS;
+        }
+    }
+    return E_BUSY;
+}
+
+int intel_xeon_ex_read_imc_counters(pci_regs_t *regs, uint64_t* read_cas, uint64_t* write_cas)
+{
+    int i;
+    uint64_t rd, wr;
+
+    *read_cas = *write_cas = 0;
+    for (i=0; i < regs->channels; ++i) {
+        if (intel_xeon_ex_read_imc_counter(&regs->addr[i], 0, &rd) != E_SUCCESS ||
+            intel_xeon_ex_read_imc_counter(&regs->addr[i], 1, &wr) != E_SUCCESS) 
+        {
+            return E_ERROR;
+        }
+        *read_cas += rd;
+        *write_cas += wr;
+    }
+    return E_SUCCESS;
+}
+
 // desc is fixed in cpu_model() if not Xeon
 
 cpu_model_t cpu_model_intel_xeon_ex = {
@@ -90,7 +163,9 @@ cpu_model_t cpu_model_intel_xeon_ex = {
     .pmc_events = PMC_EVENTS_PTR(sandybridge),
 #endif
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
-    .get_throttle_register = intel_xeon_ex_get_throttle_register
+    .get_throttle_register = intel_xeon_ex_get_throttle_register,
+    .setup_imc_counters = intel_xeon_ex_setup_imc_counters,
+    .read_imc_counters = intel_xeon_ex_read_imc_counters
 };
 
 cpu_model_t cpu_model_intel_xeon_ex_v2 = {
@@ -101,7 +176,9 @@ cpu_model_t cpu_model_intel_xeon_ex_v2 = {
     .pmc_events = PMC_EVENTS_PTR(ivybridge),
 #endif
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
-    .get_throttle_register = intel_xeon_ex_get_throttle_register
+    .get_throttle_register = intel_xeon_ex_get_throttle_register,
+    .setup_imc_counters = intel_xeon_ex_setup_imc_counters,
+    .read_imc_counters = intel_xeon_ex_read_imc_counters
 };
 
 cpu_model_t cpu_model_intel_xeon_ex_v3 = {
@@ -112,7 +189,9 @@ cpu_model_t cpu_model_intel_xeon_ex_v3 = {
     .pmc_events = PMC_EVENTS_PTR(haswell),
 #endif
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
-    .get_throttle_register = intel_xeon_ex_get_throttle_register
+    .get_throttle_register = intel_xeon_ex_get_throttle_register,
+    .setup_imc_counters = intel_xeon_ex_setup_imc_counters,
+    .read_imc_counters = intel_xeon_ex_read_imc_counters
 };
 
 // Add Sapphire Rapids CPU model definition
@@ -127,5 +206,8 @@ cpu_model_t cpu_model_intel_xeon_spr = {
 #endif
     // NOTE: Verify or replace these functions for Sapphire Rapids
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
-    .get_throttle_register = intel_xeon_ex_get_throttle_register
+    .get_throttle_register = intel_xeon_ex_get_throttle_register,
+    // Sapphire Rapids exposes its memory controller counters through MMIO
+    .setup_imc_counters = NULL,
+    .read_imc_counters = NULL
 };
@@ -19,6 +19,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <assert.h>
 #include <time.h>
 #include "config.h"
+#include "debug_ring.h"
 
 #define FOREACH_DEBUG_MODULE(ACTION)                        \
 	ACTION(all) /* special name that covers all modules */
@@ -64,7 +65,7 @@ extern const char* dbg_identifier;
 
 #define DBG_MODULE(name) dbg_module_##name
 
-#define DBG_LOG(level, format, ...)                                            \
+#define DBG_LOG_SYNC(level, format, ...)                                       \
   do {                                                                         \
     FILE* ferr = stdout;                                                       \
     time_t ctime;                                                              \
@@ -94,6 +95,37 @@ extern const char* dbg_identifier;
   } while(0);
 
 
+// the ring takes the messages that do not terminate the process, from the
+// threads that have one
+#define DBG_LOG_ASYNC(level, format, ...)                                      \
+  do {                                                                         \
+    dbg_record_t* rec;                                                         \
+    if (DBG_CODE(level) > dbg_terminate_level &&                               \
+        DBG_CODE(level) <= dbg_level && dbg_ring)                              \
+    {                                                                          \
+      if ((rec = dbg_ring_reserve()) != NULL) {                                \
+        rec->fmt = "" format;                                               \
+        rec->function = __FUNCTION__;                                          \
+        rec->file = __FILE__;                                                  \
+        rec->line = __LINE__;                                                  \
+        rec->code = DBG_CODE(level);                                          \
+        rec->nargs = DBG_NARGS(__VA_ARGS__);                                   \
+        rec->time = dbg_verbose ? time(NULL) : 0;                              \
+        DBG_STORE_ARGS(rec, ##__VA_ARGS__)                                     \
+        dbg_ring_commit();                                                     \
+      }                                                                        \
+    } else {                                                                   \
+      DBG_LOG_SYNC(level, format, ##__VA_ARGS__)                               \
+    }                                                                          \
+  } while(0);
+
+#ifdef DBG_ASYNC_MODULE
+#define DBG_LOG(level, format, ...) DBG_LOG_ASYNC(level, format, ##__VA_ARGS__)
+#else
+#define DBG_LOG(level, format, ...) DBG_LOG_SYNC(level, format, ##__VA_ARGS__)
+#endif
+
+
 #define DBG_LOG2(level, module, format, ...)                                   \
   do {                                                                         \
     FILE* ferr = stdout;                                                       \
@@ -0,0 +1,268 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "debug.h"
+#include "error.h"
+#include "interpose.h"
+
+#define DBG_RING_DEFAULT_RECORDS 1024
+#define DBG_RING_DEFAULT_FLUSH_MS 100
+#define DBG_RING_SLEEP_SLICE_US 10000
+#define DBG_RING_LINE_SIZE 1024
+
+__thread dbg_ring_t* dbg_ring = NULL;
+
+static struct {
+    int enabled;
+    uint64_t ring_records;
+    int flush_ms;
+    pthread_mutex_t mutex; // protects the ring list
+    dbg_ring_t* rings;
+    uint64_t dropped;      // by rings already freed
+    volatile int stop;
+    pthread_t thread;
+} ring_log;
+
+// expands the format with the stored arguments, one conversion at a time
+static void render(const dbg_record_t* rec, char* buf, size_t size)
+{
+    const char* f = rec->fmt;
+    const char* s;
+    char spec[32];
+    size_t len = 0, n;
+    int arg = 0;
+    int ret = 0;
+    dbg_arg_t value;
+    char conv;
+
+    while (*f && len < size - 1) {
+        if (*f != '%') {
+            buf[len++] = *f++;
+            continue;
+        }
+        n = 0;
+        spec[n++] = *f++;
+        while (*f && strchr("-+ #0123456789.hlLqjzt", *f) && n < sizeof(spec) - 2) {
+            spec[n++] = *f++;
+        }
+        if ((conv = *f) == '\0') {
+            break;
+        }
+        f++;
+        spec[n++] = conv;
+        spec[n] = '\0';
+        if (conv == '%') {
+            buf[len++] = '%';
+            continue;
+        }
+        if (arg < rec->nargs) {
+            value = rec->args[arg++];
+        } else {
+            value.i = 0;
+        }
+        switch (conv) {
+            case 'f': case 'F': case 'e': case 'E':
+            case 'g': case 'G': case 'a': case 'A':
+                if (strchr(spec, 'L')) {
+                    ret = snprintf(buf + len, size - len, spec, (long double) value.d);
+                } else {
+                    ret = snprintf(buf + len, size - len, spec, value.d);
+                }
+                break;
+            case 's':
+                s = (const char*) (uintptr_t) value.i;
+                ret = snprintf(buf + len, size - len, spec, s ? s : "(null)");
+                break;
+            case 'p':
+                ret = snprintf(buf + len, size - len, spec, (void*) (uintptr_t) value.i);
+                break;
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                // int arguments were sign extended, longer ones are whole
+                if (strpbrk(spec, "lqjzt")) {
+                    ret = snprintf(buf + len, size - len, spec, (long) value.i);
+                } else {
+                    ret = snprintf(buf + len, size - len, spec, (int) value.i);
+                }
+                break;
+            default:
+                ret = snprintf(buf + len, size - len, "%s", spec);
+                break;
+        }
+        if (ret > 0) {
+            len += ret;
+        }
+    }
+    if (len > size - 1) {
+        len = size - 1;
+    }
+    buf[len] = '\0';
+}
+
+static void print_record(const dbg_record_t* rec)
+{
+    char line[DBG_RING_LINE_SIZE];
+    FILE* ferr = stdout;
+
+    if (rec->code <= dbg_stderr_level) {
+        ferr = stderr;
+    }
+    render(rec, line, sizeof(line));
+    if (dbg_verbose) {
+        fprintf(ferr, "[%s] [%lu] %s in %s <%s,%d>: %s", dbg_identifier, rec->time, dbg_code2str[rec->code],
+                rec->function, rec->file, rec->line, line);
+    } else {
+        fprintf(ferr, "[%s] %s: %s", dbg_identifier, dbg_code2str[rec->code], line);
+    }
+}
+
+static void drain_ring(dbg_ring_t* ring)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    for (; tail != head; tail++) {
+        print_record(&ring->records[tail & ring->mask]);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void drain_rings()
+{
+    dbg_ring_t** p;
+    dbg_ring_t* ring;
+
+    __lib_pthread_mutex_lock(&ring_log.mutex);
+    for (p = &ring_log.rings; (ring = *p) != NULL; ) {
+        // a closed ring gets no more records, once drained it can go
+        int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        drain_ring(ring);
+        if (closed) {
+            *p = ring->next;
+            ring_log.dropped += ring->dropped;
+            free(ring->records);
+            free(ring);
+        } else {
+            p = &ring->next;
+        }
+    }
+    __lib_pthread_mutex_unlock(&ring_log.mutex);
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void* dbg_ring_flusher(void* arg)
+{
+    long slept;
+
+    while (!ring_log.stop) {
+        for (slept = 0; slept < ring_log.flush_ms * 1000L && !ring_log.stop; slept += DBG_RING_SLEEP_SLICE_US) {
+            usleep(DBG_RING_SLEEP_SLICE_US);
+        }
+        drain_rings();
+    }
+    return NULL;
+}
+
+int init_dbg_ring(config_t* cfg)
+{
+    int enabled = 1;
+    int records;
+
+    // messages that would go to the ring are filtered out anyway
+    __cconfig_lookup_bool(cfg, "debug.async", &enabled);
+    if (!enabled || dbg_level <= dbg_terminate_level) {
+        return E_SUCCESS;
+    }
+    if (__cconfig_lookup_int(cfg, "debug.ring_records", &records) != CONFIG_TRUE || records <= 0) {
+        records = DBG_RING_DEFAULT_RECORDS;
+    }
+    // round up to a power of two so the ring index is a mask
+    for (ring_log.ring_records = 1; ring_log.ring_records < (uint64_t) records; ring_log.ring_records <<= 1);
+    if (__cconfig_lookup_int(cfg, "debug.ring_flush_ms", &ring_log.flush_ms) != CONFIG_TRUE ||
+        ring_log.flush_ms <= 0)
+    {
+        ring_log.flush_ms = DBG_RING_DEFAULT_FLUSH_MS;
+    }
+
+    pthread_mutex_init(&ring_log.mutex, NULL);
+    if (__lib_pthread_create == NULL) {
+        init_interposition();
+    }
+    if (__lib_pthread_create(&ring_log.thread, NULL, dbg_ring_flusher, NULL) != 0) {
+        DBG_LOG(WARNING, "Cannot create the debug log flusher thread, logging synchronously\n");
+        return E_SUCCESS;
+    }
+    ring_log.enabled = 1;
+    return E_SUCCESS;
+}
+
+void dbg_ring_thread_start()
+{
+    dbg_ring_t* ring;
+
+    if (!ring_log.enabled || dbg_ring) {
+        return;
+    }
+    if ((ring = calloc(1, sizeof(*ring))) == NULL) {
+        return;
+    }
+    if ((ring->records = malloc(ring_log.ring_records * sizeof(dbg_record_t))) == NULL) {
+        free(ring);
+        return;
+    }
+    ring->mask = ring_log.ring_records - 1;
+
+    __lib_pthread_mutex_lock(&ring_log.mutex);
+    ring->next = ring_log.rings;
+    ring_log.rings = ring;
+    __lib_pthread_mutex_unlock(&ring_log.mutex);
+    dbg_ring = ring;
+}
+
+void dbg_ring_thread_stop()
+{
+    dbg_ring_t* ring = dbg_ring;
+
+    if (ring) {
+        dbg_ring = NULL;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void finalize_dbg_ring()
+{
+    dbg_ring_t* ring;
+
+    if (!ring_log.enabled) {
+        return;
+    }
+    ring_log.stop = 1;
+    pthread_join(ring_log.thread, NULL);
+    // the remaining rings belong to threads still running, keep them
+    drain_rings();
+    __lib_pthread_mutex_lock(&ring_log.mutex);
+    for (ring = ring_log.rings; ring; ring = ring->next) {
+        ring_log.dropped += ring->dropped;
+    }
+    ring_log.enabled = 0;
+    __lib_pthread_mutex_unlock(&ring_log.mutex);
+    if (ring_log.dropped) {
+        DBG_LOG(WARNING, "%lu debug messages dropped on full debug rings\n", ring_log.dropped);
+    }
+}
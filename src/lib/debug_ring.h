@@ -0,0 +1,144 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __DEBUG_RING_H
+#define __DEBUG_RING_H
+
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+
+/**
+ * \file
+ *
+ * Asynchronous debug log
+ *
+ * The epoch code runs in the SIGUSR1 handler, where stdio can deadlock and
+ * costs far more than the epoch itself. Modules that define
+ * DBG_ASYNC_MODULE before their first include have their DBG_LOG messages
+ * below ERROR stored in a ring of the calling thread instead: the format
+ * pointer and the raw arguments, with no formatting and no locks. A flusher
+ * thread renders them to stdout/stderr like DBG_LOG does.
+ *
+ * The format must be a string literal and take at most DBG_RING_MAX_ARGS
+ * arguments, without '*' widths. A %s argument is read when the message is
+ * rendered, so it must point to a string that stays around (a literal or a
+ * static table). Threads that did not register with the emulator, and all
+ * threads when the ring is disabled, log synchronously.
+ */
+
+#define DBG_RING_MAX_ARGS 8
+
+typedef union {
+    uint64_t i;
+    double d;
+} dbg_arg_t;
+
+typedef struct {
+    const char* fmt;       // a string literal
+    const char* function;
+    const char* file;
+    int line;
+    int code;              // enum dbg_code
+    int nargs;
+    time_t time;           // only with dbg_verbose
+    dbg_arg_t args[DBG_RING_MAX_ARGS];
+} dbg_record_t;
+
+typedef struct dbg_ring_s {
+    dbg_record_t* records;
+    uint64_t mask;         // capacity - 1, the capacity is a power of two
+    uint64_t head;         // next record the thread writes
+    uint64_t tail;         // next record the flusher reads
+    uint64_t dropped;
+    int busy;              // a record is being written, see dbg_ring_reserve
+    int closed;            // the thread is gone, free once drained
+    struct dbg_ring_s* next;
+} dbg_ring_t;
+
+// ring of the calling thread, NULL if it logs synchronously
+extern __thread dbg_ring_t* dbg_ring;
+
+int init_dbg_ring(config_t* cfg);
+void finalize_dbg_ring();
+
+/**
+ * \brief Gives the calling thread a ring if asynchronous logging is on
+ */
+void dbg_ring_thread_start();
+
+/**
+ * \brief Hands the ring of the exiting calling thread over to the flusher
+ */
+void dbg_ring_thread_stop();
+
+static inline dbg_record_t* dbg_ring_reserve()
+{
+    dbg_ring_t* ring = dbg_ring;
+
+    // the signal handler interrupted this thread while it was logging:
+    // the slot is taken, drop rather than corrupt it
+    if (ring->busy) {
+        ring->dropped++;
+        return NULL;
+    }
+    if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        ring->dropped++;
+        return NULL;
+    }
+    ring->busy = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    return &ring->records[ring->head & ring->mask];
+}
+
+static inline void dbg_ring_commit()
+{
+    dbg_ring_t* ring = dbg_ring;
+
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    ring->busy = 0;
+}
+
+// arguments are stored raw: doubles as such, everything else widened to
+// 64 bits, the renderer picks the type back from the conversion
+#define DBG_ARG_IS_REAL(x) (__builtin_classify_type(x) == 8)
+
+#define DBG_STORE_ARG(arg, x)                                                  \
+    do {                                                                       \
+      if (DBG_ARG_IS_REAL(x)) {                                                \
+        (arg).d = __builtin_choose_expr(DBG_ARG_IS_REAL(x), (x), 0.0);         \
+      } else {                                                                 \
+        (arg).i = (uint64_t) (int64_t)                                         \
+                  __builtin_choose_expr(DBG_ARG_IS_REAL(x), 0, (x));           \
+      }                                                                        \
+    } while (0);
+
+#define DBG_NARGS(...) DBG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DBG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#define DBG_STORE_0(r)
+#define DBG_STORE_1(r, a) DBG_STORE_ARG((r)->args[0], a)
+#define DBG_STORE_2(r, a, b) DBG_STORE_1(r, a) DBG_STORE_ARG((r)->args[1], b)
+#define DBG_STORE_3(r, a, b, c) DBG_STORE_2(r, a, b) DBG_STORE_ARG((r)->args[2], c)
+#define DBG_STORE_4(r, a, b, c, d) DBG_STORE_3(r, a, b, c) DBG_STORE_ARG((r)->args[3], d)
+#define DBG_STORE_5(r, a, b, c, d, e) DBG_STORE_4(r, a, b, c, d) DBG_STORE_ARG((r)->args[4], e)
+#define DBG_STORE_6(r, a, b, c, d, e, f) DBG_STORE_5(r, a, b, c, d, e) DBG_STORE_ARG((r)->args[5], f)
+#define DBG_STORE_7(r, a, b, c, d, e, f, g) DBG_STORE_6(r, a, b, c, d, e, f) DBG_STORE_ARG((r)->args[6], g)
+#define DBG_STORE_8(r, a, b, c, d, e, f, g, h) DBG_STORE_7(r, a, b, c, d, e, f, g) DBG_STORE_ARG((r)->args[7], h)
+
+#define DBG_CONCAT_(a, b) a##b
+#define DBG_CONCAT(a, b) DBG_CONCAT_(a, b)
+#define DBG_STORE_ARGS(r, ...) DBG_CONCAT(DBG_STORE_, DBG_NARGS(__VA_ARGS__))(r, ##__VA_ARGS__)
+
+#endif /* __DEBUG_RING_H */
@@ -0,0 +1,68 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include "histogram.h"
+
+void histogram_merge(histogram_t* dst, const histogram_t* src)
+{
+    int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+}
+
+// smallest value falling in bucket
+static uint64_t bucket_low(int bucket)
+{
+    int shift;
+
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    return (uint64_t) (HISTOGRAM_SUB_BUCKETS + (bucket & (HISTOGRAM_SUB_BUCKETS - 1))) << shift;
+}
+
+uint64_t histogram_percentile(const histogram_t* h, double percentile)
+{
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+    // rank of the value, counted from 1
+    rank = (uint64_t) (percentile / 100 * h->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > h->count) {
+        rank = h->count;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    // a histogram being written may count a value not yet in its bucket
+    if (i == HISTOGRAM_BUCKETS) {
+        i--;
+    }
+    if (i < HISTOGRAM_SUB_BUCKETS) {
+        return bucket_low(i);
+    }
+    return bucket_low(i) + (((uint64_t) 1 << ((i >> HISTOGRAM_SUB_BITS) - 1)) >> 1);
+}
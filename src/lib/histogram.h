@@ -0,0 +1,69 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Log-bucketed histograms
+ *
+ * Values below 2^HISTOGRAM_SUB_BITS get a bucket each; above, every power
+ * of two is split into 2^HISTOGRAM_SUB_BITS buckets of equal width, so a
+ * percentile is off by at most 1/16 of its value. Recording is a few
+ * instructions and never allocates, it is safe from the latency epoch
+ * signal handler. A histogram has a single writer, the owning thread;
+ * readers merge them at report time.
+ */
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+static inline int histogram_bucket(uint64_t value)
+{
+    int shift;
+
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static inline void histogram_record(histogram_t* h, uint64_t value)
+{
+    h->buckets[histogram_bucket(value)]++;
+    h->count++;
+}
+
+/**
+ * \brief Adds the counts of src to dst
+ */
+void histogram_merge(histogram_t* dst, const histogram_t* src);
+
+/**
+ * \brief Returns the value at percentile (0 to 100), the middle of its
+ * bucket; 0 for an empty histogram
+ */
+uint64_t histogram_percentile(const histogram_t* h, double percentile);
+
+#endif /* __HISTOGRAM_H */
@@ -13,35 +13,46 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include <errno.h>
 #include "cpu/cpu.h"
+#include "bw_control.h"
 #include "config.h"
 #include "error.h"
 #include "model.h"
+#include "malloc_policy.h"
 #include "measure.h"
 #include "thread.h"
 #include "topology.h"
+#include "uncore.h"
+#include "wpq.h"
 #include "interpose.h"
+#include "control.h"
+#include "live_stats.h"
 #include "monotonic_timer.h"
 #include "pflush.h"
+#include "pmalloc.h"
+#include "process_rank.h"
 #include "stat.h"
+#include "tiering.h"
+#include "trace.h"
 
 static void init() __attribute__((constructor));
 static void finalize() __attribute__((destructor));
 
-int set_process_local_rank();
-int unset_process_local_rank();
 int partition_cpus(virtual_topology_t* virtual_topology);
 
 static virtual_topology_t* virtual_topology = NULL;
 
 void finalize() {
     int i;
+
+    finalize_control();
     if (latency_model.enabled) {
         unregister_self();
+        finalize_thread_manager();
     }
 
-    if (read_bw_model.enabled) {
+    if (bandwidth_model.enabled) {
+        finalize_bw_control();
         for (i=0; i < virtual_topology->num_virtual_nodes; i++) {
-            // FIXME: currently we keep a single bandwidth model and not per-node BW model
             physical_node_t* phys_node = virtual_topology->virtual_nodes[i].nvram_node;
             pci_regs_t *regs = phys_node->mc_pci_regs;
 
@@ -49,6 +60,11 @@ void finalize() {
             phys_node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, 0x8FFF);
         }
     }
+    finalize_tiering();
+    finalize_trace();
+    finalize_live_stats();
+    finalize_dbg_ring();
+    finalize_uncore();
 #ifdef USE_STATISTICS
     stats_report();
 #endif
@@ -88,7 +104,7 @@ void init()
     }
 
     __cconfig_lookup_bool(&cfg, "latency.enable", &latency_model.enabled);
-    __cconfig_lookup_bool(&cfg, "bandwidth.enable", &read_bw_model.enabled);
+    __cconfig_lookup_bool(&cfg, "bandwidth.enable", &bandwidth_model.enabled);
 
     if (dbg_init(&cfg, -1, NULL) != E_SUCCESS) {
         goto error;
@@ -98,6 +114,15 @@ void init()
         goto error;
     }
 
+    // registered threads log through it from the epoch code
+    if (init_dbg_ring(&cfg) != E_SUCCESS) {
+        goto error;
+    }
+
+    if (init_pmalloc(&cfg) != E_SUCCESS) {
+        goto error;
+    }
+
     if ((cpu = cpu_model()) == NULL) {
         DBG_LOG(ERROR, "No supported processor found\n");
         goto error;
@@ -109,6 +134,14 @@ void init()
         goto error;
     }
 
+    if (init_uncore(&cfg, virtual_topology) != E_SUCCESS) {
+        goto error;
+    }
+
+    if (init_bw_control(&cfg, virtual_topology) != E_SUCCESS) {
+        goto error;
+    }
+
     if (latency_model.enabled) {
         if (init_latency_model(&cfg, cpu, virtual_topology) != E_SUCCESS) {
    	        goto error;
@@ -121,6 +154,16 @@ void init()
         stats_enable(&cfg);
 #endif
 
+        // threads get their trace ring when they register
+        if (init_trace(&cfg) != E_SUCCESS) {
+            goto error;
+        }
+
+        // and their live statistics slot
+        if (init_live_stats(&cfg, virtual_topology) != E_SUCCESS) {
+            goto error;
+        }
+
         set_process_local_rank();
 
         // thread manager must be initialized and local rank set
@@ -142,9 +185,27 @@ void init()
             }
         }
 #endif
-        int write_latency;
+        int write_latency = 0;
+        int write_parallelism = 0;
         __cconfig_lookup_int(&cfg, "latency.write", &write_latency);
-        init_pflush(cpu_speed_mhz(), write_latency);
+        __cconfig_lookup_int(&cfg, "latency.write_parallelism", &write_parallelism);
+        init_pflush(cpu_speed_mhz(), write_latency, write_parallelism);
+        if (init_wpq(&cfg, virtual_topology) != E_SUCCESS) {
+            goto error;
+        }
+
+        // allocations can be placed once the main thread is registered
+        if (init_malloc_policy(&cfg) != E_SUCCESS) {
+            goto error;
+        }
+        if (init_tiering(&cfg, virtual_topology) != E_SUCCESS) {
+            goto error;
+        }
+    }
+
+    // from here on the targets may change at runtime
+    if (init_control(&cfg) != E_SUCCESS) {
+        goto error;
     }
 
     end_time = monotonic_time_us();
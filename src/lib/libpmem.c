@@ -0,0 +1,364 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <numa.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cpu/cpu.h"
+#include "interpose.h"
+#include "pflush.h"
+#include "pmemcpy.h"
+#include "thread.h"
+
+/**
+ * \file
+ *
+ * libpmem compatibility
+ *
+ * Implements the libpmem 1.x ABI on top of the emulator's write latency
+ * model, so that PMDK applications run unmodified on emulated NVM: point
+ * the dynamic linker at this libpmem.so.1 instead of PMDK's. Files mapped
+ * with pmem_map_file() are bound to the NVM node of the calling thread and
+ * reported as persistent memory; flushes and drains go through pwb() and
+ * pfence(), and the persistent memcpy family through pmemcpy.h.
+ *
+ * Constants below have the values of PMDK's libpmem.h.
+ */
+
+#define PMEM_MAJOR_VERSION 1
+#define PMEM_MINOR_VERSION 1
+
+#define PMEM_FILE_CREATE   (1 << 0)
+#define PMEM_FILE_EXCL     (1 << 1)
+#define PMEM_FILE_SPARSE   (1 << 2)
+#define PMEM_FILE_TMPFILE  (1 << 3)
+
+#define PMEM_F_MEM_NODRAIN      (1U << 0)
+#define PMEM_F_MEM_NONTEMPORAL  (1U << 1)
+#define PMEM_F_MEM_TEMPORAL     (1U << 2)
+#define PMEM_F_MEM_WC           (1U << 3)
+#define PMEM_F_MEM_WB           (1U << 4)
+#define PMEM_F_MEM_NOFLUSH      (1U << 5)
+
+// copies of at least this many bytes use non-temporal stores, like PMDK
+#define PMEM_MOVNT_THRESHOLD 256
+
+#define PMEM_ERRORMSG_SIZE 256
+
+typedef struct pmem_mapping_s {
+    uintptr_t start;
+    uintptr_t end;
+    struct pmem_mapping_s* next;
+} pmem_mapping_t;
+
+static pmem_mapping_t* mappings = NULL;
+static pthread_mutex_t mappings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread char errormsg[PMEM_ERRORMSG_SIZE];
+
+static void mappings_lock()
+{
+    if (__lib_pthread_mutex_lock == NULL) {
+        init_interposition();
+    }
+    __lib_pthread_mutex_lock(&mappings_mutex);
+}
+
+static void mappings_unlock()
+{
+    __lib_pthread_mutex_unlock(&mappings_mutex);
+}
+
+static void set_error(const char* msg, const char* path)
+{
+    snprintf(errormsg, sizeof(errormsg), "%s: %s", path, msg);
+}
+
+const char *pmem_check_version(unsigned major_required, unsigned minor_required)
+{
+    if (major_required != PMEM_MAJOR_VERSION) {
+        snprintf(errormsg, sizeof(errormsg), "libpmem major version mismatch (need %u, found %u)",
+                 major_required, PMEM_MAJOR_VERSION);
+        return errormsg;
+    }
+    if (minor_required > PMEM_MINOR_VERSION) {
+        snprintf(errormsg, sizeof(errormsg), "libpmem minor version mismatch (need %u, found %u)",
+                 minor_required, PMEM_MINOR_VERSION);
+        return errormsg;
+    }
+    return NULL;
+}
+
+const char *pmem_errormsg(void)
+{
+    return errormsg;
+}
+
+int pmem_is_pmem(const void *addr, size_t len)
+{
+    uintptr_t start = (uintptr_t) addr;
+    pmem_mapping_t* m;
+    char* force;
+    int ret = 0;
+
+    if ((force = getenv("PMEM_IS_PMEM_FORCE")) != NULL) {
+        return atoi(force) != 0;
+    }
+    mappings_lock();
+    for (m = mappings; m; m = m->next) {
+        if (start >= m->start && start + len <= m->end) {
+            ret = 1;
+            break;
+        }
+    }
+    mappings_unlock();
+    return ret;
+}
+
+int pmem_has_auto_flush(void)
+{
+    return 0; // emulated NVM is behind an ADR domain, caches are not persistent
+}
+
+int pmem_has_hw_drain(void)
+{
+    return 0;
+}
+
+void *pmem_map_file(const char *path, size_t len, int flags, mode_t mode,
+                    size_t *mapped_lenp, int *is_pmemp)
+{
+    int open_flags = O_RDWR;
+    pmem_mapping_t* m;
+    struct stat st;
+    void* addr;
+    int fd, node;
+
+    if (flags & ~(PMEM_FILE_CREATE | PMEM_FILE_EXCL | PMEM_FILE_SPARSE | PMEM_FILE_TMPFILE)) {
+        set_error("invalid flags", path);
+        return NULL;
+    }
+    if (flags & PMEM_FILE_CREATE) {
+        open_flags |= O_CREAT;
+        if (flags & PMEM_FILE_EXCL) {
+            open_flags |= O_EXCL;
+        }
+    }
+    if (flags & PMEM_FILE_TMPFILE) {
+        open_flags = O_RDWR | O_TMPFILE;
+    }
+    if ((fd = open(path, open_flags, mode)) < 0) {
+        set_error("cannot open file", path);
+        return NULL;
+    }
+    if (flags & (PMEM_FILE_CREATE | PMEM_FILE_TMPFILE)) {
+        if (len == 0 || ftruncate(fd, len) < 0) {
+            set_error("cannot set file size", path);
+            close(fd);
+            return NULL;
+        }
+        if (!(flags & PMEM_FILE_SPARSE) && posix_fallocate(fd, 0, len) != 0) {
+            set_error("cannot allocate file space", path);
+            close(fd);
+            return NULL;
+        }
+    } else {
+        if (fstat(fd, &st) < 0 || st.st_size == 0) {
+            set_error("cannot get file size", path);
+            close(fd);
+            return NULL;
+        }
+        len = st.st_size;
+    }
+
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        set_error("cannot map file", path);
+        return NULL;
+    }
+    // only pages not faulted in yet follow the binding, like pheap_open()
+    if ((node = nvram_node_self()) >= 0) {
+        numa_tonode_memory(addr, len, node);
+    }
+
+    if ((m = malloc(sizeof(*m))) != NULL) {
+        m->start = (uintptr_t) addr;
+        m->end = (uintptr_t) addr + len;
+        mappings_lock();
+        m->next = mappings;
+        mappings = m;
+        mappings_unlock();
+    }
+    if (mapped_lenp) {
+        *mapped_lenp = len;
+    }
+    if (is_pmemp) {
+        *is_pmemp = pmem_is_pmem(addr, len);
+    }
+    return addr;
+}
+
+int pmem_unmap(void *addr, size_t len)
+{
+    pmem_mapping_t** p;
+    pmem_mapping_t* m;
+
+    mappings_lock();
+    for (p = &mappings; *p; p = &(*p)->next) {
+        if ((*p)->start == (uintptr_t) addr) {
+            m = *p;
+            *p = m->next;
+            free(m);
+            break;
+        }
+    }
+    mappings_unlock();
+    return munmap(addr, len);
+}
+
+void pmem_flush(const void *addr, size_t len)
+{
+    uintptr_t line = (uintptr_t) addr & ~((uintptr_t) CACHE_LINE_SIZE - 1);
+    uintptr_t end = (uintptr_t) addr + len;
+
+    for (; line < end; line += CACHE_LINE_SIZE) {
+        pwb((const void*) line);
+    }
+}
+
+void pmem_drain(void)
+{
+    pfence();
+}
+
+void pmem_persist(const void *addr, size_t len)
+{
+    pflush_range(addr, len);
+}
+
+int pmem_msync(const void *addr, size_t len)
+{
+    uintptr_t start = (uintptr_t) addr & ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+
+    pflush_range(addr, len);
+    return msync((void*) start, (uintptr_t) addr + len - start, MS_SYNC);
+}
+
+void pmem_deep_flush(const void *addr, size_t len)
+{
+    pmem_flush(addr, len);
+}
+
+int pmem_deep_drain(const void *addr, size_t len)
+{
+    pmem_drain();
+    return 0;
+}
+
+int pmem_deep_persist(const void *addr, size_t len)
+{
+    pmem_persist(addr, len);
+    return 0;
+}
+
+static int use_nontemporal(size_t len, unsigned flags)
+{
+    if (flags & (PMEM_F_MEM_TEMPORAL | PMEM_F_MEM_WB)) {
+        return 0;
+    }
+    return (flags & (PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_WC)) || len >= PMEM_MOVNT_THRESHOLD;
+}
+
+// temporal stores followed by write-backs, fenced unless NODRAIN
+static void finish_temporal(void *pmemdest, size_t len, unsigned flags)
+{
+    if (flags & PMEM_F_MEM_NOFLUSH) {
+        return;
+    }
+    if (flags & PMEM_F_MEM_NODRAIN) {
+        pmem_flush(pmemdest, len);
+    } else {
+        pflush_range(pmemdest, len);
+    }
+}
+
+/* Non-temporal copies always drain: an extra fence is cheap next to the
+ * write latency of the data. */
+
+void *pmem_memmove(void *pmemdest, const void *src, size_t len, unsigned flags)
+{
+    if (!(flags & PMEM_F_MEM_NOFLUSH) && use_nontemporal(len, flags)) {
+        return pmemmove(pmemdest, src, len);
+    }
+    memmove(pmemdest, src, len);
+    finish_temporal(pmemdest, len, flags);
+    return pmemdest;
+}
+
+void *pmem_memcpy(void *pmemdest, const void *src, size_t len, unsigned flags)
+{
+    if (!(flags & PMEM_F_MEM_NOFLUSH) && use_nontemporal(len, flags)) {
+        return pmemcpy_nt(pmemdest, src, len);
+    }
+    memcpy(pmemdest, src, len);
+    finish_temporal(pmemdest, len, flags);
+    return pmemdest;
+}
+
+void *pmem_memset(void *pmemdest, int c, size_t len, unsigned flags)
+{
+    if (!(flags & PMEM_F_MEM_NOFLUSH) && use_nontemporal(len, flags)) {
+        return pmemset_nt(pmemdest, c, len);
+    }
+    memset(pmemdest, c, len);
+    finish_temporal(pmemdest, len, flags);
+    return pmemdest;
+}
+
+void *pmem_memmove_persist(void *pmemdest, const void *src, size_t len)
+{
+    return pmem_memmove(pmemdest, src, len, 0);
+}
+
+void *pmem_memcpy_persist(void *pmemdest, const void *src, size_t len)
+{
+    return pmem_memcpy(pmemdest, src, len, 0);
+}
+
+void *pmem_memset_persist(void *pmemdest, int c, size_t len)
+{
+    return pmem_memset(pmemdest, c, len, 0);
+}
+
+void *pmem_memmove_nodrain(void *pmemdest, const void *src, size_t len)
+{
+    return pmem_memmove(pmemdest, src, len, PMEM_F_MEM_NODRAIN);
+}
+
+void *pmem_memcpy_nodrain(void *pmemdest, const void *src, size_t len)
+{
+    return pmem_memcpy(pmemdest, src, len, PMEM_F_MEM_NODRAIN);
+}
+
+void *pmem_memset_nodrain(void *pmemdest, int c, size_t len)
+{
+    return pmem_memset(pmemdest, c, len, PMEM_F_MEM_NODRAIN);
+}
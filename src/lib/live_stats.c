@@ -0,0 +1,215 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cpu/cpu.h"
+#include "error.h"
+#include "live_stats.h"
+#include "model.h"
+#include "monotonic_timer.h"
+#include "topology.h"
+
+#define LIVE_STATS_DEFAULT_THREADS 256
+
+static struct {
+    int enabled;
+    char name[32];
+    live_stats_header_t* header;
+    live_stats_node_t* nodes;
+    live_stats_thread_t* threads;
+} live;
+
+int init_live_stats(config_t* cfg, virtual_topology_t* topology)
+{
+    int enabled = 0;
+    int max_threads;
+    int write_latency = 0;
+    size_t size;
+    void* addr;
+    int fd, i;
+
+    __cconfig_lookup_bool(cfg, "statistics.live", &enabled);
+    if (!enabled) {
+        return E_SUCCESS;
+    }
+    if (__cconfig_lookup_int(cfg, "statistics.live_threads", &max_threads) != CONFIG_TRUE || max_threads <= 0) {
+        max_threads = LIVE_STATS_DEFAULT_THREADS;
+    }
+    __cconfig_lookup_int(cfg, "latency.write", &write_latency);
+
+    size = sizeof(live_stats_header_t) + topology->num_virtual_nodes * sizeof(live_stats_node_t) +
+           max_threads * sizeof(live_stats_thread_t);
+    snprintf(live.name, sizeof(live.name), LIVE_STATS_NAME, getpid());
+    if ((fd = shm_open(live.name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        DBG_LOG(WARNING, "Cannot create shared memory segment %s, live statistics disabled\n", live.name);
+        return E_SUCCESS;
+    }
+    if (ftruncate(fd, size) < 0 ||
+        (addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        DBG_LOG(WARNING, "Cannot map shared memory segment %s, live statistics disabled\n", live.name);
+        close(fd);
+        shm_unlink(live.name);
+        return E_SUCCESS;
+    }
+    close(fd);
+
+    live.header = addr;
+    live.nodes = (live_stats_node_t*) (live.header + 1);
+    live.threads = (live_stats_thread_t*) (live.nodes + topology->num_virtual_nodes);
+    for (i = 0; i < topology->num_virtual_nodes; i++) {
+        live.nodes[i].node_id = i;
+        live.nodes[i].dram_node = topology->virtual_nodes[i].dram_node->node_id;
+        live.nodes[i].nvram_node = topology->virtual_nodes[i].nvram_node->node_id;
+    }
+
+    live.header->version = LIVE_STATS_VERSION;
+    live.header->header_size = sizeof(live_stats_header_t);
+    live.header->node_size = sizeof(live_stats_node_t);
+    live.header->thread_size = sizeof(live_stats_thread_t);
+    live.header->num_nodes = topology->num_virtual_nodes;
+    live.header->max_threads = max_threads;
+    live.header->cpu_speed_mhz = cpu_speed_mhz();
+    live.header->pid = getpid();
+    live.header->start_us = monotonic_time_us();
+    live.header->read_latency = latency_model.read_latency;
+    live.header->write_latency = write_latency;
+    // readers check the magic last
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    strncpy(live.header->magic, LIVE_STATS_MAGIC, sizeof(live.header->magic));
+
+    live.enabled = 1;
+    DBG_LOG(INFO, "Publishing live statistics in /dev/shm%s\n", live.name);
+    return E_SUCCESS;
+}
+
+void finalize_live_stats()
+{
+    if (!live.enabled) {
+        return;
+    }
+    // threads still running keep writing to the mapping, only drop the name
+    live.enabled = 0;
+    shm_unlink(live.name);
+}
+
+void live_stats_set_latency(int read_latency, int write_latency)
+{
+    if (!live.enabled) {
+        return;
+    }
+    __atomic_store_n(&live.header->read_latency, read_latency, __ATOMIC_RELAXED);
+    __atomic_store_n(&live.header->write_latency, write_latency, __ATOMIC_RELAXED);
+}
+
+static inline void slot_write_begin(live_stats_thread_t* slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void slot_write_end(live_stats_thread_t* slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+static live_stats_thread_t* claim_slot(uint32_t state)
+{
+    uint32_t expected;
+    uint32_t i;
+
+    for (i = 0; i < live.header->max_threads; i++) {
+        expected = state;
+        if (__atomic_compare_exchange_n(&live.threads[i].state, &expected, LIVE_THREAD_RUNNING, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return &live.threads[i];
+        }
+    }
+    return NULL;
+}
+
+live_stats_thread_t* live_stats_thread_start(pid_t tid, int cpu_id, int node_id)
+{
+    live_stats_thread_t* slot;
+
+    if (!live.enabled) {
+        return NULL;
+    }
+    // once all slots were used, the first exited slot in index order is reused
+    if ((slot = claim_slot(LIVE_THREAD_FREE)) == NULL && (slot = claim_slot(LIVE_THREAD_EXITED)) == NULL) {
+        DBG_LOG(WARNING, "No live statistics slot left for thread %d, raise statistics.live_threads\n", tid);
+        return NULL;
+    }
+
+    slot_write_begin(slot);
+    slot->tid = tid;
+    slot->cpu_id = cpu_id;
+    slot->node_id = node_id;
+    slot->register_us = monotonic_time_us();
+    slot->update_us = slot->register_us;
+    slot->epochs = 0;
+    slot->signal_epochs = 0;
+    slot->stall_cycles = 0;
+    slot->delay_cycles = 0;
+    slot->overhead_cycles = 0;
+    slot->achieved_latency_ns = 0;
+    slot_write_end(slot);
+
+    __atomic_fetch_add(&live.nodes[node_id].threads, 1, __ATOMIC_RELAXED);
+    return slot;
+}
+
+void live_stats_thread_stop(live_stats_thread_t* slot)
+{
+    if (slot == NULL) {
+        return;
+    }
+    __atomic_fetch_sub(&live.nodes[slot->node_id].threads, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state, LIVE_THREAD_EXITED, __ATOMIC_RELEASE);
+}
+
+void live_stats_epoch(live_stats_thread_t* slot, uint64_t stall_cycles, uint64_t delay_cycles,
+                      uint64_t overhead_cycles, int signaled, double achieved_latency_ns)
+{
+    live_stats_node_t* node = &live.nodes[slot->node_id];
+
+    slot_write_begin(slot);
+    slot->update_us = monotonic_time_us();
+    slot->epochs++;
+    slot->signal_epochs += signaled != 0;
+    slot->stall_cycles += stall_cycles;
+    slot->delay_cycles += delay_cycles;
+    slot->overhead_cycles = overhead_cycles;
+    slot->achieved_latency_ns = achieved_latency_ns;
+    slot_write_end(slot);
+
+    __atomic_fetch_add(&node->epochs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->stall_cycles, stall_cycles, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&node->delay_cycles, delay_cycles, __ATOMIC_RELAXED);
+}
+
+void live_stats_wpq(int node_id, uint64_t lines, uint64_t stall_ns)
+{
+    if (!live.enabled) {
+        return;
+    }
+    __atomic_fetch_add(&live.nodes[node_id].wpq_lines, lines, __ATOMIC_RELAXED);
+    if (stall_ns) {
+        __atomic_fetch_add(&live.nodes[node_id].wpq_stall_ns, stall_ns, __ATOMIC_RELAXED);
+    }
+}
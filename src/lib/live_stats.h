@@ -0,0 +1,61 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __LIVE_STATS_H
+#define __LIVE_STATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "config.h"
+#include "live_stats_format.h"
+
+/**
+ * \file
+ *
+ * Live statistics
+ *
+ * With statistics.live the emulator publishes its counters in a shared
+ * memory segment while the application runs, see live_stats_format.h.
+ * Threads update their slot at the end of every latency epoch, so the
+ * counters are available to src/tools/quartz-top during the run and
+ * after a crash. A normal exit removes the segment.
+ */
+
+struct virtual_topology_s;
+
+int init_live_stats(config_t* cfg, struct virtual_topology_s* topology);
+void finalize_live_stats();
+
+/**
+ * \brief Returns a slot for the calling thread, NULL if live statistics are
+ * off or all slots are taken by running threads
+ */
+live_stats_thread_t* live_stats_thread_start(pid_t tid, int cpu_id, int node_id);
+
+/**
+ * \brief Marks the slot of an exiting thread; it keeps its counters until a
+ * new thread needs the slot
+ */
+void live_stats_thread_stop(live_stats_thread_t* slot);
+
+void live_stats_epoch(live_stats_thread_t* slot, uint64_t stall_cycles, uint64_t delay_cycles,
+                      uint64_t overhead_cycles, int signaled, double achieved_latency_ns);
+
+void live_stats_wpq(int node_id, uint64_t lines, uint64_t stall_ns);
+
+/**
+ * \brief Publishes new target latencies set through the control socket
+ */
+void live_stats_set_latency(int read_latency, int write_latency);
+
+#endif /* __LIVE_STATS_H */
@@ -0,0 +1,90 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __LIVE_STATS_FORMAT_H
+#define __LIVE_STATS_FORMAT_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Live statistics segment layout
+ *
+ * The POSIX shared memory object /quartz.<pid> (/dev/shm/quartz.<pid>)
+ * holds a header, num_nodes node slots and then max_threads thread slots.
+ * Readers locate the slots with the sizes in the header, so fields can be
+ * appended to the slots without a new version.
+ *
+ * A thread slot has one writer, its thread, which makes seq odd, updates
+ * the counters and makes seq even again. A reader copies the slot and
+ * retries while seq was odd or changed during the copy. Node slots are
+ * written by all the threads of the node with atomic adds and each counter
+ * is read on its own. Times are CLOCK_MONOTONIC microseconds.
+ */
+
+#define LIVE_STATS_MAGIC "QZLIVE"
+#define LIVE_STATS_VERSION 1
+#define LIVE_STATS_NAME "/quartz.%d"
+
+typedef enum {
+    LIVE_THREAD_FREE = 0,
+    LIVE_THREAD_RUNNING,
+    LIVE_THREAD_EXITED
+} live_thread_state_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t node_size;
+    uint32_t thread_size;
+    uint32_t num_nodes;
+    uint32_t max_threads;
+    uint32_t cpu_speed_mhz;  // converts cycles to time
+    int32_t pid;
+    uint64_t start_us;       // when the emulator initialized
+    uint32_t read_latency;   // target NVM latencies in ns
+    uint32_t write_latency;
+} live_stats_header_t;
+
+typedef struct {
+    uint32_t node_id;
+    int32_t dram_node;       // physical nodes
+    int32_t nvram_node;
+    uint32_t threads;        // running
+    uint64_t epochs;
+    uint64_t stall_cycles;
+    uint64_t delay_cycles;
+    uint64_t wpq_lines;      // write-backs through the write pending queue
+    uint64_t wpq_stall_ns;
+} live_stats_node_t;
+
+typedef struct live_stats_thread_s {
+    uint32_t seq;
+    uint32_t state;
+    int32_t tid;
+    int32_t cpu_id;
+    uint32_t node_id;
+    uint32_t pad;
+    uint64_t register_us;
+    uint64_t update_us;      // end of the last epoch
+    uint64_t epochs;
+    uint64_t signal_epochs;  // closed by the monitor thread
+    uint64_t stall_cycles;
+    uint64_t delay_cycles;   // injected
+    uint64_t overhead_cycles; // not amortized yet, the current value
+    double achieved_latency_ns; // NVM read latency, moving average over epochs
+} live_stats_thread_t;
+
+#endif /* __LIVE_STATS_FORMAT_H */
@@ -0,0 +1,447 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/errno.h>
+#include "error.h"
+#include "malloc_policy.h"
+#include "model.h"
+#include "pmalloc.h"
+#include "thread.h"
+
+// WARNING: everything below may run inside malloc. Allocations made while
+// in_policy is set go to the C library, so code reachable from here may
+// allocate, but it must not hold locks the allocator takes.
+
+// the C library allocator, which glibc exports under these names
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+#define MAX_CALLSITES 64
+#define CALLSITE_CACHE_SIZE 4096 // power of two
+#define CALLSITE_CACHE_PROBES 16
+
+enum {
+    PLACE_DRAM = 0,
+    PLACE_NVM
+};
+
+static const char* policy_names[MALLOC_POLICY_COUNT] = {
+    "none", "all", "size", "callsite", "ratio"
+};
+
+static struct {
+    malloc_policy_t policy;
+    size_t size_threshold;
+    uint32_t callsites[MAX_CALLSITES];
+    int num_callsites;
+    uint64_t dram_ratio;
+    uint64_t nvm_ratio;
+    uint64_t bytes[2];   // indexed by PLACE_DRAM/PLACE_NVM
+    uint64_t allocs[2];
+} mp;
+
+// entries are (caller << 1) | placement, 0 if free
+static uint64_t callsite_cache[CALLSITE_CACHE_SIZE];
+
+static __thread int in_policy;
+
+static inline int bypass()
+{
+    return mp.policy == MALLOC_POLICY_NONE || in_policy || thread_self() == NULL;
+}
+
+static inline void account(int place, size_t size)
+{
+    __atomic_fetch_add(&mp.bytes[place], size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp.allocs[place], 1, __ATOMIC_RELAXED);
+}
+
+// FNV-1a of the object name and the offset of the call site in it, which
+// unlike the address does not change between runs
+static uint32_t callsite_hash(void* caller, const char** name, uintptr_t* offset)
+{
+    Dl_info info;
+    uint32_t hash = 2166136261u;
+    const char* c;
+    int i;
+
+    *name = "?";
+    *offset = (uintptr_t) caller;
+    if (dladdr(caller, &info) && info.dli_fname) {
+        *name = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+        *offset = (uintptr_t) caller - (uintptr_t) info.dli_fbase;
+    }
+    for (c = *name; *c; c++) {
+        hash = (hash ^ (uint8_t) *c) * 16777619u;
+    }
+    for (i = 0; i < 8; i++) {
+        hash = (hash ^ (uint8_t) (*offset >> (8 * i))) * 16777619u;
+    }
+    return hash;
+}
+
+static int place_callsite(void* caller)
+{
+    uint64_t key = (uint64_t) (uintptr_t) caller;
+    uint64_t entry, expected;
+    unsigned int slot = (unsigned int) ((key >> 2) * 2654435761u) & (CALLSITE_CACHE_SIZE - 1);
+    const char* name;
+    uintptr_t offset;
+    uint32_t hash;
+    int i, place = PLACE_DRAM;
+
+    for (i = 0; i < CALLSITE_CACHE_PROBES; i++) {
+        entry = __atomic_load_n(&callsite_cache[(slot + i) & (CALLSITE_CACHE_SIZE - 1)], __ATOMIC_ACQUIRE);
+        if (entry == 0) {
+            break;
+        }
+        if (entry >> 1 == key) {
+            return entry & 1;
+        }
+    }
+
+    hash = callsite_hash(caller, &name, &offset);
+    for (i = 0; i < mp.num_callsites; i++) {
+        if (mp.callsites[i] == hash) {
+            place = PLACE_NVM;
+            break;
+        }
+    }
+    DBG_LOG(INFO, "malloc call site %s+0x%lx: hash 0x%08x, %s\n", name, offset, hash, place == PLACE_NVM ? "NVM" : "DRAM");
+
+    for (i = 0; i < CALLSITE_CACHE_PROBES; i++) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&callsite_cache[(slot + i) & (CALLSITE_CACHE_SIZE - 1)], &expected,
+                                        (key << 1) | place, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+            expected >> 1 == key)
+        {
+            break;
+        }
+    }
+    return place;
+}
+
+static int place(size_t size, void* caller)
+{
+    uint64_t dram, nvm;
+
+    switch (mp.policy) {
+        case MALLOC_POLICY_ALL:
+            return PLACE_NVM;
+        case MALLOC_POLICY_SIZE:
+            return size >= mp.size_threshold ? PLACE_NVM : PLACE_DRAM;
+        case MALLOC_POLICY_CALLSITE:
+            return place_callsite(caller);
+        case MALLOC_POLICY_RATIO:
+            // keep the NVM share of the bytes placed at nvm/(dram+nvm)
+            dram = __atomic_load_n(&mp.bytes[PLACE_DRAM], __ATOMIC_RELAXED);
+            nvm = __atomic_load_n(&mp.bytes[PLACE_NVM], __ATOMIC_RELAXED);
+            return nvm * mp.dram_ratio <= dram * mp.nvm_ratio ? PLACE_NVM : PLACE_DRAM;
+        default:
+            return PLACE_DRAM;
+    }
+}
+
+// returns NULL if the allocation should be served by the C library
+static void* policy_alloc(size_t size, size_t alignment, void* caller)
+{
+    void* ptr = NULL;
+
+    in_policy = 1;
+    if (place(size, caller) == PLACE_NVM) {
+        ptr = alignment ? pmalloc_aligned(alignment, size) : pmalloc(size);
+    }
+    in_policy = 0;
+    account(ptr ? PLACE_NVM : PLACE_DRAM, size);
+    return ptr;
+}
+
+void* malloc(size_t size)
+{
+    void* ptr;
+
+    if (bypass() || (ptr = policy_alloc(size, 0, __builtin_return_address(0))) == NULL) {
+        return __libc_malloc(size);
+    }
+    return ptr;
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    void* ptr;
+
+    if (bypass() || __builtin_mul_overflow(nmemb, size, &total) ||
+        (ptr = policy_alloc(total, 0, __builtin_return_address(0))) == NULL)
+    {
+        return __libc_calloc(nmemb, size);
+    }
+    // arena memory may be recycled
+    memset(ptr, 0, total);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    void* new_ptr;
+
+    if (ptr == NULL) {
+        if (bypass() || (new_ptr = policy_alloc(size, 0, __builtin_return_address(0))) == NULL) {
+            return __libc_malloc(size);
+        }
+        return new_ptr;
+    }
+    if (mp.policy == MALLOC_POLICY_NONE || !pmalloc_owns(ptr)) {
+        return __libc_realloc(ptr, size);
+    }
+    if (size == 0) {
+        pfree(ptr);
+        return NULL;
+    }
+    // blocks stay where they were placed
+    in_policy = 1;
+    new_ptr = prealloc(ptr, 0, size);
+    in_policy = 0;
+    return new_ptr;
+}
+
+void free(void* ptr)
+{
+    if (mp.policy != MALLOC_POLICY_NONE && pmalloc_owns(ptr)) {
+        pfree(ptr);
+        return;
+    }
+    __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    void* ptr;
+
+    if (bypass() || (ptr = policy_alloc(size, alignment, __builtin_return_address(0))) == NULL) {
+        return __libc_memalign(alignment, size);
+    }
+    return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    void* ptr;
+
+    if (bypass() || (ptr = policy_alloc(size, alignment, __builtin_return_address(0))) == NULL) {
+        return __libc_memalign(alignment, size);
+    }
+    return ptr;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    void* ptr;
+
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)) || alignment == 0) {
+        return EINVAL;
+    }
+    if (bypass() || (ptr = policy_alloc(size, alignment, __builtin_return_address(0))) == NULL) {
+        ptr = __libc_memalign(alignment, size);
+    }
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+size_t malloc_usable_size(void* ptr)
+{
+    static size_t (*__lib_malloc_usable_size)(void*);
+
+    if (mp.policy != MALLOC_POLICY_NONE && pmalloc_owns(ptr)) {
+        return pmalloc_usable_size(ptr);
+    }
+    if (__lib_malloc_usable_size == NULL) {
+        __lib_malloc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    }
+    return __lib_malloc_usable_size(ptr);
+}
+
+// C++ operator new. Interposed directly because inside malloc the return
+// address would point into libstdc++'s operator new for every C++ call site.
+// Allocations left to DRAM go to the next definition, which keeps the
+// new_handler and std::bad_alloc behavior. operator delete ends up in free().
+
+typedef void* (*new_fn_t)(size_t);
+typedef void* (*new_nothrow_fn_t)(size_t, const void*);
+typedef void* (*new_aligned_fn_t)(size_t, size_t);
+typedef void* (*new_aligned_nothrow_fn_t)(size_t, size_t, const void*);
+
+static void* next_new(void** fn, const char* name)
+{
+    if (*fn == NULL) {
+        *fn = dlsym(RTLD_NEXT, name);
+    }
+    return *fn;
+}
+
+#define DEFINE_NEW(name)                                                        \
+void* name(size_t size)                                                         \
+{                                                                               \
+    static void* __lib_new;                                                     \
+    new_fn_t fn;                                                                \
+    void* ptr;                                                                  \
+                                                                                \
+    if (!bypass() && (ptr = policy_alloc(size, 0, __builtin_return_address(0)))) { \
+        return ptr;                                                             \
+    }                                                                           \
+    if ((fn = (new_fn_t) next_new(&__lib_new, #name)) == NULL) {                \
+        return __libc_malloc(size);                                             \
+    }                                                                           \
+    return fn(size);                                                            \
+}
+
+#define DEFINE_NEW_NOTHROW(name)                                                \
+void* name(size_t size, const void* tag)                                        \
+{                                                                               \
+    static void* __lib_new;                                                     \
+    new_nothrow_fn_t fn;                                                        \
+    void* ptr;                                                                  \
+                                                                                \
+    if (!bypass() && (ptr = policy_alloc(size, 0, __builtin_return_address(0)))) { \
+        return ptr;                                                             \
+    }                                                                           \
+    if ((fn = (new_nothrow_fn_t) next_new(&__lib_new, #name)) == NULL) {        \
+        return __libc_malloc(size);                                             \
+    }                                                                           \
+    return fn(size, tag);                                                       \
+}
+
+#define DEFINE_NEW_ALIGNED(name)                                                \
+void* name(size_t size, size_t alignment)                                       \
+{                                                                               \
+    static void* __lib_new;                                                     \
+    new_aligned_fn_t fn;                                                        \
+    void* ptr;                                                                  \
+                                                                                \
+    if (!bypass() && (ptr = policy_alloc(size, alignment, __builtin_return_address(0)))) { \
+        return ptr;                                                             \
+    }                                                                           \
+    if ((fn = (new_aligned_fn_t) next_new(&__lib_new, #name)) == NULL) {        \
+        return __libc_memalign(alignment, size);                                \
+    }                                                                           \
+    return fn(size, alignment);                                                 \
+}
+
+#define DEFINE_NEW_ALIGNED_NOTHROW(name)                                        \
+void* name(size_t size, size_t alignment, const void* tag)                      \
+{                                                                               \
+    static void* __lib_new;                                                     \
+    new_aligned_nothrow_fn_t fn;                                                \
+    void* ptr;                                                                  \
+                                                                                \
+    if (!bypass() && (ptr = policy_alloc(size, alignment, __builtin_return_address(0)))) { \
+        return ptr;                                                             \
+    }                                                                           \
+    if ((fn = (new_aligned_nothrow_fn_t) next_new(&__lib_new, #name)) == NULL) { \
+        return __libc_memalign(alignment, size);                                \
+    }                                                                           \
+    return fn(size, alignment, tag);                                            \
+}
+
+// std::align_val_t is passed as a size_t and std::nothrow_t by reference
+DEFINE_NEW(_Znwm)                                          // new(size_t)
+DEFINE_NEW(_Znam)                                          // new[](size_t)
+DEFINE_NEW_NOTHROW(_ZnwmRKSt9nothrow_t)                    // new(size_t, nothrow_t)
+DEFINE_NEW_NOTHROW(_ZnamRKSt9nothrow_t)                    // new[](size_t, nothrow_t)
+DEFINE_NEW_ALIGNED(_ZnwmSt11align_val_t)                   // new(size_t, align_val_t)
+DEFINE_NEW_ALIGNED(_ZnamSt11align_val_t)                   // new[](size_t, align_val_t)
+DEFINE_NEW_ALIGNED_NOTHROW(_ZnwmSt11align_val_tRKSt9nothrow_t) // new(size_t, align_val_t, nothrow_t)
+DEFINE_NEW_ALIGNED_NOTHROW(_ZnamSt11align_val_tRKSt9nothrow_t) // new[](size_t, align_val_t, nothrow_t)
+
+static int parse_policy(const char* str, malloc_policy_t* policy)
+{
+    int p;
+
+    for (p = 0; p < MALLOC_POLICY_COUNT; p++) {
+        if (strcmp(str, policy_names[p]) == 0) {
+            *policy = p;
+            return E_SUCCESS;
+        }
+    }
+    return E_INVAL;
+}
+
+int init_malloc_policy(config_t* cfg)
+{
+    malloc_policy_t policy = MALLOC_POLICY_NONE;
+    char* str;
+    char* end;
+    int val;
+
+    if (__cconfig_lookup_string(cfg, "malloc.policy", &str) == CONFIG_TRUE &&
+        parse_policy(str, &policy) != E_SUCCESS)
+    {
+        DBG_LOG(WARNING, "Unknown malloc.policy '%s', malloc interposition disabled\n", str);
+        return E_SUCCESS;
+    }
+    if (policy == MALLOC_POLICY_NONE) {
+        return E_SUCCESS;
+    }
+    if (!latency_model.enabled) {
+        // placement follows the virtual node of registered threads
+        DBG_LOG(WARNING, "malloc.policy requires the latency emulation, malloc interposition disabled\n");
+        return E_SUCCESS;
+    }
+
+    mp.size_threshold = 4096;
+    if (__cconfig_lookup_int(cfg, "malloc.size_threshold", &val) == CONFIG_TRUE && val >= 0) {
+        mp.size_threshold = val;
+    }
+    mp.dram_ratio = mp.nvm_ratio = 1;
+    if (__cconfig_lookup_int(cfg, "malloc.dram_ratio", &val) == CONFIG_TRUE && val >= 0) {
+        mp.dram_ratio = val;
+    }
+    if (__cconfig_lookup_int(cfg, "malloc.nvm_ratio", &val) == CONFIG_TRUE && val >= 0) {
+        mp.nvm_ratio = val;
+    }
+    if (__cconfig_lookup_string(cfg, "malloc.callsites", &str) == CONFIG_TRUE) {
+        while (*str && mp.num_callsites < MAX_CALLSITES) {
+            mp.callsites[mp.num_callsites] = (uint32_t) strtoul(str, &end, 0);
+            if (end == str) {
+                break;
+            }
+            mp.num_callsites++;
+            str = end + strspn(end, ", ");
+        }
+    }
+
+    DBG_LOG(INFO, "Placing allocations on NVM with the %s policy\n", policy_names[policy]);
+    __atomic_store_n(&mp.policy, policy, __ATOMIC_RELEASE);
+    return E_SUCCESS;
+}
+
+void malloc_policy_report(FILE* out)
+{
+    if (mp.policy == MALLOC_POLICY_NONE) {
+        return;
+    }
+    fprintf(out, "\n== Allocation placement (%s policy) ==\n", policy_names[mp.policy]);
+    fprintf(out, "NVM: %lu bytes in %lu allocations\n", mp.bytes[PLACE_NVM], mp.allocs[PLACE_NVM]);
+    fprintf(out, "DRAM: %lu bytes in %lu allocations\n", mp.bytes[PLACE_DRAM], mp.allocs[PLACE_DRAM]);
+}
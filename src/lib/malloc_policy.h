@@ -0,0 +1,44 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __MALLOC_POLICY_H
+#define __MALLOC_POLICY_H
+
+#include <stdio.h>
+#include "config.h"
+
+/**
+ * \file
+ *
+ * \page malloc_policy Transparent NVM placement
+ *
+ * The emulator interposes on malloc(), calloc(), realloc(), free(), the
+ * aligned allocation functions and the C++ operator new variants, so that
+ * unmodified applications can place part of their heap on NVM. A
+ * placement policy decides which allocations go to the pmalloc() arena of
+ * the calling thread's NVM node; the others are served by the C library.
+ */
+
+typedef enum {
+    MALLOC_POLICY_NONE = 0,  // interposition off, everything stays in DRAM
+    MALLOC_POLICY_ALL,       // every allocation goes to NVM
+    MALLOC_POLICY_SIZE,      // allocations of at least size_threshold bytes
+    MALLOC_POLICY_CALLSITE,  // allocations made from allowlisted call sites
+    MALLOC_POLICY_RATIO,     // NVM gets nvm_ratio bytes for every dram_ratio bytes in DRAM
+    MALLOC_POLICY_COUNT
+} malloc_policy_t;
+
+int init_malloc_policy(config_t* cfg);
+void malloc_policy_report(FILE* out);
+
+#endif /* __MALLOC_POLICY_H */
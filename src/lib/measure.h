@@ -20,6 +20,57 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  * Memory latency and bandwidth measurements
  */
 
+#include <stddef.h>
+#include "cpu/cpu.h"
+
+typedef enum {
+    BW_KERNEL_READ = 0,
+    BW_KERNEL_WRITE,
+    BW_KERNEL_WRITE_NT,
+    BW_KERNEL_COPY,
+    BW_KERNEL_MIX,      // reads and non-temporal writes mixed by read_ratio
+    BW_KERNEL_COUNT
+} bw_kernel_t;
+
+typedef struct {
+    bw_kernel_t kernel;
+    int read_ratio;     // percentage of the traffic that is read (BW_KERNEL_MIX only)
+    int nthreads;       // 0 means one thread per processor of the cpu node
+    size_t bytes;       // total buffer size shared out among threads, 0 for default
+    int samples;        // maximum number of samples
+    int min_samples;    // samples taken before checking ci_rel
+    double ci_rel;      // stop sampling once the 95% confidence interval half-width
+                        // falls below this fraction of the mean, 0 to take all samples
+    const char* isa;    // force a kernel flavor ("sse", "avx2", "avx512"), NULL for the widest
+} bw_params_t;
+
+typedef struct {
+    double best;        // MB/s of the fastest sample
+    double mean;        // MB/s averaged over all samples
+    double stddev;
+    double ci_rel;      // 95% confidence interval half-width relative to the mean
+    int samples;
+    int nthreads;
+    const char* isa;    // kernel flavor actually used
+} bw_result_t;
+
+/**
+ * \brief Fill bandwidth measurement parameters with defaults for a kernel
+ */
+void bw_params_init(bw_params_t* params, bw_kernel_t kernel);
+
+const char* bw_kernel_name(bw_kernel_t kernel);
+
+/**
+ * \brief Measure memory bandwidth
+ *
+ * Measures the bandwidth from the processors of a local socket (cpu_node)
+ * to the memory of a possibly remote socket (mem_node). A thread is pinned
+ * on each processor of cpu_node and streams over a private buffer allocated
+ * on mem_node, using the widest vector kernel the processor supports.
+ */
+int measure_bw(int cpu_node, int mem_node, const bw_params_t* params, bw_result_t* result);
+
 /**
  * \brief Measure memory read bandwidth
  *
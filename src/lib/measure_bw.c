@@ -1,5 +1,5 @@
 /***************************************************************************
-Copyright 2016 Hewlett Packard Enterprise Development LP.  
+Copyright 2016 Hewlett Packard Enterprise Development LP.
 This program is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
 the Free Software Foundation; either version 2 of the License, or (at
@@ -11,349 +11,553 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
-
-
-// 2 BW measuring algorithms: one based on SSE4 instructions and the second based on 
-// stream benchmark Copy kernel.
-
-
-//#define SSE4_VERSION
-
-#ifdef SSE4_VERSION
-
-#include <math.h>
-#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <pthread.h>
-#include <string.h>
 #include <numa.h>
-#include "monotonic_timer.h"
+#include <immintrin.h>
+#include "cpu/cpu.h"
+#include "error.h"
 #include "interpose.h"
+#include "measure.h"
+#include "monotonic_timer.h"
 
-
-
-#ifdef __SSE4_1__
-#include <smmintrin.h>
+/**
+ * \file
+ *
+ * Memory bandwidth measurements
+ *
+ * Bandwidth is measured by a team of threads, by default one per processor
+ * of the cpu node. Each thread allocates a private buffer on the memory node
+ * and touches it from its own processor before timing starts, so threads
+ * never share pages. The streaming kernels come in SSE, AVX2 and AVX-512
+ * flavors and the widest one supported by the processor is used, as
+ * narrow loads cannot keep enough requests in flight to saturate the
+ * memory channels of a socket.
+ */
+
+#ifndef __SSE4_1__
+# error "No compiler support for SSE instructions"
 #endif
 
-#define BYTES_PER_GB (1024*1024*1024LL)
-#define BYTES_PER_MB (1024*1024LL)
+#define BYTES_PER_MB (1000*1000LL)
+#define BW_DEFAULT_BYTES (1024*1024*1024LL)
+#define BW_DEFAULT_SAMPLES 5
+#define BW_MIN_BYTES_PER_THREAD (4*1024*1024LL)
+#define BW_MIX_CHUNK (64*1024)
+
+typedef void (*bw_kernel_fn_t)(char* dst, const char* src, size_t bytes);
+
+typedef struct {
+    const char* isa;
+    cpu_feature_t feature;
+    bw_kernel_fn_t read;
+    bw_kernel_fn_t write;
+    bw_kernel_fn_t write_nt;
+    bw_kernel_fn_t copy;
+} bw_kernel_set_t;
+
+// keeps the compiler from optimizing the read kernels away
+static volatile int bw_sink;
+
+static const char* bw_kernel_names[] = {
+    "read",
+    "write",
+    "write_nt",
+    "copy",
+    "mix"
+};
+
+/*
+ * SSE kernels
+ */
+
+static void read_sse(char* dst, const char* src, size_t bytes)
+{
+    const __m128i* v = (const __m128i*) src;
+    __m128i a0 = _mm_setzero_si128(), a1 = a0, a2 = a0, a3 = a0;
+    size_t i;
 
-// flag for terminating current test
-int g_done;
+    for (i = 0; i < bytes / sizeof(__m128i); i += 4) {
+        a0 = _mm_add_epi32(a0, _mm_load_si128(&v[i]));
+        a1 = _mm_add_epi32(a1, _mm_load_si128(&v[i+1]));
+        a2 = _mm_add_epi32(a2, _mm_load_si128(&v[i+2]));
+        a3 = _mm_add_epi32(a3, _mm_load_si128(&v[i+3]));
+    }
+    a0 = _mm_add_epi32(_mm_add_epi32(a0, a1), _mm_add_epi32(a2, a3));
+    bw_sink += _mm_cvtsi128_si32(a0);
+}
 
-// global current number of threads
-int g_nthreads = 0;
+static void write_sse(char* dst, const char* src, size_t bytes)
+{
+    __m128i* v = (__m128i*) dst;
+    __m128i val = _mm_set1_epi32(1);
+    size_t i;
 
-// synchronization barrier for current thread counter
-pthread_barrier_t g_barrier;
+    for (i = 0; i < bytes / sizeof(__m128i); i++) {
+        _mm_store_si128(&v[i], val);
+    }
+}
 
-// thread shared parameters for test function
-void* g_array;
-size_t g_thrsize;
-int g_times;
-void (*g_func)(void*, size_t);
+static void write_nt_sse(char* dst, const char* src, size_t bytes)
+{
+    __m128i* v = (__m128i*) dst;
+    __m128i val = _mm_set1_epi32(1);
+    size_t i;
 
-// Compute bandwidth in MB/s.
-static inline double to_bw(size_t bytes, double secs) {
-  double size_bytes = (double) bytes;
-  double size_mb = size_bytes / ((double) BYTES_PER_MB);
-  return size_mb / secs;
+    for (i = 0; i < bytes / sizeof(__m128i); i++) {
+        _mm_stream_si128(&v[i], val);
+    }
+    _mm_sfence();
 }
 
-void* thread_worker(void* arg)
+static void copy_sse(char* dst, const char* src, size_t bytes)
 {
-    int j;
-    unsigned int thread_num = (uintptr_t) arg;
+    __m128i* d = (__m128i*) dst;
+    const __m128i* s = (const __m128i*) src;
+    size_t i;
 
-    while (1)
-    {
-        // *** Barrier ****
-        pthread_barrier_wait(&g_barrier);
+    for (i = 0; i < bytes / sizeof(__m128i); i++) {
+        _mm_store_si128(&d[i], _mm_load_si128(&s[i]));
+    }
+}
 
-        if (g_done) break;
+/*
+ * AVX2 kernels
+ */
 
-        for (j = 0; j < g_times; j++) {
-            g_func(&((char*) g_array)[g_thrsize * thread_num], g_thrsize);
-        }
+__attribute__((target("avx2")))
+static void read_avx2(char* dst, const char* src, size_t bytes)
+{
+    const __m256i* v = (const __m256i*) src;
+    __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;
+    size_t i;
 
-        // *** Barrier ****
-        pthread_barrier_wait(&g_barrier);
+    for (i = 0; i < bytes / sizeof(__m256i); i += 4) {
+        a0 = _mm256_add_epi32(a0, _mm256_load_si256(&v[i]));
+        a1 = _mm256_add_epi32(a1, _mm256_load_si256(&v[i+1]));
+        a2 = _mm256_add_epi32(a2, _mm256_load_si256(&v[i+2]));
+        a3 = _mm256_add_epi32(a3, _mm256_load_si256(&v[i+3]));
     }
-
-    return NULL;
+    a0 = _mm256_add_epi32(_mm256_add_epi32(a0, a1), _mm256_add_epi32(a2, a3));
+    bw_sink += _mm256_extract_epi32(a0, 0);
 }
 
+__attribute__((target("avx2")))
+static void write_avx2(char* dst, const char* src, size_t bytes)
+{
+    __m256i* v = (__m256i*) dst;
+    __m256i val = _mm256_set1_epi32(1);
+    size_t i;
 
-int timeitp(void (*function)(void*, size_t), int nthreads, void* array, size_t size, int samples, int times) {
-    double min = INFINITY;
-    double runtime;
-    size_t i, j, p;
-    int thread_num;
-
-    // globally set test function and thread number
-    g_func = function;
-    g_nthreads = nthreads;
-    g_array = array;
-    g_thrsize = size / nthreads;
-    g_times = times;
+    for (i = 0; i < bytes / sizeof(__m256i); i++) {
+        _mm256_store_si256(&v[i], val);
+    }
+}
 
-    // create barrier and run threads
-    pthread_barrier_init(&g_barrier, NULL, nthreads);
+__attribute__((target("avx2")))
+static void write_nt_avx2(char* dst, const char* src, size_t bytes)
+{
+    __m256i* v = (__m256i*) dst;
+    __m256i val = _mm256_set1_epi32(1);
+    size_t i;
 
-    pthread_t thr[nthreads];
-    //__lib_pthread_create(&thr[0], NULL, thread_master, new int(0));
-    for (p = 1; p < nthreads; ++p) {
-    	assert(__lib_pthread_create);
-        __lib_pthread_create(&thr[p], NULL, thread_worker, (void *) p);
+    for (i = 0; i < bytes / sizeof(__m256i); i++) {
+        _mm256_stream_si256(&v[i], val);
     }
+    _mm_sfence();
+}
 
-    // use current thread as master thread;
-    g_done = 0;
-    thread_num = 0;
-    for (i = 0; i < samples; i++) 
-    {
-        pthread_barrier_wait(&g_barrier);
-
-        assert(!g_done);
+__attribute__((target("avx2")))
+static void copy_avx2(char* dst, const char* src, size_t bytes)
+{
+    __m256i* d = (__m256i*) dst;
+    const __m256i* s = (const __m256i*) src;
+    size_t i;
 
-        double ts1 = monotonic_time();
+    for (i = 0; i < bytes / sizeof(__m256i); i++) {
+        _mm256_store_si256(&d[i], _mm256_load_si256(&s[i]));
+    }
+}
 
-        for (j = 0; j < times; j++) {
-            g_func(&((char*)g_array)[g_thrsize * thread_num], g_thrsize);
-        }
+/*
+ * AVX-512 kernels
+ */
 
-        pthread_barrier_wait(&g_barrier);
-        double ts2 = monotonic_time();
+__attribute__((target("avx512f")))
+static void read_avx512(char* dst, const char* src, size_t bytes)
+{
+    const __m512i* v = (const __m512i*) src;
+    __m512i a0 = _mm512_setzero_si512(), a1 = a0, a2 = a0, a3 = a0;
+    size_t i;
 
-        runtime = ts2 - ts1;
-        if (runtime < min) {
-            min = runtime;
-        }
+    for (i = 0; i < bytes / sizeof(__m512i); i += 4) {
+        a0 = _mm512_add_epi32(a0, _mm512_load_si512(&v[i]));
+        a1 = _mm512_add_epi32(a1, _mm512_load_si512(&v[i+1]));
+        a2 = _mm512_add_epi32(a2, _mm512_load_si512(&v[i+2]));
+        a3 = _mm512_add_epi32(a3, _mm512_load_si512(&v[i+3]));
     }
-    g_done = 1;
+    a0 = _mm512_add_epi32(_mm512_add_epi32(a0, a1), _mm512_add_epi32(a2, a3));
+    bw_sink += _mm512_reduce_add_epi32(a0);
+}
 
-    pthread_barrier_wait(&g_barrier);
+__attribute__((target("avx512f")))
+static void write_avx512(char* dst, const char* src, size_t bytes)
+{
+    __m512i* v = (__m512i*) dst;
+    __m512i val = _mm512_set1_epi32(1);
+    size_t i;
 
-    for (p = 1; p < nthreads; ++p) {
-        pthread_join(thr[p], NULL);
+    for (i = 0; i < bytes / sizeof(__m512i); i++) {
+        _mm512_store_si512(&v[i], val);
     }
+}
 
-    pthread_barrier_destroy(&g_barrier);
+__attribute__((target("avx512f")))
+static void write_nt_avx512(char* dst, const char* src, size_t bytes)
+{
+    __m512i* v = (__m512i*) dst;
+    __m512i val = _mm512_set1_epi32(1);
+    size_t i;
 
-    return to_bw(size * times, min);
+    for (i = 0; i < bytes / sizeof(__m512i); i++) {
+        _mm512_stream_si512(&v[i], val);
+    }
+    _mm_sfence();
 }
 
-
-int timeit(void (*function)(void*, size_t), void* array, size_t size, int samples, int times) {
-    double min = INFINITY;
+__attribute__((target("avx512f")))
+static void copy_avx512(char* dst, const char* src, size_t bytes)
+{
+    __m512i* d = (__m512i*) dst;
+    const __m512i* s = (const __m512i*) src;
     size_t i;
 
-    // force allocation of physical pages
-    memset(array, 0xff, size);
+    for (i = 0; i < bytes / sizeof(__m512i); i++) {
+        _mm512_store_si512(&d[i], _mm512_load_si512(&s[i]));
+    }
+}
+
+// ordered from the widest to the narrowest
+static const bw_kernel_set_t bw_kernel_sets[] = {
+    {"avx512", CPU_FEATURE_AVX512F, read_avx512, write_avx512, write_nt_avx512, copy_avx512},
+    {"avx2", CPU_FEATURE_AVX2, read_avx2, write_avx2, write_nt_avx2, copy_avx2},
+    {"sse", CPU_FEATURE_SSE4_1, read_sse, write_sse, write_nt_sse, copy_sse},
+    {NULL, 0, NULL, NULL, NULL, NULL}
+};
 
-    for (i = 0; i < samples; i++) {
-        double before, after, total;
+static const bw_kernel_set_t* select_kernel_set(const char* isa)
+{
+    const bw_kernel_set_t* set;
 
-        before = monotonic_time();
-        int j;
-        for (j = 0; j < times; j++) {
-            function(array, size);
+    for (set = bw_kernel_sets; set->isa; set++) {
+        if (isa && strcmp(isa, set->isa) != 0) {
+            continue;
         }
-        after = monotonic_time();
-
-        total = after - before;
-        if (total < min) {
-            min = total;
+        if (cpu_has_feature(set->feature)) {
+            return set;
         }
     }
-
-    return to_bw(size * times, min);
+    return NULL;
 }
 
+// two-sided 95% Student t quantiles by degrees of freedom
+static const double t95[] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228
+};
 
-#ifdef __SSE4_1__
-void write_memory_nontemporal_sse(void* array, size_t size) {
-  __m128i* varray = (__m128i*) array;
+static double ci95_rel(int n, double sum, double sum2)
+{
+    double mean, var, t;
 
-  __m128i vals = _mm_set1_epi32(1);
-  size_t i;
-  for (i = 0; i < size / sizeof(__m128i); i++) {
-    _mm_stream_si128(&varray[i], vals);
-    vals = _mm_add_epi16(vals, vals);
-  }
+    if (n < 2) {
+        return INFINITY;
+    }
+    mean = sum / n;
+    var = fmax(0.0, (sum2 - sum * sum / n) / (n - 1));
+    t = n - 1 < (int) (sizeof(t95)/sizeof(t95[0])) ? t95[n-1] : 1.96;
+    return t * sqrt(var / n) / mean;
 }
 
-void write_memory_sse(void* array, size_t size) {
-  __m128i* varray = (__m128i*) array;
-
-  __m128i vals = _mm_set1_epi32(1);
-  size_t i;
-  for (i = 0; i < size / sizeof(__m128i); i++) {
-    _mm_store_si128(&varray[i], vals);
-    vals = _mm_add_epi16(vals, vals);
-  }
+const char* bw_kernel_name(bw_kernel_t kernel)
+{
+    if (kernel < 0 || kernel >= BW_KERNEL_COUNT) {
+        return "unknown";
+    }
+    return bw_kernel_names[kernel];
 }
 
-void read_memory_sse(void* array, size_t size) {
-  __m128i* varray = (__m128i*) array;
-  __m128i accum = _mm_set1_epi32(0xDEADBEEF);
-  size_t i;
-  for (i = 0; i < size / sizeof(__m128i); i++) {
-    accum = _mm_add_epi16(varray[i], accum);
-  }
-
-  // This is unlikely, and we want to make sure the reads are not optimized
-  // away.
-  assert(!_mm_testz_si128(accum, accum));
+void bw_params_init(bw_params_t* params, bw_kernel_t kernel)
+{
+    memset(params, 0, sizeof(*params));
+    params->kernel = kernel;
+    params->read_ratio = 100;
+    params->samples = BW_DEFAULT_SAMPLES;
+    params->min_samples = 2;
 }
-#else
-# error "No compiler support for SSE instructions"
-#endif
 
-//static char array[1024*1024*1024];
-
-double measure_read_bw(int cpu_node, int mem_node)
+typedef struct bw_team_s {
+    pthread_barrier_t barrier;
+    volatile int done;
+    int mem_node;
+    int alloc_failed;
+    size_t bytes_per_thread;
+    bw_params_t params;
+    const bw_kernel_set_t* kernels;
+} bw_team_t;
+
+typedef struct {
+    bw_team_t* team;
+    int cpu_id;
+    pthread_t pthread;
+} bw_worker_t;
+
+static void run_mix(const bw_kernel_set_t* k, char* buf, size_t bytes, int read_ratio)
 {
-    char* array;
-    size_t size = 1024*1024*1024;
-    double bw;
-    int nthreads = 16;
-
-    array = numa_alloc_onnode(size, mem_node);
-    assert(array);
-    numa_run_on_node(cpu_node);
-    // force allocation of physical pages
-    memset(array, 0xff, size);
-    bw = timeitp(read_memory_sse, nthreads, array, size, 5, 1);
-    numa_free(array, size);
-    return bw;
+    size_t off;
+    int credit = 0;
+
+    // spread the reads evenly among the writes so that the ratio holds
+    // over any window of a hundred chunks
+    for (off = 0; off + BW_MIX_CHUNK <= bytes; off += BW_MIX_CHUNK) {
+        credit += read_ratio;
+        if (credit >= 100) {
+            credit -= 100;
+            k->read(NULL, buf + off, BW_MIX_CHUNK);
+        } else {
+            k->write_nt(buf + off, NULL, BW_MIX_CHUNK);
+        }
+    }
 }
 
-double measure_write_bw(int cpu_node, int mem_node)
+static void run_kernel(bw_team_t* team, char* buf)
 {
-    char* array;
-    size_t size = 1024*1024*1024;
-    double bw;
-    int nthreads = 16;
-
-    array = numa_alloc_onnode(size, mem_node);
-    assert(array);
-    numa_run_on_node(cpu_node);
-    // force allocation of physical pages
-    memset(array, 0xff, size);
-    bw = timeitp(write_memory_nontemporal_sse, nthreads, array, size, 5, 1);
-    numa_free(array, size);
-    return bw;
+    const bw_kernel_set_t* k = team->kernels;
+    size_t bytes = team->bytes_per_thread;
+
+    switch (team->params.kernel) {
+        case BW_KERNEL_READ:
+            k->read(NULL, buf, bytes);
+            break;
+        case BW_KERNEL_WRITE:
+            k->write(buf, NULL, bytes);
+            break;
+        case BW_KERNEL_WRITE_NT:
+            k->write_nt(buf, NULL, bytes);
+            break;
+        case BW_KERNEL_COPY:
+            k->copy(buf + bytes/2, buf, bytes/2);
+            break;
+        case BW_KERNEL_MIX:
+            run_mix(k, buf, bytes, team->params.read_ratio);
+            break;
+        default:
+            break;
+    }
 }
 
-#else // SSE4_VERSION
+static void* bw_worker(void* arg)
+{
+    bw_worker_t* worker = (bw_worker_t*) arg;
+    bw_team_t* team = worker->team;
+    struct bitmask* cpubind;
+    char* buf;
+
+    cpubind = numa_allocate_cpumask();
+    numa_bitmask_setbit(cpubind, worker->cpu_id);
+    if (numa_sched_setaffinity(0, cpubind) != 0) {
+        DBG_LOG(WARNING, "Cannot bind bandwidth thread on processor %d\n", worker->cpu_id);
+    }
+    numa_bitmask_free(cpubind);
+
+    // allocate and first touch from the processor that streams over the buffer
+    buf = numa_alloc_onnode(team->bytes_per_thread, team->mem_node);
+    if (buf) {
+        memset(buf, 0xff, team->bytes_per_thread);
+    } else {
+        __sync_fetch_and_add(&team->alloc_failed, 1);
+    }
 
+    // *** Barrier: setup done ***
+    pthread_barrier_wait(&team->barrier);
 
-#include <stdio.h>
-#include <math.h>
-#include <float.h>
-#include <limits.h>
-#include <sys/time.h>
-#include <numa.h>
-#include <numaif.h>
-#include <omp.h>
-#include "monotonic_timer.h"
-#include "debug.h"
+    while (1) {
+        pthread_barrier_wait(&team->barrier);
+        if (team->done) break;
+        if (buf) run_kernel(team, buf);
+        pthread_barrier_wait(&team->barrier);
+    }
+
+    if (buf) {
+        numa_free(buf, team->bytes_per_thread);
+    }
+    return NULL;
+}
 
+// processors of cpu_node we are allowed to run on
+static int node_cpus(int cpu_node, int* cpus, int max_cpus)
+{
+    struct bitmask* mask;
+    int i, n;
 
-# define N	20000000
-# define NTIMES	10
-# define OFFSET	0
+    mask = numa_allocate_cpumask();
+    if (numa_node_to_cpus(cpu_node, mask) != 0) {
+        numa_bitmask_free(mask);
+        return 0;
+    }
+    for (i = 0, n = 0; i < numa_num_configured_cpus() && n < max_cpus; i++) {
+        if (numa_bitmask_isbitset(mask, i) && numa_bitmask_isbitset(numa_all_cpus_ptr, i)) {
+            cpus[n++] = i;
+        }
+    }
+    numa_bitmask_free(mask);
+    return n;
+}
 
-# define HLINE "-------------------------------------------------------------\n"
+int measure_bw(int cpu_node, int mem_node, const bw_params_t* params, bw_result_t* result)
+{
+    bw_team_t team;
+    bw_worker_t* workers;
+    int* cpus;
+    int ncpus, nthreads;
+    int i, created;
+    size_t total_bytes;
+    double sum = 0, sum2 = 0, best = 0;
+    int n = 0;
+    int ret = E_SUCCESS;
+
+    memset(result, 0, sizeof(*result));
+    memset(&team, 0, sizeof(team));
+    team.params = *params;
+    team.mem_node = mem_node;
+
+    if (!(team.kernels = select_kernel_set(params->isa))) {
+        DBG_LOG(WARNING, "No %s bandwidth kernels supported by this processor\n", params->isa ? params->isa : "");
+        return E_INVAL;
+    }
+    if (team.params.samples <= 0) {
+        team.params.samples = BW_DEFAULT_SAMPLES;
+    }
+    if (team.params.read_ratio < 0) team.params.read_ratio = 0;
+    if (team.params.read_ratio > 100) team.params.read_ratio = 100;
 
-# ifndef MIN
-# define MIN(x,y) ((x)<(y)?(x):(y))
-# endif
-# ifndef MAX
-# define MAX(x,y) ((x)>(y)?(x):(y))
-# endif
+    if ((cpus = malloc(numa_num_configured_cpus() * sizeof(*cpus))) == NULL) {
+        return E_NOMEM;
+    }
+    if ((ncpus = node_cpus(cpu_node, cpus, numa_num_configured_cpus())) == 0) {
+        DBG_LOG(WARNING, "No processors available on node %d to measure bandwidth\n", cpu_node);
+        free(cpus);
+        return E_INVAL;
+    }
+    nthreads = params->nthreads > 0 ? params->nthreads : ncpus;
 
+    total_bytes = params->bytes ? params->bytes : BW_DEFAULT_BYTES;
+    team.bytes_per_thread = total_bytes / nthreads;
+    if (team.bytes_per_thread < BW_MIN_BYTES_PER_THREAD) {
+        team.bytes_per_thread = BW_MIN_BYTES_PER_THREAD;
+    }
+    // keep every kernel on whole chunks so no kernel needs a remainder loop
+    team.bytes_per_thread &= ~((size_t) 2*BW_MIX_CHUNK - 1);
 
-static double	mintime[4] = {FLT_MAX,FLT_MAX,FLT_MAX,FLT_MAX};
+    if (__lib_pthread_create == NULL) {
+        init_interposition();
+    }
 
-static double	bytes[4] = {
-    2 * sizeof(double) * N,
-    2 * sizeof(double) * N,
-    3 * sizeof(double) * N,
-    3 * sizeof(double) * N
-    };
+    if ((workers = calloc(nthreads, sizeof(*workers))) == NULL) {
+        free(cpus);
+        return E_NOMEM;
+    }
+    pthread_barrier_init(&team.barrier, NULL, nthreads + 1);
+    for (i = 0, created = 0; i < nthreads; i++) {
+        workers[i].team = &team;
+        workers[i].cpu_id = cpus[i % ncpus];
+        // bandwidth threads must not be tracked by the latency emulator
+        if (__lib_pthread_create(&workers[i].pthread, NULL, bw_worker, &workers[i]) != 0) {
+            break;
+        }
+        created++;
+    }
+    if (created < nthreads) {
+        // nobody will ever reach the barrier, we cannot recover from this
+        DBG_LOG(ERROR, "Failed to create bandwidth measurement threads\n");
+        abort();
+    }
 
-//extern double mysecond();
+    DBG_LOG(DEBUG, "Measuring %s bandwidth (%s) on cpu node %d and mem node %d with %d threads\n",
+            bw_kernel_name(params->kernel), team.kernels->isa, cpu_node, mem_node, nthreads);
+
+    // *** Barrier: setup done ***
+    pthread_barrier_wait(&team.barrier);
+
+    if (team.alloc_failed) {
+        DBG_LOG(WARNING, "Failed to allocate bandwidth buffers on node %d\n", mem_node);
+        ret = E_NOMEM;
+    } else {
+        while (n < team.params.samples) {
+            double ts1, ts2, bw;
+
+            pthread_barrier_wait(&team.barrier);
+            ts1 = monotonic_time();
+            pthread_barrier_wait(&team.barrier);
+            ts2 = monotonic_time();
+
+            bw = (double) (team.bytes_per_thread * nthreads) / BYTES_PER_MB / (ts2 - ts1);
+            sum += bw;
+            sum2 += bw * bw;
+            if (bw > best) best = bw;
+            n++;
+
+            if (team.params.ci_rel > 0 && n >= team.params.min_samples &&
+                ci95_rel(n, sum, sum2) < team.params.ci_rel) {
+                break;
+            }
+        }
+    }
 
-double measure_read_bw(int cpu_node, int mem_node)
-    {
-    register int	j, k;
-    double		t, times[4][NTIMES];
-    double *a, *c;
-    //struct bitmask* membind;
-
-    /* --- SETUP --- determine precision and check timing --- */
-
-    //membind = numa_allocate_nodemask();
-    //numa_bitmask_setbit(membind, mem_node);
-    //numa_bind(membind);
-    //numa_free_nodemask(membind);
-    numa_run_on_node(cpu_node);
-
-    omp_set_num_threads(10);
-
-    // allocate memory dynamically to make sure the data is stored on the expected NUMA node
-    a = (double *)numa_alloc_onnode( (N+OFFSET) * sizeof(double), mem_node);
-    c = (double *)numa_alloc_onnode( (N+OFFSET) * sizeof(double), mem_node);
-
-    DBG_LOG(DEBUG, "Measuring read BW on cpu node %d and mem node %d\n", cpu_node, mem_node);
-
-    /* Get initial value for system clock. */
-#pragma omp parallel for
-    for (j=0; j<N; j++) {
-	a[j] = (double)random(); //1.0;
-	c[j] = 0.0;
-	}
-
-    t = monotonic_time(); //mysecond();
-#pragma omp parallel for
-    for (j = 0; j < N; j++)
-	a[j] = 2.0E0 * a[j];
-    t = 1.0E6 * (monotonic_time() - t);
-
-    /*	--- MAIN LOOP --- repeat test cases NTIMES times --- */
-
-    for (k=0; k<NTIMES; k++)
-	{
-	times[0][k] = monotonic_time(); //mysecond();
-#pragma omp parallel for
-	for (j=0; j<N; j++)
-	    c[j] = a[j];
-	times[0][k] = monotonic_time() - times[0][k];
-	}
-
-    /*	--- SUMMARY --- */
-    
-    mintime[0] = FLT_MAX;
-    for (k=1; k<NTIMES; k++) 
-	{
-	    mintime[0] = MIN(mintime[0], times[0][k]);
-	}
-
-    numa_free(a, (N+OFFSET) * sizeof(double));
-    numa_free(c, (N+OFFSET) * sizeof(double));
-
-    // reset NUMA binding
-    //numa_run_on_node_mask(numa_all_nodes_ptr);
-    //numa_set_membind(numa_all_nodes_ptr);
-    //numa_bind(numa_all_nodes_ptr);
-    numa_run_on_node(-1);
-
-    return 1.0E-06 * bytes[0]/mintime[0]; // bytes to MiB/s 
+    team.done = 1;
+    pthread_barrier_wait(&team.barrier);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].pthread, NULL);
+    }
+    pthread_barrier_destroy(&team.barrier);
+    free(workers);
+    free(cpus);
+
+    if (ret == E_SUCCESS) {
+        result->best = best;
+        result->mean = sum / n;
+        result->stddev = n > 1 ? sqrt(fmax(0.0, (sum2 - sum * sum / n) / (n - 1))) : 0.0;
+        result->ci_rel = ci95_rel(n, sum, sum2);
+        result->samples = n;
+        result->nthreads = nthreads;
+        result->isa = team.kernels->isa;
+    }
+    return ret;
 }
 
+double measure_read_bw(int cpu_node, int mem_node)
+{
+    bw_params_t params;
+    bw_result_t result;
 
+    bw_params_init(&params, BW_KERNEL_READ);
+    if (measure_bw(cpu_node, mem_node, &params, &result) != E_SUCCESS) {
+        return 0;
+    }
+    return result.best;
+}
 
-#endif // SSE4_VERSION
+double measure_write_bw(int cpu_node, int mem_node)
+{
+    bw_params_t params;
+    bw_result_t result;
+
+    bw_params_init(&params, BW_KERNEL_WRITE_NT);
+    if (measure_bw(cpu_node, mem_node, &params, &result) != E_SUCCESS) {
+        return 0;
+    }
+    return result.best;
+}
@@ -16,6 +16,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 #include "config.h"
 #include "cpu/cpu.h"
+#include "quartz.h"
 #include "thread.h"
 #ifdef PAPI_SUPPORT
 #include "cpu/pmc-papi.h"
@@ -45,24 +46,79 @@ typedef struct {
 #endif
 
     double stalls_calibration_factor;
+
+    // runtime check of the achieved latency against read_latency
+    int accuracy_check;
+    int accuracy_window;    // epochs averaged
+    int accuracy_tolerance; // percent of read_latency
+
+    uint64_t targets_version; // bumped by set_target_latency()
+    int paused;               // nesting count of quartz_pause()
+    uint64_t injected_ns;     // delay injected into all threads, updated atomically
 } latency_model_t;
 
 extern latency_model_t latency_model;
 
-typedef struct {
+// counters of the calling thread exported through quartz_thread_info()
+extern __thread quartz_thread_info_t quartz_tls_info;
+
+static inline int thread_read_latency(thread_t* thread)
+{
+    return thread->read_latency ? thread->read_latency : latency_model.read_latency;
+}
+
+// throttle register to bandwidth curve of a single memory controller,
+// sorted by register value with bandwidth non-decreasing
+typedef struct bw_model_s {
     unsigned int throttle_reg_val[MAX_THROTTLE_VALUE]; 
     double bandwidth[MAX_THROTTLE_VALUE];
     int npoints;
-    int enabled;
 } bw_model_t;
 
-extern bw_model_t read_bw_model;
-extern bw_model_t write_bw_model;
+typedef struct {
+    int enabled;
+    int read_bw;  // targets in MB/s, -1 when unthrottled
+    int write_bw;
+} bandwidth_model_t;
+
+extern bandwidth_model_t bandwidth_model;
 
 int init_bandwidth_model(config_t* cfg, struct virtual_topology_s* topology);
+int __set_bw(physical_node_t* node, uint64_t read_bw, uint64_t write_bw);
+int find_bw_throttle(physical_node_t* node, bw_model_t* model, const char* type,
+                     uint64_t target_bw, uint16_t* val);
 int init_latency_model(config_t* cfg, cpu_model_t* cpu, struct virtual_topology_s* virtual_topology);
+
+/**
+ * \brief Changes the target latencies at runtime, see control.c.
+ * valid_target_latency() returns E_INVAL unless both exceed the hardware
+ * latency of every virtual node, as at initialization.
+ */
+int valid_target_latency(int read_latency, int write_latency);
+void set_target_latency(int read_latency, int write_latency);
+
+/**
+ * \brief Changes the bandwidth targets at runtime and reprograms the
+ * throttles from the trained models, -1 leaves a traffic class unthrottled.
+ * valid_bandwidth() returns E_NOENT when there is no model to use.
+ */
+int valid_bandwidth(int read_bw, int write_bw);
+int set_bandwidth(int read_bw, int write_bw);
 void init_thread_latency_model(thread_t *thread);
 
+/**
+ * \brief Emulates other latencies for the calling thread, 0 keeps the
+ * target. Returns E_INVAL unless they exceed the hardware latency of the
+ * thread's virtual node.
+ */
+int set_thread_latency(thread_t* thread, int read_latency, int write_latency);
+
 void create_latency_epoch();
 
+/**
+ * \brief Returns the NVM read latency in ns the thread achieved over its last
+ * latency.accuracy_window epochs, 0 before its first NVM access
+ */
+double achieved_latency_ns(thread_t* thread);
+
 #endif /* __MODEL_H */
@@ -12,6 +12,7 @@ with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <math.h>
@@ -19,10 +20,10 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "config.h"
 #include "error.h"
 #include "measure.h"
-#include "stat.h"
 #include "topology.h"
 #include "monotonic_timer.h"
 #include "model.h"
+#include "bw_control.h"
 
 /**
  * \file
@@ -35,252 +36,496 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  * We use a kernel-module to set the proper PCI registers. 
  * 
  * Initially, we perform a series of bandwidth measurements to find out the bandwidth 
- * that corresponds to each register value. We incrementally try out each register value 
- * starting from 0x800f until we saturate memory bandwidth.
+ * that corresponds to each register value. Read and write bandwidth respond differently
+ * to throttling and each memory controller has its own curve, so we train a read and a 
+ * write model for every physical node.
+ *
+ * Measuring every register value takes far too long, so training is adaptive. We first
+ * probe a handful of log-spaced register values, which is enough to see the shape of the
+ * curve: bandwidth grows roughly linearly with the register value until the memory 
+ * controller saturates. We then bisect only the interval that brackets the configured
+ * target bandwidth until we land close enough to it. Each probe samples only until the 
+ * confidence interval of the measurement is tight. Later runs with a different target
+ * reuse the cached points and refine around the new target.
  * 
  */ 
 
 
-bw_model_t read_bw_model;
-bw_model_t write_bw_model;
+bandwidth_model_t bandwidth_model;
+static virtual_topology_t* bandwidth_topology;
 
 
-#define THROTTLE_INCREMENT 15
 #define THROTTLE_INITIAL_VALUE 0x800f
+#define THROTTLE_MAX_VALUE 0x8fff
+#define THROTTLE_RESOLUTION 4        // stop bisecting below this register interval
+#define TRAIN_TARGET_TOLERANCE 0.02  // relative distance to the target that is close enough
+#define TRAIN_MAX_BISECTIONS 12
+#define TRAIN_BYTES (256*1024*1024LL)
+#define TRAIN_MAX_SAMPLES 5
+#define TRAIN_CI_REL 0.02
+
+static const char* model_type_name(char model_type)
+{
+    return model_type == 'w' ? "write" : "read";
+}
 
-static int train_model(physical_node_t* phys_node, char model_type, bw_model_t* bw_model)
+// inserts a point keeping the model sorted by register value
+static void insert_point(bw_model_t* bw_model, unsigned int x, double y)
 {
-    double x[MAX_THROTTLE_VALUE];
-    double best_rate;
-    double m;
-    int    i;
-    uint16_t    throttle_reg_val;
-
-    int min_number_throttle_points = 10;
-    double stop_slope = 0.1;
-    int phys_node_id = phys_node->node_id;
-    pci_regs_t *regs = phys_node->mc_pci_regs;
+    int j;
 
-    // reset throttling
-    phys_node->cpu_model->get_throttle_register(regs, THROTTLE_DDR_ACT, &throttle_reg_val);
-    if (throttle_reg_val < 0x8fff)
-        phys_node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, 0x8FFF);
-
-    DBG_LOG(INFO, "throttle bus id %d, on physical node: %d\n", regs->addr[0].bus_id, phys_node_id);
-
-    // we run until our bandwidth curve flattens out which we find out using 
-    // gradient (slope) analysis 
-    for (i=0; i < MAX_THROTTLE_VALUE; i++) {
-        phys_node->cpu_model->get_throttle_register(regs, THROTTLE_DDR_ACT, &throttle_reg_val);
-        if (throttle_reg_val >= 0x8fff) throttle_reg_val = THROTTLE_INITIAL_VALUE;
-        else throttle_reg_val += THROTTLE_INCREMENT;
-        if (model_type == 'r') {
-            phys_node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, throttle_reg_val);
-            best_rate = measure_read_bw(phys_node_id, phys_node_id);
-            // restore throttling register
-            //phys_node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, 0x8fff);
-        } /*else if (model_type == 'w') {
-            phys_node->cpu_model->set_throttle_register(bus_id, THROTTLE_DDR_ACT, throttle_reg_val);
-            best_rate = measure_write_bw(phys_node_id, phys_node_id);
-            // restore throttling register
-            phys_node->cpu_model->set_throttle_register(bus_id, THROTTLE_DDR_ACT, 0x8fff);
-        }*/
-        DBG_LOG(INFO, "throttle reg: 0x%x, %c bandwidth: %f\n", throttle_reg_val, model_type, best_rate);
-        bw_model->throttle_reg_val[i] = throttle_reg_val;
-        bw_model->bandwidth[i] = best_rate;
-        x[i] = (double) throttle_reg_val; // slope calculation requires values of type double
-        if (i > min_number_throttle_points) {
-            m = slope(&x[i-min_number_throttle_points], 
-                      &bw_model->bandwidth[i-min_number_throttle_points], 
-                      min_number_throttle_points);
-            if (abs(m) < stop_slope) {
-                break;
-            }
+    if (bw_model->npoints >= MAX_THROTTLE_VALUE) {
+        return;
+    }
+    for (j=bw_model->npoints-1; j>=0 && bw_model->throttle_reg_val[j] > x; j--) {
+        bw_model->throttle_reg_val[j+1] = bw_model->throttle_reg_val[j];
+        bw_model->bandwidth[j+1] = bw_model->bandwidth[j];
+    }
+    bw_model->throttle_reg_val[j+1] = x;
+    bw_model->bandwidth[j+1] = y;
+    bw_model->npoints++;
+}
+
+static int find_point(bw_model_t* bw_model, unsigned int x)
+{
+    int i;
+
+    for (i=0; i<bw_model->npoints; i++) {
+        if (bw_model->throttle_reg_val[i] == x) {
+            return i;
         }
     }
-    bw_model->npoints = i;
+    return -1;
+}
+
+static void save_point(FILE* fp, int node_id, char model_type, unsigned int x, double y)
+{
+    if (fp == NULL) {
+        return;
+    }
+    if (ftell(fp) == 0) {
+        fprintf(fp, "# node\ttype\tthrottle_reg\tbandwidth_MBps\n");
+    }
+    fprintf(fp, "%d\t%s\t0x%x\t%f\n", node_id, model_type_name(model_type), x, y);
+    fflush(fp);
+}
+
+/**
+ * Measures the bandwidth at a register value and records it in the model and 
+ * the model file. Points are saved as soon as they are measured so that an 
+ * interrupted training does not have to start over.
+ */
+static double probe(physical_node_t* phys_node, char model_type, uint16_t throttle_reg_val, 
+                    bw_model_t* bw_model, FILE* fp)
+{
+    bw_params_t params;
+    bw_result_t result;
+    int i;
+
+    if ((i = find_point(bw_model, throttle_reg_val)) >= 0) {
+        return bw_model->bandwidth[i];
+    }
+
+    bw_params_init(&params, model_type == 'w' ? BW_KERNEL_WRITE_NT : BW_KERNEL_READ);
+    params.bytes = TRAIN_BYTES;
+    params.samples = TRAIN_MAX_SAMPLES;
+    params.ci_rel = TRAIN_CI_REL;
+
+    phys_node->cpu_model->set_throttle_register(phys_node->mc_pci_regs, THROTTLE_DDR_ACT, throttle_reg_val);
+    if (measure_bw(phys_node->node_id, phys_node->node_id, &params, &result) != E_SUCCESS) {
+        result.best = 0;
+    }
+    DBG_LOG(INFO, "throttle reg: 0x%x, %c bandwidth: %f (%d samples, ci %.1f%%)\n", 
+            throttle_reg_val, model_type, result.best, result.samples, result.ci_rel * 100);
+
+    insert_point(bw_model, throttle_reg_val, result.best);
+    save_point(fp, phys_node->node_id, model_type, throttle_reg_val, result.best);
+    return result.best;
+}
+
+// coarse log-spaced probing of the register range until bandwidth saturates
+static void train_coarse(physical_node_t* phys_node, char model_type, bw_model_t* bw_model, FILE* fp)
+{
+    unsigned int v;
+    double bw, prev_bw = 0;
+    int n;
+
+    for (v = THROTTLE_INITIAL_VALUE & 0xfff, n = 0; ; v = v * 2 > 0xfff ? 0xfff : v * 2, n++) {
+        bw = probe(phys_node, model_type, 0x8000 | v, bw_model, fp);
+        // doubling the register value no longer buys bandwidth
+        if (n >= 2 && bw < prev_bw * (1 + TRAIN_TARGET_TOLERANCE)) {
+            break;
+        }
+        if (v == 0xfff) {
+            break;
+        }
+        prev_bw = bw;
+    }
+}
+
+/**
+ * Bisects the register interval that brackets target_bw. Measurements are 
+ * noisy so the bracket is recomputed from all points after each probe.
+ */
+static void train_target(physical_node_t* phys_node, char model_type, double target_bw, 
+                         bw_model_t* bw_model, FILE* fp)
+{
+    int i, lo, hi;
+    unsigned int mid;
+
+    for (i=0; i<TRAIN_MAX_BISECTIONS; i++) {
+        for (hi=0; hi<bw_model->npoints && bw_model->bandwidth[hi] <= target_bw; hi++);
+        if (hi == 0 || hi == bw_model->npoints) {
+            // the target lies outside what the throttle can reach
+            return;
+        }
+        lo = hi - 1;
+        if (fabs(bw_model->bandwidth[lo] - target_bw) <= target_bw * TRAIN_TARGET_TOLERANCE ||
+            fabs(bw_model->bandwidth[hi] - target_bw) <= target_bw * TRAIN_TARGET_TOLERANCE ||
+            bw_model->throttle_reg_val[hi] - bw_model->throttle_reg_val[lo] <= THROTTLE_RESOLUTION) 
+        {
+            return;
+        }
+        mid = (bw_model->throttle_reg_val[lo] + bw_model->throttle_reg_val[hi]) / 2;
+        probe(phys_node, model_type, mid, bw_model, fp);
+    }
+}
+
+static int train_model(physical_node_t* phys_node, char model_type, double target_bw, 
+                       bw_model_t* bw_model, const char* path)
+{
+    FILE* fp;
+    double start_time;
+    int npoints = bw_model->npoints;
+    pci_regs_t *regs = phys_node->mc_pci_regs;
+
+    start_time = monotonic_time();
+
+    if ((fp = fopen(path, "a")) == NULL) {
+        DBG_LOG(WARNING, "Cannot save bandwidth model into %s\n", path);
+    }
+
+    DBG_LOG(DEBUG, "Training %s bandwidth model, throttle bus id %d, on physical node: %d\n", 
+            model_type_name(model_type), regs->addr[0].bus_id, phys_node->node_id);
+
+    if (bw_model->npoints == 0) {
+        train_coarse(phys_node, model_type, bw_model, fp);
+    }
+    if (target_bw > 0) {
+        train_target(phys_node, model_type, target_bw, bw_model, fp);
+    }
+
+    // restore throttling register
+    phys_node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, THROTTLE_MAX_VALUE);
+    if (fp) {
+        fclose(fp);
+    }
+
+    if (bw_model->npoints > npoints) {
+        DBG_LOG(INFO, "Bandwidth model training: node %d, %s model, %d new points, %.1f seconds\n",
+                phys_node->node_id, model_type_name(model_type), bw_model->npoints - npoints, 
+                monotonic_time() - start_time);
+    }
     return E_SUCCESS;
 }
 
-static int load_model(const char* path, const char* prefix, bw_model_t* bw_model)
+/**
+ * Makes bandwidth non-decreasing in the register value. 
+ *
+ * Measurements are noisy so neighbouring points may invert. We fix this up 
+ * with a pool-adjacent-violators pass that replaces each inverted run with
+ * its mean, which is the closest monotone curve to the measurements in the 
+ * least squares sense. A monotone curve is what lets us binary search and 
+ * interpolate on bandwidth.
+ */
+static void smooth_model(bw_model_t* bw_model)
+{
+    double level[MAX_THROTTLE_VALUE];
+    int weight[MAX_THROTTLE_VALUE];
+    int i, j, k, nblocks;
+
+    for (i=0, nblocks=0; i<bw_model->npoints; i++) {
+        level[nblocks] = bw_model->bandwidth[i];
+        weight[nblocks] = 1;
+        nblocks++;
+        while (nblocks > 1 && level[nblocks-2] > level[nblocks-1]) {
+            level[nblocks-2] = (level[nblocks-2] * weight[nblocks-2] + level[nblocks-1] * weight[nblocks-1]) /
+                               (weight[nblocks-2] + weight[nblocks-1]);
+            weight[nblocks-2] += weight[nblocks-1];
+            nblocks--;
+        }
+    }
+    for (j=0, k=0; j<nblocks; j++) {
+        for (i=0; i<weight[j]; i++) {
+            bw_model->bandwidth[k++] = level[j];
+        }
+    }
+}
+
+static int load_model(const char* path, int node_id, char model_type, bw_model_t* bw_model)
 {
     FILE *fp;
     char *line = NULL;
-    char str[64];
+    char type[16];
     size_t len = 0;
     ssize_t read;
-    int x;
+    int node;
+    unsigned int x;
     double y;
-    int found_points;
 
     fp = fopen(path, "r");
     if (fp == NULL) {
         return E_ERROR;
     }
 
-    DBG_LOG(INFO, "Loading %s bandwidth model from %s\n", prefix, path);
-    for (found_points = 0; (read = getline(&line, &len, fp)) != -1; ) {
-        if (strstr(line, prefix)) {
-            sscanf(line, "%s\t%d\t%lf", str, &x, &y);
-            DBG_LOG(INFO, "throttle reg: 0x%x, bandwidth: %f\n", x, y);
-            bw_model->throttle_reg_val[found_points] = x;
-            bw_model->bandwidth[found_points] = y;
-            found_points++;
+    DBG_LOG(INFO, "Loading %s bandwidth model of node %d from %s\n", model_type_name(model_type), node_id, path);
+    bw_model->npoints = 0;
+    while ((read = getline(&line, &len, fp)) != -1) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%d\t%15s\t%x\t%lf", &node, type, &x, &y) != 4) {
+            continue;
+        }
+        if (node != node_id || strcmp(type, model_type_name(model_type)) != 0 || find_point(bw_model, x) >= 0) {
+            continue;
         }
+        DBG_LOG(DEBUG, "throttle reg: 0x%x, bandwidth: %f\n", x, y);
+        insert_point(bw_model, x, y);
     }
     free(line);
-    if (found_points) {
-        bw_model->npoints = found_points;
-    } else {
-        DBG_LOG(INFO, "No %s bandwidth model found in %s\n", prefix, path);
+    fclose(fp);
+    if (!bw_model->npoints) {
+        DBG_LOG(INFO, "No %s bandwidth model of node %d found in %s\n", model_type_name(model_type), node_id, path);
         return E_ERROR;
     }
-    fclose(fp);
     return E_SUCCESS;
 }
 
-static int save_model(const char* path, const char* prefix, bw_model_t* bw_model)
+/**
+ * Finds the throttle register value that yields target_bw according to the
+ * model, interpolating linearly between the two enclosing model points. 
+ * Targets beyond the highest point leave the memory controller unthrottled 
+ * and targets below the lowest point get the most restrictive value we know.
+ */
+static int find_throttle_value(bw_model_t* model, double target_bw, uint16_t* val, double* expected_bw)
 {
-    int i;
-    FILE *fp;
+    int lo, hi, mid;
+    double x0, x1, y0, y1;
 
-    fp = fopen(path, "a");
-    if (fp == NULL) {
-        return E_ERROR;
+    if (model->npoints == 0) {
+        return E_NOENT;
     }
-
-    DBG_LOG(INFO, "Saving %s bandwidth model into %s\n", prefix, path);
-    for (i=0; i<bw_model->npoints; i++) {
-        int x = bw_model->throttle_reg_val[i];
-        double y = bw_model->bandwidth[i];
-        //DBG_LOG(INFO, "throttle reg: 0x%x, bandwidth: %f\n", x, y);
-        fprintf(fp, "%s\t%d\t%f\n", prefix, x, y);
+    if (target_bw >= model->bandwidth[model->npoints-1]) {
+        *val = THROTTLE_MAX_VALUE;
+        *expected_bw = model->bandwidth[model->npoints-1];
+        return E_SUCCESS;
+    }
+    if (target_bw <= model->bandwidth[0]) {
+        *val = model->throttle_reg_val[0];
+        *expected_bw = model->bandwidth[0];
+        return E_SUCCESS;
     }
-    fclose(fp);
-    return E_SUCCESS;
-}
 
-static int find_data_point(bw_model_t* model, double target_bw, unsigned int* point)
-{
-    int i;
-    double error;
-
-    // go through all points as we are not sorted and pick the one closest
-    *point = 0;
-    error = target_bw;    
-    for (i=1; i<model->npoints; i++) {
-        if (fabs(model->bandwidth[i] - target_bw) < error) {
-            *point = i;
-            error = fabs(model->bandwidth[i] - target_bw);
+    // find the first point with bandwidth[hi] > target_bw
+    lo = 0;
+    hi = model->npoints - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (model->bandwidth[mid] > target_bw) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
         }
     }
+    x0 = model->throttle_reg_val[hi-1];
+    x1 = model->throttle_reg_val[hi];
+    y0 = model->bandwidth[hi-1];
+    y1 = model->bandwidth[hi];
+    *val = (uint16_t) floor(x0 + (x1 - x0) * (target_bw - y0) / (y1 - y0) + 0.5);
+    *expected_bw = target_bw;
     return E_SUCCESS;
 }
 
-int __set_write_bw(physical_node_t* node, uint64_t target_bw)
+/**
+ * Finds the throttle register value of node for a target bandwidth of the 
+ * given type ("read" or "write"). A target of -1 means unthrottled.
+ */
+int find_bw_throttle(physical_node_t* node, bw_model_t* model, const char* type, 
+                     uint64_t target_bw, uint16_t* val)
 {
-    pci_regs_t *regs = node->mc_pci_regs;
+    double expected_bw;
     int ret;
-    unsigned int point;
-
-    if (regs == NULL) {
-        return E_SUCCESS;
-    }
 
     if (target_bw == (uint64_t) (-1)) {
-        node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, 0x8fff);
+        *val = THROTTLE_MAX_VALUE;
         return E_SUCCESS;
     }
-
-    if ((ret = find_data_point(&write_bw_model, (double) target_bw, &point)) != E_SUCCESS) {
+    if (model == NULL) {
+        DBG_LOG(WARNING, "No %s bandwidth model for node %d\n", type, node->node_id);
+        return E_NOENT;
+    }
+    if ((ret = find_throttle_value(model, (double) target_bw, val, &expected_bw)) != E_SUCCESS) {
         return ret;
     }
-    DBG_LOG(INFO, "Setting throttle reg: %d (0x%x), target write bandwidth: %" PRIu64 ", actual write bandwidth: %" PRIu64 "\n", write_bw_model.throttle_reg_val[point], write_bw_model.throttle_reg_val[point], target_bw, (uint64_t) write_bw_model.bandwidth[point]);
-    node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, write_bw_model.throttle_reg_val[point]);
-    
+    DBG_LOG(INFO, "Node %d: throttle reg 0x%x for target %s bandwidth %" PRIu64 ", expected %s bandwidth %" PRIu64 "\n",
+            node->node_id, *val, type, target_bw, type, (uint64_t) expected_bw);
     return E_SUCCESS;
 }
 
-int set_write_bw(config_t* cfg, physical_node_t* node)
-{
-    int target_bw;
-    __cconfig_lookup_int(cfg, "bandwidth.write", &target_bw);
-
-    return __set_write_bw(node, target_bw);
-}
-
-int __set_read_bw(physical_node_t* node, uint64_t target_bw)
+/**
+ * Throttles node to the target read and write bandwidth.
+ *
+ * There is a single activation throttle per memory controller so when both 
+ * targets are given we program the most restrictive of the two register 
+ * values, which keeps each traffic class at or below its target.
+ */
+int __set_bw(physical_node_t* node, uint64_t read_bw, uint64_t write_bw)
 {
     pci_regs_t *regs = node->mc_pci_regs;
+    uint16_t read_val = THROTTLE_MAX_VALUE;
+    uint16_t write_val = THROTTLE_MAX_VALUE;
     int ret;
-    unsigned int point;
 
     if (regs == NULL) {
         return E_SUCCESS;
     }
 
-    if (target_bw == (uint64_t) (-1)) {
-        node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, 0x8fff);
-        return E_SUCCESS;
+    if ((ret = find_bw_throttle(node, node->read_bw_model, "read", read_bw, &read_val)) != E_SUCCESS) {
+        return ret;
     }
-
-    if ((ret = find_data_point(&read_bw_model, (double) target_bw, &point)) != E_SUCCESS) {
+    if ((ret = find_bw_throttle(node, node->write_bw_model, "write", write_bw, &write_val)) != E_SUCCESS) {
         return ret;
     }
-    DBG_LOG(INFO, "Setting throttle reg: %d (0x%x), target read bandwidth: %" PRIu64 ", actual read bandwidth: %" PRIu64 "\n", read_bw_model.throttle_reg_val[point], read_bw_model.throttle_reg_val[point], target_bw, (uint64_t) read_bw_model.bandwidth[point]);
-    node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, read_bw_model.throttle_reg_val[point]);
+    node->cpu_model->set_throttle_register(regs, THROTTLE_DDR_ACT, read_val < write_val ? read_val : write_val);
 
     return E_SUCCESS;
 }
 
-int set_read_bw(config_t* cfg, physical_node_t* node)
+int set_bw(config_t* cfg, physical_node_t* node)
 {
-    int target_bw;
-    __cconfig_lookup_int(cfg, "bandwidth.read", &target_bw);
+    int read_bw = -1;
+    int write_bw = -1;
+
+    __cconfig_lookup_int(cfg, "bandwidth.read", &read_bw);
+    __cconfig_lookup_int(cfg, "bandwidth.write", &write_bw);
 
-    return __set_read_bw(node, target_bw);
+    return __set_bw(node, (uint64_t) (int64_t) read_bw, (uint64_t) (int64_t) write_bw);
+}
+
+static bw_model_t* init_node_model(physical_node_t* phys_node, const char* model_file, char model_type, int target_bw)
+{
+    bw_model_t* bw_model;
+
+    if (!(bw_model = calloc(1, sizeof(*bw_model)))) {
+        DBG_LOG(ERROR, "Failed bandwidth model allocation\n");
+        return NULL;
+    }
+    // a cached model may still need refining around a new target
+    load_model(model_file, phys_node->node_id, model_type, bw_model);
+    train_model(phys_node, model_type, (double) target_bw, bw_model, model_file);
+    smooth_model(bw_model);
+    return bw_model;
 }
 
 int init_bandwidth_model(config_t* cfg, virtual_topology_t* topology)
 {
     int i;
     char* model_file;
+    int read_bw = -1;
+    int write_bw = -1;
 
     srandom((int)monotonic_time());
+    bandwidth_model.read_bw = -1;
+    bandwidth_model.write_bw = -1;
 
-    if (read_bw_model.enabled) {
+    if (bandwidth_model.enabled) {
         DBG_LOG(INFO, "Initializing bandwidth model\n");
-        // initialize bandwidth model
+        if (__cconfig_lookup_string(cfg, "bandwidth.model", &model_file) == CONFIG_FALSE) {
+            DBG_LOG(WARNING, "No bandwidth model file given, bandwidth is not throttled\n");
+            return E_SUCCESS;
+        }
+        // each memory controller has its own throttle-to-bandwidth curve so 
+        // every nvram node gets its own read and write model
+        __cconfig_lookup_int(cfg, "bandwidth.read", &read_bw);
+        __cconfig_lookup_int(cfg, "bandwidth.write", &write_bw);
+        bandwidth_model.read_bw = read_bw;
+        bandwidth_model.write_bw = write_bw;
+        bandwidth_topology = topology;
         for (i=0; i<topology->num_virtual_nodes; i++) {
-            // FIXME: currently we keep a single bandwidth model and not per-node bandwidth model
             physical_node_t* phys_node = topology->virtual_nodes[i].nvram_node;
-            if (__cconfig_lookup_string(cfg, "bandwidth.model", &model_file) == CONFIG_TRUE) {
-                if (load_model(model_file, "read", &read_bw_model) != E_SUCCESS) {
-                    train_model(phys_node, 'r', &read_bw_model);
-                    save_model(model_file, "read", &read_bw_model);
-                }
-                /*if (load_model(model_file, "write", &write_bw_model) != E_SUCCESS) {
-                    train_model(phys_node, 'w', &write_bw_model);
-                    save_model(model_file, "write", &write_bw_model);
-                }*/
+            if (phys_node == NULL || phys_node->mc_pci_regs == NULL) {
+                continue;
+            }
+            if (!phys_node->read_bw_model) {
+                phys_node->read_bw_model = init_node_model(phys_node, model_file, 'r', read_bw);
+            }
+            if (!phys_node->write_bw_model) {
+                phys_node->write_bw_model = init_node_model(phys_node, model_file, 'w', write_bw);
             }
         }
 
         // set read and write memory bandwidth 
         for (i=0; i<topology->num_virtual_nodes; i++) {
             physical_node_t* phys_node = topology->virtual_nodes[i].nvram_node;
-            set_read_bw(cfg, phys_node);
-            //set_write_bw(cfg, phys_node);
+            if (phys_node) {
+                set_bw(cfg, phys_node);
+            }
         }
     } else {
         // reset throttle registers
         for (i=0; i<topology->num_virtual_nodes; i++) {
-            // FIXME: currently we keep a single bandwidth model and not per-node bandwidth model
             physical_node_t* phys_node = topology->virtual_nodes[i].dram_node;
-            __set_read_bw(phys_node, (uint64_t) (-1));
-            __set_write_bw(phys_node, (uint64_t) (-1));
+            __set_bw(phys_node, (uint64_t) (-1), (uint64_t) (-1));
         }
     }
 
     return E_SUCCESS;
 }
+
+int valid_bandwidth(int read_bw, int write_bw)
+{
+    int i;
+
+    if (!bandwidth_topology || read_bw == 0 || write_bw == 0 || read_bw < -1 || write_bw < -1) {
+        return bandwidth_topology ? E_INVAL : E_NOENT;
+    }
+    // models are not trained at runtime, targets beyond them are clamped
+    for (i = 0; i < bandwidth_topology->num_virtual_nodes; i++) {
+        physical_node_t* phys_node = bandwidth_topology->virtual_nodes[i].nvram_node;
+        if (phys_node == NULL || phys_node->mc_pci_regs == NULL) {
+            continue;
+        }
+        if ((read_bw != -1 && !phys_node->read_bw_model) || (write_bw != -1 && !phys_node->write_bw_model)) {
+            return E_NOENT;
+        }
+    }
+    return E_SUCCESS;
+}
+
+int set_bandwidth(int read_bw, int write_bw)
+{
+    int i, ret;
+
+    // the controller owns the throttles unless they are set once
+    if ((ret = bw_control_set_targets(read_bw, write_bw)) != E_NOENT) {
+        if (ret == E_SUCCESS) {
+            bandwidth_model.read_bw = read_bw;
+            bandwidth_model.write_bw = write_bw;
+        }
+        return ret;
+    }
+    // find every node's model before programming any throttle
+    if ((ret = valid_bandwidth(read_bw, write_bw)) != E_SUCCESS) {
+        return E_INVAL;
+    }
+    bandwidth_model.read_bw = read_bw;
+    bandwidth_model.write_bw = write_bw;
+    for (i = 0; i < bandwidth_topology->num_virtual_nodes; i++) {
+        physical_node_t* phys_node = bandwidth_topology->virtual_nodes[i].nvram_node;
+        if (phys_node && (ret = __set_bw(phys_node, (uint64_t) (int64_t) read_bw, (uint64_t) (int64_t) write_bw)) != E_SUCCESS) {
+            return ret;
+        }
+    }
+    return E_SUCCESS;
+}
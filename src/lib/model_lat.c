@@ -11,16 +11,25 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+// the epoch code logs from the signal handler, through the debug ring
+#define DBG_ASYNC_MODULE
 #include <string.h>
 #include "cpu/cpu.h"
+#include "bw_control.h"
 #include "config.h"
 #include "error.h"
+#include "live_stats.h"
 #include "thread.h"
 #include "topology.h"
+#include "trace.h"
 #include "model.h"
 #include "monotonic_timer.h"
+#include "pflush.h"
 #include <limits.h> // For UINT64_MAX
 
+#define DEFAULT_ACCURACY_WINDOW 64
+#define DEFAULT_ACCURACY_TOLERANCE 10
+
 /**
  * \file
  * 
@@ -38,6 +47,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 
 latency_model_t latency_model;
+__thread quartz_thread_info_t quartz_tls_info;
 
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
@@ -83,6 +93,18 @@ static inline void create_delay_ns(cpu_model_t* cpu, int ns)
 }
 */
 
+static virtual_topology_t* latency_topology;
+
+// the delays only add latency, targets must exceed what the hardware does
+static int above_hw_latency(virtual_node_t* virtual_node, int read_latency, int write_latency)
+{
+    int hw_latency_dram = virtual_node->dram_node->latency;
+    int hw_latency_nvram = virtual_node->nvram_node->latency;
+
+    return hw_latency_dram < read_latency && hw_latency_dram < write_latency &&
+           hw_latency_nvram < read_latency && hw_latency_nvram < write_latency;
+}
+
 static int check_target_latency_against_hw_latency(virtual_topology_t* virtual_topology) {
     int status = 0;
     int i;
@@ -92,10 +114,8 @@ static int check_target_latency_against_hw_latency(virtual_topology_t* virtual_t
     for (i = 0; i < virtual_topology->num_virtual_nodes; ++i) {
         hw_latency_dram = virtual_topology->virtual_nodes[i].dram_node->latency;
         hw_latency_nvram = virtual_topology->virtual_nodes[i].nvram_node->latency;
-        if (hw_latency_dram >= latency_model.read_latency ||
-            hw_latency_dram >= latency_model.write_latency ||
-            hw_latency_nvram >= latency_model.read_latency ||
-            hw_latency_nvram >= latency_model.write_latency) {
+        if (!above_hw_latency(&virtual_topology->virtual_nodes[i], latency_model.read_latency,
+                              latency_model.write_latency)) {
             DBG_LOG(ERROR, "Target read (%d) and write (%d) latency to be emulated must be greater than the "
             		"hardware latency dram (%d) and virtual nvram (%d) (virtual node %d)\n",
             		latency_model.read_latency, latency_model.write_latency, hw_latency_dram, hw_latency_nvram, i);
@@ -107,6 +127,33 @@ static int check_target_latency_against_hw_latency(virtual_topology_t* virtual_t
     return status;
 }
 
+int valid_target_latency(int read_latency, int write_latency)
+{
+    int i;
+
+    if (!latency_model.enabled) {
+        return E_INVAL;
+    }
+    for (i = 0; i < latency_topology->num_virtual_nodes; ++i) {
+        if (!above_hw_latency(&latency_topology->virtual_nodes[i], read_latency, write_latency)) {
+            return E_INVAL;
+        }
+    }
+    return E_SUCCESS;
+}
+
+void set_target_latency(int read_latency, int write_latency)
+{
+    // every epoch reads the target once, so it sees either value
+    __atomic_store_n(&latency_model.read_latency, read_latency, __ATOMIC_RELAXED);
+    __atomic_store_n(&latency_model.write_latency, write_latency, __ATOMIC_RELAXED);
+    pflush_set_write_latency(write_latency);
+    live_stats_set_latency(read_latency, write_latency);
+    // the achieved latency estimates start over
+    __atomic_add_fetch(&latency_model.targets_version, 1, __ATOMIC_RELEASE);
+    DBG_LOG(INFO, "Target latency set to read %d ns, write %d ns\n", read_latency, write_latency);
+}
+
 int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virtual_topology)
 {
 	int i;
@@ -122,6 +169,7 @@ int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virt
     if (check_target_latency_against_hw_latency(virtual_topology) < 0) {
         return E_INVAL;
     }
+    latency_topology = virtual_topology;
 
     __cconfig_lookup_bool(cfg, "latency.inject_delay", &latency_model.inject_delay);
     if (!latency_model.inject_delay) {
@@ -153,6 +201,16 @@ int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virt
     assert(latency_model.pmc_stall_cycles);
 #endif
 
+    latency_model.accuracy_check = 1;
+    latency_model.accuracy_window = DEFAULT_ACCURACY_WINDOW;
+    latency_model.accuracy_tolerance = DEFAULT_ACCURACY_TOLERANCE;
+    __cconfig_lookup_bool(cfg, "latency.accuracy_check", &latency_model.accuracy_check);
+    __cconfig_lookup_int(cfg, "latency.accuracy_window", &latency_model.accuracy_window);
+    __cconfig_lookup_int(cfg, "latency.accuracy_tolerance", &latency_model.accuracy_tolerance);
+    if (latency_model.accuracy_window < 1) {
+        latency_model.accuracy_window = DEFAULT_ACCURACY_WINDOW;
+    }
+
 #ifdef CALIBRATION_SUPPORT
     __cconfig_lookup_bool(cfg, "latency.calibration", &latency_model.calibration);
     if (latency_model.calibration) {
@@ -163,6 +221,29 @@ int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virt
     return E_SUCCESS;
 }
 
+int set_thread_latency(thread_t* thread, int read_latency, int write_latency)
+{
+    if (read_latency < 0 || write_latency < 0 ||
+        !above_hw_latency(thread->virtual_node, read_latency ? read_latency : latency_model.read_latency,
+                          write_latency ? write_latency : latency_model.write_latency))
+    {
+        return E_INVAL;
+    }
+    // the epoch so far is emulated with the latency it ran with
+    if (reached_min_epoch_duration(thread)) {
+        create_latency_epoch();
+    }
+    block_new_epoch();
+    thread->read_latency = read_latency;
+    thread->latency_estimate.epochs = 0;
+    thread->latency_estimate.off_target = 0;
+    unblock_new_epoch();
+    pflush_set_thread_write_latency(write_latency);
+    DBG_LOG(INFO, "thread id [%d] latency set to read %d ns, write %d ns (0 for the target)\n", thread->tid,
+            read_latency, write_latency);
+    return E_SUCCESS;
+}
+
 __thread uint64_t tls_overhead = 0;
 __thread int tls_hw_local_latency = 0;
 __thread int tls_hw_remote_latency = 0;
@@ -177,6 +258,66 @@ void init_thread_latency_model(thread_t *thread)
     tls_hw_remote_latency = thread->virtual_node->nvram_node->latency;
 }
 
+double achieved_latency_ns(thread_t* thread)
+{
+    latency_estimate_t* estimate = &thread->latency_estimate;
+
+    if (estimate->accesses <= 0 || thread->cpu_speed_mhz <= 0) {
+        return 0;
+    }
+    return estimate->cycles / estimate->accesses * 1000.0 / thread->cpu_speed_mhz;
+}
+
+// Folds an epoch into the moving averages of the thread. The NVM accesses
+// come from the miss counters, so the estimate holds as long as the stalls
+// of an access do not overlap with the ones of other accesses; memory level
+// parallelism makes it read low. Averaging cycles and accesses apart weighs
+// each epoch by its accesses.
+static void update_latency_estimate(thread_t* thread, uint64_t stall_cycles, uint64_t delay_cycles,
+                                    uint64_t nvm_accesses)
+{
+    latency_estimate_t* estimate = &thread->latency_estimate;
+    double alpha = 2.0 / (latency_model.accuracy_window + 1);
+    double latency, deviation;
+    int target_latency = thread_read_latency(thread);
+    uint64_t version = __atomic_load_n(&latency_model.targets_version, __ATOMIC_ACQUIRE);
+
+    if (estimate->version != version) {
+        estimate->version = version;
+        estimate->epochs = 0;
+        estimate->off_target = 0;
+    }
+    if (estimate->epochs++ == 0) {
+        estimate->cycles = stall_cycles + delay_cycles;
+        estimate->accesses = nvm_accesses;
+    } else {
+        estimate->cycles += alpha * ((double) (stall_cycles + delay_cycles) - estimate->cycles);
+        estimate->accesses += alpha * ((double) nvm_accesses - estimate->accesses);
+    }
+
+    // a warning per excursion, once the average covers a full window
+    if (!latency_model.accuracy_check || !latency_model.inject_delay ||
+        estimate->epochs < latency_model.accuracy_window || (latency = achieved_latency_ns(thread)) == 0)
+    {
+        return;
+    }
+    deviation = 100.0 * (latency - target_latency) / target_latency;
+    if (deviation > latency_model.accuracy_tolerance || -deviation > latency_model.accuracy_tolerance) {
+#ifdef USE_STATISTICS
+        if (thread->thread_manager->stats.enabled) {
+            thread->stats.off_target_epochs++;
+        }
+#endif
+        if (!estimate->off_target) {
+            estimate->off_target = 1;
+            DBG_LOG(WARNING, "thread id [%d] achieved NVM latency %.0f ns is %.0f%% off the %d ns target\n",
+                    thread->tid, latency, deviation, target_latency);
+        }
+    } else {
+        estimate->off_target = 0;
+    }
+}
+
 void create_latency_epoch()
 {
     uint64_t stall_cycles = 0;
@@ -185,6 +326,8 @@ void create_latency_epoch()
     int target_latency;
     hrtime_t start, stop;
     double epoch_end;
+    int delay_capped = 0;
+    int paused, inject;
 
     start = hrtime_cycles();
 
@@ -213,17 +356,28 @@ void create_latency_epoch()
 
     // this is the generic hardware latency for this thread (it takes into account the current virtual node latencies)
     hw_latency = thread->virtual_node->nvram_node->latency;
-    target_latency = latency_model.read_latency;
+    target_latency = thread_read_latency(thread);
+    // a paused epoch still runs the model, for the statistics
+    paused = __atomic_load_n(&latency_model.paused, __ATOMIC_RELAXED);
+    inject = latency_model.inject_delay && !paused;
 
     // check if the thread_self is remote (virtual topology where dram != nvram) or local (dram == nvram)
     // on this case, stall cycles will be a proportion of remote memory accesses
     // TODO: the read pmc method used below must be changed to support PAPI
+#ifdef MEMLAT_SUPPORT
+    uint64_t nvm_misses = tls_global_remote_dram + tls_global_local_dram;
+#endif
     if (thread->virtual_node->dram_node != thread->virtual_node->nvram_node &&
             latency_model.pmc_remote_dram) {
         stall_cycles = read_pmc_event(latency_model.pmc_remote_dram);
 	} else {
 		stall_cycles = read_pmc_event(latency_model.pmc_stall_cycles);
 	}
+#ifdef MEMLAT_SUPPORT
+    // the miss counters the pmc read just advanced are the NVM reads of this epoch
+    nvm_misses = tls_global_remote_dram + tls_global_local_dram - nvm_misses;
+    bw_control_account(thread->virtual_node, nvm_misses * CACHE_LINE_SIZE, 0);
+#endif
 
 #ifdef CALIBRATION_SUPPORT
     if (latency_model.calibration) {
@@ -271,7 +425,6 @@ void create_latency_epoch()
 #ifdef USE_STATISTICS
     if (thread->thread_manager->stats.enabled) {
         thread->stats.stall_cycles += stall_cycles;
-        thread->stats.delay_cycles += delay_cycles; // Store delay before capping for stats
         thread->stats.overhead_cycles = tls_overhead;
     }
 #endif
@@ -294,18 +447,58 @@ void create_latency_epoch()
         DBG_LOG(WARNING, "Calculated delay_cycles %lu for thread %d exceeds max allowed %lu (10x min_epoch_duration_ns). Ignoring (setting to 0) excessive delay.\n",
                 delay_cycles, thread->tid, max_allowed_delay_cycles);
         delay_cycles = 0; // Ignore if the final delay addition is too large
+        delay_capped = 1;
+    }
+
+
+#ifdef MEMLAT_SUPPORT
+    if (!paused) {
+        update_latency_estimate(thread, stall_cycles, inject ? delay_cycles : 0, nvm_misses);
     }
-    
-#ifdef USE_STATISTICS
-    // If stats are enabled, you might want to record the capped delay if different from the original delay_cycles
-    // For simplicity, current stats.delay_cycles holds pre-cap value. If capped value is needed for stats, update here.
 #endif
 
+    quartz_tls_info.stall_cycles += stall_cycles;
+    if (inject) {
+        quartz_tls_info.delay_cycles += delay_cycles;
+        if (thread->cpu_speed_mhz > 0) {
+            quartz_tls_info.delay_ns = quartz_tls_info.delay_cycles * 1000 / thread->cpu_speed_mhz;
+            __atomic_fetch_add(&latency_model.injected_ns, delay_cycles * 1000 / thread->cpu_speed_mhz, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    quartz_tls_info.epochs++;
+
     epoch_end = monotonic_time_us();
 
+    if (thread->trace) {
+        trace_record_t record;
+        record.tsc = start;
+        record.stall_cycles = stall_cycles;
+        record.delay_cycles = inject ? delay_cycles : 0;
+        record.overhead_cycles = tls_overhead;
+#ifdef MEMLAT_SUPPORT
+        record.nvm_misses = nvm_misses;
+#else
+        record.nvm_misses = 0;
+#endif
+#ifdef USE_STATISTICS
+        record.epoch_us = epoch_end - thread->stats.last_epoch_timestamp;
+#else
+        record.epoch_us = epoch_end - thread->last_epoch_timestamp;
+#endif
+        record.trigger = thread->signaled ? TRACE_TRIGGER_SIGNAL : TRACE_TRIGGER_SYNC;
+        record.flags = delay_capped ? TRACE_FLAG_DELAY_CAPPED : 0;
+        trace_epoch(thread->trace, &record);
+    }
+
+    if (thread->live) {
+        live_stats_epoch(thread->live, stall_cycles, inject ? delay_cycles : 0,
+                         tls_overhead, thread->signaled, achieved_latency_ns(thread));
+    }
+
     DBG_LOG(DEBUG, "injecting delay of %lu cycles (%lu usec) - discounted overhead, after cap\n", delay_cycles,
                     cycles_to_us(thread->cpu_speed_mhz, delay_cycles));
-    if (delay_cycles && latency_model.inject_delay) {
+    if (delay_cycles && inject) {
         create_delay_cycles(delay_cycles);
     }
 
@@ -323,6 +516,12 @@ void create_latency_epoch()
     	}
 
     	thread->stats.overall_epoch_duration_us += diff_epoch_timestamp;
+    	histogram_record(&thread->stats.epoch_duration_us, diff_epoch_timestamp);
+    	// the delay actually injected, after the cap, as in the histogram
+    	thread->stats.delay_cycles += inject ? delay_cycles : 0;
+    	histogram_record(&thread->stats.delay_cycles_hist, inject ? delay_cycles : 0);
+    	histogram_record(&thread->stats.stall_cycles_hist, stall_cycles);
+    	histogram_record(&thread->stats.overhead_cycles_hist, tls_overhead);
     	thread->stats.last_epoch_timestamp = monotonic_time_us();
     } else {
     	// last epoch timestamp must always be updated
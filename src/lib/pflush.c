@@ -12,6 +12,9 @@ with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include "pflush.h"
+#include "bw_control.h"
+#include "cpu/cpu.h"
+#include "wpq.h"
 
 #include <stdint.h>
 
@@ -65,13 +68,95 @@ static inline unsigned long long asm_rdtscp(void)
     __asm__ __volatile__ ("mfence");    \
 })
 
+/* Write back cacheline, without serializing */
+#define asm_clflushopt(addr)                   \
+({                              \
+    __asm__ __volatile__ ("clflushopt %0" : "+m"(*(volatile char*) (addr))); \
+})
+
+/* Write back cacheline and keep it cached */
+#define asm_clwb(addr)                   \
+({                              \
+    __asm__ __volatile__ ("clwb %0" : "+m"(*(volatile char*) (addr))); \
+})
+
+/* Store fence */
+#define asm_sfence()                \
+({                      \
+    __asm__ __volatile__ ("sfence" ::: "memory");    \
+})
+
+#define DEFAULT_WRITE_PARALLELISM 8
+
 static int global_cpu_speed_mhz = 0;
 static int global_write_latency_ns = 0;
+static int global_write_parallelism = DEFAULT_WRITE_PARALLELISM;
+static int paused = 0; // nesting count of pflush_pause()
+
+static void writeback_clflush(const void* addr);
+static void (*writeback_line)(const void* addr) = writeback_clflush;
+
+// write-backs issued by pwb() since the last fence of the thread
+static __thread uint64_t pending_lines = 0;
+static __thread hrtime_t pending_start = 0;
+
+// set by the thread through quartz_set_thread_latency(), 0 if none
+static __thread int tls_write_latency_ns = 0;
+
+static void writeback_clflush(const void* addr)
+{
+    asm_clflush((volatile char*) addr);
+}
+
+static void writeback_clflushopt(const void* addr)
+{
+    asm_clflushopt(addr);
+}
 
-void init_pflush(int cpu_speed_mhz, int write_latency_ns)
+static void writeback_clwb(const void* addr)
+{
+    asm_clwb(addr);
+}
+
+void init_pflush(int cpu_speed_mhz, int write_latency_ns, int write_parallelism)
 {
     global_cpu_speed_mhz = cpu_speed_mhz;
     global_write_latency_ns = write_latency_ns;
+    global_write_parallelism = write_parallelism > 0 ? write_parallelism : DEFAULT_WRITE_PARALLELISM;
+
+    if (cpu_has_feature(CPU_FEATURE_CLWB)) {
+        writeback_line = writeback_clwb;
+    } else if (cpu_has_feature(CPU_FEATURE_CLFLUSHOPT)) {
+        writeback_line = writeback_clflushopt;
+    } else {
+        writeback_line = writeback_clflush;
+    }
+}
+
+void pflush_set_write_latency(int write_latency_ns)
+{
+    __atomic_store_n(&global_write_latency_ns, write_latency_ns, __ATOMIC_RELAXED);
+}
+
+void pflush_set_thread_write_latency(int write_latency_ns)
+{
+    tls_write_latency_ns = write_latency_ns;
+}
+
+void pflush_pause(int pause)
+{
+    __atomic_add_fetch(&paused, pause ? 1 : -1, __ATOMIC_RELAXED);
+}
+
+static inline int write_latency_ns()
+{
+    if (__atomic_load_n(&paused, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    if (tls_write_latency_ns) {
+        return tls_write_latency_ns;
+    }
+    return __atomic_load_n(&global_write_latency_ns, __ATOMIC_RELAXED);
 }
 
 inline hrtime_t cycles_to_ns(int cpu_speed_mhz, hrtime_t cycles)
@@ -109,20 +194,136 @@ emulate_latency_ns(int ns)
 void
 pflush(uint64_t *addr)
 {
-    if (global_write_latency_ns == 0) {
+    uint64_t stall_ns;
+    int latency_ns = write_latency_ns();
+
+    bw_control_account_self(0, CACHE_LINE_SIZE);
+    stall_ns = wpq_enqueue(1);
+
+    if (latency_ns == 0 && stall_ns == 0) {
         return;
     }
 
     /* Measure the latency of a clflush and add an additional delay to
-     * meet the latency to write to NVM */
+     * meet the latency to write to NVM, plus the time the write pending
+     * queue is full */
     hrtime_t start;
     hrtime_t stop;
     start = asm_rdtscp();
     asm_clflush(addr);  
     stop = asm_rdtscp();
-    int to_insert_ns = global_write_latency_ns - cycles_to_ns(global_cpu_speed_mhz, stop-start);
+    int to_insert_ns = (int64_t) (latency_ns + stall_ns) - (int64_t) cycles_to_ns(global_cpu_speed_mhz, stop-start);
     if (to_insert_ns <= 0) {
         return;
     }
     emulate_latency_ns(to_insert_ns);
 }
+
+void
+pwb(const void *addr)
+{
+    if (pending_lines++ == 0) {
+        pending_start = asm_rdtsc();
+    }
+    writeback_line(addr);
+    bw_control_account_self(0, CACHE_LINE_SIZE);
+}
+
+void
+pflush_range(const void *addr, size_t len)
+{
+    uintptr_t line = (uintptr_t) addr & ~((uintptr_t) CACHE_LINE_SIZE - 1);
+    uintptr_t end = (uintptr_t) addr + len;
+    uint64_t lines = (end - line + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+
+    if (len == 0) {
+        return;
+    }
+    if (pending_lines == 0) {
+        pending_start = asm_rdtsc();
+    }
+    pending_lines += lines;
+    for (; line < end; line += CACHE_LINE_SIZE) {
+        writeback_line((const void*) line);
+    }
+    bw_control_account_self(0, lines * CACHE_LINE_SIZE);
+    pfence();
+}
+
+/* NVM serves write_parallelism write-backs at a time, so N outstanding
+ * lines take ceil(N / write_parallelism) write latencies, plus the stall
+ * on a full write pending queue. Time spent since the first write-back
+ * overlaps with that. */
+static inline void drain_pending()
+{
+    uint64_t rounds, stall_ns;
+    int64_t to_insert_ns;
+    int latency_ns;
+
+    if (pending_lines == 0) {
+        return;
+    }
+    latency_ns = write_latency_ns();
+    stall_ns = wpq_enqueue(pending_lines);
+    if (latency_ns || stall_ns) {
+        rounds = (pending_lines + global_write_parallelism - 1) / global_write_parallelism;
+        to_insert_ns = (int64_t) (rounds * latency_ns + stall_ns) -
+                       (int64_t) cycles_to_ns(global_cpu_speed_mhz, asm_rdtscp() - pending_start);
+        if (to_insert_ns > 0) {
+            emulate_latency_ns(to_insert_ns);
+        }
+    }
+    pending_lines = 0;
+}
+
+/* Streamed lines pay one write latency per fence, plus the time the write
+ * pending queue needs to absorb them, or without the queue model the time
+ * to write them at the NVM write bandwidth. */
+void
+pdrain_nt(size_t bytes, uint64_t elapsed_ns)
+{
+    uint64_t lines = (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+    uint64_t stall_ns;
+    int64_t to_insert_ns;
+    int latency_ns = write_latency_ns();
+    int write_bw;
+
+    asm_sfence();
+    bw_control_account_self(0, lines * CACHE_LINE_SIZE);
+    // the write-backs of the thread drain along with the streamed lines
+    lines += pending_lines;
+    if (wpq_enabled()) {
+        stall_ns = wpq_enqueue(lines);
+    } else {
+        // nothing is injected while paused; bytes per MB/s is in us
+        write_bw = latency_ns ? bw_control_write_bw_self() : 0;
+        stall_ns = write_bw > 0 ? (uint64_t) bytes * 1000 / write_bw : 0;
+    }
+    if (latency_ns || stall_ns) {
+        if (pending_lines) {
+            hrtime_t pending_ns = cycles_to_ns(global_cpu_speed_mhz, asm_rdtscp() - pending_start);
+            if (pending_ns > elapsed_ns) {
+                elapsed_ns = pending_ns;
+            }
+        }
+        to_insert_ns = (int64_t) (latency_ns + stall_ns) - (int64_t) elapsed_ns;
+        if (to_insert_ns > 0) {
+            emulate_latency_ns(to_insert_ns);
+        }
+    }
+    pending_lines = 0;
+}
+
+void
+pfence()
+{
+    asm_sfence();
+    drain_pending();
+}
+
+void
+psync()
+{
+    __sync_synchronize();
+    drain_pending();
+}
@@ -22,19 +22,76 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  * Method to be used by client to inject a write latency.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void init_pflush(int cpu_speed_mhz, int write_latency_ns);
+/**
+ * \brief Sets up the write latency model. write_parallelism is the number of
+ * cache line write-backs NVM serves concurrently, 0 for the default.
+ */
+void init_pflush(int cpu_speed_mhz, int write_latency_ns, int write_parallelism);
+
+/**
+ * \brief Changes the write latency of later write-backs at runtime
+ */
+void pflush_set_write_latency(int write_latency_ns);
+
+/**
+ * \brief Overrides the write latency for the calling thread, 0 restores it
+ */
+void pflush_set_thread_write_latency(int write_latency_ns);
+
+/**
+ * \brief Stops (pause != 0) or resumes emulating the write latency, calls
+ * nest. Write pending queue stalls are still emulated.
+ */
+void pflush_pause(int pause);
 
 /**
  * \brief Flush the cacheline containing address addr.
+ *
+ * Uses a serializing clflush and waits a full write latency, so flushing N
+ * lines costs N write latencies. Prefer pflush_range() or pwb() and pfence().
  */
 void pflush(uint64_t *addr);
 
+/**
+ * \brief Write back the cachelines of [addr, addr + len) and wait for them
+ * with a single fence.
+ */
+void pflush_range(const void *addr, size_t len);
+
+/**
+ * \brief Start writing back the cacheline containing addr, with clwb or
+ * clflushopt when the processor has them. The write-back completes at the
+ * next pfence() or psync().
+ */
+void pwb(const void *addr);
+
+/**
+ * \brief Order the write-backs issued so far by this thread before later
+ * stores, paying the write latency of the outstanding lines.
+ */
+void pfence();
+
+/**
+ * \brief Like pfence(), and also orders later loads: a full fence.
+ */
+void psync();
+
+/**
+ * \brief Fence bytes written with non-temporal stores over the last
+ * elapsed_ns nanoseconds, along with the outstanding write-backs. Costs one
+ * write latency plus the write pending queue stall, or the time to write
+ * the bytes at the NVM write bandwidth without the queue model, see
+ * pmemcpy.h.
+ */
+void pdrain_nt(size_t bytes, uint64_t elapsed_ns);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,397 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <fcntl.h>
+#include <numa.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include "debug.h"
+#include "error.h"
+#include "interpose.h"
+#include "monotonic_timer.h"
+#include "pflush.h"
+#include "pheap.h"
+#include "thread.h"
+
+/**
+ * \file
+ *
+ * Persistent heap
+ *
+ * The file starts with the heap header, followed by blocks carved from the
+ * rest of the file in address order. Every block starts with a header word
+ * holding its size and an allocated bit; blocks up to the header's top
+ * offset cover the used part of the file without gaps.
+ *
+ * Metadata changes are ordered so that every crash leaves a walkable heap:
+ *  - allocating from the top writes the new block header, persists it, and
+ *    then moves top with a single 8-byte store;
+ *  - splitting a free block writes the header of the remainder first and
+ *    then shrinks the block with a single 8-byte store;
+ *  - freeing clears the allocated bit with a single 8-byte store.
+ * Free blocks are only tracked in DRAM. Opening a heap walks its blocks to
+ * rebuild the free list, merging adjacent free blocks, which is the
+ * recovery time a restarting application pays.
+ */
+
+#define PHEAP_MAGIC 0x5041454850544151ULL // "QATPHEAP"
+#define PHEAP_VERSION 1
+#define PHEAP_HEADER_SIZE 4096
+#define PHEAP_ALIGN 16
+#define PHEAP_BLOCK_HEADER 16 // keeps objects aligned to PHEAP_ALIGN
+#define PHEAP_MIN_BLOCK 32
+#define PHEAP_ALLOCATED 0x1ULL
+#define PHEAP_HUGETLBFS_MAGIC 0x958458f6
+#define PHEAP_HUGE_PAGE_SIZE (2*1024*1024)
+
+typedef struct {
+    uint64_t magic;     // written last when formatting
+    uint64_t version;
+    uint64_t size;      // bytes of the file used by the heap
+    uint64_t top;       // offset of the first byte never allocated
+    uint64_t root;      // offset of the root object, 0 if none
+    uint64_t clean;     // 1 after pheap_close, 0 while mapped
+} pheap_header_t;
+
+typedef struct pheap_extent_s {
+    uint64_t off;   // offset of the block header
+    uint64_t size;
+    struct pheap_extent_s* next;
+} pheap_extent_t;
+
+struct pheap_s {
+    char* base; // first member, see pheap_base()
+    pheap_header_t* header;
+    size_t size;
+    int node;
+    int recovered;
+    pthread_mutex_t mutex;
+    pheap_extent_t* free_list;
+};
+
+static inline uint64_t* block_word(pheap_t* heap, uint64_t off)
+{
+    return (uint64_t*) (heap->base + off);
+}
+
+static inline void heap_lock(pheap_t* heap)
+{
+    if (__lib_pthread_mutex_lock == NULL) {
+        init_interposition();
+    }
+    __lib_pthread_mutex_lock(&heap->mutex);
+}
+
+static inline void heap_unlock(pheap_t* heap)
+{
+    __lib_pthread_mutex_unlock(&heap->mutex);
+}
+
+void pheap_persist(pheap_t* heap, const void* addr, size_t len)
+{
+    pflush_range(addr, len);
+}
+
+// stores an 8-byte metadata word and persists it
+static inline void store_word(pheap_t* heap, uint64_t* word, uint64_t val)
+{
+    __atomic_store_n(word, val, __ATOMIC_RELEASE);
+    pheap_persist(heap, word, sizeof(*word));
+}
+
+static int add_free(pheap_t* heap, uint64_t off, uint64_t size)
+{
+    pheap_extent_t* e = malloc(sizeof(*e));
+
+    if (e == NULL) {
+        return E_NOMEM;
+    }
+    e->off = off;
+    e->size = size;
+    e->next = heap->free_list;
+    heap->free_list = e;
+    return E_SUCCESS;
+}
+
+static void format(pheap_t* heap)
+{
+    pheap_header_t* header = heap->header;
+
+    memset(header, 0, sizeof(*header));
+    header->version = PHEAP_VERSION;
+    header->size = heap->size;
+    header->top = PHEAP_HEADER_SIZE;
+    pheap_persist(heap, header, sizeof(*header));
+    store_word(heap, &header->magic, PHEAP_MAGIC);
+}
+
+// unmaps the heap without touching the header
+static void release(pheap_t* heap)
+{
+    pheap_extent_t* e;
+
+    while ((e = heap->free_list)) {
+        heap->free_list = e->next;
+        free(e);
+    }
+    munmap(heap->base, heap->size);
+    free(heap);
+}
+
+// walks all blocks, merges runs of free blocks and collects them
+static int recover(pheap_t* heap)
+{
+    uint64_t off = PHEAP_HEADER_SIZE;
+    uint64_t top = heap->header->top;
+    uint64_t free_off = 0, free_size = 0;
+    uint64_t word, size;
+    long nblocks = 0;
+    double start = monotonic_time_us();
+
+    while (off < top) {
+        word = *block_word(heap, off);
+        size = word & ~(PHEAP_ALIGN - 1);
+        if (size < PHEAP_MIN_BLOCK || off + size > top) {
+            DBG_LOG(WARNING, "Persistent heap corrupted at offset %lu\n", off);
+            return E_INVAL;
+        }
+        if (word & PHEAP_ALLOCATED) {
+            if (free_size && add_free(heap, free_off, free_size) != E_SUCCESS) {
+                return E_NOMEM;
+            }
+            free_size = 0;
+        } else if (free_size) {
+            // merging is a single store to the first block of the run
+            free_size += size;
+            store_word(heap, block_word(heap, free_off), free_size);
+        } else {
+            free_off = off;
+            free_size = size;
+        }
+        off += size;
+        nblocks++;
+    }
+    if (free_size && add_free(heap, free_off, free_size) != E_SUCCESS) {
+        return E_NOMEM;
+    }
+
+    DBG_LOG(INFO, "Persistent heap: walked %ld blocks in %.1f us%s\n", nblocks,
+            monotonic_time_us() - start, heap->recovered ? " after unclean shutdown" : "");
+    return E_SUCCESS;
+}
+
+pheap_t* pheap_open(const char* path, size_t size, int flags)
+{
+    struct stat st;
+    struct statfs sfs;
+    pheap_t* heap;
+    int fd;
+    int created = 0;
+
+    if ((heap = calloc(1, sizeof(*heap))) == NULL) {
+        return NULL;
+    }
+    if ((fd = open(path, O_RDWR | ((flags & PHEAP_CREATE) ? O_CREAT : 0), 0666)) < 0) {
+        free(heap);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || fstatfs(fd, &sfs) < 0) {
+        goto error;
+    }
+    if (st.st_size == 0) {
+        if (!(flags & PHEAP_CREATE) || size <= PHEAP_HEADER_SIZE) {
+            goto error;
+        }
+        if (sfs.f_type == PHEAP_HUGETLBFS_MAGIC) {
+            size = (size + PHEAP_HUGE_PAGE_SIZE - 1) & ~((size_t) PHEAP_HUGE_PAGE_SIZE - 1);
+        }
+        if (ftruncate(fd, size) < 0) {
+            goto error;
+        }
+        created = 1;
+    } else {
+        size = st.st_size;
+    }
+
+    heap->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (heap->base == MAP_FAILED) {
+        goto error;
+    }
+    close(fd);
+    heap->header = (pheap_header_t*) heap->base;
+    heap->size = size;
+    pthread_mutex_init(&heap->mutex, NULL);
+
+    // bind before the first touch so that new pages are allocated on NVM
+    if ((heap->node = nvram_node_self()) >= 0) {
+        numa_tonode_memory(heap->base, size, heap->node);
+    }
+
+    if (created || heap->header->magic != PHEAP_MAGIC) {
+        if (!(flags & PHEAP_CREATE)) {
+            DBG_LOG(WARNING, "%s does not hold a persistent heap\n", path);
+            munmap(heap->base, size);
+            free(heap);
+            return NULL;
+        }
+        format(heap);
+    } else if (heap->header->version != PHEAP_VERSION || heap->header->size > size) {
+        DBG_LOG(WARNING, "%s holds an incompatible persistent heap\n", path);
+        munmap(heap->base, size);
+        free(heap);
+        return NULL;
+    }
+
+    heap->recovered = !heap->header->clean && !created;
+    store_word(heap, &heap->header->clean, 0);
+    if (recover(heap) != E_SUCCESS) {
+        // not marked clean, the next open must not trust the heap either
+        release(heap);
+        return NULL;
+    }
+    return heap;
+
+error:
+    close(fd);
+    free(heap);
+    return NULL;
+}
+
+void pheap_close(pheap_t* heap)
+{
+    if (heap == NULL) {
+        return;
+    }
+    store_word(heap, &heap->header->clean, 1);
+    release(heap);
+}
+
+int pheap_recovered(pheap_t* heap)
+{
+    return heap->recovered;
+}
+
+// must be called with the heap lock held, returns the block offset
+static uint64_t alloc_block(pheap_t* heap, uint64_t size)
+{
+    pheap_extent_t** prev;
+    pheap_extent_t* e;
+    uint64_t off;
+
+    // first fit
+    for (prev = &heap->free_list; (e = *prev); prev = &e->next) {
+        if (e->size < size) {
+            continue;
+        }
+        off = e->off;
+        if (e->size - size >= PHEAP_MIN_BLOCK) {
+            // the remainder header must be durable before the block shrinks
+            store_word(heap, block_word(heap, off + size), e->size - size);
+            e->off += size;
+            e->size -= size;
+        } else {
+            size = e->size;
+            *prev = e->next;
+            free(e);
+        }
+        store_word(heap, block_word(heap, off), size | PHEAP_ALLOCATED);
+        return off;
+    }
+
+    off = heap->header->top;
+    if (off + size > heap->size) {
+        return 0;
+    }
+    store_word(heap, block_word(heap, off), size | PHEAP_ALLOCATED);
+    store_word(heap, &heap->header->top, off + size);
+    return off;
+}
+
+void* pheap_alloc(pheap_t* heap, size_t size)
+{
+    uint64_t block = (size + PHEAP_BLOCK_HEADER + PHEAP_ALIGN - 1) & ~((uint64_t) PHEAP_ALIGN - 1);
+    uint64_t off;
+
+    if (block < PHEAP_MIN_BLOCK) {
+        block = PHEAP_MIN_BLOCK;
+    }
+    heap_lock(heap);
+    off = alloc_block(heap, block);
+    heap_unlock(heap);
+
+    if (off == 0) {
+        return NULL;
+    }
+    return heap->base + off + PHEAP_BLOCK_HEADER;
+}
+
+void pheap_free(pheap_t* heap, void* ptr)
+{
+    uint64_t off;
+    uint64_t* word;
+
+    if (ptr == NULL) {
+        return;
+    }
+    off = (char*) ptr - heap->base - PHEAP_BLOCK_HEADER;
+    word = block_word(heap, off);
+    if (off < PHEAP_HEADER_SIZE || off >= heap->header->top || !(*word & PHEAP_ALLOCATED)) {
+        DBG_LOG(WARNING, "pheap_free of %p not allocated from the heap\n", ptr);
+        return;
+    }
+
+    heap_lock(heap);
+    store_word(heap, word, *word & ~PHEAP_ALLOCATED);
+    add_free(heap, off, *word);
+    heap_unlock(heap);
+}
+
+void* pheap_root(pheap_t* heap, size_t size)
+{
+    void* root;
+    uint64_t off;
+
+    heap_lock(heap);
+    if (heap->header->root) {
+        off = heap->header->root;
+        heap_unlock(heap);
+        root = heap->base + off;
+        if ((*block_word(heap, off - PHEAP_BLOCK_HEADER) & ~(PHEAP_ALIGN - 1)) - PHEAP_BLOCK_HEADER < size) {
+            return NULL;
+        }
+        return root;
+    }
+    heap_unlock(heap);
+
+    if ((root = pheap_alloc(heap, size)) == NULL) {
+        return NULL;
+    }
+    memset(root, 0, size);
+    pheap_persist(heap, root, size);
+
+    heap_lock(heap);
+    if (heap->header->root) {
+        // another thread won the race
+        heap_unlock(heap);
+        pheap_free(heap, root);
+        return pheap_root(heap, size);
+    }
+    store_word(heap, &heap->header->root, pheap_offset(heap, root));
+    heap_unlock(heap);
+    return root;
+}
@@ -0,0 +1,105 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __PHEAP_H
+#define __PHEAP_H
+
+/**
+ * \file
+ *
+ * \page pheap_api Persistent Heap API
+ *
+ * A persistent heap is a file mapped into the address space, the way an App
+ * Direct namespace is mapped through DAX. The file should live on tmpfs or
+ * hugetlbfs: the emulator binds its pages to the NVM node of the calling
+ * thread, which the kernel only honors for memory backed files.
+ *
+ * The heap may be mapped at a different address every time it is opened, so
+ * persistent data structures link their objects with offsets, translated
+ * with pheap_direct() and pheap_offset(). Every heap has a root object from
+ * which applications find their data after a restart.
+ *
+ * Heap metadata is kept crash consistent: a crash may leak an allocation
+ * that was not linked to persistent data yet but never corrupts the heap.
+ * Data written by the application is persistent only after pheap_persist(),
+ * which goes through the pflush_range() write latency model.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pheap_s pheap_t;
+
+/** Offset of an object from the start of its heap, 0 means NULL */
+typedef uint64_t pheap_off_t;
+
+#define PHEAP_CREATE 0x1 // create the file, or format it if it does not hold a heap
+
+/**
+ * \brief Maps the heap kept in the file at path
+ *
+ * size is the file size used when the heap is created, 0 to use the size of
+ * an existing file. Returns NULL on failure.
+ */
+pheap_t* pheap_open(const char* path, size_t size, int flags);
+
+/**
+ * \brief Unmaps the heap and marks it as cleanly shut down
+ */
+void pheap_close(pheap_t* heap);
+
+/**
+ * \brief Returns 1 if the heap was recovered from a crash when opened
+ */
+int pheap_recovered(pheap_t* heap);
+
+/**
+ * \brief Returns the root object, allocating and zeroing it the first time
+ *
+ * Returns NULL if the root exists with a smaller size.
+ */
+void* pheap_root(pheap_t* heap, size_t size);
+
+void* pheap_alloc(pheap_t* heap, size_t size);
+void pheap_free(pheap_t* heap, void* ptr);
+
+/**
+ * \brief Writes back the cache lines of the range to NVM and orders them
+ * before any later store
+ */
+void pheap_persist(pheap_t* heap, const void* addr, size_t len);
+
+static inline void* pheap_base(pheap_t* heap)
+{
+    return *(void**) heap;
+}
+
+static inline void* pheap_direct(pheap_t* heap, pheap_off_t off)
+{
+    return off ? (char*) pheap_base(heap) + off : NULL;
+}
+
+static inline pheap_off_t pheap_offset(pheap_t* heap, const void* ptr)
+{
+    return ptr ? (pheap_off_t) ((const char*) ptr - (char*) pheap_base(heap)) : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PHEAP_H */
@@ -1,5 +1,5 @@
 /***************************************************************************
-Copyright 2016 Hewlett Packard Enterprise Development LP.  
+Copyright 2016 Hewlett Packard Enterprise Development LP.
 This program is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
 the Free Software Foundation; either version 2 of the License, or (at
@@ -11,7 +11,17 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+#define _GNU_SOURCE
 #include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "error.h"
+#include "interpose.h"
 #include "topology.h"
 #include "pmalloc.h"
 #include "thread.h"
@@ -19,38 +29,678 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 // pmalloc should be implemented as a separate library
 
-// FIXME: pmalloc currently uses numa_alloc_onnode() which is slower than regular malloc.
-// Consider layering another malloc on top of a emulated nvram 
+/**
+ * \file
+ *
+ * NVM heap
+ *
+ * Each emulated NVM node has an arena that reserves 2MB chunks bound to the
+ * node. A chunk is aligned to its size, so the chunk header of any pointer we
+ * return is found by masking the pointer. The first slab of a chunk holds the
+ * header and the remaining slabs are handed out to size classes; a slab only
+ * holds objects of a single class. Allocations larger than the biggest class
+ * get a mapping of their own, with the header in the first page.
+ *
+ * Large blocks grow with mremap() so their pages are never copied. A moved
+ * block lands on a chunk aligned address we reserve beforehand and the
+ * grown range is bound to the block's node again. mremap() only moves a
+ * single mapping, so a block is always bound with one policy: interleaved
+ * blocks use the kernel's interleaving rather than a binding per run.
+ *
+ * A two level table over the address space marks the chunks and large
+ * blocks we mapped, so we can tell our pointers from others without touching
+ * memory that may not be mapped, and find all NVM heap memory.
+ *
+ * Threads keep a small cache of free objects per class so that most calls do
+ * not touch the arena lock. Memory is never returned from slabs to the system.
+ */
 
+#define PMALLOC_CHUNK_SIZE (2*1024*1024)
+#define PMALLOC_SLAB_SIZE (64*1024)
+#define PMALLOC_SLABS_PER_CHUNK (PMALLOC_CHUNK_SIZE / PMALLOC_SLAB_SIZE)
+#define PMALLOC_NUM_CLASSES 40
+#define PMALLOC_MAX_SMALL_SIZE 32768
+#define PMALLOC_LARGE_OFFSET 4096
+#define PMALLOC_PAGE_SIZE 4096
+#define PMALLOC_TCACHE_BYTES (32*1024)
+#define PMALLOC_TCACHE_MAX 64
+#define PMALLOC_MAGIC 0x706d656d
+#define PMALLOC_CHUNK_SHIFT 21
+#define PMALLOC_MAP_LEAF_BITS 13
+#define PMALLOC_MAP_ROOT_BITS (47 - PMALLOC_CHUNK_SHIFT - PMALLOC_MAP_LEAF_BITS)
+#define PMALLOC_MAP_START 1 // chunk holding a header
+#define PMALLOC_MAP_CONT 2  // following chunks of a large block
+#define PMALLOC_MAP_INTERLEAVED 4 // with the above, chunks of a pmalloc_interleave() block
+#define PMALLOC_MAP_KIND (PMALLOC_MAP_START | PMALLOC_MAP_CONT)
+
+typedef enum {
+    PMALLOC_HUGEPAGES_NONE = 0,
+    PMALLOC_HUGEPAGES_THP,     // madvise(MADV_HUGEPAGE) on the chunks
+    PMALLOC_HUGEPAGES_HUGETLB  // MAP_HUGETLB, falls back to THP
+} pmalloc_hugepages_t;
+
+typedef enum {
+    PMALLOC_CHUNK_SMALL = 1,
+    PMALLOC_CHUNK_LARGE
+} pmalloc_chunk_kind_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t kind;
+    int16_t node;
+    size_t size; // bytes mapped
+    int16_t dram_node;     // interleaved large blocks only
+    uint8_t dram_weight;   // pages on DRAM per interleaving period, 0 if not interleaved
+    uint8_t nvm_weight;    // pages on NVM per interleaving period
+    uint8_t slab_class[PMALLOC_SLABS_PER_CHUNK];
+} pmalloc_chunk_t;
+
+typedef struct pmalloc_free_s {
+    struct pmalloc_free_s* next;
+} pmalloc_free_t;
+
+typedef struct {
+    pmalloc_free_t* free;
+    char* bump;     // objects of the current slab not handed out yet
+    char* bump_end;
+} pmalloc_bin_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    int node;
+    pmalloc_chunk_t* chunk; // chunk we carve slabs from
+    int next_slab;
+    pmalloc_bin_t bins[PMALLOC_NUM_CLASSES];
+} pmalloc_arena_t;
+
+typedef struct {
+    pmalloc_free_t* head;
+    int count;
+} pmalloc_tcache_bin_t;
+
+typedef struct {
+    int node; // < 0 until the cache is bound to the thread's NVM node
+    pmalloc_tcache_bin_t bins[PMALLOC_NUM_CLASSES];
+} pmalloc_tcache_t;
+
+static uint8_t* chunk_map[1 << PMALLOC_MAP_ROOT_BITS];
+static pmalloc_arena_t* arenas;
+static int num_arenas;
+static pmalloc_hugepages_t hugepages = PMALLOC_HUGEPAGES_THP;
+static pthread_once_t arenas_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread pmalloc_tcache_t tcache = { -1 };
+
+static inline int size_class(size_t size)
+{
+    int lg;
+
+    if (size <= 128) {
+        return size ? (int) ((size + 15) >> 4) - 1 : 0;
+    }
+    // four classes per power of two above 128 bytes
+    lg = 63 - __builtin_clzl(size - 1);
+    return 8 + (lg - 7) * 4 + (int) ((size - 1) >> (lg - 2)) - 4;
+}
+
+static inline size_t class_size(int c)
+{
+    if (c < 8) {
+        return (size_t) (c + 1) * 16;
+    }
+    return (size_t) ((c - 8) % 4 + 5) << (7 + (c - 8) / 4 - 2);
+}
+
+static inline int tcache_limit(int c)
+{
+    size_t n = PMALLOC_TCACHE_BYTES / class_size(c);
+    return n < 2 ? 2 : (n > PMALLOC_TCACHE_MAX ? PMALLOC_TCACHE_MAX : (int) n);
+}
+
+static inline pmalloc_chunk_t* chunk_of(void* ptr)
+{
+    return (pmalloc_chunk_t*) ((uintptr_t) ptr & ~((uintptr_t) PMALLOC_CHUNK_SIZE - 1));
+}
+
+static void chunk_map_set(uintptr_t addr, uint8_t val)
+{
+    uintptr_t root = addr >> PMALLOC_MAP_LEAF_BITS;
+    uint8_t* leaf;
+    uint8_t* expected = NULL;
+
+    if (root >= (1 << PMALLOC_MAP_ROOT_BITS)) {
+        DBG_LOG(ERROR, "pmalloc chunk 0x%lx is out of the supported address range\n", addr << PMALLOC_CHUNK_SHIFT);
+        return;
+    }
+    if ((leaf = __atomic_load_n(&chunk_map[root], __ATOMIC_ACQUIRE)) == NULL) {
+        // not malloc, we may be serving malloc
+        leaf = mmap(NULL, 1 << PMALLOC_MAP_LEAF_BITS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (leaf == MAP_FAILED) {
+            DBG_LOG(ERROR, "Cannot map the pmalloc chunk table\n");
+            return;
+        }
+        if (!__atomic_compare_exchange_n(&chunk_map[root], &expected, leaf, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            munmap(leaf, 1 << PMALLOC_MAP_LEAF_BITS);
+            leaf = expected;
+        }
+    }
+    __atomic_store_n(&leaf[addr & ((1 << PMALLOC_MAP_LEAF_BITS) - 1)], val, __ATOMIC_RELEASE);
+}
+
+// marks, or unmarks, the chunks a mapping of size bytes at chunk spans;
+// when marking, the header must be written
+static void chunk_map_mark(void* chunk, size_t size, int mapped)
+{
+    uintptr_t addr = (uintptr_t) chunk >> PMALLOC_CHUNK_SHIFT;
+    uintptr_t end = ((uintptr_t) chunk + size + PMALLOC_CHUNK_SIZE - 1) >> PMALLOC_CHUNK_SHIFT;
+    uint8_t flags = 0;
+
+    if (mapped && ((pmalloc_chunk_t*) chunk)->dram_weight) {
+        flags = PMALLOC_MAP_INTERLEAVED;
+    }
+    chunk_map_set(addr, mapped ? PMALLOC_MAP_START | flags : 0);
+    for (addr++; addr < end; addr++) {
+        chunk_map_set(addr, mapped ? PMALLOC_MAP_CONT | flags : 0);
+    }
+}
+
+static inline uint8_t chunk_map_get(uintptr_t addr)
+{
+    uintptr_t root = addr >> PMALLOC_MAP_LEAF_BITS;
+    uint8_t* leaf;
+
+    if (root >= (1 << PMALLOC_MAP_ROOT_BITS)) {
+        return 0;
+    }
+    if ((leaf = __atomic_load_n(&chunk_map[root], __ATOMIC_ACQUIRE)) == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(&leaf[addr & ((1 << PMALLOC_MAP_LEAF_BITS) - 1)], __ATOMIC_ACQUIRE);
+}
+
+int pmalloc_owns(void* ptr)
+{
+    return (chunk_map_get((uintptr_t) ptr >> PMALLOC_CHUNK_SHIFT) & PMALLOC_MAP_KIND) == PMALLOC_MAP_START;
+}
+
+int pmalloc_for_each_chunk(int (*fn)(void* addr, void* arg), void* arg)
+{
+    uintptr_t root, i;
+    uint8_t* leaf;
+    uint8_t val;
+    int ret;
+
+    for (root = 0; root < (1 << PMALLOC_MAP_ROOT_BITS); root++) {
+        if ((leaf = __atomic_load_n(&chunk_map[root], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+        for (i = 0; i < (1 << PMALLOC_MAP_LEAF_BITS); i++) {
+            val = __atomic_load_n(&leaf[i], __ATOMIC_ACQUIRE);
+            if (val && !(val & PMALLOC_MAP_INTERLEAVED) &&
+                (ret = fn((void*) (((root << PMALLOC_MAP_LEAF_BITS) | i) << PMALLOC_CHUNK_SHIFT), arg)) != E_SUCCESS)
+            {
+                return ret;
+            }
+        }
+    }
+    return E_SUCCESS;
+}
+
+static inline void arena_lock(pmalloc_arena_t* arena)
+{
+    if (__lib_pthread_mutex_lock == NULL) {
+        init_interposition();
+    }
+    __lib_pthread_mutex_lock(&arena->mutex);
+}
+
+static inline void arena_unlock(pmalloc_arena_t* arena)
+{
+    __lib_pthread_mutex_unlock(&arena->mutex);
+}
+
+// reserves size bytes of address space aligned to PMALLOC_CHUNK_SIZE
+static void* reserve_aligned(size_t size, int prot)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    char* addr;
+    uintptr_t aligned;
+
+    addr = mmap(NULL, size + PMALLOC_CHUNK_SIZE, prot, flags, -1, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = ((uintptr_t) addr + PMALLOC_CHUNK_SIZE - 1) & ~((uintptr_t) PMALLOC_CHUNK_SIZE - 1);
+    if (aligned > (uintptr_t) addr) {
+        munmap(addr, aligned - (uintptr_t) addr);
+    }
+    munmap((char*) aligned + size, (uintptr_t) addr + PMALLOC_CHUNK_SIZE - aligned);
+    return (void*) aligned;
+}
+
+static void bind_region(void* addr, size_t size, int node)
+{
+    if (hugepages == PMALLOC_HUGEPAGES_THP) {
+        madvise(addr, size, MADV_HUGEPAGE);
+    }
+    numa_tonode_memory(addr, size, node);
+}
+
+// binds a whole interleaved block with a single policy, so that it stays a
+// single mapping mremap() can grow. The kernel picks the node of a page from
+// its offset in the mapping, so the pattern survives resizing; unequal
+// weights need the kernel's weighted interleaving, and 1:1 is the fallback
+static void interleave_region(pmalloc_chunk_t* chunk, size_t size, int dram_node, int nvm_node,
+                              int dram_weight, int nvm_weight)
+{
+    static int warned = 0;
+    struct bitmask* nodemask = numa_allocate_nodemask();
+
+    // huge pages would put whole runs of the pattern on one node
+    madvise(chunk, size, MADV_NOHUGEPAGE);
+    numa_bitmask_setbit(nodemask, dram_node);
+    numa_bitmask_setbit(nodemask, nvm_node);
+    if (dram_weight == nvm_weight ||
+        set_node_interleave_weights(dram_node, nvm_node, dram_weight, nvm_weight) != E_SUCCESS ||
+        mbind(chunk, size, MPOL_WEIGHTED_INTERLEAVE, nodemask->maskp, nodemask->size + 1, 0) != 0)
+    {
+        if (dram_weight != nvm_weight && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+            DBG_LOG(WARNING, "No weighted interleaving, pmalloc_interleave() interleaves pages 1:1\n");
+        }
+        mbind(chunk, size, MPOL_INTERLEAVE, nodemask->maskp, nodemask->size + 1, 0);
+    }
+    numa_free_nodemask(nodemask);
+}
+
+// maps size bytes aligned to PMALLOC_CHUNK_SIZE and binds them to the node
+static void* map_region(size_t size, int node)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    void* addr;
+
+    if (hugepages == PMALLOC_HUGEPAGES_HUGETLB && size % PMALLOC_CHUNK_SIZE == 0) {
+        // huge page mappings are aligned to the huge page size
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            numa_tonode_memory(addr, size, node);
+            return addr;
+        }
+        DBG_LOG(WARNING, "Cannot map huge pages, falling back to transparent huge pages\n");
+        hugepages = PMALLOC_HUGEPAGES_THP;
+    }
+
+    if ((addr = reserve_aligned(size, PROT_READ | PROT_WRITE)) == NULL) {
+        return NULL;
+    }
+    bind_region(addr, size, node);
+    return addr;
+}
+
+static void flush_tcache(void* arg);
+
+static void setup_arenas()
+{
+    int i;
+
+    num_arenas = numa_max_node() + 1;
+    if (!(arenas = calloc(num_arenas, sizeof(*arenas)))) {
+        DBG_LOG(ERROR, "Cannot allocate the NVM arenas\n");
+        num_arenas = 0;
+        return;
+    }
+    for (i = 0; i < num_arenas; i++) {
+        pthread_mutex_init(&arenas[i].mutex, NULL);
+        arenas[i].node = i;
+        arenas[i].next_slab = PMALLOC_SLABS_PER_CHUNK;
+    }
+    // return the objects cached by a thread when it exits
+    pthread_key_create(&tcache_key, flush_tcache);
+}
+
+int init_pmalloc(config_t* cfg)
+{
+    char* str;
+
+    if (__cconfig_lookup_string(cfg, "pmalloc.hugepages", &str) == CONFIG_TRUE) {
+        if (strcmp(str, "none") == 0) {
+            hugepages = PMALLOC_HUGEPAGES_NONE;
+        } else if (strcmp(str, "thp") == 0) {
+            hugepages = PMALLOC_HUGEPAGES_THP;
+        } else if (strcmp(str, "hugetlb") == 0) {
+            hugepages = PMALLOC_HUGEPAGES_HUGETLB;
+        } else {
+            DBG_LOG(WARNING, "Unknown pmalloc.hugepages '%s', using thp\n", str);
+        }
+    }
+    pthread_once(&arenas_once, setup_arenas);
+    return num_arenas ? E_SUCCESS : E_NOMEM;
+}
+
+// must be called with the arena lock held
+static int new_slab(pmalloc_arena_t* arena, int c)
+{
+    pmalloc_bin_t* bin = &arena->bins[c];
+    size_t size = class_size(c);
+    int slab;
+
+    if (arena->next_slab == PMALLOC_SLABS_PER_CHUNK) {
+        pmalloc_chunk_t* chunk = map_region(PMALLOC_CHUNK_SIZE, arena->node);
+        if (chunk == NULL) {
+            return E_NOMEM;
+        }
+        chunk->magic = PMALLOC_MAGIC;
+        chunk->kind = PMALLOC_CHUNK_SMALL;
+        chunk->node = arena->node;
+        chunk->size = PMALLOC_CHUNK_SIZE;
+        chunk->dram_weight = 0;
+        chunk_map_mark(chunk, PMALLOC_CHUNK_SIZE, 1);
+        arena->chunk = chunk;
+        arena->next_slab = 1; // the first slab holds the header
+    }
+    slab = arena->next_slab++;
+    arena->chunk->slab_class[slab] = c;
+    bin->bump = (char*) arena->chunk + slab * PMALLOC_SLAB_SIZE;
+    bin->bump_end = bin->bump + (PMALLOC_SLAB_SIZE / size) * size;
+    return E_SUCCESS;
+}
+
+// moves up to count objects of class c from the arena to the thread cache
+static void refill_tcache(pmalloc_arena_t* arena, int c, int count)
+{
+    pmalloc_bin_t* bin = &arena->bins[c];
+    pmalloc_tcache_bin_t* tbin = &tcache.bins[c];
+    size_t size = class_size(c);
+    pmalloc_free_t* obj;
+
+    arena_lock(arena);
+    while (count > 0) {
+        if (bin->free) {
+            obj = bin->free;
+            bin->free = obj->next;
+        } else {
+            if (bin->bump == bin->bump_end && new_slab(arena, c) != E_SUCCESS) {
+                break;
+            }
+            obj = (pmalloc_free_t*) bin->bump;
+            bin->bump += size;
+        }
+        obj->next = tbin->head;
+        tbin->head = obj;
+        tbin->count++;
+        count--;
+    }
+    arena_unlock(arena);
+}
+
+// returns count objects of class c from the thread cache to the arena
+static void drain_tcache(int c, int count)
+{
+    pmalloc_tcache_bin_t* tbin = &tcache.bins[c];
+    pmalloc_bin_t* bin = &arenas[tcache.node].bins[c];
+    pmalloc_free_t* obj;
+
+    arena_lock(&arenas[tcache.node]);
+    while (count-- > 0 && (obj = tbin->head)) {
+        tbin->head = obj->next;
+        tbin->count--;
+        obj->next = bin->free;
+        bin->free = obj;
+    }
+    arena_unlock(&arenas[tcache.node]);
+}
+
+static void flush_tcache(void* arg)
+{
+    int c;
+
+    for (c = 0; c < PMALLOC_NUM_CLASSES; c++) {
+        if (tcache.bins[c].count) {
+            drain_tcache(c, tcache.bins[c].count);
+        }
+    }
+    tcache.node = -1;
+}
+
+static size_t large_mapping_size(size_t size)
+{
+    size_t mapped = (size + PMALLOC_LARGE_OFFSET + PMALLOC_LARGE_OFFSET - 1) & ~((size_t) PMALLOC_LARGE_OFFSET - 1);
+
+    if (hugepages == PMALLOC_HUGEPAGES_HUGETLB) {
+        mapped = (mapped + PMALLOC_CHUNK_SIZE - 1) & ~((size_t) PMALLOC_CHUNK_SIZE - 1);
+    }
+    return mapped;
+}
+
+static void* alloc_large(size_t size, int node)
+{
+    size_t mapped = large_mapping_size(size);
+    pmalloc_chunk_t* chunk;
+
+    if ((chunk = map_region(mapped, node)) == NULL) {
+        return NULL;
+    }
+    chunk->magic = PMALLOC_MAGIC;
+    chunk->kind = PMALLOC_CHUNK_LARGE;
+    chunk->node = node;
+    chunk->size = mapped;
+    chunk->dram_weight = 0;
+    chunk_map_mark(chunk, mapped, 1);
+    return (char*) chunk + PMALLOC_LARGE_OFFSET;
+}
 
 void* pmalloc(size_t size)
 {
-    thread_t* thread = thread_self();
+    pmalloc_tcache_bin_t* tbin;
+    pmalloc_free_t* obj;
+    int c;
 
-    if (thread == NULL) {
-    	// FIXME: JVM for instance create threads using a mechanism not traced by this emulator
-    	//        for now we make sure the current thread is registered right when it makes the
-    	//        first explicit NVM allocation. A better solution is to trace the thread creation
-    	//        done by JVM.
-        register_self();
-        thread = thread_self();
+    if (tcache.node < 0) {
+        pthread_once(&arenas_once, setup_arenas);
+        if ((tcache.node = nvram_node_self()) < 0 || tcache.node >= num_arenas) {
+            tcache.node = -1;
+            return NULL;
+        }
+        pthread_setspecific(tcache_key, &tcache);
     }
 
-    if (thread) {
-        return numa_alloc_onnode(size, thread->virtual_node->nvram_node->node_id);
+    if (size > PMALLOC_MAX_SMALL_SIZE) {
+        return alloc_large(size, tcache.node);
+    }
+
+    c = size_class(size);
+    tbin = &tcache.bins[c];
+    if (tbin->head == NULL) {
+        refill_tcache(&arenas[tcache.node], c, (tcache_limit(c) + 1) / 2);
+        if (tbin->head == NULL) {
+            return NULL;
+        }
+    }
+    obj = tbin->head;
+    tbin->head = obj->next;
+    tbin->count--;
+    return obj;
+}
+
+void* pmalloc_interleave(size_t size, int dram_weight, int nvm_weight)
+{
+    size_t mapped = (size + PMALLOC_LARGE_OFFSET + PMALLOC_PAGE_SIZE - 1) & ~((size_t) PMALLOC_PAGE_SIZE - 1);
+    pmalloc_chunk_t* chunk;
+    int node, dram_node;
+
+    if (dram_weight < 0 || nvm_weight < 0 || dram_weight > 255 || nvm_weight > 255 ||
+        dram_weight + nvm_weight == 0)
+    {
+        return NULL;
+    }
+    if (dram_weight == 0) {
+        return pmalloc(size);
+    }
+    if ((node = nvram_node_self()) < 0 || (dram_node = dram_node_self()) < 0) {
+        return NULL;
+    }
+    pthread_once(&arenas_once, setup_arenas);
+
+    // bound before the header is written, the header page included
+    if ((chunk = reserve_aligned(mapped, PROT_READ | PROT_WRITE)) == NULL) {
+        return NULL;
+    }
+    interleave_region(chunk, mapped, dram_node, node, dram_weight, nvm_weight);
+    chunk->dram_node = dram_node;
+    chunk->dram_weight = dram_weight;
+    chunk->nvm_weight = nvm_weight;
+    chunk->node = node;
+    chunk->magic = PMALLOC_MAGIC;
+    chunk->kind = PMALLOC_CHUNK_LARGE;
+    chunk->size = mapped;
+    chunk_map_mark(chunk, mapped, 1);
+    return (char*) chunk + PMALLOC_LARGE_OFFSET;
+}
+
+void* pmalloc_aligned(size_t alignment, size_t size)
+{
+    if (alignment <= 16) {
+        return pmalloc(size);
+    }
+    if (alignment > PMALLOC_LARGE_OFFSET) {
+        return NULL;
+    }
+    // power of two classes are aligned to their size since slabs are, and
+    // large blocks are page aligned
+    if (size < alignment) {
+        size = alignment;
+    }
+    if (size <= PMALLOC_MAX_SMALL_SIZE && (size & (size - 1))) {
+        size = 1UL << (64 - __builtin_clzl(size));
+    }
+    return pmalloc(size);
+}
+
+size_t pmalloc_usable_size(void* ptr)
+{
+    pmalloc_chunk_t* chunk = chunk_of(ptr);
+
+    if (!pmalloc_owns(ptr)) {
+        return 0;
+    }
+    if (chunk->kind == PMALLOC_CHUNK_LARGE) {
+        return chunk->size - PMALLOC_LARGE_OFFSET;
+    }
+    return class_size(chunk->slab_class[((char*) ptr - (char*) chunk) / PMALLOC_SLAB_SIZE]);
+}
+
+// resizes a large block without copying its pages, returns NULL if the
+// kernel cannot remap it
+static void* resize_large(pmalloc_chunk_t* chunk, size_t new_size)
+{
+    size_t mapped = large_mapping_size(new_size);
+    void* old_addr = chunk;
+    char* addr;
+    void* target;
+
+    if (mapped <= chunk->size) {
+        if (mapped < chunk->size) {
+            chunk_map_mark(chunk, chunk->size, 0);
+            munmap((char*) chunk + mapped, chunk->size - mapped);
+            chunk->size = mapped;
+            chunk_map_mark(chunk, mapped, 1);
+        }
+        return (char*) chunk + PMALLOC_LARGE_OFFSET;
+    }
+
+    // grow in place if the address space after the block is free
+    addr = mremap(chunk, chunk->size, mapped, 0);
+    if (addr == MAP_FAILED) {
+        if ((target = reserve_aligned(mapped, PROT_NONE)) == NULL) {
+            return NULL;
+        }
+        addr = mremap(chunk, chunk->size, mapped, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+        if (addr == MAP_FAILED) {
+            munmap(target, mapped);
+            return NULL;
+        }
+    }
+    chunk = (pmalloc_chunk_t*) addr;
+    // the header moved along with the block
+    chunk_map_mark(old_addr, chunk->size, 0);
+    chunk_map_mark(chunk, mapped, 1);
+    // pages of the grown range are not faulted yet, bind them before they
+    // are; the policy of the whole block is set again so it stays one mapping
+    if (chunk->dram_weight) {
+        interleave_region(chunk, mapped, chunk->dram_node, chunk->node, chunk->dram_weight, chunk->nvm_weight);
     } else {
-    	DBG_LOG(ERROR, "pmalloc called with NULL thread\n");
+        bind_region(addr + chunk->size, mapped - chunk->size, chunk->node);
     }
-    
-    return NULL;
+    chunk->size = mapped;
+    return addr + PMALLOC_LARGE_OFFSET;
 }
 
 void *prealloc(void *old_addr, size_t old_size, size_t new_size)
 {
-    return numa_realloc(old_addr, old_size, new_size);
+    pmalloc_chunk_t* chunk = chunk_of(old_addr);
+    void* new_addr;
+    size_t usable;
+
+    if (old_addr == NULL) {
+        return pmalloc(new_size);
+    }
+    if ((usable = pmalloc_usable_size(old_addr)) == 0) {
+        DBG_LOG(WARNING, "prealloc of %p not allocated by pmalloc\n", old_addr);
+        return NULL;
+    }
+    if (chunk->kind == PMALLOC_CHUNK_LARGE) {
+        if ((new_addr = resize_large(chunk, new_size)) != NULL) {
+            return new_addr;
+        }
+    } else if (usable >= new_size) {
+        return old_addr;
+    }
+    // a copy keeps the interleaving of the block
+    if (chunk->kind == PMALLOC_CHUNK_LARGE && chunk->dram_weight) {
+        new_addr = pmalloc_interleave(new_size, chunk->dram_weight, chunk->nvm_weight);
+    } else {
+        new_addr = pmalloc(new_size);
+    }
+    if (new_addr == NULL) {
+        return NULL;
+    }
+    memcpy(new_addr, old_addr, usable);
+    pfree(old_addr);
+    return new_addr;
 }
 
-void pfree(void* start, size_t size)
+void pfree(void* ptr)
 {
-    numa_free(start, size);
+    pmalloc_chunk_t* chunk = chunk_of(ptr);
+    pmalloc_free_t* obj = ptr;
+    int c;
+
+    if (ptr == NULL) {
+        return;
+    }
+    if (!pmalloc_owns(ptr)) {
+        DBG_LOG(WARNING, "pfree of %p not allocated by pmalloc\n", ptr);
+        return;
+    }
+    if (chunk->kind == PMALLOC_CHUNK_LARGE) {
+        chunk_map_mark(chunk, chunk->size, 0);
+        munmap(chunk, chunk->size);
+        return;
+    }
+
+    c = chunk->slab_class[((char*) ptr - (char*) chunk) / PMALLOC_SLAB_SIZE];
+    if (chunk->node == tcache.node) {
+        pmalloc_tcache_bin_t* tbin = &tcache.bins[c];
+        obj->next = tbin->head;
+        tbin->head = obj;
+        if (++tbin->count > tcache_limit(c)) {
+            drain_tcache(c, tbin->count / 2);
+        }
+    } else {
+        // objects of other nodes go straight back to their arena
+        pmalloc_arena_t* arena = &arenas[chunk->node];
+        arena_lock(arena);
+        obj->next = arena->bins[c].free;
+        arena->bins[c].free = obj;
+        arena_unlock(arena);
+    }
 }
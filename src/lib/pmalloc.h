@@ -28,9 +28,67 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 extern "C" {
 #endif
 
+struct config_t;
+
+int init_pmalloc(struct config_t* cfg);
+
 void *pmalloc(size_t size);
+
+/**
+ * \brief Allocate NVM aligned to alignment, a power of two of at most the
+ * page size. Returns NULL for larger alignments.
+ */
+void *pmalloc_aligned(size_t alignment, size_t size);
+
+/**
+ * \brief Allocate memory whose pages are interleaved between the DRAM and
+ * the NVM of the calling thread's virtual node, dram_weight pages on DRAM
+ * for every nvm_weight pages on NVM (weights up to 255).
+ *
+ * Meant for large buffers that should use the bandwidth of both memories:
+ * the block takes whole base pages. A dram_weight of 0 is the same as
+ * pmalloc(). Free with pfree(); prealloc() keeps the interleaving.
+ *
+ * Unequal weights are set as the kernel's weighted interleaving weights of
+ * the two nodes, which are system wide: they apply to the pages faulted
+ * from then on, in this block and others. Without weighted interleaving
+ * (Linux 6.9) pages are interleaved 1:1.
+ */
+void *pmalloc_interleave(size_t size, int dram_weight, int nvm_weight);
+
+/**
+ * \brief Resize memory returned by pmalloc().
+ *
+ * Small blocks are resized in place when the new size fits their size class.
+ * Large blocks are remapped, so their contents are never copied and stay on
+ * the NVM node they were allocated on. old_size is not needed anymore and is
+ * kept for compatibility.
+ */
 void *prealloc(void *old_addr, size_t old_size, size_t new_size);
-void pfree(void *start, size_t size);
+
+/**
+ * \brief Free memory returned by pmalloc() or prealloc().
+ */
+void pfree(void *ptr);
+
+/**
+ * \brief Returns the number of bytes usable at ptr, 0 if ptr was not
+ * returned by pmalloc().
+ */
+size_t pmalloc_usable_size(void *ptr);
+
+/**
+ * \brief Returns 1 if ptr was returned by pmalloc(), without dereferencing it.
+ */
+int pmalloc_owns(void *ptr);
+
+/**
+ * \brief Calls fn for every 2MB aligned chunk of address space holding NVM
+ * heap memory, in address order. Parts of a chunk may not be mapped. Blocks
+ * of pmalloc_interleave() are left out, their placement is fixed. Stops at
+ * the first call that does not return E_SUCCESS and returns its value.
+ */
+int pmalloc_for_each_chunk(int (*fn)(void *addr, void *arg), void *arg);
 
 #ifdef __cplusplus
 }
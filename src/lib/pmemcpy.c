@@ -0,0 +1,232 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include "cpu/cpu.h"
+#include "monotonic_timer.h"
+#include "pflush.h"
+#include "pmemcpy.h"
+#include "thread.h"
+
+/*
+ * Non-temporal kernels, in the style of the measure_bw.c ones. They write
+ * whole cache lines: dst is aligned to CACHE_LINE_SIZE and bytes is a
+ * multiple of it, src may be unaligned.
+ */
+
+typedef struct {
+    const char* isa;
+    cpu_feature_t feature;
+    void (*copy_nt)(char* dst, const char* src, size_t bytes);
+    void (*set_nt)(char* dst, int c, size_t bytes);
+} pmem_kernel_set_t;
+
+static void copy_nt_sse(char* dst, const char* src, size_t bytes)
+{
+    __m128i* d = (__m128i*) dst;
+    const __m128i* s = (const __m128i*) src;
+    size_t i;
+
+    for (i = 0; i < bytes / sizeof(__m128i); i += 4) {
+        _mm_stream_si128(&d[i], _mm_loadu_si128(&s[i]));
+        _mm_stream_si128(&d[i+1], _mm_loadu_si128(&s[i+1]));
+        _mm_stream_si128(&d[i+2], _mm_loadu_si128(&s[i+2]));
+        _mm_stream_si128(&d[i+3], _mm_loadu_si128(&s[i+3]));
+    }
+}
+
+static void set_nt_sse(char* dst, int c, size_t bytes)
+{
+    __m128i* d = (__m128i*) dst;
+    __m128i val = _mm_set1_epi8((char) c);
+    size_t i;
+
+    for (i = 0; i < bytes / sizeof(__m128i); i++) {
+        _mm_stream_si128(&d[i], val);
+    }
+}
+
+__attribute__((target("avx2")))
+static void copy_nt_avx2(char* dst, const char* src, size_t bytes)
+{
+    __m256i* d = (__m256i*) dst;
+    const __m256i* s = (const __m256i*) src;
+    size_t i;
+
+    for (i = 0; i < bytes / sizeof(__m256i); i += 2) {
+        _mm256_stream_si256(&d[i], _mm256_loadu_si256(&s[i]));
+        _mm256_stream_si256(&d[i+1], _mm256_loadu_si256(&s[i+1]));
+    }
+}
+
+__attribute__((target("avx2")))
+static void set_nt_avx2(char* dst, int c, size_t bytes)
+{
+    __m256i* d = (__m256i*) dst;
+    __m256i val = _mm256_set1_epi8((char) c);
+    size_t i;
+
+    for (i = 0; i < bytes / sizeof(__m256i); i++) {
+        _mm256_stream_si256(&d[i], val);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void copy_nt_avx512(char* dst, const char* src, size_t bytes)
+{
+    __m512i* d = (__m512i*) dst;
+    const __m512i* s = (const __m512i*) src;
+    size_t i;
+
+    for (i = 0; i < bytes / sizeof(__m512i); i++) {
+        _mm512_stream_si512(&d[i], _mm512_loadu_si512(&s[i]));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void set_nt_avx512(char* dst, int c, size_t bytes)
+{
+    __m512i* d = (__m512i*) dst;
+    __m512i val = _mm512_set1_epi32((c & 0xff) * 0x01010101);
+    size_t i;
+
+    for (i = 0; i < bytes / sizeof(__m512i); i++) {
+        _mm512_stream_si512(&d[i], val);
+    }
+}
+
+// ordered from the widest to the narrowest
+static const pmem_kernel_set_t pmem_kernel_sets[] = {
+    {"avx512", CPU_FEATURE_AVX512F, copy_nt_avx512, set_nt_avx512},
+    {"avx2", CPU_FEATURE_AVX2, copy_nt_avx2, set_nt_avx2},
+    {"sse", CPU_FEATURE_SSE4_1, copy_nt_sse, set_nt_sse},
+    {NULL, 0, NULL, NULL}
+};
+
+static const pmem_kernel_set_t* kernels = NULL;
+
+static const pmem_kernel_set_t* kernel_set()
+{
+    const pmem_kernel_set_t* set = __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+
+    if (set == NULL) {
+        for (set = pmem_kernel_sets; set->isa; set++) {
+            if (cpu_has_feature(set->feature)) {
+                break;
+            }
+        }
+        if (set->isa == NULL) {
+            set--; // SSE2 is part of x86-64
+        }
+        __atomic_store_n(&kernels, set, __ATOMIC_RELEASE);
+    }
+    return set;
+}
+
+static inline void account_persist(size_t len)
+{
+#ifdef USE_STATISTICS
+    thread_t* thread = thread_self();
+
+    if (thread) {
+        thread->stats.persist_calls++;
+        thread->stats.persisted_bytes += len;
+    }
+#endif
+}
+
+// splits [dst, dst + len) into a cached head and tail and a body of whole
+// lines; returns the size of the head
+static inline size_t split_lines(char* dst, size_t len, size_t* body)
+{
+    size_t head = (CACHE_LINE_SIZE - ((uintptr_t) dst & (CACHE_LINE_SIZE - 1))) & (CACHE_LINE_SIZE - 1);
+
+    if (head > len) {
+        head = len;
+    }
+    *body = (len - head) & ~((size_t) CACHE_LINE_SIZE - 1);
+    return head;
+}
+
+void *pmemcpy_nt(void *dst, const void *src, size_t len)
+{
+    char* d = dst;
+    const char* s = src;
+    double start = monotonic_time_us();
+    size_t head, body, tail;
+
+    if (len == 0) {
+        return dst;
+    }
+    head = split_lines(d, len, &body);
+    tail = len - head - body;
+    // partial lines go through the cache and are written back
+    if (head) {
+        memcpy(d, s, head);
+        pwb(d);
+    }
+    if (body) {
+        kernel_set()->copy_nt(d + head, s + head, body);
+    }
+    if (tail) {
+        memcpy(d + head + body, s + head + body, tail);
+        pwb(d + head + body);
+    }
+    pdrain_nt(body, (monotonic_time_us() - start) * 1000);
+    account_persist(len);
+    return dst;
+}
+
+void *pmemset_nt(void *dst, int c, size_t len)
+{
+    char* d = dst;
+    double start = monotonic_time_us();
+    size_t head, body, tail;
+
+    if (len == 0) {
+        return dst;
+    }
+    head = split_lines(d, len, &body);
+    tail = len - head - body;
+    if (head) {
+        memset(d, c, head);
+        pwb(d);
+    }
+    if (body) {
+        kernel_set()->set_nt(d + head, c, body);
+    }
+    if (tail) {
+        memset(d + head + body, c, tail);
+        pwb(d + head + body);
+    }
+    pdrain_nt(body, (monotonic_time_us() - start) * 1000);
+    account_persist(len);
+    return dst;
+}
+
+void *pmemmove(void *dst, const void *src, size_t len)
+{
+    uintptr_t d = (uintptr_t) dst;
+    uintptr_t s = (uintptr_t) src;
+
+    if (d + len <= s || s + len <= d) {
+        return pmemcpy_nt(dst, src, len);
+    }
+    // streaming stores could overwrite source bytes not read yet
+    memmove(dst, src, len);
+    pflush_range(dst, len);
+    account_persist(len);
+    return dst;
+}
@@ -0,0 +1,57 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __PMEMCPY_H
+#define __PMEMCPY_H
+
+/**
+ * \file
+ *
+ * \page pmemcpy_api Persistent Memory Copy API
+ *
+ * Bulk writes to NVM. The destination is written with non-temporal stores,
+ * which bypass the caches, so no cache line has to be flushed: data is
+ * persistent when the function returns, after a single fence. The emulated
+ * cost is one write latency plus the time the write pending queue needs to
+ * absorb the data at latency.write_bw, or without it the time to write the
+ * data at bandwidth.write or the measured NVM write bandwidth.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Copy len bytes from src to NVM at dst and persist them.
+ * The ranges must not overlap.
+ */
+void *pmemcpy_nt(void *dst, const void *src, size_t len);
+
+/**
+ * \brief Fill len bytes of NVM at dst with c and persist them.
+ */
+void *pmemset_nt(void *dst, int c, size_t len);
+
+/**
+ * \brief Like pmemcpy_nt(), but the ranges may overlap. Overlapping moves
+ * go through the caches and write the lines back.
+ */
+void *pmemmove(void *dst, const void *src, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PMEMCPY_H */
@@ -18,42 +18,266 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  *      Author: root
  */
 
-
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "model.h"
 #include "error.h"
+#include "process_rank.h"
 
 #define EMUL_LOCAL_PROCESSES_VAR "EMUL_LOCAL_PROCESSES"
-
-#define EMUL_LOCK_FILE "/tmp/emul_lock_file"
-#define EMUL_PROCESS_LOCAL_RANK_FILE "/tmp/emul_process_local_rank"
-#define LOCKED_WAIT_US 1000
-#define MAX_LOCKED_RETRIES 50
+#define EMUL_RANK_SEGMENT_VAR "EMUL_RANK_SEGMENT"
 
 extern latency_model_t latency_model;
 
+static rank_segment_t* segment = NULL;
+static uint64_t owner_self = 0; // the slot value of this process
+
+// start time of the process in clock ticks since boot, 0 if it is gone
+static uint64_t process_start_time(pid_t pid)
+{
+    char path[32];
+    char buf[512];
+    char* p;
+    unsigned long long start_time = 0;
+    ssize_t len;
+    int fd, field;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return 0;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    // the command name may hold spaces and parentheses, fields start after the last ')'
+    if ((p = strrchr(buf, ')')) == NULL) {
+        return 0;
+    }
+    for (field = 2; field < 22 && p; field++) {
+        p = strchr(p + 1, ' ');
+    }
+    if (p == NULL || sscanf(p, "%llu", &start_time) != 1) {
+        return 0;
+    }
+    return start_time;
+}
+
+static uint64_t owner_of(pid_t pid, uint64_t start_time)
+{
+    return (uint32_t) pid | (start_time << 32);
+}
+
+// Signals tell cheaply whether the pid still runs; only a check of its
+// start time tells whether the pid was reused since the slot was claimed
+static int owner_alive(uint64_t owner, int check_start_time)
+{
+    pid_t pid = (pid_t) (uint32_t) owner;
+
+    if (kill(pid, 0) < 0) {
+        return 0;
+    }
+    return !check_start_time || owner_of(pid, process_start_time(pid)) == owner;
+}
+
+static rank_segment_t* map_segment()
+{
+    char name[256];
+    const char* override = getenv(EMUL_RANK_SEGMENT_VAR);
+    rank_segment_t* seg;
+    uint32_t magic = 0;
+    int fd;
+
+    // separate groups of processes, or tests, can use their own table
+    if (override && override[0]) {
+        snprintf(name, sizeof(name), "%s", override);
+    } else {
+        snprintf(name, sizeof(name), RANK_SEGMENT_NAME, (int) getuid());
+    }
+    // every process may be the first, all of them size the segment the
+    // same and a new one reads as zeros, which is all slots free
+    if ((fd = shm_open(name, O_RDWR | O_CREAT, 0600)) < 0) {
+        DBG_LOG(WARNING, "Cannot open shared memory segment %s\n", name);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(rank_segment_t)) < 0 ||
+        (seg = mmap(NULL, sizeof(rank_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        DBG_LOG(WARNING, "Cannot map shared memory segment %s\n", name);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    if (!__atomic_compare_exchange_n(&seg->magic, &magic, RANK_SEGMENT_MAGIC, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE) && magic != RANK_SEGMENT_MAGIC)
+    {
+        DBG_LOG(WARNING, "Shared memory segment %s has an unknown layout, remove it\n", name);
+        munmap(seg, sizeof(rank_segment_t));
+        return NULL;
+    }
+    return seg;
+}
+
+// takes the slot unless a live process holds it, returns whether it did
+static int claim_slot(int rank, int check_start_time)
+{
+    uint64_t owner = __atomic_load_n(&segment->owner[rank], __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        if (owner == owner_self) {
+            return 1;
+        }
+        if (owner && owner_alive(owner, check_start_time)) {
+            return 0;
+        }
+        if (owner) {
+            DBG_LOG(DEBUG, "taking over local rank %d of exited process %d\n", rank, (int) (uint32_t) owner);
+        }
+        // on failure another process changed the slot first, owner is its new value
+        if (__atomic_compare_exchange_n(&segment->owner[rank], &owner, owner_self, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+}
+
+static int claim_rank(int max_ranks, int check_start_time)
+{
+    int rank;
+
+    for (rank = 0; rank < max_ranks; rank++) {
+        if (claim_slot(rank, check_start_time)) {
+            return rank;
+        }
+    }
+    return -1;
+}
+
+static int parse_count(const char* str, int* value)
+{
+    char* end;
+    long v;
+
+    if (str == NULL) {
+        return E_INVAL;
+    }
+    v = strtol(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || v < 0 || v > 0x7fffffff) {
+        return E_INVAL;
+    }
+    *value = (int) v;
+    return E_SUCCESS;
+}
+
+// SLURM_STEP_TASKS_PER_NODE lists the tasks of every node of the step, as
+// in "4(x2),3": two nodes with 4 tasks, then one with 3
+static int slurm_local_size(int* size)
+{
+    const char* tasks = getenv("SLURM_STEP_TASKS_PER_NODE");
+    int node_id, count, repeat, n;
+
+    if (tasks == NULL) {
+        tasks = getenv("SLURM_TASKS_PER_NODE");
+    }
+    if (tasks == NULL || parse_count(getenv("SLURM_NODEID"), &node_id) != E_SUCCESS) {
+        return E_NOENT;
+    }
+    while (*tasks) {
+        if (sscanf(tasks, "%d%n", &count, &n) != 1) {
+            return E_INVAL;
+        }
+        tasks += n;
+        repeat = 1;
+        if (sscanf(tasks, "(x%d)%n", &repeat, &n) == 1) {
+            tasks += n;
+        }
+        if (node_id < repeat) {
+            *size = count;
+            return E_SUCCESS;
+        }
+        node_id -= repeat;
+        if (*tasks == ',') {
+            tasks++;
+        }
+    }
+    return E_NOENT;
+}
+
+// node local rank and size variables of the common launchers, in the order
+// they are looked for
+static const struct {
+    const char* rank;
+    const char* size;
+    int job_wide; // the rank is job wide and the size is not the local one
+} launcher_vars[] = {
+    { "OMPI_COMM_WORLD_LOCAL_RANK", "OMPI_COMM_WORLD_LOCAL_SIZE", 0 }, // Open MPI
+    { "MV2_COMM_WORLD_LOCAL_RANK", "MV2_COMM_WORLD_LOCAL_SIZE", 0 },   // MVAPICH2
+    { "MPI_LOCALRANKID", "MPI_LOCALNRANKS", 0 },                       // MPICH, Intel MPI
+    { "SLURM_LOCALID", NULL, 0 },                                      // srun
+    { "PMI_RANK", NULL, 1 },  // PMI_SIZE counts all nodes, only right for single node jobs
+    { NULL, NULL, 0 }
+};
+
+/**
+ * \brief Reads the local rank and size the launcher gave the process, the
+ * size is 0 if it did not give one
+ */
+static int launcher_local_rank(int* rank, int* size)
+{
+    int i;
+
+    for (i = 0; launcher_vars[i].rank; i++) {
+        if (parse_count(getenv(launcher_vars[i].rank), rank) != E_SUCCESS) {
+            continue;
+        }
+        if (launcher_vars[i].job_wide) {
+            // only EMUL_LOCAL_PROCESSES can tell how many of them run here
+            *size = 0;
+        } else if (launcher_vars[i].size) {
+            if (parse_count(getenv(launcher_vars[i].size), size) != E_SUCCESS) {
+                *size = 0;
+            }
+        } else if (slurm_local_size(size) != E_SUCCESS) {
+            *size = 0;
+        }
+        DBG_LOG(INFO, "local rank %d of %d from %s\n", *rank, *size, launcher_vars[i].rank);
+        return E_SUCCESS;
+    }
+    return E_NOENT;
+}
+
 int set_process_local_rank()
 {
-    FILE *flock = NULL;
-    FILE *fcounter = NULL;
-    int expired = 0;
-    int process_id = 0;
     char *processes;
-    int ret = E_SUCCESS;
+    int rank = -1;
+    int launcher_size = 0;
 #ifndef NDEBUG
     char hname[64];
 #endif
 
+    if (launcher_local_rank(&rank, &launcher_size) != E_SUCCESS) {
+    	rank = -1;
+    }
     processes = getenv(EMUL_LOCAL_PROCESSES_VAR);
 
-    if (!processes) {
-    	DBG_LOG(WARNING, "No %s variable set, skipping rank setting\n", EMUL_LOCAL_PROCESSES_VAR);
-    	return E_SUCCESS;
-    } else {
+    // the variable still wins, to run fewer emulated processes than ranks
+    if (processes) {
     	if (sscanf(processes, "%d", &latency_model.max_local_processe_ranks) != 1) {
     		DBG_LOG(WARNING, "Ignoring EMUL_PROCESSES_PER_SYSTEM variable with invalid value '%s'\n", processes);
     		return E_SUCCESS;
     	}
+    } else if (launcher_size > 0) {
+    	latency_model.max_local_processe_ranks = launcher_size;
+    } else {
+    	DBG_LOG(WARNING, "No %s variable set, skipping rank setting\n", EMUL_LOCAL_PROCESSES_VAR);
+    	return E_SUCCESS;
     }
 
     if (latency_model.max_local_processe_ranks < 2) {
@@ -61,121 +285,69 @@ int set_process_local_rank()
     			latency_model.max_local_processe_ranks);
     	return E_SUCCESS;
     }
+    if (latency_model.max_local_processe_ranks > MAX_LOCAL_RANKS) {
+    	DBG_LOG(WARNING, "EMUL_PROCESSES_PER_SYSTEM value %d limited to %d\n",
+    			latency_model.max_local_processe_ranks, MAX_LOCAL_RANKS);
+    	latency_model.max_local_processe_ranks = MAX_LOCAL_RANKS;
+    }
 
     DBG_LOG(DEBUG, "setting process local rank for %d local processes\n",
     		latency_model.max_local_processe_ranks);
 
-    while (expired < MAX_LOCKED_RETRIES) {
-    	// open lock file on exclusive mode
-        flock = fopen(EMUL_LOCK_FILE, "wx");
-
-        if (flock == NULL) {
-//        	DBG_LOG(DEBUG, "failed to create lock file\n");
-            usleep(LOCKED_WAIT_US);
-            expired++;
-        }
-        if (flock) break;
-    }
-    if (expired >= MAX_LOCKED_RETRIES) {
+    if (segment == NULL && (segment = map_segment()) == NULL) {
     	DBG_LOG(ERROR, "failed to set process local rank\n");
     	return E_ERROR;
     }
+    owner_self = owner_of(getpid(), process_start_time(getpid()));
 
-    // lock acquired, read process counter file
-    if (access(EMUL_PROCESS_LOCAL_RANK_FILE, R_OK | W_OK) < 0) {
-    	// rank file does not exist, create it and write "1" for next process
-    	// this process rank id is 1
-    	process_id = 1;
-    	fcounter = fopen(EMUL_PROCESS_LOCAL_RANK_FILE, "w");
-    	fwrite(&process_id, sizeof(int), 1, fcounter);
-    	fclose(fcounter);
-    } else {
-    	// rank file exists, read the current rank max value and use it as this process local
-    	// rank id and increment the value in the rank file for the next process
-    	fcounter = fopen(EMUL_PROCESS_LOCAL_RANK_FILE, "r+");
-    	if (fread(&process_id, sizeof(int), 1, fcounter) == 0) {
-    	    abort();
-    	}
-    	DBG_LOG(DEBUG, "read from file current max rank %d\n", process_id);
-    	latency_model.process_local_rank = process_id;
-    	process_id++;
-    	if (process_id >= latency_model.max_local_processe_ranks) {
-    	    DBG_LOG(ERROR, "process rank %d exceeded limit of %d max emulated processes\n",
-    	        process_id, latency_model.max_local_processe_ranks);
-    	    fclose(fcounter);
-    	    ret = E_ERROR;
-    	} else {
-    	    DBG_LOG(DEBUG, "write to file new max rank %d\n", process_id);
-    	    rewind(fcounter);
-            fwrite(&process_id, sizeof(int), 1, fcounter);
-            fclose(fcounter);
-        }
+    // the launcher rank places the process the same way on every run, as
+    // long as no other emulated process holds it
+    if (rank >= latency_model.max_local_processe_ranks) {
+    	DBG_LOG(WARNING, "launcher local rank %d exceeds %d local processes, ignoring it\n",
+    			rank, latency_model.max_local_processe_ranks);
+    	rank = -1;
     }
-
-    // close and delete lock file
-    fclose(flock);
-    remove(EMUL_LOCK_FILE);
+    if (rank >= 0 && !claim_slot(rank, 0) && !claim_slot(rank, 1)) {
+    	DBG_LOG(WARNING, "launcher local rank %d is held by another emulated process, using a free one\n",
+    			rank);
+    	rank = -1;
+    }
+    // reused pids are rare and costly to find, look for them last
+    if (rank < 0 &&
+        (rank = claim_rank(latency_model.max_local_processe_ranks, 0)) < 0 &&
+        (rank = claim_rank(latency_model.max_local_processe_ranks, 1)) < 0)
+    {
+    	DBG_LOG(ERROR, "all %d local ranks are taken by running emulated processes\n",
+    			latency_model.max_local_processe_ranks);
+    	return E_ERROR;
+    }
+    latency_model.process_local_rank = rank;
 
 #ifndef NDEBUG
     gethostname(hname, sizeof(hname));
     DBG_LOG(DEBUG, "process local rank is %d on system %s\n", latency_model.process_local_rank, hname);
 #endif
 
-    return ret;
+    return E_SUCCESS;
 }
 
 int unset_process_local_rank()
 {
-    FILE *flock = NULL;
-    FILE *fcounter = NULL;
-    int expired = 0;
-    int process_id;
+    uint64_t owner = owner_self;
 
-    if (latency_model.max_local_processe_ranks < 2) {
+    if (latency_model.max_local_processe_ranks < 2 || segment == NULL) {
     	return E_SUCCESS;
     }
 
-    DBG_LOG(DEBUG, "Unsetting process local rank\n");
-
-    while (expired < MAX_LOCKED_RETRIES) {
-    	// open lock file on Exclusive mode
-        flock = fopen(EMUL_LOCK_FILE, "wx");
-
-        if (flock == NULL) {
-//        	DBG_LOG(DEBUG, "failed to create lock file\n");
-            usleep(LOCKED_WAIT_US);
-            expired++;
-        }
-        if (flock) break;
-    }
-    if (expired >= MAX_LOCKED_RETRIES) {
-    	DBG_LOG(ERROR, "failed to unset process local rank\n");
-    	return E_ERROR;
-    }
+    DBG_LOG(DEBUG, "Unsetting process local rank %d\n", latency_model.process_local_rank);
 
-    // lock acquired, read process counter file
-    if (access(EMUL_PROCESS_LOCAL_RANK_FILE, R_OK | W_OK) == 0) {
-    	// if rank file does not exist, nothing to be done
-    	// file exists, read the current value and decrement it
-    	fcounter = fopen(EMUL_PROCESS_LOCAL_RANK_FILE, "r+");
-    	if (fread(&process_id, sizeof(int), 1, fcounter) == 0) {
-    	    abort();
-    	}
-    	DBG_LOG(DEBUG, "Exiting process and reading current rank max %d\n", process_id);
-    	if (process_id > 0) process_id--;
-    	{
-    	char hname[64];
-    	gethostname(hname, sizeof(hname));
-    	DBG_LOG(DEBUG, "Exiting process and writing new rank max %d on %s\n", process_id, hname);
-    	}
-    	rewind(fcounter);
-		fwrite(&process_id, sizeof(int), 1, fcounter);
-		fclose(fcounter);
+    // a forked child inherits the rank but does not own it
+    if (owner_self != owner_of(getpid(), process_start_time(getpid())) ||
+        !__atomic_compare_exchange_n(&segment->owner[latency_model.process_local_rank], &owner, 0, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+    	DBG_LOG(DEBUG, "local rank %d is not owned by this process\n", latency_model.process_local_rank);
     }
 
-    // close and delete lock file
-    fclose(flock);
-    remove(EMUL_LOCK_FILE);
-
     return E_SUCCESS;
 }
@@ -0,0 +1,59 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __PROCESS_RANK_H
+#define __PROCESS_RANK_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Local ranks of the emulated processes of a system
+ *
+ * Processes sharing the system partition its CPUs by local rank. Ranks are
+ * the slots of a table in a shared memory segment, one per user, that a
+ * process claims with a compare-and-swap of its pid and start time: no
+ * lock, so no lock left behind either. A process that exits frees its
+ * slot; the slot of a process that died without doing so is taken over by
+ * the next process that finds it, after checking the owner is gone. The
+ * lowest free rank is taken, so ranks stay dense as processes come and go.
+ *
+ * Under an MPI launcher or srun the process takes the node local rank the
+ * launcher gave it instead, so placement does not depend on which process
+ * starts first, and the local size comes from the launcher when
+ * EMUL_LOCAL_PROCESSES is not set.
+ *
+ * EMUL_RANK_SEGMENT names another segment, to keep a group of processes
+ * apart from the others of the user.
+ */
+
+#define RANK_SEGMENT_NAME "/quartz.ranks.%d" // uid
+#define RANK_SEGMENT_MAGIC 0x514b4e52u
+#define MAX_LOCAL_RANKS 1024
+
+typedef struct {
+    uint32_t magic;
+    // pid in the low half, low half of the start time in the high half,
+    // 0 when free
+    uint64_t owner[MAX_LOCAL_RANKS];
+} rank_segment_t;
+
+/**
+ * \brief Claims a local rank for the calling process if EMUL_LOCAL_PROCESSES
+ * or the launcher asks for more than one process
+ */
+int set_process_local_rank();
+int unset_process_local_rank();
+
+#endif /* __PROCESS_RANK_H */
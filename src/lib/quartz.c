@@ -0,0 +1,93 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include "quartz.h"
+#include "error.h"
+#include "model.h"
+#include "pflush.h"
+#include "roi.h"
+#include "thread.h"
+
+/**
+ * \file
+ *
+ * The library side of the application API in quartz.h
+ */
+
+static void close_epoch()
+{
+    if (latency_model.enabled && reached_min_epoch_duration(thread_self())) {
+        create_latency_epoch();
+    }
+}
+
+void __quartz_pause(void)
+{
+    close_epoch();
+    if (__atomic_add_fetch(&latency_model.paused, 1, __ATOMIC_RELAXED) == 1) {
+        DBG_LOG(INFO, "Emulation paused\n");
+    }
+    pflush_pause(1);
+}
+
+void __quartz_resume(void)
+{
+    int paused;
+
+    // the paused part of the epoch goes without delay
+    close_epoch();
+    paused = __atomic_load_n(&latency_model.paused, __ATOMIC_RELAXED);
+    do {
+        if (paused == 0) {
+            DBG_LOG(WARNING, "quartz_resume() without a matching quartz_pause()\n");
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&latency_model.paused, &paused, paused - 1, 0, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    pflush_pause(0);
+    if (paused == 1) {
+        DBG_LOG(INFO, "Emulation resumed\n");
+    }
+}
+
+int __quartz_set_thread_latency(int read_ns, int write_ns)
+{
+    thread_t* thread;
+
+    if (!latency_model.enabled) {
+        return -1;
+    }
+    if ((thread = thread_self()) == NULL) {
+        if (register_self() != E_SUCCESS || (thread = thread_self()) == NULL) {
+            return -1;
+        }
+    }
+    return set_thread_latency(thread, read_ns, write_ns) == E_SUCCESS ? 0 : -1;
+}
+
+void __quartz_roi_begin(const char* name)
+{
+    close_epoch();
+    roi_begin(name);
+}
+
+void __quartz_roi_end(void)
+{
+    close_epoch();
+    roi_end();
+}
+
+const quartz_thread_info_t* __quartz_thread_info(void)
+{
+    return &quartz_tls_info;
+}
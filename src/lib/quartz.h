@@ -0,0 +1,178 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __QUARTZ_H
+#define __QUARTZ_H
+
+/**
+ * \file
+ *
+ * \page quartz_api Application API
+ *
+ * Lets an application steer the emulation from inside: pause it around
+ * warm-up, give threads their own latencies, measure regions of interest
+ * and read the delay injected into the calling thread.
+ *
+ * Applications only need this header, and libdl before glibc 2.34. The
+ * emulator is usually preloaded, so its functions are looked up at run time
+ * and every call below is a no-op when the program runs without it.
+ *
+ * Changes take effect at latency epoch granularity: the calls close the
+ * current epoch of the thread first, and the epoch in progress when another
+ * thread calls quartz_pause() or quartz_resume() is emulated as it ends.
+ */
+
+#include <dlfcn.h>
+#include <stdint.h>
+
+#ifndef RTLD_DEFAULT
+#define RTLD_DEFAULT ((void*) 0) // glibc only defines it with _GNU_SOURCE
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUARTZ_MAX_ROI_DEPTH 8 // nested regions of interest per thread
+#define QUARTZ_MAX_ROIS 64     // distinct region names per process
+
+typedef struct {
+    uint64_t epochs;         // latency epochs closed by the thread
+    uint64_t stall_cycles;   // NVM stall cycles measured
+    uint64_t delay_cycles;   // delay injected
+    uint64_t delay_ns;
+} quartz_thread_info_t;
+
+// the entry points of the emulator, see quartz.c
+void __quartz_pause(void);
+void __quartz_resume(void);
+int __quartz_set_thread_latency(int read_ns, int write_ns);
+void __quartz_roi_begin(const char* name);
+void __quartz_roi_end(void);
+const quartz_thread_info_t* __quartz_thread_info(void);
+
+/*
+ * Looks an entry point up once. Weak references would do without dlsym(),
+ * but a non-PIE executable has them resolved to 0 at link time, so they
+ * would never reach a preloaded emulator.
+ */
+static inline void* __quartz_entry(void** entry, int* resolved, const char* name)
+{
+    if (!__atomic_load_n(resolved, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(entry, dlsym(RTLD_DEFAULT, name), __ATOMIC_RELAXED);
+        __atomic_store_n(resolved, 1, __ATOMIC_RELEASE);
+    }
+    return __atomic_load_n(entry, __ATOMIC_RELAXED);
+}
+
+typedef void (*__quartz_void_fn)(void);
+typedef int (*__quartz_latency_fn)(int, int);
+typedef void (*__quartz_roi_fn)(const char*);
+typedef const quartz_thread_info_t* (*__quartz_info_fn)(void);
+
+#define __QUARTZ_ENTRY(type, name)                                   \
+    static void* entry;                                              \
+    static int resolved;                                             \
+    type fn = (type) __quartz_entry(&entry, &resolved, #name)
+
+/**
+ * \brief Stops injecting delays in all threads until the matching
+ * quartz_resume(); calls nest
+ */
+static inline void quartz_pause(void)
+{
+    __QUARTZ_ENTRY(__quartz_void_fn, __quartz_pause);
+
+    if (fn) {
+        fn();
+    }
+}
+
+static inline void quartz_resume(void)
+{
+    __QUARTZ_ENTRY(__quartz_void_fn, __quartz_resume);
+
+    if (fn) {
+        fn();
+    }
+}
+
+/**
+ * \brief Emulates the given read and write latencies in ns for the calling
+ * thread instead of the configured ones, 0 restores the configured one
+ *
+ * Returns 0, or -1 if a latency does not exceed the hardware latency of the
+ * thread's virtual node or the emulator is not running.
+ */
+static inline int quartz_set_thread_latency(int read_ns, int write_ns)
+{
+    __QUARTZ_ENTRY(__quartz_latency_fn, __quartz_set_thread_latency);
+
+    if (fn) {
+        return fn(read_ns, write_ns);
+    }
+    return -1;
+}
+
+/**
+ * \brief Marks the start of a region of interest of the calling thread
+ *
+ * Regions may nest. The statistics report sums, per name, the calls, time,
+ * epochs, stall cycles and injected delay between quartz_roi_begin() and
+ * quartz_roi_end() over all threads. Names are compared on their first 63
+ * characters.
+ */
+static inline void quartz_roi_begin(const char* name)
+{
+    __QUARTZ_ENTRY(__quartz_roi_fn, __quartz_roi_begin);
+
+    if (fn) {
+        fn(name);
+    }
+}
+
+/**
+ * \brief Ends the innermost region of interest of the calling thread
+ */
+static inline void quartz_roi_end(void)
+{
+    __QUARTZ_ENTRY(__quartz_void_fn, __quartz_roi_end);
+
+    if (fn) {
+        fn();
+    }
+}
+
+/**
+ * \brief Returns the counters of the calling thread, updated at the end of
+ * its every latency epoch
+ *
+ * The pointer stays valid for the life of the thread, so it can be kept and
+ * read directly. Without the emulator all counters are 0.
+ */
+static inline const quartz_thread_info_t* quartz_thread_info(void)
+{
+    static const quartz_thread_info_t none = {0, 0, 0, 0};
+    __QUARTZ_ENTRY(__quartz_info_fn, __quartz_thread_info);
+
+    if (fn) {
+        return fn();
+    }
+    return &none;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __QUARTZ_H */
@@ -0,0 +1,136 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <pthread.h>
+#include <string.h>
+#include "debug.h"
+#include "interpose.h"
+#include "model.h"
+#include "monotonic_timer.h"
+#include "roi.h"
+
+typedef struct {
+    int roi;         // index in the table, -1 if it was full
+    double start_us;
+    quartz_thread_info_t start;
+} roi_frame_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    roi_stats_t table[QUARTZ_MAX_ROIS];
+    int count;
+    int full_warned;
+} rois = { PTHREAD_MUTEX_INITIALIZER };
+
+// frames of the open regions of the thread, deeper ones are not measured
+// but still counted so the ends match their begins
+static __thread roi_frame_t tls_frames[QUARTZ_MAX_ROI_DEPTH];
+static __thread int tls_depth = 0;
+
+// the caller holds the mutex
+static int find_roi(const char* name)
+{
+    int i;
+
+    for (i = 0; i < rois.count; i++) {
+        if (strncmp(rois.table[i].name, name, ROI_NAME_SIZE - 1) == 0) {
+            return i;
+        }
+    }
+    if (rois.count == QUARTZ_MAX_ROIS) {
+        if (!rois.full_warned) {
+            rois.full_warned = 1;
+            DBG_LOG(WARNING, "More than %d regions of interest, %s and later ones are not measured\n",
+                    QUARTZ_MAX_ROIS, name);
+        }
+        return -1;
+    }
+    snprintf(rois.table[rois.count].name, ROI_NAME_SIZE, "%s", name);
+    return rois.count++;
+}
+
+void roi_begin(const char* name)
+{
+    roi_frame_t* frame;
+
+    if (tls_depth++ >= QUARTZ_MAX_ROI_DEPTH) {
+        return;
+    }
+    frame = &tls_frames[tls_depth - 1];
+    if (__lib_pthread_mutex_lock == NULL) {
+        init_interposition();
+    }
+    __lib_pthread_mutex_lock(&rois.mutex);
+    frame->roi = find_roi(name ? name : "(null)");
+    __lib_pthread_mutex_unlock(&rois.mutex);
+
+    frame->start = quartz_tls_info;
+    frame->start_us = monotonic_time_us();
+}
+
+void roi_end()
+{
+    roi_frame_t* frame;
+    roi_stats_t* roi;
+    double end_us;
+
+    if (tls_depth == 0) {
+        DBG_LOG(WARNING, "quartz_roi_end() without a matching quartz_roi_begin()\n");
+        return;
+    }
+    if (tls_depth-- > QUARTZ_MAX_ROI_DEPTH) {
+        return;
+    }
+    frame = &tls_frames[tls_depth];
+    if (frame->roi < 0) {
+        return;
+    }
+    end_us = monotonic_time_us();
+
+    __lib_pthread_mutex_lock(&rois.mutex);
+    roi = &rois.table[frame->roi];
+    roi->calls++;
+    roi->time_us += (uint64_t) (end_us - frame->start_us);
+    roi->epochs += quartz_tls_info.epochs - frame->start.epochs;
+    roi->stall_cycles += quartz_tls_info.stall_cycles - frame->start.stall_cycles;
+    roi->delay_cycles += quartz_tls_info.delay_cycles - frame->start.delay_cycles;
+    __lib_pthread_mutex_unlock(&rois.mutex);
+}
+
+void roi_report(FILE* out)
+{
+    roi_stats_t* roi;
+    int i;
+
+    __lib_pthread_mutex_lock(&rois.mutex);
+    if (rois.count) {
+        fprintf(out, "\n== Regions of interest ==\n");
+    }
+    for (i = 0; i < rois.count; i++) {
+        roi = &rois.table[i];
+        fprintf(out, "%s: %lu calls, %lu usec, %lu epochs, %lu stall cycles, %lu injected delay cycles\n",
+                roi->name, roi->calls, roi->time_us, roi->epochs, roi->stall_cycles, roi->delay_cycles);
+    }
+    __lib_pthread_mutex_unlock(&rois.mutex);
+}
+
+int roi_snapshot(roi_stats_t* table)
+{
+    int count;
+
+    __lib_pthread_mutex_lock(&rois.mutex);
+    count = rois.count;
+    memcpy(table, rois.table, count * sizeof(roi_stats_t));
+    __lib_pthread_mutex_unlock(&rois.mutex);
+    return count;
+}
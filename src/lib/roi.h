@@ -0,0 +1,54 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __ROI_H
+#define __ROI_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * \file
+ *
+ * Regions of interest
+ *
+ * Applications mark regions with quartz_roi_begin() and quartz_roi_end(),
+ * see quartz.h. A region takes a snapshot of the counters of the calling
+ * thread at both ends and adds the difference to the totals of its name,
+ * shared by all threads. The counters move at latency epoch boundaries,
+ * so callers close the current epoch of the thread first.
+ */
+
+#define ROI_NAME_SIZE 64
+
+typedef struct {
+    char name[ROI_NAME_SIZE];
+    uint64_t calls;
+    uint64_t time_us;
+    uint64_t epochs;
+    uint64_t stall_cycles;
+    uint64_t delay_cycles;
+} roi_stats_t;
+
+void roi_begin(const char* name);
+void roi_end();
+
+void roi_report(FILE* out);
+
+/**
+ * \brief Copies the totals of the regions, QUARTZ_MAX_ROIS at most, into
+ * table and returns how many there are
+ */
+int roi_snapshot(roi_stats_t* table);
+
+#endif /* __ROI_H */
@@ -12,6 +12,8 @@ with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -20,7 +22,12 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "stat.h"
 #include "thread.h"
 #include "interpose.h"
+#include "error.h"
+#include "malloc_policy.h"
 #include "model.h"
+#include "roi.h"
+#include "tiering.h"
+#include "wpq.h"
 
 thread_manager_t* get_thread_manager();
 hrtime_t cycles_to_us(int cpu_speed_mhz, hrtime_t cycles);
@@ -34,8 +41,22 @@ void stats_set_init_time(double init_time_us) {
 	__lib_pthread_mutex_unlock(&thread_manager->mutex);
 }
 
+// keeps a copy of the setting, the configuration is gone by report time
+static void save_setting(const char *name, const char *value, void *arg) {
+    stats_t *stats = arg;
+    stats_setting_t *setting;
+
+    if ((setting = malloc(sizeof(*setting))) == NULL) {
+        return;
+    }
+    setting->name = strdup(name);
+    setting->value = strdup(value);
+    LL_APPEND(stats->settings, setting);
+}
+
 void stats_enable(config_t *cfg) {
 	thread_manager_t* thread_manager = get_thread_manager();
+    char *format;
 
     __cconfig_lookup_bool(cfg, "statistics.enable", &thread_manager->stats.enabled);
     if (__cconfig_lookup_string(cfg, "statistics.file", &thread_manager->stats.output_file) == CONFIG_FALSE) {
@@ -43,6 +64,20 @@ void stats_enable(config_t *cfg) {
     	thread_manager->stats.output_file = NULL;
     	__lib_pthread_mutex_unlock(&thread_manager->mutex);
     }
+
+    thread_manager->stats.format = STATS_FORMAT_TEXT;
+    if (__cconfig_lookup_string(cfg, "statistics.format", &format) == CONFIG_TRUE) {
+        if (strcmp(format, "json") == 0) {
+            thread_manager->stats.format = STATS_FORMAT_JSON;
+        } else if (strcmp(format, "csv") == 0) {
+            thread_manager->stats.format = STATS_FORMAT_CSV;
+        } else if (strcmp(format, "text") != 0) {
+            DBG_LOG(WARNING, "Unknown statistics format '%s', using text\n", format);
+        }
+    }
+    if (thread_manager->stats.enabled && thread_manager->stats.format != STATS_FORMAT_TEXT) {
+        __cconfig_for_each_setting(cfg, save_setting, &thread_manager->stats);
+    }
 }
 
 static char *get_current_time() {
@@ -64,6 +99,42 @@ static inline hrtime_t ns_to_cycles(int cpu_speed_mhz, int ns)
 extern __thread int tls_hw_local_latency;
 extern __thread int tls_hw_remote_latency;
 
+static const double report_percentiles[] = {50, 90, 99, 99.9};
+
+// prints the percentiles of h divided by scale (1 keeps the unit)
+static void show_percentiles(FILE *out_file, const char *name, const char *indent,
+                             const histogram_t *h, double scale) {
+    int i;
+
+    fprintf(out_file, "%s: %s p50/p90/p99/p99.9:", indent, name);
+    for (i = 0; i < sizeof(report_percentiles) / sizeof(report_percentiles[0]); i++) {
+        fprintf(out_file, "%s%.0f", i ? " / " : " ",
+                histogram_percentile(h, report_percentiles[i]) / scale);
+    }
+    fprintf(out_file, "\n");
+}
+
+static void show_histograms(FILE *out_file, const char *indent, const thread_stats_t *stats, int cpu_speed_mhz) {
+    if (stats->epoch_duration_us.count == 0) {
+        return;
+    }
+    show_percentiles(out_file, "epoch duration usec", indent, &stats->epoch_duration_us, 1);
+    if (cpu_speed_mhz) {
+        show_percentiles(out_file, "injected delay usec", indent, &stats->delay_cycles_hist, cpu_speed_mhz);
+    } else {
+        show_percentiles(out_file, "injected delay cycles", indent, &stats->delay_cycles_hist, 1);
+    }
+    show_percentiles(out_file, "stall cycles per epoch", indent, &stats->stall_cycles_hist, 1);
+    show_percentiles(out_file, "overhead cycles per epoch", indent, &stats->overhead_cycles_hist, 1);
+}
+
+static void merge_histograms(thread_stats_t *all, const thread_stats_t *stats) {
+    histogram_merge(&all->epoch_duration_us, &stats->epoch_duration_us);
+    histogram_merge(&all->delay_cycles_hist, &stats->delay_cycles_hist);
+    histogram_merge(&all->stall_cycles_hist, &stats->stall_cycles_hist);
+    histogram_merge(&all->overhead_cycles_hist, &stats->overhead_cycles_hist);
+}
+
 static void show_thread_stats(thread_t *thread, FILE *out_file) {
     uint64_t fixed_value;
     uint64_t cycles;
@@ -102,11 +173,19 @@ static void show_thread_stats(thread_t *thread, FILE *out_file) {
     fprintf(out_file, "\t\t: number of epochs: %lu\n", thread->stats.epochs);
     fprintf(out_file, "\t\t: epochs which didn't reach min duration: %lu\n", thread->stats.min_epoch_not_reached);
     fprintf(out_file, "\t\t: static epochs requested: %lu\n", thread->stats.signals_sent);
+    fprintf(out_file, "\t\t: bytes persisted: %lu in %lu calls\n", thread->stats.persisted_bytes,
+            thread->stats.persist_calls);
+    fprintf(out_file, "\t\t: achieved NVM read latency: %.0f ns (target %d ns)\n", achieved_latency_ns(thread),
+            thread_read_latency(thread));
+    fprintf(out_file, "\t\t: epochs off the target latency: %lu\n", thread->stats.off_target_epochs);
+    show_histograms(out_file, "\t\t", &thread->stats, thread->cpu_speed_mhz);
 }
 
 void stats_report() {
+    static thread_stats_t all_threads; // too large for the stack of small threads
     thread_t *thread;
     FILE *out_file;
+    int cpu_speed_mhz = 0;
     uint64_t running_threads = 0;
     thread_manager_t* thread_manager = get_thread_manager();
     uint64_t terminated_threads;
@@ -124,6 +203,18 @@ void stats_report() {
         out_file = stdout;
     }
 
+    if (thread_manager->stats.format != STATS_FORMAT_TEXT) {
+        if (thread_manager->stats.format == STATS_FORMAT_JSON) {
+            stats_report_json(out_file);
+        } else {
+            stats_report_csv(out_file);
+        }
+        if (out_file != stdout) {
+            fclose(out_file);
+        }
+        return;
+    }
+
     __lib_pthread_mutex_lock(&thread_manager->mutex);
     LL_FOREACH(thread_manager->thread_list, thread) {
         running_threads++;
@@ -144,8 +235,11 @@ void stats_report() {
     fprintf(out_file, "== Running threads == \n");
 
     __lib_pthread_mutex_lock(&thread_manager->mutex);
+    memset(&all_threads, 0, sizeof(all_threads));
     LL_FOREACH(thread_manager->thread_list, thread) {
     	show_thread_stats(thread, out_file);
+    	merge_histograms(&all_threads, &thread->stats);
+    	cpu_speed_mhz = thread->cpu_speed_mhz;
     }
     __lib_pthread_mutex_unlock(&thread_manager->mutex);
 
@@ -154,9 +248,21 @@ void stats_report() {
     __lib_pthread_mutex_lock(&thread_manager->mutex);
     LL_FOREACH(thread_manager->stats.thread_list, thread) {
     	show_thread_stats(thread, out_file);
+    	merge_histograms(&all_threads, &thread->stats);
+    	cpu_speed_mhz = thread->cpu_speed_mhz;
     }
     __lib_pthread_mutex_unlock(&thread_manager->mutex);
 
+    if (all_threads.epoch_duration_us.count) {
+        fprintf(out_file, "\n== All threads == \n");
+        show_histograms(out_file, "\t", &all_threads, cpu_speed_mhz);
+    }
+
+    malloc_policy_report(out_file);
+    tiering_report(out_file);
+    wpq_report(out_file);
+    roi_report(out_file);
+
     if (out_file != stdout) {
         fclose(out_file);
     }
@@ -16,17 +16,34 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 //#include <sys/types.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "config.h"
+#include "histogram.h"
 
 #ifdef USE_STATISTICS
 struct thread_s;
 
+typedef enum {
+    STATS_FORMAT_TEXT = 0,
+    STATS_FORMAT_JSON,
+    STATS_FORMAT_CSV
+} stats_format_t;
+
+// a configuration setting in effect, reported with the run
+typedef struct stats_setting_s {
+    char *name;
+    char *value;
+    struct stats_setting_s *next;
+} stats_setting_t;
+
 typedef struct {
     int enabled;
     struct thread_s* thread_list;
     uint64_t n_threads;
     uint64_t init_time_us;
     char *output_file;
+    stats_format_t format;
+    stats_setting_t *settings;
 } stats_t;
 
 typedef struct {
@@ -42,11 +59,25 @@ typedef struct {
     uint64_t min_epoch_not_reached;
     uint64_t register_timestamp;
     uint64_t unregister_timestamp;
+    uint64_t persist_calls;   // pmemcpy_nt(), pmemset_nt() and pmemmove()
+    uint64_t persisted_bytes;
+    uint64_t off_target_epochs; // achieved latency out of latency.accuracy_tolerance
+    // one value per epoch, for the percentiles of the report
+    histogram_t epoch_duration_us;
+    histogram_t delay_cycles_hist;
+    histogram_t stall_cycles_hist;
+    histogram_t overhead_cycles_hist;
 } thread_stats_t;
 
 void stats_enable(config_t *cfg);
 void stats_set_init_time(double init_time_us);
 void stats_report();
+
+/**
+ * \brief Structured reports, see stat_export.c
+ */
+void stats_report_json(FILE *out_file);
+void stats_report_csv(FILE *out_file);
 #endif
 
 double sum(double array[], int n);
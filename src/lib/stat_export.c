@@ -0,0 +1,372 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu/cpu.h"
+#include "utlist.h"
+#include "stat.h"
+#include "thread.h"
+#include "interpose.h"
+#include "model.h"
+#include "roi.h"
+#include "topology.h"
+
+/**
+ * \file
+ *
+ * Structured statistics reports
+ *
+ * statistics.format = "json" appends one JSON object per report, on a
+ * single line, so a file collecting several runs can be read line by line.
+ * "csv" appends one row per thread, with the run metadata repeated on every
+ * row and the configuration last as "name=value;..."; the header row is
+ * written when the file is empty. benchmark-tests/compare-stats.sh compares
+ * two CSV reports.
+ *
+ * Values are raw: times in usec, the rest in cycles. The hardware latencies
+ * of a thread are those of its virtual node, which the latency model of the
+ * thread uses (tls_hw_local_latency and tls_hw_remote_latency).
+ */
+
+#ifdef USE_STATISTICS
+
+thread_manager_t* get_thread_manager();
+
+typedef struct {
+    const char *name;
+    size_t offset; // in thread_stats_t
+} stats_histogram_field_t;
+
+static const stats_histogram_field_t histogram_fields[] = {
+    {"epoch_duration_us", offsetof(thread_stats_t, epoch_duration_us)},
+    {"delay_cycles", offsetof(thread_stats_t, delay_cycles_hist)},
+    {"stall_cycles", offsetof(thread_stats_t, stall_cycles_hist)},
+    {"overhead_cycles", offsetof(thread_stats_t, overhead_cycles_hist)},
+    {NULL, 0}
+};
+
+static const struct {
+    const char *name;
+    double percentile;
+} percentiles[] = {
+    {"p50", 50}, {"p90", 90}, {"p99", 99}, {"p99_9", 99.9}, {NULL, 0}
+};
+
+// run metadata gathered once per report
+typedef struct {
+    time_t timestamp;
+    char *cpu_model;
+    const char *microarch;
+    int cpu_speed_mhz;
+    uint64_t running_threads;
+    uint64_t terminated_threads;
+} report_info_t;
+
+static inline const histogram_t *stats_histogram(const thread_stats_t *stats, int field) {
+    return (const histogram_t *) ((const char *) stats + histogram_fields[field].offset);
+}
+
+static void get_report_info(thread_manager_t *thread_manager, report_info_t *info) {
+    virtual_topology_t *topology = thread_manager->virtual_topology;
+    thread_t *thread;
+    char *newline;
+
+    memset(info, 0, sizeof(*info));
+    info->timestamp = time(NULL);
+    if ((info->cpu_model = cpu_model_name()) != NULL && (newline = strchr(info->cpu_model, '\n')) != NULL) {
+        *newline = '\0';
+    }
+    info->microarch = "unknown";
+    if (topology && topology->num_virtual_nodes > 0 && topology->virtual_nodes[0].dram_node->cpu_model) {
+        info->microarch = cpu_microarch_name(topology->virtual_nodes[0].dram_node->cpu_model->microarch);
+    }
+    info->cpu_speed_mhz = cpu_speed_mhz();
+
+    LL_FOREACH(thread_manager->thread_list, thread) {
+        info->running_threads++;
+    }
+    info->terminated_threads = thread_manager->stats.n_threads > info->running_threads ?
+            thread_manager->stats.n_threads - info->running_threads : 0;
+}
+
+static void thread_hw_latencies(thread_t *thread, int *local, int *remote) {
+    *local = thread->virtual_node->dram_node->latency;
+    *remote = thread->virtual_node->nvram_node->latency;
+}
+
+// same estimate as the text report: stall cycles over the latency of a miss
+static uint64_t thread_nvm_accesses(thread_t *thread) {
+    int local, remote;
+    uint64_t cycles;
+
+    thread_hw_latencies(thread, &local, &remote);
+    if (thread->virtual_node->dram_node != thread->virtual_node->nvram_node && latency_model.pmc_remote_dram) {
+        cycles = (uint64_t) thread->cpu_speed_mhz * remote / 1000;
+    } else {
+        cycles = (uint64_t) thread->cpu_speed_mhz * local / 1000;
+    }
+    return cycles ? thread->stats.stall_cycles / cycles : 0;
+}
+
+static uint64_t thread_execution_time(thread_t *thread) {
+    return thread->stats.unregister_timestamp > 0 ?
+            thread->stats.unregister_timestamp - thread->stats.register_timestamp : 0;
+}
+
+static uint64_t thread_shortest_epoch(thread_t *thread) {
+    return thread->stats.shortest_epoch_duration_us == UINT64_MAX ? 0 : thread->stats.shortest_epoch_duration_us;
+}
+
+static uint64_t thread_average_epoch(thread_t *thread) {
+    return thread->stats.epochs ? thread->stats.overall_epoch_duration_us / thread->stats.epochs :
+            thread->stats.overall_epoch_duration_us;
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void json_histograms(FILE *out, const thread_stats_t *stats) {
+    int i, j;
+
+    for (i = 0; histogram_fields[i].name; i++) {
+        fprintf(out, "%s\"%s\":{", i ? "," : "", histogram_fields[i].name);
+        for (j = 0; percentiles[j].name; j++) {
+            fprintf(out, "%s\"%s\":%lu", j ? "," : "", percentiles[j].name,
+                    histogram_percentile(stats_histogram(stats, i), percentiles[j].percentile));
+        }
+        fprintf(out, "}");
+    }
+}
+
+static void json_thread(FILE *out, thread_t *thread, const char *state) {
+    int local, remote;
+
+    thread_hw_latencies(thread, &local, &remote);
+    fprintf(out, "{\"tid\":%d,\"state\":\"%s\",\"cpu_id\":%d,\"virtual_node\":%d,\"cpu_speed_mhz\":%d,",
+            thread->tid, state, thread->cpu_id, thread->virtual_node->node_id, thread->cpu_speed_mhz);
+    fprintf(out, "\"hw_local_latency_ns\":%d,\"hw_remote_latency_ns\":%d,", local, remote);
+    fprintf(out, "\"register_timestamp\":%lu,\"unregister_timestamp\":%lu,\"execution_time_us\":%lu,",
+            thread->stats.register_timestamp, thread->stats.unregister_timestamp, thread_execution_time(thread));
+    fprintf(out, "\"stall_cycles\":%lu,\"nvm_accesses\":%lu,\"overhead_cycles\":%lu,\"delay_cycles\":%lu,",
+            thread->stats.stall_cycles, thread_nvm_accesses(thread), thread->stats.overhead_cycles,
+            thread->stats.delay_cycles);
+    fprintf(out, "\"epochs\":%lu,\"signals_sent\":%lu,\"min_epoch_not_reached\":%lu,",
+            thread->stats.epochs, thread->stats.signals_sent, thread->stats.min_epoch_not_reached);
+    fprintf(out, "\"shortest_epoch_duration_us\":%lu,\"longest_epoch_duration_us\":%lu,"
+            "\"average_epoch_duration_us\":%lu,\"overall_epoch_duration_us\":%lu,\"last_epoch_timestamp\":%.0f,",
+            thread_shortest_epoch(thread), thread->stats.longest_epoch_duration_us, thread_average_epoch(thread),
+            thread->stats.overall_epoch_duration_us, thread->stats.last_epoch_timestamp);
+    fprintf(out, "\"persist_calls\":%lu,\"persisted_bytes\":%lu,", thread->stats.persist_calls,
+            thread->stats.persisted_bytes);
+    fprintf(out, "\"achieved_latency_ns\":%.1f,\"off_target_epochs\":%lu,\"percentiles\":{",
+            achieved_latency_ns(thread), thread->stats.off_target_epochs);
+    json_histograms(out, &thread->stats);
+    fprintf(out, "}}");
+}
+
+void stats_report_json(FILE *out) {
+    static thread_stats_t all_threads;
+    static roi_stats_t rois[QUARTZ_MAX_ROIS];
+    thread_manager_t *thread_manager = get_thread_manager();
+    virtual_topology_t *topology = thread_manager->virtual_topology;
+    stats_setting_t *setting;
+    report_info_t info;
+    thread_t *thread;
+    int i, nrois, first = 1;
+
+    __lib_pthread_mutex_lock(&thread_manager->mutex);
+    get_report_info(thread_manager, &info);
+
+    fprintf(out, "{\"timestamp\":%ld,\"pid\":%d,\"delay_injection\":%s,\"init_time_us\":%lu,",
+            (long) info.timestamp, getpid(), latency_model.inject_delay ? "true" : "false",
+            thread_manager->stats.init_time_us);
+    fprintf(out, "\"threads\":%lu,\"running_threads\":%lu,\"terminated_threads\":%lu,",
+            thread_manager->stats.n_threads, info.running_threads, info.terminated_threads);
+    fprintf(out, "\"cpu\":{\"model\":");
+    json_string(out, info.cpu_model);
+    fprintf(out, ",\"microarch\":");
+    json_string(out, info.microarch);
+    fprintf(out, ",\"speed_mhz\":%d},", info.cpu_speed_mhz);
+    fprintf(out, "\"latency_model\":{\"read_latency_ns\":%d,\"write_latency_ns\":%d,"
+            "\"min_epoch_duration_us\":%d,\"max_epoch_duration_us\":%d},",
+            latency_model.read_latency, latency_model.write_latency,
+            thread_manager->min_epoch_duration_us, thread_manager->max_epoch_duration_us);
+
+    fprintf(out, "\"virtual_nodes\":[");
+    for (i = 0; topology && i < topology->num_virtual_nodes; i++) {
+        fprintf(out, "%s{\"id\":%d,\"dram_node\":%d,\"dram_latency_ns\":%d,\"nvram_node\":%d,\"nvram_latency_ns\":%d}",
+                i ? "," : "", topology->virtual_nodes[i].node_id,
+                topology->virtual_nodes[i].dram_node->node_id, topology->virtual_nodes[i].dram_node->latency,
+                topology->virtual_nodes[i].nvram_node->node_id, topology->virtual_nodes[i].nvram_node->latency);
+    }
+    fprintf(out, "],\"config\":{");
+    LL_FOREACH(thread_manager->stats.settings, setting) {
+        fprintf(out, "%s", setting == thread_manager->stats.settings ? "" : ",");
+        json_string(out, setting->name);
+        fputc(':', out);
+        json_string(out, setting->value);
+    }
+
+    memset(&all_threads, 0, sizeof(all_threads));
+    fprintf(out, "},\"thread_stats\":[");
+    LL_FOREACH(thread_manager->thread_list, thread) {
+        fprintf(out, "%s", first ? "" : ",");
+        json_thread(out, thread, "running");
+        histogram_merge(&all_threads.epoch_duration_us, &thread->stats.epoch_duration_us);
+        histogram_merge(&all_threads.delay_cycles_hist, &thread->stats.delay_cycles_hist);
+        histogram_merge(&all_threads.stall_cycles_hist, &thread->stats.stall_cycles_hist);
+        histogram_merge(&all_threads.overhead_cycles_hist, &thread->stats.overhead_cycles_hist);
+        first = 0;
+    }
+    LL_FOREACH(thread_manager->stats.thread_list, thread) {
+        fprintf(out, "%s", first ? "" : ",");
+        json_thread(out, thread, "terminated");
+        histogram_merge(&all_threads.epoch_duration_us, &thread->stats.epoch_duration_us);
+        histogram_merge(&all_threads.delay_cycles_hist, &thread->stats.delay_cycles_hist);
+        histogram_merge(&all_threads.stall_cycles_hist, &thread->stats.stall_cycles_hist);
+        histogram_merge(&all_threads.overhead_cycles_hist, &thread->stats.overhead_cycles_hist);
+        first = 0;
+    }
+    __lib_pthread_mutex_unlock(&thread_manager->mutex);
+
+    fprintf(out, "],\"all_threads_percentiles\":{");
+    json_histograms(out, &all_threads);
+    fprintf(out, "},\"rois\":[");
+    nrois = roi_snapshot(rois);
+    for (i = 0; i < nrois; i++) {
+        fprintf(out, "%s{\"name\":", i ? "," : "");
+        json_string(out, rois[i].name);
+        fprintf(out, ",\"calls\":%lu,\"time_us\":%lu,\"epochs\":%lu,\"stall_cycles\":%lu,\"delay_cycles\":%lu}",
+                rois[i].calls, rois[i].time_us, rois[i].epochs, rois[i].stall_cycles, rois[i].delay_cycles);
+    }
+    fprintf(out, "]}\n");
+    free(info.cpu_model);
+}
+
+// quotes a CSV field, doubling the quotes inside
+static void csv_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        if (*s == '"') {
+            fputc('"', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void csv_header(FILE *out) {
+    int i, j;
+
+    fprintf(out, "timestamp,pid,cpu_model,cpu_microarch,cpu_speed_mhz,delay_injection,init_time_us,"
+            "threads,running_threads,terminated_threads,read_latency_ns,write_latency_ns,"
+            "min_epoch_duration_us,max_epoch_duration_us,");
+    fprintf(out, "tid,state,cpu_id,virtual_node,hw_local_latency_ns,hw_remote_latency_ns,"
+            "register_timestamp,unregister_timestamp,execution_time_us,stall_cycles,nvm_accesses,"
+            "overhead_cycles,delay_cycles,epochs,signals_sent,min_epoch_not_reached,"
+            "shortest_epoch_duration_us,longest_epoch_duration_us,average_epoch_duration_us,"
+            "overall_epoch_duration_us,last_epoch_timestamp,persist_calls,persisted_bytes,"
+            "achieved_latency_ns,off_target_epochs,");
+    for (i = 0; histogram_fields[i].name; i++) {
+        for (j = 0; percentiles[j].name; j++) {
+            fprintf(out, "%s_%s,", histogram_fields[i].name, percentiles[j].name);
+        }
+    }
+    fprintf(out, "config\n");
+}
+
+static void csv_thread(FILE *out, thread_manager_t *thread_manager, report_info_t *info,
+                       thread_t *thread, const char *state) {
+    stats_setting_t *setting;
+    int local, remote;
+    int i, j;
+
+    fprintf(out, "%ld,%d,", (long) info->timestamp, getpid());
+    csv_string(out, info->cpu_model);
+    fputc(',', out);
+    csv_string(out, info->microarch);
+    fprintf(out, ",%d,%d,%lu,%lu,%lu,%lu,%d,%d,%d,%d,", info->cpu_speed_mhz, latency_model.inject_delay,
+            thread_manager->stats.init_time_us, thread_manager->stats.n_threads, info->running_threads,
+            info->terminated_threads, latency_model.read_latency, latency_model.write_latency,
+            thread_manager->min_epoch_duration_us, thread_manager->max_epoch_duration_us);
+
+    thread_hw_latencies(thread, &local, &remote);
+    fprintf(out, "%d,%s,%d,%d,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.0f,%lu,%lu,%.1f,%lu,",
+            thread->tid, state, thread->cpu_id, thread->virtual_node->node_id, local, remote,
+            thread->stats.register_timestamp, thread->stats.unregister_timestamp, thread_execution_time(thread),
+            thread->stats.stall_cycles, thread_nvm_accesses(thread), thread->stats.overhead_cycles,
+            thread->stats.delay_cycles, thread->stats.epochs, thread->stats.signals_sent,
+            thread->stats.min_epoch_not_reached, thread_shortest_epoch(thread),
+            thread->stats.longest_epoch_duration_us, thread_average_epoch(thread),
+            thread->stats.overall_epoch_duration_us, thread->stats.last_epoch_timestamp,
+            thread->stats.persist_calls, thread->stats.persisted_bytes, achieved_latency_ns(thread),
+            thread->stats.off_target_epochs);
+    for (i = 0; histogram_fields[i].name; i++) {
+        for (j = 0; percentiles[j].name; j++) {
+            fprintf(out, "%lu,", histogram_percentile(stats_histogram(&thread->stats, i), percentiles[j].percentile));
+        }
+    }
+
+    fputc('"', out);
+    LL_FOREACH(thread_manager->stats.settings, setting) {
+        fprintf(out, "%s%s=", setting == thread_manager->stats.settings ? "" : ";", setting->name);
+        for (i = 0; setting->value[i]; i++) {
+            if (setting->value[i] == '"') {
+                fputc('"', out);
+            }
+            fputc(setting->value[i], out);
+        }
+    }
+    fprintf(out, "\"\n");
+}
+
+void stats_report_csv(FILE *out) {
+    thread_manager_t *thread_manager = get_thread_manager();
+    report_info_t info;
+    thread_t *thread;
+
+    // a file collecting several runs gets a single header
+    if (fseek(out, 0, SEEK_END) != 0 || ftell(out) <= 0) {
+        csv_header(out);
+    }
+
+    __lib_pthread_mutex_lock(&thread_manager->mutex);
+    get_report_info(thread_manager, &info);
+    LL_FOREACH(thread_manager->thread_list, thread) {
+        csv_thread(out, thread_manager, &info, thread, "running");
+    }
+    LL_FOREACH(thread_manager->stats.thread_list, thread) {
+        csv_thread(out, thread_manager, &info, thread, "terminated");
+    }
+    __lib_pthread_mutex_unlock(&thread_manager->mutex);
+    free(info.cpu_model);
+}
+
+#endif
@@ -11,18 +11,25 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+// the epoch code logs from the signal handler, through the debug ring
+#define DBG_ASYNC_MODULE
 #include <sys/syscall.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <numaif.h>
+#include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
 #include "cpu/cpu.h"
 #include "utlist.h"
 #include "error.h"
 #include "interpose.h"
+#include "live_stats.h"
 #include "model.h"
 #include "thread.h"
 #include "topology.h"
+#include "trace.h"
 #include "monotonic_timer.h"
 
 static thread_manager_t* thread_manager = NULL;
@@ -54,44 +61,58 @@ static void rr_next_cpu_id(thread_manager_t* thread_manager, int* next_virtual_n
     } 
 }
 
+// restarts the round-robin order from the first CPU, as init_thread_manager() does
+static void rr_reset(thread_manager_t* thread_manager)
+{
+    virtual_node_t* virtual_node = &thread_manager->virtual_topology->virtual_nodes[0];
+
+    thread_manager->next_virtual_node_id = 0;
+    thread_manager->next_cpu_id = first_cpu(virtual_node->dram_node->cpu_bitmask);
+}
+
 void rr_set_next_cpu_based_on_rank(int rank, int max_rank)
 {
     int cpu_id;
     int virtual_node_id;
     int i;
 
-    // set the next CPU id based on this process rank id
-    thread_manager->next_virtual_node_id = 0;
-    thread_manager->next_cpu_id = 0;
-    for (i = 0; i <= rank; ++i) {
+    // set the next CPU id based on this process rank id, rank 0 starts on
+    // the first CPU
+    rr_reset(thread_manager);
+    for (i = 0; i < rank; ++i) {
         rr_next_cpu_id(thread_manager, &virtual_node_id, &cpu_id);
     }
 
     DBG_LOG(DEBUG, "no partitioning of CPUs, set next CPU "
-                   "to vnode %d and cpu %d\n", virtual_node_id, cpu_id);
+                   "to vnode %d and cpu %d\n", thread_manager->next_virtual_node_id, thread_manager->next_cpu_id);
 }
 
 void partition_cpus_based_on_rank(int rank, int max_rank, int num_cpus,
                                   virtual_topology_t* virtual_topology)
 {
-    // assumed the number of cpus/2 is greater or equal to max_rank
-    // this partition is num_cpus/max_rank
-    int part_size = num_cpus/max_rank;
-    int start = rank * part_size;
-    int end = start + part_size -1;
+    // ranks get contiguous runs of the round-robin CPU order, which covers
+    // a virtual node before the next one; when the CPUs do not divide
+    // evenly some partitions are one CPU larger, so none is left idle
+    int start = (int) ((long) rank * num_cpus / max_rank);
+    int end = (int) ((long) (rank + 1) * num_cpus / max_rank) - 1;
     int i;
     int cpu_id = 0;
     int virtual_node_id = 0;
+    int first_cpu_id = 0;
+    int first_virtual_node_id = 0;
     virtual_node_t* virtual_node;
     physical_node_t* physical_node;
 
     DBG_LOG(DEBUG, "partitioning CPUS, this process has CPUs from %d and %d\n",
             start, end);
 
-    thread_manager->next_virtual_node_id = 0;
-    thread_manager->next_cpu_id = 0;
+    rr_reset(thread_manager);
     for (i = 0; i < num_cpus; ++i) {
         rr_next_cpu_id(thread_manager, &virtual_node_id, &cpu_id);
+        if (i == start) {
+            first_virtual_node_id = virtual_node_id;
+            first_cpu_id = cpu_id;
+        }
         if (i < start || i > end) {
             // this CPU is outside the partition of this process
             // disable this CPU
@@ -105,6 +126,10 @@ void partition_cpus_based_on_rank(int rank, int max_rank, int num_cpus,
             }
         }
     }
+
+    // the first thread runs on the first CPU of the partition
+    thread_manager->next_virtual_node_id = first_virtual_node_id;
+    thread_manager->next_cpu_id = first_cpu_id;
 }
 
 int bind_thread_on_cpu(thread_manager_t* thread_manager, thread_t* thread, int virtual_node_id, int cpu_id)
@@ -124,21 +149,187 @@ int bind_thread_on_cpu(thread_manager_t* thread_manager, thread_t* thread, int v
 
 int bind_thread_on_mem(thread_manager_t* thread_manager, thread_t* thread, int virtual_node_id, int cpu_id)
 {
-    int physical_node_id;
-    struct bitmask* membind = numa_allocate_nodemask();
-    physical_node_id = thread_manager->virtual_topology->virtual_nodes[virtual_node_id].dram_node->node_id;
-    numa_bitmask_setbit(membind, physical_node_id);
-    numa_set_membind(membind);
-    numa_free_nodemask(membind);
+    virtual_node_t* virtual_node = &thread_manager->virtual_topology->virtual_nodes[virtual_node_id];
+    struct bitmask* nodemask = numa_allocate_nodemask();
+
+    numa_bitmask_setbit(nodemask, virtual_node->dram_node->node_id);
+    if (thread_manager->interleave_dram_weight == 0 || virtual_node->dram_node == virtual_node->nvram_node) {
+        numa_set_membind(nodemask);
+        numa_free_nodemask(nodemask);
+        return E_SUCCESS;
+    }
+
+    numa_bitmask_setbit(nodemask, virtual_node->nvram_node->node_id);
+    // unequal weights need the kernel's weighted interleaving, which takes
+    // the node weights set up by init_thread_manager()
+    if (thread_manager->interleave_dram_weight == thread_manager->interleave_nvm_weight ||
+        set_mempolicy(MPOL_WEIGHTED_INTERLEAVE, nodemask->maskp, nodemask->size + 1) != 0)
+    {
+        numa_set_interleave_mask(nodemask);
+    }
+    numa_free_nodemask(nodemask);
 
     return E_SUCCESS;
 }
 
+#define INTERLEAVE_WEIGHT_PATH "/sys/kernel/mm/mempolicy/weighted_interleave/node%d"
+
+static int read_interleave_weight(int node_id, int* weight)
+{
+    char path[128];
+    char buf[16];
+    int fd, len;
+
+    snprintf(path, sizeof(path), INTERLEAVE_WEIGHT_PATH, node_id);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return E_ERROR;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return E_ERROR;
+    }
+    buf[len] = '\0';
+    return sscanf(buf, "%d", weight) == 1 ? E_SUCCESS : E_ERROR;
+}
+
+static int write_interleave_weight(int node_id, int weight)
+{
+    char path[128];
+    char buf[16];
+    int fd, len, ret;
+
+    snprintf(path, sizeof(path), INTERLEAVE_WEIGHT_PATH, node_id);
+    if ((fd = open(path, O_WRONLY)) < 0) {
+        return E_ERROR;
+    }
+    len = snprintf(buf, sizeof(buf), "%d", weight);
+    ret = write(fd, buf, len) == len ? E_SUCCESS : E_ERROR;
+    close(fd);
+    return ret;
+}
+
+// saves the weight of the node the first time it is changed, so that
+// finalize_thread_manager() can give it back
+static int set_interleave_weight(thread_manager_t* mgr, int node_id, int weight)
+{
+    int old;
+
+    if (node_id < 0 || node_id >= mgr->num_saved_weights) {
+        return E_INVAL;
+    }
+    if (mgr->saved_weights[node_id] < 0) {
+        if (read_interleave_weight(node_id, &old) != E_SUCCESS) {
+            return E_ERROR;
+        }
+        mgr->saved_weights[node_id] = old;
+    }
+    return write_interleave_weight(node_id, weight);
+}
+
+// reads the interleaving weights of the thread memory policy and hands them
+// to the kernel; the weights are system wide and restored on exit
+static void setup_interleave(config_t* cfg, thread_manager_t* mgr)
+{
+    virtual_topology_t* virtual_topology = mgr->virtual_topology;
+    virtual_node_t* virtual_node;
+    int enabled = 0;
+    int i, ret = E_SUCCESS;
+
+    __cconfig_lookup_bool(cfg, "interleave.threads", &enabled);
+    if (!enabled) {
+        return;
+    }
+    mgr->interleave_dram_weight = 1;
+    mgr->interleave_nvm_weight = 1;
+    __cconfig_lookup_int(cfg, "interleave.dram_weight", &mgr->interleave_dram_weight);
+    __cconfig_lookup_int(cfg, "interleave.nvm_weight", &mgr->interleave_nvm_weight);
+    if (mgr->interleave_dram_weight <= 0 || mgr->interleave_nvm_weight <= 0 ||
+        mgr->interleave_dram_weight > 255 || mgr->interleave_nvm_weight > 255)
+    {
+        DBG_LOG(WARNING, "interleave weights must be in [1, 255], binding threads to DRAM\n");
+        mgr->interleave_dram_weight = mgr->interleave_nvm_weight = 0;
+        return;
+    }
+    if (mgr->interleave_dram_weight == mgr->interleave_nvm_weight) {
+        return;
+    }
+    for (i = 0; i < virtual_topology->num_virtual_nodes; i++) {
+        virtual_node = &virtual_topology->virtual_nodes[i];
+        // such nodes are bound, not interleaved
+        if (virtual_node->dram_node == virtual_node->nvram_node) {
+            continue;
+        }
+        ret |= set_interleave_weight(mgr, virtual_node->dram_node->node_id, mgr->interleave_dram_weight);
+        ret |= set_interleave_weight(mgr, virtual_node->nvram_node->node_id, mgr->interleave_nvm_weight);
+    }
+    if (ret != E_SUCCESS) {
+        DBG_LOG(WARNING, "Cannot set the kernel interleave weights, threads may interleave pages 1:1\n");
+    }
+}
+
+int set_node_interleave_weights(int dram_node, int nvm_node, int dram_weight, int nvm_weight)
+{
+    thread_manager_t* mgr = __atomic_load_n(&thread_manager, __ATOMIC_ACQUIRE);
+    int ret;
+
+    if (mgr == NULL) {
+        return E_ERROR;
+    }
+    __lib_pthread_mutex_lock(&mgr->mutex);
+    ret = set_interleave_weight(mgr, dram_node, dram_weight);
+    if (ret == E_SUCCESS) {
+        ret = set_interleave_weight(mgr, nvm_node, nvm_weight);
+    }
+    __lib_pthread_mutex_unlock(&mgr->mutex);
+    return ret;
+}
+
 thread_t* thread_self()
 {
     return tls_thread;
 }
 
+static int unbound_warned = 0;
+
+static virtual_node_t* virtual_node_self()
+{
+    thread_t* thread = thread_self();
+
+    if (thread == NULL) {
+    	// FIXME: JVM for instance create threads using a mechanism not traced by this emulator
+    	//        for now we make sure the current thread is registered right when it makes the
+    	//        first explicit NVM allocation. A better solution is to trace the thread creation
+    	//        done by JVM.
+        register_self();
+        thread = thread_self();
+    }
+
+    // without the latency model there is no thread manager to register
+    // with: callers skip the NVM binding or fail the allocation
+    if (thread == NULL) {
+    	if (!__atomic_exchange_n(&unbound_warned, 1, __ATOMIC_RELAXED)) {
+    	    DBG_LOG(WARNING, "NVM allocation called with no registered thread, memory is not bound to NVM\n");
+    	}
+    	return NULL;
+    }
+    return thread->virtual_node;
+}
+
+int nvram_node_self()
+{
+    virtual_node_t* virtual_node = virtual_node_self();
+
+    return virtual_node ? virtual_node->nvram_node->node_id : -1;
+}
+
+int dram_node_self()
+{
+    virtual_node_t* virtual_node = virtual_node_self();
+
+    return virtual_node ? virtual_node->dram_node->node_id : -1;
+}
+
 void thread_interrupt_handler(int signum)
 {
     DBG_LOG(DEBUG, "Handling interrupt thread [%d] pthread: 0x%lx\n", thread_self()->tid, thread_self()->pthread);
@@ -246,6 +437,9 @@ int register_thread(thread_manager_t* thread_manager, pthread_t pthread, pid_t t
     __lib_pthread_mutex_unlock(&thread_manager->mutex);
 
     init_thread_latency_model(thread);
+    thread->trace = trace_thread_start(tid);
+    thread->live = live_stats_thread_start(tid, thread->cpu_id, thread->virtual_node->node_id);
+    dbg_ring_thread_start();
 
     tls_thread = thread;
 
@@ -277,6 +471,15 @@ int unregister_thread(thread_manager_t* thread_manager, thread_t * thread)
 
     __lib_pthread_mutex_unlock(&thread_manager->mutex);
 
+    // no epoch of this thread is traced past this point
+    trace_ring_t* trace = thread->trace;
+    thread->trace = NULL;
+    trace_thread_stop(trace);
+    live_stats_thread_t* live = thread->live;
+    thread->live = NULL;
+    live_stats_thread_stop(live);
+    dbg_ring_thread_stop();
+
 #ifdef PAPI_SUPPORT
     pmc_events_stop_local_thread();
     pmc_destroy_event_set_local_thread();
@@ -346,9 +549,59 @@ void interrupt_threads(thread_manager_t* manager)
     __lib_pthread_mutex_unlock(&manager->mutex);
 }
 
+typedef struct {
+    monitor_hook_t hook;
+    void* arg;
+    int period_us;
+    double last_run_us;
+} monitor_hook_entry_t;
+
+static monitor_hook_entry_t monitor_hooks[MAX_MONITOR_HOOKS];
+static int num_monitor_hooks = 0;
+static int monitor_started = 0;
+
+/**
+ * Registers a function the monitor thread calls every period_us. Hooks run
+ * on the monitor thread, so they must be short and must not block.
+ */
+int register_monitor_hook(monitor_hook_t hook, void* arg, int period_us)
+{
+    int i = __atomic_load_n(&num_monitor_hooks, __ATOMIC_ACQUIRE);
+
+    if (i >= MAX_MONITOR_HOOKS) {
+        DBG_LOG(WARNING, "Too many monitor hooks\n");
+        return E_BUSY;
+    }
+    monitor_hooks[i].hook = hook;
+    monitor_hooks[i].arg = arg;
+    monitor_hooks[i].period_us = period_us;
+    monitor_hooks[i].last_run_us = monotonic_time_us();
+    // publish the entry only once it is complete
+    __atomic_store_n(&num_monitor_hooks, i + 1, __ATOMIC_RELEASE);
+    return E_SUCCESS;
+}
+
+static void run_monitor_hooks()
+{
+    int i, n;
+    double now;
+
+    n = __atomic_load_n(&num_monitor_hooks, __ATOMIC_ACQUIRE);
+    if (n == 0) {
+        return;
+    }
+    now = monotonic_time_us();
+    for (i = 0; i < n; i++) {
+        if (now - monitor_hooks[i].last_run_us >= monitor_hooks[i].period_us) {
+            monitor_hooks[i].last_run_us = now;
+            monitor_hooks[i].hook(monitor_hooks[i].arg);
+        }
+    }
+}
+
 void* monitor_thread(void* arg)
 {
-    thread_manager_t* manager = (thread_manager_t*) arg;
+    thread_manager_t* manager;
     struct timespec epoch_duration;
 //    time_t secs = thread_manager->max_epoch_duration_us / USECS_PER_SEC;
 //    long nanosecs = (thread_manager->max_epoch_duration_us % USECS_PER_SEC) * NANOS_PER_USEC;
@@ -357,11 +610,39 @@ void* monitor_thread(void* arg)
     epoch_duration.tv_nsec = MIN_EPOCH_DURATION_US * 1000;
     while(1) {
         nanosleep(&epoch_duration, NULL);
-        interrupt_threads(manager);
+        // the monitor also serves hooks when the latency model is off, 
+        // in which case there is no thread manager
+        if ((manager = __atomic_load_n(&thread_manager, __ATOMIC_ACQUIRE))) {
+            interrupt_threads(manager);
+        }
+        run_monitor_hooks();
     }
     return NULL;
 }
 
+/**
+ * Fires the monitoring thread unless already running. 
+ */
+int start_monitor_thread()
+{
+    pthread_t monitor_tid;
+
+    if (__sync_lock_test_and_set(&monitor_started, 1)) {
+        return E_SUCCESS;
+    }
+    if (__lib_pthread_create == NULL) {
+        init_interposition();
+    }
+    assert(__lib_pthread_create);
+    assert(__lib_pthread_detach);
+    if (__lib_pthread_create(&monitor_tid, NULL, monitor_thread, NULL) != 0) {
+        monitor_started = 0;
+        return E_ERROR;
+    }
+    __lib_pthread_detach(monitor_tid);
+    return E_SUCCESS;
+}
+
 static void set_epoch_duration(config_t* cfg, const char *config_str, int *epoch_us, int default_epoch_us) {
     if (__cconfig_lookup_int(cfg, config_str, epoch_us) != CONFIG_TRUE) {
     	*epoch_us = default_epoch_us;
@@ -378,13 +659,36 @@ static void set_epoch_duration(config_t* cfg, const char *config_str, int *epoch
     }
 }
 
+int valid_epoch_durations(int min_epoch_duration_us, int max_epoch_duration_us)
+{
+    if (min_epoch_duration_us < MIN_EPOCH_DURATION_US || max_epoch_duration_us > MAX_EPOCH_DURATION_US ||
+        min_epoch_duration_us > max_epoch_duration_us)
+    {
+        return E_INVAL;
+    }
+    return E_SUCCESS;
+}
+
+void set_epoch_durations(int min_epoch_duration_us, int max_epoch_duration_us)
+{
+    // each bound is read once per check, no lock needed
+    __atomic_store_n(&thread_manager->min_epoch_duration_us, min_epoch_duration_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&thread_manager->max_epoch_duration_us, max_epoch_duration_us, __ATOMIC_RELAXED);
+}
+
+void get_epoch_durations(int* min_epoch_duration_us, int* max_epoch_duration_us)
+{
+    *min_epoch_duration_us = __atomic_load_n(&thread_manager->min_epoch_duration_us, __ATOMIC_RELAXED);
+    *max_epoch_duration_us = __atomic_load_n(&thread_manager->max_epoch_duration_us, __ATOMIC_RELAXED);
+}
+
 int init_thread_manager(config_t* cfg, virtual_topology_t* virtual_topology)
 {
     int ret;
-    pthread_t monitor_tid;
     thread_manager_t* mgr;
     virtual_node_t* virtual_node;
     physical_node_t* physical_node;
+    int i;
 
     if (!(mgr = malloc(sizeof(thread_manager_t)))) {
         ret = E_ERROR;
@@ -397,6 +701,17 @@ int init_thread_manager(config_t* cfg, virtual_topology_t* virtual_topology)
     mgr->virtual_topology = virtual_topology;
     mgr->next_virtual_node_id = 0;
 
+    // weights we change are restored at exit
+    mgr->num_saved_weights = numa_max_node() + 1;
+    if (!(mgr->saved_weights = malloc(mgr->num_saved_weights * sizeof(*mgr->saved_weights)))) {
+        free(mgr);
+        ret = E_NOMEM;
+        goto done;
+    }
+    for (i = 0; i < mgr->num_saved_weights; i++) {
+        mgr->saved_weights[i] = -1;
+    }
+
     set_epoch_duration(cfg, "latency.max_epoch_duration_us", &mgr->max_epoch_duration_us, MAX_EPOCH_DURATION_US);
     set_epoch_duration(cfg, "latency.min_epoch_duration_us", &mgr->min_epoch_duration_us, MIN_EPOCH_DURATION_US);
 
@@ -405,25 +720,45 @@ int init_thread_manager(config_t* cfg, virtual_topology_t* virtual_topology)
                 MIN_EPOCH_DURATION_US);
         mgr->min_epoch_duration_us = MIN_EPOCH_DURATION_US;
     }
+    setup_interleave(cfg, mgr);
 
     virtual_node = &virtual_topology->virtual_nodes[mgr->next_virtual_node_id];
     physical_node = virtual_node->dram_node;
     mgr->next_cpu_id = first_cpu(physical_node->cpu_bitmask);
     pthread_mutex_init(&mgr->mutex, NULL);
 
-    // fire a monitoring thread that periodically interrupts threads
-    assert(__lib_pthread_create);
-    assert(__lib_pthread_detach);
-    __lib_pthread_create(&monitor_tid, NULL, monitor_thread, (void*) mgr);
-    __lib_pthread_detach(monitor_tid);
+    __atomic_store_n(&thread_manager, mgr, __ATOMIC_RELEASE);
 
-    thread_manager = mgr;
+    // fire a monitoring thread that periodically interrupts threads
+    if ((ret = start_monitor_thread()) != E_SUCCESS) {
+        goto done;
+    }
     return E_SUCCESS;
 
 done:
     return ret;
 }
 
+void finalize_thread_manager()
+{
+    thread_manager_t* mgr = __atomic_load_n(&thread_manager, __ATOMIC_ACQUIRE);
+    int i;
+
+    if (mgr == NULL) {
+        return;
+    }
+    __lib_pthread_mutex_lock(&mgr->mutex);
+    for (i = 0; i < mgr->num_saved_weights; i++) {
+        if (mgr->saved_weights[i] >= 0 && write_interleave_weight(i, mgr->saved_weights[i]) != E_SUCCESS) {
+            DBG_LOG(WARNING, "Cannot restore the kernel interleave weight of node %d\n", i);
+        }
+    }
+    free(mgr->saved_weights);
+    mgr->saved_weights = NULL;
+    mgr->num_saved_weights = 0;
+    __lib_pthread_mutex_unlock(&mgr->mutex);
+}
+
 int reached_min_epoch_duration(thread_t* thread) {
 	double current_time;
 	uint64_t diff_us;
@@ -31,6 +31,16 @@ typedef uint64_t hrtime_t;
 // TODO: Used by memlat benchmark, should be disabled on a release version
 #define MEMLAT_SUPPORT
 
+// moving averages over the latency epochs of a thread, their ratio is the
+// NVM access latency the thread actually sees, see model_lat.c
+typedef struct {
+    double cycles;   // stall plus injected delay cycles
+    double accesses; // NVM accesses
+    uint64_t epochs;
+    uint64_t version; // latency_model.targets_version averaged against
+    int off_target;  // the last check was out of tolerance
+} latency_estimate_t;
+
 typedef struct thread_s {
     struct virtual_node_s* virtual_node;
     pthread_t pthread;
@@ -40,6 +50,10 @@ typedef struct thread_s {
     struct thread_manager_s* thread_manager;
     struct thread_s* next;
     int signaled;
+    struct trace_ring_s* trace; // epoch trace ring, NULL if tracing is off
+    struct live_stats_thread_s* live; // live statistics slot, NULL if off
+    latency_estimate_t latency_estimate;
+    int read_latency; // set through quartz_set_thread_latency(), 0 if none
 #ifdef MEMLAT_SUPPORT
 	uint64_t stall_cycles;
 #endif
@@ -57,17 +71,61 @@ typedef struct thread_manager_s {
     int min_epoch_duration_us; // minimum epoch duration in microseconds
     int next_virtual_node_id; // used by the round-robin policy -- next virtual node to run on 
     int next_cpu_id; // used by the round-robin policy -- next cpu to run on
+    int interleave_dram_weight; // pages interleaved on DRAM and NVM by the thread
+    int interleave_nvm_weight;  // memory policy, 0 to bind threads to DRAM
+    int* saved_weights;         // kernel interleave weights to restore, -1 if untouched
+    int num_saved_weights;
     struct virtual_topology_s* virtual_topology;   
 #ifdef USE_STATISTICS
     stats_t stats;
 #endif
 } thread_manager_t; 
 
+#define MAX_MONITOR_HOOKS 8
+
+typedef void (*monitor_hook_t)(void* arg);
+
 int init_thread_manager(config_t* cfg, struct virtual_topology_s* virtual_topology);
+void finalize_thread_manager();
+int start_monitor_thread();
+int register_monitor_hook(monitor_hook_t hook, void* arg, int period_us);
 int register_self();
 int unregister_self();
 thread_t* thread_self();
+
+/**
+ * \brief Returns the id of the physical node emulating the NVM of the 
+ * calling thread, registering the thread first if needed
+ */
+int nvram_node_self();
+
+/**
+ * \brief Returns the id of the physical node emulating the DRAM of the 
+ * calling thread, registering the thread first if needed
+ */
+int dram_node_self();
+
+#ifndef MPOL_WEIGHTED_INTERLEAVE
+#define MPOL_WEIGHTED_INTERLEAVE 6 // Linux 6.9
+#endif
+
+/**
+ * \brief Hands the weights of two nodes to the kernel's weighted
+ * interleaving. The weights are system wide: they apply to the pages
+ * faulted from then on by every MPOL_WEIGHTED_INTERLEAVE policy, and
+ * finalize_thread_manager() restores the ones we found.
+ */
+int set_node_interleave_weights(int dram_node, int nvm_node, int dram_weight, int nvm_weight);
 int reached_min_epoch_duration(thread_t* thread);
+
+/**
+ * \brief Changes the epoch duration bounds at runtime, see control.c.
+ * valid_epoch_durations() returns E_INVAL for bounds init_thread_manager()
+ * would not accept.
+ */
+int valid_epoch_durations(int min_epoch_duration_us, int max_epoch_duration_us);
+void set_epoch_durations(int min_epoch_duration_us, int max_epoch_duration_us);
+void get_epoch_durations(int* min_epoch_duration_us, int* max_epoch_duration_us);
 void block_new_epoch();
 void unblock_new_epoch();
 
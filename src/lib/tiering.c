@@ -0,0 +1,536 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "error.h"
+#include "interpose.h"
+#include "model.h"
+#include "monotonic_timer.h"
+#include "pmalloc.h"
+#include "tiering.h"
+#include "topology.h"
+
+/**
+ * \file
+ *
+ * Page tiering daemon
+ *
+ * Every period the daemon walks the NVM heap chunk by chunk. For each page
+ * it reads /proc/self/pagemap to learn whether the page was accessed since
+ * the previous period, either from the idle page bitmap (which needs the
+ * page frame numbers only root can see) or from the soft-dirty bit, and
+ * shifts that into a short access history. move_pages() tells where each
+ * page currently lives. Pages on NVM accessed in at least hot_threshold of
+ * the last TIERING_HISTORY periods are promoted, hottest first, to the DRAM
+ * node of the same virtual node; pages on DRAM with no access in the
+ * history are demoted back.
+ *
+ * Blocks of pmalloc_interleave() are not scanned, the application chose
+ * their placement.
+ *
+ * Clearing soft-dirty bits write protects all the pages of the process, so
+ * the softdirty backend adds a page fault to the first write of every page
+ * in every period. It only sees writes.
+ */
+
+#define TIERING_PAGE_SIZE 4096
+#define TIERING_CHUNK_SIZE (2*1024*1024)
+#define TIERING_PAGES_PER_CHUNK (TIERING_CHUNK_SIZE / TIERING_PAGE_SIZE)
+#define TIERING_HISTORY 4 // periods of access history kept per page
+#define TIERING_HISTORY_MASK ((1 << TIERING_HISTORY) - 1)
+#define TIERING_MOVE_BATCH 1024
+#define TIERING_SLEEP_SLICE_US 10000
+
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define PAGEMAP_PFN_MASK ((1ULL << 55) - 1)
+
+#define TIERING_DEFAULT_PERIOD_MS 1000
+#define TIERING_DEFAULT_PROMOTE_MB 64
+#define TIERING_DEFAULT_DEMOTE_MB 64
+#define TIERING_DEFAULT_HOT_THRESHOLD 2
+
+typedef struct {
+    uintptr_t addr;
+    uint8_t history[TIERING_PAGES_PER_CHUNK]; // newest period in bit 0
+} tier_chunk_t;
+
+typedef struct {
+    void* page;
+    int node;  // target node
+    int heat;  // periods accessed in the history
+} tier_move_t;
+
+typedef struct {
+    tier_move_t* moves;
+    int num;
+    int max;
+} tier_move_list_t;
+
+static struct {
+    tiering_backend_t backend;
+    int period_ms;
+    long promote_pages;  // per period
+    long demote_pages;   // per period
+    long dram_pages;     // NVM heap pages allowed on DRAM, 0 for no limit
+    int hot_threshold;
+    int* promote_node;   // indexed by node id, DRAM node to promote to, -1 if not NVM
+    int* demote_node;    // indexed by node id, NVM node to demote to, -1 if not DRAM
+    int num_nodes;
+    int pagemap_fd;
+    int idle_fd;
+
+    tier_chunk_t* chunks; // sorted by address
+    int num_chunks;
+    int max_chunks;
+    tier_chunk_t* next_chunks;
+    int num_next;
+    int max_next;
+    tier_move_list_t promote;
+    tier_move_list_t demote;
+    long dram_resident;
+
+    uint64_t periods;
+    uint64_t promoted;
+    uint64_t demoted;
+    uint64_t failed;
+    uint64_t accessed;       // accessed page samples
+    uint64_t accessed_dram;  // of which on DRAM
+    double scan_us;
+    double migrate_us;
+    uint64_t injected_ns;     // latency model delay at the last period
+    uint64_t first_delay_ns;  // injected during the first period, before any migration
+    uint64_t last_delay_ns;   // injected during the last period
+    uint64_t delay_ns;        // injected during all periods
+
+    volatile int stop;
+    int running;
+    pthread_t thread;
+} tiering;
+
+static int add_move(tier_move_list_t* list, void* page, int node, int heat)
+{
+    tier_move_t* moves;
+
+    if (list->num == list->max) {
+        int max = list->max ? 2 * list->max : 1024;
+        if ((moves = realloc(list->moves, max * sizeof(*moves))) == NULL) {
+            return E_NOMEM;
+        }
+        list->moves = moves;
+        list->max = max;
+    }
+    list->moves[list->num].page = page;
+    list->moves[list->num].node = node;
+    list->moves[list->num].heat = heat;
+    list->num++;
+    return E_SUCCESS;
+}
+
+// builds the chunk list of this period, carrying over the history of the
+// chunks we already knew; both lists are in address order
+static int collect_chunk(void* addr, void* arg)
+{
+    int* old = arg;
+    tier_chunk_t* chunk;
+
+    if (tiering.num_next == tiering.max_next) {
+        int max = tiering.max_next ? 2 * tiering.max_next : 64;
+        tier_chunk_t* chunks = realloc(tiering.next_chunks, max * sizeof(*chunks));
+        if (chunks == NULL) {
+            DBG_LOG(WARNING, "Cannot grow the tiering chunk list, skipping the period\n");
+            return E_NOMEM;
+        }
+        tiering.next_chunks = chunks;
+        tiering.max_next = max;
+    }
+    chunk = &tiering.next_chunks[tiering.num_next++];
+    chunk->addr = (uintptr_t) addr;
+
+    while (*old < tiering.num_chunks && tiering.chunks[*old].addr < chunk->addr) {
+        (*old)++;
+    }
+    if (*old < tiering.num_chunks && tiering.chunks[*old].addr == chunk->addr) {
+        memcpy(chunk->history, tiering.chunks[*old].history, sizeof(chunk->history));
+    } else {
+        memset(chunk->history, 0, sizeof(chunk->history));
+    }
+    return E_SUCCESS;
+}
+
+// keeps the chunks of the last period if the new list cannot be built
+static int swap_chunks()
+{
+    tier_chunk_t* chunks = tiering.chunks;
+    int max = tiering.max_chunks;
+    int old = 0;
+    int ret;
+
+    tiering.num_next = 0;
+    if ((ret = pmalloc_for_each_chunk(collect_chunk, &old)) != E_SUCCESS) {
+        return ret;
+    }
+
+    tiering.chunks = tiering.next_chunks;
+    tiering.num_chunks = tiering.num_next;
+    tiering.max_chunks = tiering.max_next;
+    tiering.next_chunks = chunks;
+    tiering.max_next = max;
+    return E_SUCCESS;
+}
+
+// fills accessed[] from the idle page bitmap and marks the pages idle again
+static int sample_idle(uint64_t* pagemap, uint8_t* accessed)
+{
+    uint64_t word = 0, mark = 0, pfn;
+    off_t cur = -1, off;
+    int i;
+
+    for (i = 0; i < TIERING_PAGES_PER_CHUNK; i++) {
+        accessed[i] = 0;
+        if (!(pagemap[i] & PAGEMAP_PRESENT)) {
+            continue;
+        }
+        if ((pfn = pagemap[i] & PAGEMAP_PFN_MASK) == 0) {
+            return E_NOENT; // page frame numbers are hidden from us
+        }
+        // pages of a huge page share bitmap words, so batch by word
+        off = (off_t) (pfn / 64) * sizeof(uint64_t);
+        if (off != cur) {
+            if (cur >= 0 && pwrite(tiering.idle_fd, &mark, sizeof(mark), cur) != sizeof(mark)) {
+                return E_ERRNO;
+            }
+            if (pread(tiering.idle_fd, &word, sizeof(word), off) != sizeof(word)) {
+                return E_ERRNO;
+            }
+            cur = off;
+            mark = 0;
+        }
+        accessed[i] = !(word & (1ULL << (pfn % 64)));
+        mark |= 1ULL << (pfn % 64);
+    }
+    if (cur >= 0 && pwrite(tiering.idle_fd, &mark, sizeof(mark), cur) != sizeof(mark)) {
+        return E_ERRNO;
+    }
+    return E_SUCCESS;
+}
+
+static void clear_soft_dirty()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+
+    if (fd >= 0) {
+        if (write(fd, "4", 1) != 1) {
+            DBG_LOG(WARNING, "Cannot clear soft-dirty bits\n");
+        }
+        close(fd);
+    }
+}
+
+static int scan_chunk(tier_chunk_t* chunk)
+{
+    uint64_t pagemap[TIERING_PAGES_PER_CHUNK];
+    uint8_t accessed[TIERING_PAGES_PER_CHUNK];
+    void* pages[TIERING_PAGES_PER_CHUNK];
+    int index[TIERING_PAGES_PER_CHUNK];
+    int status[TIERING_PAGES_PER_CHUNK];
+    off_t off = (off_t) (chunk->addr / TIERING_PAGE_SIZE) * sizeof(uint64_t);
+    int i, n = 0, node, heat;
+
+    if (pread(tiering.pagemap_fd, pagemap, sizeof(pagemap), off) != sizeof(pagemap)) {
+        return E_SUCCESS;
+    }
+    if (tiering.backend == TIERING_BACKEND_IDLE && sample_idle(pagemap, accessed) != E_SUCCESS) {
+        DBG_LOG(WARNING, "Idle page tracking unavailable, tiering falls back to soft-dirty bits\n");
+        tiering.backend = TIERING_BACKEND_SOFTDIRTY;
+    }
+    for (i = 0; i < TIERING_PAGES_PER_CHUNK; i++) {
+        if (tiering.backend == TIERING_BACKEND_SOFTDIRTY) {
+            accessed[i] = (pagemap[i] & PAGEMAP_SOFT_DIRTY) != 0;
+        }
+        chunk->history[i] = ((chunk->history[i] << 1) | accessed[i]) & TIERING_HISTORY_MASK;
+        if (pagemap[i] & PAGEMAP_PRESENT) {
+            pages[n] = (void*) (chunk->addr + (uintptr_t) i * TIERING_PAGE_SIZE);
+            index[n++] = i;
+        }
+    }
+    if (n == 0 || move_pages(0, n, pages, NULL, status, 0) != 0) {
+        return E_SUCCESS;
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((node = status[i]) < 0 || node >= tiering.num_nodes) {
+            continue;
+        }
+        heat = __builtin_popcount(chunk->history[index[i]]);
+        if (accessed[index[i]]) {
+            tiering.accessed++;
+            if (tiering.demote_node[node] >= 0) {
+                tiering.accessed_dram++;
+            }
+        }
+        if (tiering.promote_node[node] >= 0 && heat >= tiering.hot_threshold) {
+            if (add_move(&tiering.promote, pages[i], tiering.promote_node[node], heat) != E_SUCCESS) {
+                return E_NOMEM;
+            }
+        } else if (tiering.demote_node[node] >= 0) {
+            tiering.dram_resident++;
+            if (heat == 0 && add_move(&tiering.demote, pages[i], tiering.demote_node[node], 0) != E_SUCCESS) {
+                return E_NOMEM;
+            }
+        }
+    }
+    return E_SUCCESS;
+}
+
+static int hotter(const void* a, const void* b)
+{
+    return ((const tier_move_t*) b)->heat - ((const tier_move_t*) a)->heat;
+}
+
+// migrates the first n pages of the list, returns the number moved
+static long migrate(tier_move_list_t* list, long n)
+{
+    void* pages[TIERING_MOVE_BATCH];
+    int nodes[TIERING_MOVE_BATCH];
+    int status[TIERING_MOVE_BATCH];
+    long done = 0, i;
+    int b, count;
+    double start = monotonic_time_us();
+
+    for (i = 0; i < n; i += count) {
+        count = n - i < TIERING_MOVE_BATCH ? (int) (n - i) : TIERING_MOVE_BATCH;
+        for (b = 0; b < count; b++) {
+            pages[b] = list->moves[i + b].page;
+            nodes[b] = list->moves[i + b].node;
+        }
+        if (move_pages(0, count, pages, nodes, status, MPOL_MF_MOVE) < 0) {
+            tiering.failed += count;
+            continue;
+        }
+        for (b = 0; b < count; b++) {
+            if (status[b] == nodes[b]) {
+                done++;
+            } else {
+                tiering.failed++;
+            }
+        }
+    }
+    tiering.migrate_us += monotonic_time_us() - start;
+    return done;
+}
+
+static void tiering_period()
+{
+    double start = monotonic_time_us();
+    uint64_t injected = __atomic_load_n(&latency_model.injected_ns, __ATOMIC_RELAXED);
+    uint64_t delay = injected - tiering.injected_ns; // since the previous period
+    long n, room;
+    int i, ret = E_SUCCESS;
+
+    tiering.injected_ns = injected;
+    if (swap_chunks() != E_SUCCESS) {
+        return;
+    }
+    tiering.promote.num = tiering.demote.num = 0;
+    tiering.dram_resident = 0;
+    for (i = 0; i < tiering.num_chunks && !tiering.stop && ret == E_SUCCESS; i++) {
+        ret = scan_chunk(&tiering.chunks[i]);
+    }
+    if (tiering.backend == TIERING_BACKEND_SOFTDIRTY) {
+        clear_soft_dirty();
+    }
+    tiering.scan_us += monotonic_time_us() - start;
+    if (ret != E_SUCCESS) {
+        // a partial list would demote pages whose heat was never looked at
+        DBG_LOG(WARNING, "Cannot grow the tiering move lists, skipping the period\n");
+        return;
+    }
+    if (tiering.periods == 0) {
+        tiering.first_delay_ns = delay;
+    }
+    tiering.last_delay_ns = delay;
+    tiering.delay_ns += delay;
+
+    n = tiering.demote.num < tiering.demote_pages ? tiering.demote.num : tiering.demote_pages;
+    n = migrate(&tiering.demote, n);
+    tiering.demoted += n;
+    tiering.dram_resident -= n;
+
+    n = tiering.promote.num < tiering.promote_pages ? tiering.promote.num : tiering.promote_pages;
+    if (tiering.dram_pages) {
+        room = tiering.dram_pages - tiering.dram_resident;
+        n = n < room ? n : (room > 0 ? room : 0);
+    }
+    qsort(tiering.promote.moves, tiering.promote.num, sizeof(tier_move_t), hotter);
+    tiering.promoted += migrate(&tiering.promote, n);
+    tiering.periods++;
+}
+
+static void* tiering_thread(void* arg)
+{
+    long slept;
+
+    while (!tiering.stop) {
+        for (slept = 0; slept < tiering.period_ms * 1000L && !tiering.stop; slept += TIERING_SLEEP_SLICE_US) {
+            usleep(TIERING_SLEEP_SLICE_US);
+        }
+        if (!tiering.stop) {
+            tiering_period();
+        }
+    }
+    return NULL;
+}
+
+int init_tiering(config_t* cfg, virtual_topology_t* topology)
+{
+    int enabled = 0;
+    int val, i, dram, nvram;
+    char* str;
+
+    memset(&tiering, 0, sizeof(tiering));
+    __cconfig_lookup_bool(cfg, "tiering.enable", &enabled);
+    if (!enabled) {
+        return E_SUCCESS;
+    }
+
+    tiering.backend = TIERING_BACKEND_IDLE;
+    if (__cconfig_lookup_string(cfg, "tiering.backend", &str) == CONFIG_TRUE) {
+        if (strcmp(str, "softdirty") == 0) {
+            tiering.backend = TIERING_BACKEND_SOFTDIRTY;
+        } else if (strcmp(str, "idle") != 0) {
+            DBG_LOG(WARNING, "Unknown tiering.backend '%s', using idle\n", str);
+        }
+    }
+    if (__cconfig_lookup_int(cfg, "tiering.period_ms", &tiering.period_ms) != CONFIG_TRUE || tiering.period_ms <= 0) {
+        tiering.period_ms = TIERING_DEFAULT_PERIOD_MS;
+    }
+    val = TIERING_DEFAULT_PROMOTE_MB;
+    __cconfig_lookup_int(cfg, "tiering.promote_mb", &val);
+    tiering.promote_pages = (long) val * 1024 * 1024 / TIERING_PAGE_SIZE;
+    val = TIERING_DEFAULT_DEMOTE_MB;
+    __cconfig_lookup_int(cfg, "tiering.demote_mb", &val);
+    tiering.demote_pages = (long) val * 1024 * 1024 / TIERING_PAGE_SIZE;
+    val = 0;
+    __cconfig_lookup_int(cfg, "tiering.dram_mb", &val);
+    tiering.dram_pages = (long) val * 1024 * 1024 / TIERING_PAGE_SIZE;
+    tiering.hot_threshold = TIERING_DEFAULT_HOT_THRESHOLD;
+    if (__cconfig_lookup_int(cfg, "tiering.hot_threshold", &val) == CONFIG_TRUE && val > 0 && val <= TIERING_HISTORY) {
+        tiering.hot_threshold = val;
+    }
+
+    tiering.num_nodes = numa_max_node() + 1;
+    tiering.promote_node = malloc(tiering.num_nodes * sizeof(int));
+    tiering.demote_node = malloc(tiering.num_nodes * sizeof(int));
+    if (!tiering.promote_node || !tiering.demote_node) {
+        return E_NOMEM;
+    }
+    for (i = 0; i < tiering.num_nodes; i++) {
+        tiering.promote_node[i] = tiering.demote_node[i] = -1;
+    }
+    for (i = 0; i < topology->num_virtual_nodes; i++) {
+        dram = topology->virtual_nodes[i].dram_node->node_id;
+        nvram = topology->virtual_nodes[i].nvram_node->node_id;
+        if (dram != nvram && dram < tiering.num_nodes && nvram < tiering.num_nodes) {
+            tiering.promote_node[nvram] = dram;
+            tiering.demote_node[dram] = nvram;
+        }
+    }
+    for (i = 0; i < tiering.num_nodes && tiering.promote_node[i] < 0; i++);
+    if (i == tiering.num_nodes) {
+        DBG_LOG(WARNING, "Tiering needs virtual nodes with both DRAM and NVM, tiering disabled\n");
+        return E_SUCCESS;
+    }
+
+    if ((tiering.pagemap_fd = open("/proc/self/pagemap", O_RDONLY)) < 0) {
+        DBG_LOG(WARNING, "Cannot open /proc/self/pagemap, tiering disabled\n");
+        return E_SUCCESS;
+    }
+    if (tiering.backend == TIERING_BACKEND_IDLE &&
+        (tiering.idle_fd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR)) < 0)
+    {
+        DBG_LOG(WARNING, "Cannot open the idle page bitmap, tiering falls back to soft-dirty bits\n");
+        tiering.backend = TIERING_BACKEND_SOFTDIRTY;
+    }
+    if (tiering.backend == TIERING_BACKEND_SOFTDIRTY) {
+        clear_soft_dirty();
+    }
+
+    if (__lib_pthread_create == NULL) {
+        init_interposition();
+    }
+    tiering.injected_ns = __atomic_load_n(&latency_model.injected_ns, __ATOMIC_RELAXED);
+    // not registered with the thread manager, the daemon is no application thread
+    if (__lib_pthread_create(&tiering.thread, NULL, tiering_thread, NULL) != 0) {
+        DBG_LOG(WARNING, "Cannot create the tiering thread, tiering disabled\n");
+        return E_SUCCESS;
+    }
+    tiering.running = 1;
+    DBG_LOG(INFO, "Tiering every %d ms with %s, promoting up to %ld and demoting up to %ld pages per period\n",
+            tiering.period_ms, tiering.backend == TIERING_BACKEND_IDLE ? "idle page tracking" : "soft-dirty bits",
+            tiering.promote_pages, tiering.demote_pages);
+    return E_SUCCESS;
+}
+
+void finalize_tiering()
+{
+    if (!tiering.running) {
+        return;
+    }
+    tiering.stop = 1;
+    pthread_join(tiering.thread, NULL);
+    tiering.running = 0;
+    DBG_LOG(INFO, "Tiering: %lu pages promoted, %lu demoted, %lu failed in %lu periods\n",
+            tiering.promoted, tiering.demoted, tiering.failed, tiering.periods);
+}
+
+void tiering_report(FILE* out)
+{
+    double seconds = tiering.periods * tiering.period_ms / 1000.0;
+    uint64_t moved = tiering.promoted + tiering.demoted;
+
+    if (tiering.periods == 0) {
+        return;
+    }
+    fprintf(out, "\n== Tiering ==\n");
+    fprintf(out, "Periods: %lu of %d ms\n", tiering.periods, tiering.period_ms);
+    fprintf(out, "Promoted pages: %lu (%.1f MB/s)\n", tiering.promoted,
+            tiering.promoted * TIERING_PAGE_SIZE / seconds / (1024 * 1024));
+    fprintf(out, "Demoted pages: %lu (%.1f MB/s)\n", tiering.demoted,
+            tiering.demoted * TIERING_PAGE_SIZE / seconds / (1024 * 1024));
+    fprintf(out, "Failed migrations: %lu\n", tiering.failed);
+    fprintf(out, "Scan time: %.0f usec\n", tiering.scan_us);
+    fprintf(out, "Migration time: %.0f usec (%.2f usec per page)\n", tiering.migrate_us,
+            moved ? tiering.migrate_us / moved : 0.0);
+    // accesses to pages on DRAM are not delayed by the latency model
+    fprintf(out, "Accessed pages found on DRAM: %.1f%%\n",
+            tiering.accessed ? 100.0 * tiering.accessed_dram / tiering.accessed : 0.0);
+    if (tiering.delay_ns == 0) {
+        return;
+    }
+    // the first period runs before any migration, so it is the baseline the
+    // later periods are compared against
+    fprintf(out, "Injected delay per period: %.0f usec first, %.0f usec last, %.0f usec mean\n",
+            tiering.first_delay_ns / 1000.0, tiering.last_delay_ns / 1000.0,
+            tiering.delay_ns / 1000.0 / tiering.periods);
+    fprintf(out, "Injected delay saved against the first period: %.0f usec\n",
+            ((double) tiering.first_delay_ns * tiering.periods - tiering.delay_ns) / 1000.0);
+}
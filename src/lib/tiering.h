@@ -0,0 +1,44 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __TIERING_H
+#define __TIERING_H
+
+#include <stdio.h>
+#include "config.h"
+
+/**
+ * \file
+ *
+ * \page tiering Page tiering
+ *
+ * A daemon thread periodically samples which pages of the NVM heap were
+ * accessed, promotes pages that stay hot to the DRAM of their virtual node
+ * and demotes promoted pages that went cold back to NVM, within per period
+ * migration budgets and a DRAM capacity budget. Since the latency model
+ * only delays accesses to NVM, the emulated runtime of the application
+ * reflects the placement the tiering policy achieves.
+ */
+
+struct virtual_topology_s;
+
+typedef enum {
+    TIERING_BACKEND_IDLE = 0,  // idle page tracking, sees reads and writes, needs root
+    TIERING_BACKEND_SOFTDIRTY  // soft-dirty bits, sees writes only
+} tiering_backend_t;
+
+int init_tiering(config_t* cfg, struct virtual_topology_s* topology);
+void finalize_tiering();
+void tiering_report(FILE* out);
+
+#endif /* __TIERING_H */
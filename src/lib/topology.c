@@ -68,10 +68,8 @@ int select_cpus_based_on_local_rank(virtual_topology_t* virtual_topology)
         // the max rank
         rr_set_next_cpu_based_on_rank(rank, n_procs);
     } else {
-        // partition the CPUs to each rank
-        // some CPUs may end up idle/without bound processes, if n_procs is not
-        // multiple of 2
-        // TODO: warn or avoid idle CPUs
+        // partition the CPUs to each rank, the remainder of an uneven
+        // split goes one CPU to a rank
         partition_cpus_based_on_rank(rank, n_procs, num_cpus, virtual_topology);
     }
 
@@ -56,6 +56,10 @@ typedef struct {
     // if dram then latency is the measured local latency to dram.
     // if nvram then latency is the measured remote latency to the sibling nvram node
     int latency; 
+
+    // throttle register to bandwidth models of the node's memory controller
+    struct bw_model_s* read_bw_model;
+    struct bw_model_s* write_bw_model;
 } physical_node_t;
 
 typedef struct virtual_node_s {
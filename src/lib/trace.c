@@ -0,0 +1,203 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu/cpu.h"
+#include "error.h"
+#include "interpose.h"
+#include "trace.h"
+
+#define TRACE_DEFAULT_RING_RECORDS 8192
+#define TRACE_DEFAULT_FLUSH_MS 100
+#define TRACE_SLEEP_SLICE_US 10000
+
+static struct {
+    int enabled;
+    FILE* file;
+    uint64_t ring_records;
+    int flush_ms;
+    pthread_mutex_t mutex; // protects the ring list
+    trace_ring_t* rings;
+    uint64_t records;
+    uint64_t dropped;      // by rings already freed
+    volatile int stop;
+    pthread_t thread;
+} trace;
+
+// writes the records the thread produced since the last drain
+static void drain_ring(trace_ring_t* ring)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first, count;
+    trace_block_t block;
+
+    while (tail != head) {
+        // up to the end of the ring, the rest in the next round
+        first = tail & ring->mask;
+        count = head - tail;
+        if (count > ring->mask + 1 - first) {
+            count = ring->mask + 1 - first;
+        }
+        block.tid = ring->tid;
+        block.count = count;
+        fwrite(&block, sizeof(block), 1, trace.file);
+        fwrite(&ring->records[first], sizeof(trace_record_t), count, trace.file);
+        tail += count;
+        trace.records += count;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void drain_rings()
+{
+    trace_ring_t** p;
+    trace_ring_t* ring;
+
+    __lib_pthread_mutex_lock(&trace.mutex);
+    for (p = &trace.rings; (ring = *p) != NULL; ) {
+        // a closed ring gets no more records, once drained it can go
+        int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        drain_ring(ring);
+        if (closed) {
+            *p = ring->next;
+            trace.dropped += ring->dropped;
+            free(ring->records);
+            free(ring);
+        } else {
+            p = &ring->next;
+        }
+    }
+    __lib_pthread_mutex_unlock(&trace.mutex);
+    fflush(trace.file);
+}
+
+static void* trace_flusher(void* arg)
+{
+    long slept;
+
+    while (!trace.stop) {
+        for (slept = 0; slept < trace.flush_ms * 1000L && !trace.stop; slept += TRACE_SLEEP_SLICE_US) {
+            usleep(TRACE_SLEEP_SLICE_US);
+        }
+        drain_rings();
+    }
+    return NULL;
+}
+
+int init_trace(config_t* cfg)
+{
+    trace_file_header_t header;
+    char default_file[64];
+    int enabled = 0;
+    int records;
+    char* file;
+
+    __cconfig_lookup_bool(cfg, "trace.enable", &enabled);
+    if (!enabled) {
+        return E_SUCCESS;
+    }
+    if (__cconfig_lookup_string(cfg, "trace.file", &file) != CONFIG_TRUE) {
+        snprintf(default_file, sizeof(default_file), "nvmemul-trace.%d.bin", getpid());
+        file = default_file;
+    }
+    if (__cconfig_lookup_int(cfg, "trace.ring_records", &records) != CONFIG_TRUE || records <= 0) {
+        records = TRACE_DEFAULT_RING_RECORDS;
+    }
+    // round up to a power of two so the ring index is a mask
+    for (trace.ring_records = 1; trace.ring_records < (uint64_t) records; trace.ring_records <<= 1);
+    if (__cconfig_lookup_int(cfg, "trace.flush_ms", &trace.flush_ms) != CONFIG_TRUE || trace.flush_ms <= 0) {
+        trace.flush_ms = TRACE_DEFAULT_FLUSH_MS;
+    }
+
+    if ((trace.file = fopen(file, "w")) == NULL) {
+        DBG_LOG(WARNING, "Cannot open trace file %s, tracing disabled\n", file);
+        return E_SUCCESS;
+    }
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(trace_record_t);
+    header.cpu_speed_mhz = cpu_speed_mhz();
+    header.pid = getpid();
+    fwrite(&header, sizeof(header), 1, trace.file);
+
+    pthread_mutex_init(&trace.mutex, NULL);
+    if (__lib_pthread_create == NULL) {
+        init_interposition();
+    }
+    if (__lib_pthread_create(&trace.thread, NULL, trace_flusher, NULL) != 0) {
+        DBG_LOG(WARNING, "Cannot create the trace flusher thread, tracing disabled\n");
+        fclose(trace.file);
+        return E_SUCCESS;
+    }
+    trace.enabled = 1;
+    DBG_LOG(INFO, "Tracing epochs to %s\n", file);
+    return E_SUCCESS;
+}
+
+trace_ring_t* trace_thread_start(pid_t tid)
+{
+    trace_ring_t* ring;
+
+    if (!trace.enabled) {
+        return NULL;
+    }
+    if ((ring = calloc(1, sizeof(*ring))) == NULL) {
+        return NULL;
+    }
+    if ((ring->records = malloc(trace.ring_records * sizeof(trace_record_t))) == NULL) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = trace.ring_records - 1;
+    ring->tid = tid;
+
+    __lib_pthread_mutex_lock(&trace.mutex);
+    ring->next = trace.rings;
+    trace.rings = ring;
+    __lib_pthread_mutex_unlock(&trace.mutex);
+    return ring;
+}
+
+void trace_thread_stop(trace_ring_t* ring)
+{
+    if (ring) {
+        __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void finalize_trace()
+{
+    trace_ring_t* ring;
+
+    if (!trace.enabled) {
+        return;
+    }
+    trace.stop = 1;
+    pthread_join(trace.thread, NULL);
+    // the remaining rings belong to threads still running, keep them
+    drain_rings();
+    __lib_pthread_mutex_lock(&trace.mutex);
+    for (ring = trace.rings; ring; ring = ring->next) {
+        trace.dropped += ring->dropped;
+    }
+    trace.enabled = 0;
+    __lib_pthread_mutex_unlock(&trace.mutex);
+    fclose(trace.file);
+    DBG_LOG(INFO, "Traced %lu epochs, %lu dropped on full rings\n", trace.records, trace.dropped);
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <sys/types.h>
+#include "config.h"
+#include "trace_format.h"
+
+/**
+ * \file
+ *
+ * Epoch tracing
+ *
+ * Every registered thread gets a ring of trace_record_t, written by the
+ * thread itself when it closes a latency epoch, possibly from the signal
+ * handler, so the ring is single producer and lock free: a full ring drops
+ * records instead of blocking. A flusher thread drains all the rings to the
+ * trace file periodically. src/tools/quartz-trace analyzes the file.
+ */
+
+typedef struct trace_ring_s {
+    trace_record_t* records;
+    uint64_t mask;         // capacity - 1, the capacity is a power of two
+    uint64_t head;         // next record the thread writes
+    uint64_t tail;         // next record the flusher reads
+    uint64_t dropped;
+    pid_t tid;
+    int closed;            // the thread is gone, free once drained
+    struct trace_ring_s* next;
+} trace_ring_t;
+
+int init_trace(config_t* cfg);
+void finalize_trace();
+
+/**
+ * \brief Returns a ring for the calling thread, NULL if tracing is off
+ */
+trace_ring_t* trace_thread_start(pid_t tid);
+
+/**
+ * \brief Hands the ring of an exiting thread over to the flusher
+ */
+void trace_thread_stop(trace_ring_t* ring);
+
+static inline void trace_epoch(trace_ring_t* ring, const trace_record_t* record)
+{
+    uint64_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        ring->dropped++;
+        return;
+    }
+    ring->records[head & ring->mask] = *record;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* __TRACE_H */
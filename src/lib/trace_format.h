@@ -0,0 +1,64 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __TRACE_FORMAT_H
+#define __TRACE_FORMAT_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Epoch trace file format
+ *
+ * A header followed by blocks, each made of a block header and count
+ * records of the thread tid. Blocks of different threads interleave in the
+ * order the flusher drained them; records of a thread are in order.
+ * Everything is in host byte order.
+ */
+
+#define TRACE_MAGIC "QZTRACE"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_TRIGGER_SIGNAL = 0,  // the monitor thread interrupted the thread
+    TRACE_TRIGGER_SYNC         // a synchronization call closed the epoch
+} trace_trigger_t;
+
+#define TRACE_FLAG_DELAY_CAPPED 0x1 // the delay exceeded the cap and was dropped
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t cpu_speed_mhz;  // converts TSC cycles to time
+    uint32_t pid;
+} trace_file_header_t;
+
+typedef struct {
+    uint32_t tid;
+    uint32_t count;
+} trace_block_t;
+
+typedef struct {
+    uint64_t tsc;             // when the epoch closed
+    uint64_t stall_cycles;    // memory stall cycles of the epoch
+    uint64_t delay_cycles;    // delay injected
+    uint64_t overhead_cycles; // emulator overhead not yet discounted
+    uint64_t nvm_misses;      // PMC delta of NVM (remote or local DRAM) misses
+    uint32_t epoch_us;        // time since the previous epoch
+    uint16_t trigger;
+    uint16_t flags;
+} trace_record_t;
+
+#endif /* __TRACE_FORMAT_H */
@@ -0,0 +1,282 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu/cpu.h"
+#include "error.h"
+#include "monotonic_timer.h"
+#include "thread.h"
+#include "topology.h"
+#include "uncore.h"
+
+/**
+ * \file
+ *
+ * Uncore counter sampling
+ *
+ * Two backends provide the counters. The pci backend programs the memory
+ * controller channel counters to count read and write CAS commands through
+ * the emulator's device driver; each CAS moves a cache line. The sim backend
+ * reads cumulative byte counts from a file instead, one line per node:
+ *
+ *     <node id> <read bytes> <write bytes>
+ *
+ * so that tests can drive the models with a known traffic pattern on
+ * machines without accessible memory controller counters.
+ *
+ * Samples are written by the monitor thread only and published with a
+ * sequence lock, so readers never block the sampler.
+ */
+
+#define UNCORE_DEFAULT_PERIOD_MS 10
+
+typedef struct {
+    const char* name;
+    int counter_bits;  // counters wrap around at 2^counter_bits
+    int unit_bytes;    // bytes moved per counted event
+    int (*setup)(physical_node_t* node);
+    int (*read)(physical_node_t* node, uint64_t* reads, uint64_t* writes);
+} uncore_backend_t;
+
+typedef struct {
+    physical_node_t* node;
+    uint64_t raw_read;
+    uint64_t raw_write;
+    volatile uint64_t lock; // odd while the sample is being updated
+    uncore_sample_t sample;
+} uncore_node_t;
+
+static struct {
+    int enabled;
+    int period_ms;
+    char* sim_file;
+    const uncore_backend_t* backend;
+    uncore_node_t* nodes;
+    int num_nodes;
+} uncore;
+
+static int pci_setup(physical_node_t* node)
+{
+    if (node->mc_pci_regs == NULL || node->cpu_model->setup_imc_counters == NULL) {
+        return E_NOENT;
+    }
+    return node->cpu_model->setup_imc_counters(node->mc_pci_regs);
+}
+
+static int pci_read(physical_node_t* node, uint64_t* reads, uint64_t* writes)
+{
+    return node->cpu_model->read_imc_counters(node->mc_pci_regs, reads, writes);
+}
+
+static int sim_setup(physical_node_t* node)
+{
+    return uncore.sim_file ? E_SUCCESS : E_INVAL;
+}
+
+static int sim_read(physical_node_t* node, uint64_t* reads, uint64_t* writes)
+{
+    FILE* fp;
+    char line[256];
+    int node_id;
+    unsigned long long rd, wr;
+    int ret = E_NOENT;
+
+    if ((fp = fopen(uncore.sim_file, "r")) == NULL) {
+        return E_ERRNO;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%d %llu %llu", &node_id, &rd, &wr) == 3 && node_id == node->node_id) {
+            *reads = rd;
+            *writes = wr;
+            ret = E_SUCCESS;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+static const uncore_backend_t uncore_backends[] = {
+    {"pci", 48, CACHE_LINE_SIZE, pci_setup, pci_read},
+    {"sim", 64, 1, sim_setup, sim_read},
+    {NULL, 0, 0, NULL, NULL}
+};
+
+static uint64_t counter_delta(uint64_t cur, uint64_t last, int bits)
+{
+    if (bits < 64 && cur < last) {
+        return cur + (1ULL << bits) - last;
+    }
+    return cur - last;
+}
+
+static void sample_node(uncore_node_t* n, double now)
+{
+    uint64_t rd, wr, drd, dwr;
+
+    if (uncore.backend->read(n->node, &rd, &wr) != E_SUCCESS) {
+        return;
+    }
+    drd = counter_delta(rd, n->raw_read, uncore.backend->counter_bits) * uncore.backend->unit_bytes;
+    dwr = counter_delta(wr, n->raw_write, uncore.backend->counter_bits) * uncore.backend->unit_bytes;
+    n->raw_read = rd;
+    n->raw_write = wr;
+
+    __atomic_add_fetch(&n->lock, 1, __ATOMIC_ACQ_REL);
+    if (n->sample.seq == 0) {
+        // first sample only sets the baseline
+        drd = dwr = 0;
+    }
+    n->sample.epoch_us = n->sample.seq ? now - n->sample.timestamp_us : 0;
+    n->sample.timestamp_us = now;
+    n->sample.read_bytes += drd;
+    n->sample.write_bytes += dwr;
+    n->sample.epoch_read_bytes = drd;
+    n->sample.epoch_write_bytes = dwr;
+    n->sample.seq++;
+    __atomic_add_fetch(&n->lock, 1, __ATOMIC_RELEASE);
+}
+
+static void uncore_hook(void* arg)
+{
+    int i;
+    double now = monotonic_time_us();
+
+    for (i = 0; i < uncore.num_nodes; i++) {
+        sample_node(&uncore.nodes[i], now);
+    }
+}
+
+int uncore_enabled()
+{
+    return uncore.enabled;
+}
+
+int uncore_node_traffic(int node_id, uncore_sample_t* sample)
+{
+    uncore_node_t* n = NULL;
+    uint64_t lock;
+    int i;
+
+    if (!uncore.enabled) {
+        return E_NOENT;
+    }
+    for (i = 0; i < uncore.num_nodes; i++) {
+        if (uncore.nodes[i].node->node_id == node_id) {
+            n = &uncore.nodes[i];
+            break;
+        }
+    }
+    if (n == NULL) {
+        return E_NOENT;
+    }
+    do {
+        while ((lock = __atomic_load_n(&n->lock, __ATOMIC_ACQUIRE)) & 1);
+        memcpy(sample, &n->sample, sizeof(*sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&n->lock, __ATOMIC_RELAXED) != lock);
+
+    return sample->seq ? E_SUCCESS : E_NOENT;
+}
+
+static void add_node(physical_node_t* node)
+{
+    int i;
+
+    if (node == NULL) {
+        return;
+    }
+    for (i = 0; i < uncore.num_nodes; i++) {
+        if (uncore.nodes[i].node == node) {
+            return;
+        }
+    }
+    if (uncore.backend->setup(node) != E_SUCCESS) {
+        DBG_LOG(WARNING, "No %s uncore counters for node %d\n", uncore.backend->name, node->node_id);
+        return;
+    }
+    uncore.nodes[uncore.num_nodes++].node = node;
+}
+
+int init_uncore(config_t* cfg, virtual_topology_t* topology)
+{
+    char* backend = "pci";
+    const uncore_backend_t* b;
+    int i;
+
+    memset(&uncore, 0, sizeof(uncore));
+    __cconfig_lookup_bool(cfg, "uncore.enable", &uncore.enabled);
+    if (!uncore.enabled) {
+        return E_SUCCESS;
+    }
+    uncore.enabled = 0;
+
+    __cconfig_lookup_string(cfg, "uncore.backend", &backend);
+    for (b = uncore_backends; b->name; b++) {
+        if (strcmp(b->name, backend) == 0) {
+            uncore.backend = b;
+            break;
+        }
+    }
+    if (uncore.backend == NULL) {
+        DBG_LOG(WARNING, "Unknown uncore backend '%s', uncore counters disabled\n", backend);
+        return E_SUCCESS;
+    }
+    if (__cconfig_lookup_string(cfg, "uncore.sim_file", &uncore.sim_file) == CONFIG_TRUE) {
+        uncore.sim_file = strdup(uncore.sim_file);
+    }
+    if (__cconfig_lookup_int(cfg, "uncore.period_ms", &uncore.period_ms) != CONFIG_TRUE ||
+        uncore.period_ms <= 0)
+    {
+        uncore.period_ms = UNCORE_DEFAULT_PERIOD_MS;
+    }
+
+    if (!(uncore.nodes = calloc(2 * topology->num_virtual_nodes, sizeof(*uncore.nodes)))) {
+        return E_NOMEM;
+    }
+    for (i = 0; i < topology->num_virtual_nodes; i++) {
+        add_node(topology->virtual_nodes[i].dram_node);
+        add_node(topology->virtual_nodes[i].nvram_node);
+    }
+    if (uncore.num_nodes == 0) {
+        DBG_LOG(WARNING, "No node has %s uncore counters, uncore counters disabled\n", backend);
+        return E_SUCCESS;
+    }
+
+    // take the baseline before anybody reads
+    uncore_hook(NULL);
+    uncore.enabled = 1;
+
+    DBG_LOG(INFO, "Sampling %s uncore counters of %d nodes every %d ms\n", backend, uncore.num_nodes, uncore.period_ms);
+    if (register_monitor_hook(uncore_hook, NULL, uncore.period_ms * 1000) != E_SUCCESS) {
+        return E_ERROR;
+    }
+    return start_monitor_thread();
+}
+
+void finalize_uncore()
+{
+    uncore_sample_t s;
+    int i;
+
+    for (i = 0; i < uncore.num_nodes; i++) {
+        if (uncore_node_traffic(uncore.nodes[i].node->node_id, &s) == E_SUCCESS) {
+            DBG_LOG(INFO, "Node %d: %lu bytes read, %lu bytes written\n",
+                    uncore.nodes[i].node->node_id, s.read_bytes, s.write_bytes);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __UNCORE_H
+#define __UNCORE_H
+
+#include <stdint.h>
+#include "config.h"
+
+/**
+ * \file
+ *
+ * Uncore memory controller counters
+ *
+ * Per-core counters only see the misses of the core they run on. The memory
+ * controller (IMC) counters see all the read and write traffic reaching the
+ * DRAM of a socket, which is what bandwidth emulation and write modeling
+ * need. The monitor thread samples the counters of every physical node
+ * periodically; an epoch here is one sampling period.
+ *
+ * Only the bandwidth controller reads the samples for now. The latency
+ * model still works from the per-core stall counters of each thread, since
+ * node wide traffic cannot be attributed to the thread whose epoch ends.
+ */
+
+struct virtual_topology_s;
+
+typedef struct {
+    uint64_t seq;             // sample sequence number, 0 before the first sample
+    double timestamp_us;      // when the sample was taken
+    double epoch_us;          // time since the previous sample
+    uint64_t read_bytes;      // cumulative
+    uint64_t write_bytes;     // cumulative
+    uint64_t epoch_read_bytes;  // traffic during the last epoch
+    uint64_t epoch_write_bytes;
+} uncore_sample_t;
+
+int init_uncore(config_t* cfg, struct virtual_topology_s* topology);
+void finalize_uncore();
+
+/**
+ * \brief Returns 1 if uncore traffic samples are available
+ */
+int uncore_enabled();
+
+/**
+ * \brief Copies the latest traffic sample of a physical node
+ *
+ * Returns E_NOENT if the node is not sampled or has no sample yet.
+ */
+int uncore_node_traffic(int node_id, uncore_sample_t* sample);
+
+#endif /* __UNCORE_H */
@@ -0,0 +1,139 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu/cpu.h"
+#include "error.h"
+#include "live_stats.h"
+#include "thread.h"
+#include "topology.h"
+#include "wpq.h"
+
+#define WPQ_DEFAULT_DEPTH 64 // lines
+
+// times are in picoseconds, a line drains in a few nanoseconds
+typedef struct {
+    uint64_t tail_ps;      // when the queue will be empty
+    uint64_t lines;
+    uint64_t stalls;
+    uint64_t stall_ps;
+    uint64_t max_backlog_ps;
+} __attribute__((aligned(CACHE_LINE_SIZE))) wpq_t;
+
+static struct {
+    int enabled;
+    int write_bw_mbps;
+    int depth;
+    uint64_t line_ps;  // time to drain one line at write_bw
+    uint64_t limit_ps; // backlog of a full queue
+    int num_queues;
+    wpq_t* queues;
+} wpq;
+
+static inline uint64_t now_ps()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec) * 1000;
+}
+
+int init_wpq(config_t* cfg, virtual_topology_t* topology)
+{
+    memset(&wpq, 0, sizeof(wpq));
+    if (__cconfig_lookup_int(cfg, "latency.write_bw", &wpq.write_bw_mbps) != CONFIG_TRUE ||
+        wpq.write_bw_mbps <= 0)
+    {
+        return E_SUCCESS;
+    }
+    if (__cconfig_lookup_int(cfg, "latency.wpq_depth", &wpq.depth) != CONFIG_TRUE || wpq.depth <= 0) {
+        wpq.depth = WPQ_DEFAULT_DEPTH;
+    }
+    // bytes per us, so a line takes CACHE_LINE_SIZE * 10^6 / write_bw ps
+    wpq.line_ps = (uint64_t) CACHE_LINE_SIZE * 1000000 / wpq.write_bw_mbps;
+    if (wpq.line_ps == 0) {
+        wpq.line_ps = 1;
+    }
+    wpq.limit_ps = wpq.line_ps * wpq.depth;
+
+    wpq.num_queues = topology->num_virtual_nodes;
+    if (posix_memalign((void**) &wpq.queues, CACHE_LINE_SIZE, wpq.num_queues * sizeof(wpq_t)) != 0) {
+        return E_NOMEM;
+    }
+    memset(wpq.queues, 0, wpq.num_queues * sizeof(wpq_t));
+    wpq.enabled = 1;
+    DBG_LOG(INFO, "Write pending queue model: %d MB/s, %d lines deep\n", wpq.write_bw_mbps, wpq.depth);
+    return E_SUCCESS;
+}
+
+int wpq_enabled()
+{
+    return wpq.enabled;
+}
+
+uint64_t wpq_enqueue(uint64_t lines)
+{
+    thread_t* thread;
+    wpq_t* q;
+    uint64_t now, tail, start, backlog, stall, max;
+    int node_id;
+
+    if (!wpq.enabled || lines == 0) {
+        return 0;
+    }
+    // threads the emulator does not manage share the first node's queue
+    thread = thread_self();
+    node_id = thread ? thread->virtual_node->node_id : 0;
+    q = &wpq.queues[node_id];
+
+    now = now_ps();
+    tail = __atomic_load_n(&q->tail_ps, __ATOMIC_RELAXED);
+    do {
+        start = tail > now ? tail : now;
+    } while (!__atomic_compare_exchange_n(&q->tail_ps, &tail, start + lines * wpq.line_ps, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // our last line is accepted once the backlog ahead of it fits the queue
+    backlog = start + lines * wpq.line_ps - now;
+    stall = backlog > wpq.limit_ps ? backlog - wpq.limit_ps : 0;
+
+    __atomic_fetch_add(&q->lines, lines, __ATOMIC_RELAXED);
+    if (stall) {
+        __atomic_fetch_add(&q->stalls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&q->stall_ps, stall, __ATOMIC_RELAXED);
+    }
+    max = __atomic_load_n(&q->max_backlog_ps, __ATOMIC_RELAXED);
+    while (backlog > max && !__atomic_compare_exchange_n(&q->max_backlog_ps, &max, backlog, 1,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    live_stats_wpq(node_id, lines, stall / 1000);
+    return stall / 1000;
+}
+
+void wpq_report(FILE* out)
+{
+    wpq_t* q;
+    int i;
+
+    if (!wpq.enabled) {
+        return;
+    }
+    fprintf(out, "\n== Write pending queues (%d MB/s, %d lines) ==\n", wpq.write_bw_mbps, wpq.depth);
+    for (i = 0; i < wpq.num_queues; i++) {
+        q = &wpq.queues[i];
+        fprintf(out, "Virtual node %d: %lu lines, %lu stalls, %.0f usec queueing delay (%.1f ns per line), max depth %lu lines\n",
+                i, q->lines, q->stalls, q->stall_ps / 1e6, q->lines ? (double) q->stall_ps / 1000 / q->lines : 0.0,
+                q->max_backlog_ps / wpq.line_ps);
+    }
+}
@@ -0,0 +1,52 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __WPQ_H
+#define __WPQ_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "config.h"
+
+/**
+ * \file
+ *
+ * Write pending queue model
+ *
+ * Cache line write-backs to NVM enter the write pending queue (WPQ) of the
+ * memory controller, which drains to the media at the NVM write bandwidth.
+ * All threads of a virtual node share its queue. A write-back is durable
+ * once the queue accepts it, so flushes only wait when the queue is full:
+ * with more than wpq_depth lines queued ahead, the flushing thread stalls
+ * until enough of them drained.
+ *
+ * Each queue is the time at which it will be empty, advanced with a
+ * compare-and-swap by every flush; the backlog divided by the time to
+ * drain a line estimates the queue depth.
+ */
+
+struct virtual_topology_s;
+
+int init_wpq(config_t* cfg, struct virtual_topology_s* topology);
+int wpq_enabled();
+
+/**
+ * \brief Enqueues lines write-backs on the queue of the calling thread's
+ * virtual node and returns how long the thread stalls on a full queue, in
+ * nanoseconds
+ */
+uint64_t wpq_enqueue(uint64_t lines);
+
+void wpq_report(FILE* out);
+
+#endif /* __WPQ_H */
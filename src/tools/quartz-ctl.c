@@ -0,0 +1,85 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "control_format.h"
+
+// Sends a command to the control socket of an emulated process and prints
+// the reply, e.g. quartz-ctl <pid> set latency.read=500 latency.write=500
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s pid|socket get\n", prog);
+    fprintf(stderr, "       %s pid|socket set key=value...\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    struct sockaddr_un addr;
+    char command[CONTROL_LINE_SIZE];
+    char reply[CONTROL_LINE_SIZE];
+    size_t len = 0;
+    ssize_t n;
+    int fd, i;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strchr(argv[1], '/') != NULL) {
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+    } else {
+        snprintf(addr.sun_path, sizeof(addr.sun_path), CONTROL_SOCKET_NAME, atoi(argv[1]));
+    }
+
+    command[0] = '\0';
+    for (i = 2; i < argc; i++) {
+        len += snprintf(command + len, sizeof(command) - len, "%s%s", argv[i], i + 1 < argc ? " " : "\n");
+        if (len >= sizeof(command)) {
+            fprintf(stderr, "Command too long\n");
+            return 1;
+        }
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "Cannot connect to %s, is control.enable set?\n", addr.sun_path);
+        return 1;
+    }
+    if (write(fd, command, len) != (ssize_t) len) {
+        fprintf(stderr, "Cannot send the command\n");
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    len = 0;
+    while (len < sizeof(reply) - 1 && (n = read(fd, reply + len, sizeof(reply) - 1 - len)) > 0) {
+        len += n;
+    }
+    reply[len] = '\0';
+    close(fd);
+    if (len == 0) {
+        fprintf(stderr, "No reply from %s\n", addr.sun_path);
+        return 1;
+    }
+    fputs(reply, stdout);
+    return strncmp(reply, "ok", 2) == 0 ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "live_stats_format.h"
+
+// Shows the live statistics of an emulated process, refreshed every
+// interval: per thread the epoch rate, the share of time spent in injected
+// delays, stall cycles and overhead, then the same per virtual node along
+// with its write pending queue.
+
+#define READ_RETRIES 1000
+
+typedef struct {
+    const char* base;
+    size_t size;
+    const live_stats_header_t* header;
+    live_stats_thread_t* threads; // snapshot
+    live_stats_node_t* nodes;     // snapshot
+    double time_us;               // of the snapshot
+} snapshot_t;
+
+static double now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static const char* attach(const char* target, size_t* sizep)
+{
+    const live_stats_header_t* header;
+    char path[256];
+    struct stat st;
+    const char* base;
+    int fd;
+
+    if (strchr(target, '/') != NULL) {
+        snprintf(path, sizeof(path), "%s", target);
+    } else {
+        snprintf(path, sizeof(path), "/dev/shm" LIVE_STATS_NAME, atoi(target));
+    }
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "Cannot open %s, is statistics.live enabled?\n", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(live_stats_header_t)) {
+        fprintf(stderr, "%s is not a live statistics segment\n", path);
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s\n", path);
+        return NULL;
+    }
+    header = (const live_stats_header_t*) base;
+    if (strncmp(header->magic, LIVE_STATS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != LIVE_STATS_VERSION ||
+        st.st_size < header->header_size + (size_t) header->num_nodes * header->node_size +
+                     (size_t) header->max_threads * header->thread_size)
+    {
+        fprintf(stderr, "%s is not a live statistics segment of this version\n", path);
+        munmap((void*) base, st.st_size);
+        return NULL;
+    }
+    *sizep = st.st_size;
+    return base;
+}
+
+static size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+// copies a thread slot consistently, returns 0 if the writer kept it busy
+static int read_thread(const live_stats_thread_t* slot, live_stats_thread_t* copy, size_t size)
+{
+    uint32_t seq;
+    int i;
+
+    for (i = 0; i < READ_RETRIES; i++) {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(copy, slot, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void take_snapshot(snapshot_t* s)
+{
+    const live_stats_header_t* h = s->header;
+    const char* nodes = s->base + h->header_size;
+    const char* threads = nodes + (size_t) h->num_nodes * h->node_size;
+    uint32_t i;
+
+    memset(s->threads, 0, h->max_threads * sizeof(live_stats_thread_t));
+    memset(s->nodes, 0, h->num_nodes * sizeof(live_stats_node_t));
+    s->time_us = now_us();
+    for (i = 0; i < h->num_nodes; i++) {
+        memcpy(&s->nodes[i], nodes + i * h->node_size, min_size(h->node_size, sizeof(live_stats_node_t)));
+    }
+    for (i = 0; i < h->max_threads; i++) {
+        if (!read_thread((const live_stats_thread_t*) (threads + i * h->thread_size), &s->threads[i],
+                         min_size(h->thread_size, sizeof(live_stats_thread_t))))
+        {
+            s->threads[i].state = LIVE_THREAD_FREE;
+        }
+    }
+}
+
+static int process_alive(pid_t pid)
+{
+    char path[32];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "/proc/%d", pid);
+    return stat(path, &st) == 0;
+}
+
+static void show(const snapshot_t* prev, const snapshot_t* cur)
+{
+    const live_stats_header_t* h = cur->header;
+    const live_stats_thread_t *t, *p;
+    const live_stats_node_t *n, *pn;
+    live_stats_thread_t zero;
+    double interval_us = cur->time_us - prev->time_us;
+    double mhz = h->cpu_speed_mhz ? h->cpu_speed_mhz : 1;
+    uint64_t epochs;
+    uint32_t i;
+
+    memset(&zero, 0, sizeof(zero));
+    printf("PID %d (%s), up %.0f s, NVM read latency %u ns, write latency %u ns\n\n", h->pid,
+           process_alive(h->pid) ? "running" : "gone", (cur->time_us - h->start_us) / 1e6,
+           h->read_latency, h->write_latency);
+
+    printf("%8s %4s %4s %7s %10s %6s %7s %14s %12s %8s %12s\n", "TID", "CPU", "NODE", "STATE", "EPOCH/s",
+           "SIG%", "DELAY%", "STALL cyc/s", "OVERHEAD", "LAT ns", "EPOCHS");
+    for (i = 0; i < h->max_threads; i++) {
+        t = &cur->threads[i];
+        if (t->state == LIVE_THREAD_FREE) {
+            continue;
+        }
+        // a slot given to another thread since the last refresh starts over
+        p = &prev->threads[i];
+        if (p->state == LIVE_THREAD_FREE || p->tid != t->tid || p->register_us != t->register_us) {
+            p = &zero;
+        }
+        epochs = t->epochs - p->epochs;
+        printf("%8d %4d %4u %7s %10.1f %6.1f %7.2f %14.0f %12lu %8.0f %12lu\n", t->tid, t->cpu_id, t->node_id,
+               t->state == LIVE_THREAD_RUNNING ? "run" : "exited", epochs * 1e6 / interval_us,
+               epochs ? 100.0 * (t->signal_epochs - p->signal_epochs) / epochs : 0.0,
+               100.0 * (t->delay_cycles - p->delay_cycles) / mhz / interval_us,
+               (t->stall_cycles - p->stall_cycles) * 1e6 / interval_us, t->overhead_cycles,
+               t->achieved_latency_ns, t->epochs);
+    }
+
+    printf("\n%4s %5s %5s %7s %10s %12s %14s %12s %14s\n", "NODE", "DRAM", "NVM", "THREADS", "EPOCH/s",
+           "DELAY ms/s", "STALL cyc/s", "WPQ MB/s", "WPQ stall us/s");
+    for (i = 0; i < h->num_nodes; i++) {
+        n = &cur->nodes[i];
+        pn = &prev->nodes[i];
+        printf("%4u %5d %5d %7u %10.1f %12.2f %14.0f %12.1f %14.1f\n", n->node_id, n->dram_node, n->nvram_node,
+               n->threads, (n->epochs - pn->epochs) * 1e6 / interval_us,
+               (n->delay_cycles - pn->delay_cycles) / mhz / interval_us * 1e3,
+               (n->stall_cycles - pn->stall_cycles) * 1e6 / interval_us,
+               (n->wpq_lines - pn->wpq_lines) * 64 / interval_us,
+               (n->wpq_stall_ns - pn->wpq_stall_ns) / 1e3 * 1e6 / interval_us);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-d seconds] [-n iterations] [-b] pid|segment\n", prog);
+    fprintf(stderr, "  -d: refresh interval (default 1)\n");
+    fprintf(stderr, "  -n: exit after this many refreshes\n");
+    fprintf(stderr, "  -b: batch mode, do not clear the screen\n");
+}
+
+int main(int argc, char* argv[])
+{
+    snapshot_t snapshots[2], *prev, *cur, *tmp;
+    double interval = 1;
+    int iterations = -1;
+    int batch = !isatty(STDOUT_FILENO);
+    const char* base;
+    size_t size;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "d:n:bh")) != -1) {
+        switch (opt) {
+            case 'd':
+                interval = atof(optarg);
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'b':
+                batch = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || interval <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if ((base = attach(argv[optind], &size)) == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        snapshots[i].base = base;
+        snapshots[i].size = size;
+        snapshots[i].header = (const live_stats_header_t*) base;
+        snapshots[i].threads = malloc(snapshots[i].header->max_threads * sizeof(live_stats_thread_t));
+        snapshots[i].nodes = malloc(snapshots[i].header->num_nodes * sizeof(live_stats_node_t));
+        if (!snapshots[i].threads || !snapshots[i].nodes) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    prev = &snapshots[0];
+    cur = &snapshots[1];
+    take_snapshot(prev);
+
+    for (i = 0; iterations < 0 || i < iterations; i++) {
+        usleep(interval * 1e6);
+        take_snapshot(cur);
+        if (!batch) {
+            printf("\033[H\033[2J");
+        } else if (i) {
+            printf("\n");
+        }
+        show(prev, cur);
+        fflush(stdout);
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    return 0;
+}
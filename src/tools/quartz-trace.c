@@ -0,0 +1,278 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace_format.h"
+
+// Analyzes an epoch trace written by the emulator with trace.enable:
+// per-thread summaries and percentiles by default, a time series of
+// fixed-size buckets with -s, or the raw records with -r.
+
+typedef struct {
+    uint32_t tid;
+    trace_record_t* records;
+    size_t count;
+    size_t max;
+} thread_trace_t;
+
+typedef struct {
+    thread_trace_t* threads;
+    int num_threads;
+    int max_threads;
+    uint64_t first_tsc;
+    double cycles_per_us;
+} trace_t;
+
+static thread_trace_t* find_thread(trace_t* trace, uint32_t tid)
+{
+    int i;
+
+    for (i = 0; i < trace->num_threads; i++) {
+        if (trace->threads[i].tid == tid) {
+            return &trace->threads[i];
+        }
+    }
+    if (trace->num_threads == trace->max_threads) {
+        trace->max_threads = trace->max_threads ? 2 * trace->max_threads : 16;
+        trace->threads = realloc(trace->threads, trace->max_threads * sizeof(thread_trace_t));
+        if (trace->threads == NULL) {
+            return NULL;
+        }
+    }
+    memset(&trace->threads[trace->num_threads], 0, sizeof(thread_trace_t));
+    trace->threads[trace->num_threads].tid = tid;
+    return &trace->threads[trace->num_threads++];
+}
+
+static int load_trace(const char* path, trace_t* trace)
+{
+    trace_file_header_t header;
+    trace_block_t block;
+    thread_trace_t* t;
+    FILE* f;
+    size_t i;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || strncmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not an epoch trace\n", path);
+        fclose(f);
+        return -1;
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "%s: unsupported trace version %u\n", path, header.version);
+        fclose(f);
+        return -1;
+    }
+
+    memset(trace, 0, sizeof(*trace));
+    trace->cycles_per_us = header.cpu_speed_mhz ? header.cpu_speed_mhz : 1;
+    trace->first_tsc = UINT64_MAX;
+    while (fread(&block, sizeof(block), 1, f) == 1) {
+        if ((t = find_thread(trace, block.tid)) == NULL) {
+            break;
+        }
+        if (t->count + block.count > t->max) {
+            t->max = (t->count + block.count) * 2;
+            if ((t->records = realloc(t->records, t->max * sizeof(trace_record_t))) == NULL) {
+                break;
+            }
+        }
+        // a trace cut short by a crash ends with a partial block
+        block.count = fread(&t->records[t->count], sizeof(trace_record_t), block.count, f);
+        for (i = t->count; i < t->count + block.count; i++) {
+            if (t->records[i].tsc < trace->first_tsc) {
+                trace->first_tsc = t->records[i].tsc;
+            }
+        }
+        t->count += block.count;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// prints p50, p90, p99 and max of values, sorting them
+static void print_percentiles(const char* name, uint64_t* values, size_t n, double scale)
+{
+    if (n == 0) {
+        return;
+    }
+    qsort(values, n, sizeof(uint64_t), compare_u64);
+    printf("    %-14s p50 %10.1f  p90 %10.1f  p99 %10.1f  max %10.1f\n", name,
+           values[n * 50 / 100] / scale, values[n * 90 / 100] / scale,
+           values[n * 99 / 100] / scale, values[n - 1] / scale);
+}
+
+static void summarize(trace_t* trace, int only_tid)
+{
+    thread_trace_t* t;
+    uint64_t* values;
+    uint64_t stall, delay, overhead, misses, signals, capped;
+    size_t i;
+    int k;
+
+    printf("%8s %10s %8s %8s %14s %14s %12s %12s\n", "tid", "epochs", "signal", "sync",
+           "stall cycles", "delay usec", "nvm misses", "capped");
+    for (k = 0; k < trace->num_threads; k++) {
+        t = &trace->threads[k];
+        if (only_tid && t->tid != (uint32_t) only_tid) continue;
+        stall = delay = overhead = misses = signals = capped = 0;
+        for (i = 0; i < t->count; i++) {
+            stall += t->records[i].stall_cycles;
+            delay += t->records[i].delay_cycles;
+            overhead += t->records[i].overhead_cycles;
+            misses += t->records[i].nvm_misses;
+            signals += t->records[i].trigger == TRACE_TRIGGER_SIGNAL;
+            capped += (t->records[i].flags & TRACE_FLAG_DELAY_CAPPED) != 0;
+        }
+        printf("%8u %10zu %8lu %8lu %14lu %14.0f %12lu %12lu\n", t->tid, t->count, signals,
+               t->count - signals, stall, delay / trace->cycles_per_us, misses, capped);
+
+        if ((values = malloc(t->count * sizeof(uint64_t))) == NULL) {
+            continue;
+        }
+        for (i = 0; i < t->count; i++) values[i] = t->records[i].epoch_us;
+        print_percentiles("epoch usec", values, t->count, 1);
+        for (i = 0; i < t->count; i++) values[i] = t->records[i].delay_cycles;
+        print_percentiles("delay usec", values, t->count, trace->cycles_per_us);
+        for (i = 0; i < t->count; i++) values[i] = t->records[i].stall_cycles;
+        print_percentiles("stall cycles", values, t->count, 1);
+        free(values);
+    }
+}
+
+static void time_series(trace_t* trace, int only_tid, double bucket_ms)
+{
+    double bucket_cycles = bucket_ms * 1000 * trace->cycles_per_us;
+    uint64_t nbuckets = 0, b;
+    uint64_t *epochs, *stall, *delay, *misses;
+    thread_trace_t* t;
+    size_t i;
+    int k;
+
+    for (k = 0; k < trace->num_threads; k++) {
+        t = &trace->threads[k];
+        for (i = 0; i < t->count; i++) {
+            b = (t->records[i].tsc - trace->first_tsc) / bucket_cycles + 1;
+            if (b > nbuckets) nbuckets = b;
+        }
+    }
+    epochs = calloc(nbuckets, sizeof(uint64_t));
+    stall = calloc(nbuckets, sizeof(uint64_t));
+    delay = calloc(nbuckets, sizeof(uint64_t));
+    misses = calloc(nbuckets, sizeof(uint64_t));
+    if (!epochs || !stall || !delay || !misses) {
+        fprintf(stderr, "Out of memory\n");
+        return;
+    }
+    for (k = 0; k < trace->num_threads; k++) {
+        t = &trace->threads[k];
+        if (only_tid && t->tid != (uint32_t) only_tid) continue;
+        for (i = 0; i < t->count; i++) {
+            b = (t->records[i].tsc - trace->first_tsc) / bucket_cycles;
+            epochs[b]++;
+            stall[b] += t->records[i].stall_cycles;
+            delay[b] += t->records[i].delay_cycles;
+            misses[b] += t->records[i].nvm_misses;
+        }
+    }
+    printf("time_ms,epochs,stall_cycles,delay_us,nvm_misses\n");
+    for (b = 0; b < nbuckets; b++) {
+        printf("%.1f,%lu,%lu,%.1f,%lu\n", b * bucket_ms, epochs[b], stall[b],
+               delay[b] / trace->cycles_per_us, misses[b]);
+    }
+    free(epochs);
+    free(stall);
+    free(delay);
+    free(misses);
+}
+
+static void dump(trace_t* trace, int only_tid)
+{
+    thread_trace_t* t;
+    trace_record_t* r;
+    size_t i;
+    int k;
+
+    printf("tid,time_us,epoch_us,trigger,stall_cycles,delay_cycles,overhead_cycles,nvm_misses,flags\n");
+    for (k = 0; k < trace->num_threads; k++) {
+        t = &trace->threads[k];
+        if (only_tid && t->tid != (uint32_t) only_tid) continue;
+        for (i = 0; i < t->count; i++) {
+            r = &t->records[i];
+            printf("%u,%.1f,%u,%s,%lu,%lu,%lu,%lu,%u\n", t->tid, (r->tsc - trace->first_tsc) / trace->cycles_per_us,
+                   r->epoch_us, r->trigger == TRACE_TRIGGER_SIGNAL ? "signal" : "sync", r->stall_cycles,
+                   r->delay_cycles, r->overhead_cycles, r->nvm_misses, r->flags);
+        }
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-s bucket_ms | -r] [-t tid] trace_file\n", prog);
+    fprintf(stderr, "  default: per-thread summary and percentiles\n");
+    fprintf(stderr, "  -s: CSV time series of all (or one) threads in buckets of bucket_ms\n");
+    fprintf(stderr, "  -r: CSV of the raw records\n");
+}
+
+int main(int argc, char* argv[])
+{
+    trace_t trace;
+    double bucket_ms = 0;
+    int raw = 0, tid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:rt:h")) != -1) {
+        switch (opt) {
+            case 's':
+                bucket_ms = atof(optarg);
+                break;
+            case 'r':
+                raw = 1;
+                break;
+            case 't':
+                tid = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || bucket_ms < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (load_trace(argv[optind], &trace) != 0) {
+        return 1;
+    }
+
+    if (raw) {
+        dump(&trace, tid);
+    } else if (bucket_ms > 0) {
+        time_series(&trace, tid, bucket_ms);
+    } else {
+        summarize(&trace, tid);
+    }
+    return 0;
+}
@@ -48,9 +48,9 @@ void iter()
 	}
 
 	for (i=0; i < BUF_SIZE; ++i) {
-		pfree(mem[i], BUF_SIZE * sizeof(unsigned long));
+		pfree(mem[i]);
 	}
-	pfree(mem, BUF_SIZE * sizeof(unsigned long *));
+	pfree(mem);
 }
 
 int main()
@@ -0,0 +1,140 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "pheap.h"
+
+// A child process pushes nodes to a persistent list and frees some of them
+// until it is killed. The list found after reopening the heap must be intact.
+// Storing the head is the only commit point: the value of the head node is
+// the length of the list, so no separate count can be left stale.
+
+#define HEAP_FILE "/dev/shm/test_pheap"
+#define HEAP_SIZE (64*1024*1024)
+
+typedef struct {
+    pheap_off_t next;
+    long value;
+    char payload[48];
+} node_t;
+
+typedef struct {
+    pheap_off_t head;
+} root_t;
+
+static long length(pheap_t* heap, root_t* root)
+{
+    node_t* head = pheap_direct(heap, root->head);
+
+    return head ? head->value : 0;
+}
+
+static void push(pheap_t* heap, root_t* root)
+{
+    node_t* node = pheap_alloc(heap, sizeof(*node));
+
+    assert(node != NULL);
+    node->value = length(heap, root) + 1;
+    node->next = root->head;
+    pheap_persist(heap, node, sizeof(*node));
+    // linking the node makes it reachable
+    root->head = pheap_offset(heap, node);
+    pheap_persist(heap, root, sizeof(*root));
+}
+
+static void pop(pheap_t* heap, root_t* root)
+{
+    node_t* node = pheap_direct(heap, root->head);
+
+    root->head = node->next;
+    pheap_persist(heap, root, sizeof(*root));
+    pheap_free(heap, node);
+}
+
+static void mutate_forever()
+{
+    pheap_t* heap = pheap_open(HEAP_FILE, 0, 0);
+    root_t* root;
+
+    assert(heap != NULL);
+    root = pheap_root(heap, sizeof(*root));
+    for (;;) {
+        push(heap, root);
+        if (length(heap, root) % 3 == 0) {
+            pop(heap, root);
+            push(heap, root);
+        }
+        if (length(heap, root) >= 100000) {
+            // keep the heap from filling up
+            while (length(heap, root) > 1000) {
+                pop(heap, root);
+            }
+        }
+    }
+}
+
+static long verify(pheap_t* heap)
+{
+    root_t* root = pheap_root(heap, sizeof(*root));
+    node_t* node;
+    long expected = length(heap, root);
+
+    for (node = pheap_direct(heap, root->head); node; node = pheap_direct(heap, node->next)) {
+        assert(node->value == expected);
+        expected--;
+    }
+    assert(expected == 0);
+    return length(heap, root);
+}
+
+int main()
+{
+    pheap_t* heap;
+    pid_t pid;
+    int round;
+
+    unlink(HEAP_FILE);
+    heap = pheap_open(HEAP_FILE, HEAP_SIZE, PHEAP_CREATE);
+    assert(heap != NULL);
+    assert(!pheap_recovered(heap));
+    verify(heap);
+    pheap_close(heap);
+
+    for (round = 0; round < 5; round++) {
+        if ((pid = fork()) == 0) {
+            mutate_forever();
+        }
+        usleep(100000 + round * 50000);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+
+        heap = pheap_open(HEAP_FILE, 0, 0);
+        assert(heap != NULL);
+        assert(pheap_recovered(heap));
+        printf("round %d: recovered list of %ld nodes\n", round, verify(heap));
+        pheap_close(heap);
+    }
+
+    heap = pheap_open(HEAP_FILE, 0, 0);
+    assert(heap != NULL && !pheap_recovered(heap));
+    pheap_close(heap);
+    unlink(HEAP_FILE);
+
+    printf("pheap test passed\n");
+    return 0;
+}
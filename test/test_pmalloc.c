@@ -0,0 +1,194 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <assert.h>
+#include <numa.h>
+#include <numaif.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pmalloc.h"
+
+#define NTHREADS 4
+#define NOBJS 4096
+#define NITERS 100000
+
+static void* handoff[NTHREADS][NOBJS];
+
+static void fill(unsigned char* p, size_t size, unsigned char seed)
+{
+    memset(p, seed, size);
+}
+
+static void check(unsigned char* p, size_t size, unsigned char seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        assert(p[i] == seed);
+    }
+}
+
+static size_t random_size(unsigned int* seed)
+{
+    // mostly small objects, some above the largest size class
+    if (rand_r(seed) % 64 == 0) {
+        return 32768 + rand_r(seed) % (1024 * 1024);
+    }
+    return 1 + rand_r(seed) % 4096;
+}
+
+static void* worker(void* arg)
+{
+    long id = (long) arg;
+    unsigned int seed = id + 1;
+    void* objs[NOBJS];
+    size_t sizes[NOBJS];
+    int i, s;
+
+    memset(objs, 0, sizeof(objs));
+    for (i = 0; i < NITERS; i++) {
+        s = rand_r(&seed) % NOBJS;
+        if (objs[s]) {
+            check(objs[s], sizes[s], (unsigned char) s);
+            pfree(objs[s]);
+        }
+        sizes[s] = random_size(&seed);
+        objs[s] = pmalloc(sizes[s]);
+        assert(objs[s] != NULL);
+        assert(((uintptr_t) objs[s] & 15) == 0);
+        assert(pmalloc_usable_size(objs[s]) >= sizes[s]);
+        fill(objs[s], sizes[s], (unsigned char) s);
+    }
+
+    // grow some objects and hand the rest to another thread to free
+    for (s = 0; s < NOBJS; s++) {
+        if (objs[s] && s % 2) {
+            objs[s] = prealloc(objs[s], sizes[s], sizes[s] * 2);
+            assert(objs[s] != NULL);
+            check(objs[s], sizes[s], (unsigned char) s);
+        }
+        handoff[id][s] = objs[s];
+    }
+    return NULL;
+}
+
+static void* reaper(void* arg)
+{
+    long id = (long) arg;
+    int s;
+
+    for (s = 0; s < NOBJS; s++) {
+        pfree(handoff[(id + 1) % NTHREADS][s]);
+    }
+    return NULL;
+}
+
+static void test_large_growth()
+{
+    size_t size = 1024 * 1024;
+    unsigned char* p = pmalloc(size);
+    int i;
+
+    assert(p != NULL);
+    fill(p, size, 0x5a);
+    // force moves by growing past whatever follows the mapping
+    for (i = 0; i < 4; i++) {
+        p = prealloc(p, size, size * 4);
+        assert(p != NULL);
+        check(p, size, 0x5a);
+        assert(pmalloc_usable_size(p) >= size * 4);
+        size *= 4;
+        fill(p, size, 0x5a);
+    }
+    p = prealloc(p, size, 4096);
+    assert(p != NULL);
+    check(p, 4096, 0x5a);
+    pfree(p);
+}
+
+// an interleaved block must stay interleaved when prealloc() grows it
+static void test_interleave_growth()
+{
+    size_t size = 4 * 1024 * 1024;
+    unsigned char* p = pmalloc_interleave(size, 1, 1);
+    int counts[2] = {0, 0};
+    int nodes[2] = {-1, -1};
+    void** pages;
+    int* status;
+    size_t i, n;
+    int j;
+
+    assert(p != NULL);
+    fill(p, size, 0xa5);
+    p = prealloc(p, size, size * 4);
+    assert(p != NULL);
+    check(p, size, 0xa5);
+    size *= 4;
+    fill(p, size, 0xa5);
+
+    n = size / 4096;
+    pages = malloc(n * sizeof(*pages));
+    status = malloc(n * sizeof(*status));
+    assert(pages != NULL && status != NULL);
+    for (i = 0; i < n; i++) {
+        pages[i] = p + i * 4096;
+    }
+    assert(move_pages(0, n, pages, NULL, status, 0) == 0);
+    for (i = 0; i < n; i++) {
+        assert(status[i] >= 0);
+        for (j = 0; j < 2 && nodes[j] != status[i] && nodes[j] >= 0; j++);
+        assert(j < 2); // DRAM and NVM of one virtual node only
+        nodes[j] = status[i];
+        counts[j]++;
+    }
+    if (nodes[1] < 0) {
+        printf("interleaving not checked, DRAM and NVM are on node %d\n", nodes[0]);
+    } else {
+        printf("grown interleaved block: %d pages on node %d, %d on node %d\n",
+               counts[0], nodes[0], counts[1], nodes[1]);
+        assert(counts[0] - counts[1] <= 1 && counts[1] - counts[0] <= 1);
+    }
+    free(pages);
+    free(status);
+    pfree(p);
+}
+
+int main()
+{
+    pthread_t threads[NTHREADS];
+    long t;
+
+    assert(pmalloc_usable_size(NULL) == 0);
+    pfree(NULL);
+    test_large_growth();
+    test_interleave_growth();
+
+    for (t = 0; t < NTHREADS; t++) {
+        pthread_create(&threads[t], NULL, worker, (void*) t);
+    }
+    for (t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    for (t = 0; t < NTHREADS; t++) {
+        pthread_create(&threads[t], NULL, reaper, (void*) t);
+    }
+    for (t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    printf("pmalloc test passed\n");
+    return 0;
+}
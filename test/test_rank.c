@@ -0,0 +1,141 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "error.h"
+#include "model.h"
+#include "monotonic_timer.h"
+#include "process_rank.h"
+
+// NPROCS processes claim a local rank at once and hold it until all of
+// them have one: the ranks must be distinct and cover [0, NPROCS). Then a
+// process dies holding its rank, which the next process must get back.
+// The test uses a segment of its own, so emulated processes of the user
+// that run meanwhile are not disturbed.
+
+#define NPROCS 256
+
+typedef struct {
+    int claimed;
+    int ranks[NPROCS];
+    double claim_us[NPROCS];
+} results_t;
+
+static results_t* results;
+static char segment_name[64];
+
+static void remove_segment()
+{
+    shm_unlink(segment_name);
+}
+
+static void wait_eof(int fd)
+{
+    char c;
+
+    while (read(fd, &c, 1) > 0);
+}
+
+static int claim(int id)
+{
+    double start = monotonic_time_us();
+
+    if (set_process_local_rank() != E_SUCCESS) {
+        _exit(1);
+    }
+    results->claim_us[id] = monotonic_time_us() - start;
+    results->ranks[id] = latency_model.process_local_rank;
+    __atomic_add_fetch(&results->claimed, 1, __ATOMIC_RELEASE);
+    return latency_model.process_local_rank;
+}
+
+int main()
+{
+    int go[2], release[2];
+    int seen[NPROCS];
+    pid_t pids[NPROCS];
+    double max_claim_us = 0;
+    int status, i, rank;
+
+    results = mmap(NULL, sizeof(*results), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(results != MAP_FAILED);
+    setenv("EMUL_LOCAL_PROCESSES", "256", 1);
+    snprintf(segment_name, sizeof(segment_name), "/quartz.ranks.test.%d", (int) getpid());
+    setenv("EMUL_RANK_SEGMENT", segment_name, 1);
+    atexit(remove_segment);
+    assert(pipe(go) == 0 && pipe(release) == 0);
+
+    for (i = 0; i < NPROCS; i++) {
+        if ((pids[i] = fork()) == 0) {
+            close(go[1]);
+            close(release[1]);
+            wait_eof(go[0]);
+            claim(i);
+            wait_eof(release[0]);
+            unset_process_local_rank();
+            _exit(0);
+        }
+        assert(pids[i] > 0);
+    }
+    close(go[0]);
+    close(release[0]);
+    // all children start claiming at once
+    close(go[1]);
+    while (__atomic_load_n(&results->claimed, __ATOMIC_ACQUIRE) < NPROCS) {
+        for (i = 0; i < NPROCS; i++) {
+            assert(waitpid(pids[i], &status, WNOHANG) == 0);
+        }
+        usleep(1000);
+    }
+
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < NPROCS; i++) {
+        assert(results->ranks[i] >= 0 && results->ranks[i] < NPROCS);
+        assert(!seen[results->ranks[i]]);
+        seen[results->ranks[i]] = 1;
+        if (results->claim_us[i] > max_claim_us) {
+            max_claim_us = results->claim_us[i];
+        }
+    }
+    close(release[1]);
+    for (i = 0; i < NPROCS; i++) {
+        assert(waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    printf("%d processes got distinct ranks, slowest claim took %.0f usec\n", NPROCS, max_claim_us);
+
+    // a process killed with its rank does not release it
+    if ((pids[0] = fork()) == 0) {
+        claim(0);
+        raise(SIGKILL);
+    }
+    assert(waitpid(pids[0], &status, 0) == pids[0] && WIFSIGNALED(status));
+    rank = results->ranks[0];
+    if ((pids[1] = fork()) == 0) {
+        claim(1);
+        unset_process_local_rank();
+        _exit(0);
+    }
+    assert(waitpid(pids[1], &status, 0) == pids[1] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    printf("rank %d of a killed process reused as rank %d\n", rank, results->ranks[1]);
+    assert(results->ranks[1] == rank);
+
+    printf("rank test passed\n");
+    return 0;
+}